@@ -0,0 +1,275 @@
+/*
+ * SHA1 block routines for x86 processors: one using the SHA
+ * extensions, and one computing the message schedule of two
+ * blocks at once with AVX2 vectors before running the rounds on
+ * scalar registers.
+ *
+ * Each function is compiled for the instructions it needs; the
+ * caller checks that the CPU has them.
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+/* before common.h, which forbids the malloc() it uses */
+# include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "sha1.h"
+
+#ifdef BLK_SHA1_X86
+
+#define SHA_ROL(X,n)	(((X) << (n)) | ((X) >> (32-(n))))
+
+static const unsigned int sha1_k[4] = {
+	0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+};
+
+/*
+ * The 80 rounds of a block, given the message schedule with the
+ * round constants already added to it.  The schedule is stored by
+ * groups of four words, each followed by those of the other
+ * blocks scheduled at the same time.
+ */
+#define SHA_ROUND(t, fn, A, B, C, D, E) do { \
+	E += wk[((t) & ~3) * lanes + ((t) & 3)] + SHA_ROL(A,5) + (fn); \
+	B = SHA_ROL(B, 30); } while (0)
+
+#define F_0_19(B, C, D)  (((C^D)&B)^D)
+#define F_20_39(B, C, D) (B^C^D)
+#define F_40_59(B, C, D) ((B&C)+(D&(B^C)))
+#define F_60_79(B, C, D) (B^C^D)
+
+#define SHA_ROUNDS5(t, fn) do { \
+	SHA_ROUND(t + 0, fn(B, C, D), A, B, C, D, E); \
+	SHA_ROUND(t + 1, fn(A, B, C), E, A, B, C, D); \
+	SHA_ROUND(t + 2, fn(E, A, B), D, E, A, B, C); \
+	SHA_ROUND(t + 3, fn(D, E, A), C, D, E, A, B); \
+	SHA_ROUND(t + 4, fn(C, D, E), B, C, D, E, A); } while (0)
+
+/* always inlined, so that the positions in wk are constants */
+__attribute__((always_inline))
+static inline void sha1_rounds(unsigned int H[5], const unsigned int *wk, int lanes)
+{
+	unsigned int A = H[0], B = H[1], C = H[2], D = H[3], E = H[4];
+
+	SHA_ROUNDS5( 0, F_0_19);
+	SHA_ROUNDS5( 5, F_0_19);
+	SHA_ROUNDS5(10, F_0_19);
+	SHA_ROUNDS5(15, F_0_19);
+	SHA_ROUNDS5(20, F_20_39);
+	SHA_ROUNDS5(25, F_20_39);
+	SHA_ROUNDS5(30, F_20_39);
+	SHA_ROUNDS5(35, F_20_39);
+	SHA_ROUNDS5(40, F_40_59);
+	SHA_ROUNDS5(45, F_40_59);
+	SHA_ROUNDS5(50, F_40_59);
+	SHA_ROUNDS5(55, F_40_59);
+	SHA_ROUNDS5(60, F_60_79);
+	SHA_ROUNDS5(65, F_60_79);
+	SHA_ROUNDS5(70, F_60_79);
+	SHA_ROUNDS5(75, F_60_79);
+
+	H[0] += A;
+	H[1] += B;
+	H[2] += C;
+	H[3] += D;
+	H[4] += E;
+}
+
+#define ROL256(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+/*
+ * Two blocks at a time, one in each 128-bit lane; a last odd
+ * block is scheduled in both lanes, and its rounds run once.
+ *
+ * The message schedule is computed four words at a time: w[g]
+ * holds words 4g to 4g+3.  For words 16 to 31, the last word of
+ * each group depends on the first one and is fixed up afterwards;
+ * from word 32 on, W[t] = rol(W[t-6] ^ W[t-16] ^ W[t-28] ^ W[t-32], 2)
+ * has no dependency within a group.
+ */
+__attribute__((target("avx2")))
+void git__blk_SHA1_Blocks_avx2(unsigned int H[5], const unsigned char *data, size_t n)
+{
+	const __m256i bswap = _mm256_set_epi8(
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	unsigned int wk[160] __attribute__((aligned(32)));
+	__m256i w[20];
+	int g;
+
+	for (; n; n -= n > 1 ? 2 : 1, data += 128) {
+		const unsigned char *next = n > 1 ? data + 64 : data;
+
+		for (g = 0; g < 4; g++) {
+			__m256i v = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)data + g)),
+				_mm_loadu_si128((const __m128i *)next + g), 1);
+			w[g] = _mm256_shuffle_epi8(v, bswap);
+		}
+
+		for (g = 4; g < 8; g++) {
+			__m256i x = _mm256_xor_si256(
+				_mm256_xor_si256(_mm256_srli_si256(w[g - 1], 4), w[g - 2]),
+				_mm256_xor_si256(_mm256_alignr_epi8(w[g - 3], w[g - 4], 8), w[g - 4]));
+			__m256i r = ROL256(x, 1);
+			w[g] = _mm256_xor_si256(r, ROL256(_mm256_slli_si256(r, 12), 1));
+		}
+		for (g = 8; g < 20; g++) {
+			__m256i x = _mm256_xor_si256(
+				_mm256_xor_si256(_mm256_alignr_epi8(w[g - 1], w[g - 2], 8), w[g - 4]),
+				_mm256_xor_si256(w[g - 7], w[g - 8]));
+			w[g] = ROL256(x, 2);
+		}
+		for (g = 0; g < 20; g++)
+			_mm256_store_si256((__m256i *)(wk + 8 * g),
+				_mm256_add_epi32(w[g], _mm256_set1_epi32((int)sha1_k[g / 5])));
+
+		sha1_rounds(H, wk, 2);
+		if (n > 1)
+			sha1_rounds(H, wk + 4, 2);
+	}
+}
+
+/*
+ * Four rounds with the SHA extensions.  msg[i % 4] holds the
+ * words of rounds 4i to 4i+3, and the words of the next groups
+ * are computed as the rounds go.
+ */
+#define SHANI_ROUNDS4(i) do { \
+	if (i == 0) \
+		e[0] = _mm_add_epi32(e[0], msg[0]); \
+	else \
+		e[i % 2] = _mm_sha1nexte_epu32(e[i % 2], msg[i % 4]); \
+	e[(i + 1) % 2] = abcd; \
+	if (i >= 3 && i <= 18) \
+		msg[(i + 1) % 4] = _mm_sha1msg2_epu32(msg[(i + 1) % 4], msg[i % 4]); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e[i % 2], i / 5); \
+	if (i >= 1 && i <= 16) \
+		msg[(i + 3) % 4] = _mm_sha1msg1_epu32(msg[(i + 3) % 4], msg[i % 4]); \
+	if (i >= 2 && i <= 17) \
+		msg[(i + 2) % 4] = _mm_xor_si128(msg[(i + 2) % 4], msg[i % 4]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+void git__blk_SHA1_Blocks_shani(unsigned int H[5], const unsigned char *data, size_t n)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i abcd, abcd_save, e_save, e[2], msg[4];
+	int g;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0x1b);
+	e[0] = _mm_set_epi32((int)H[4], 0, 0, 0);
+
+	for (; n; n--, data += 64) {
+		abcd_save = abcd;
+		e_save = e[0];
+
+		for (g = 0; g < 4; g++)
+			msg[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data + g), bswap);
+
+		SHANI_ROUNDS4(0);
+		SHANI_ROUNDS4(1);
+		SHANI_ROUNDS4(2);
+		SHANI_ROUNDS4(3);
+		SHANI_ROUNDS4(4);
+		SHANI_ROUNDS4(5);
+		SHANI_ROUNDS4(6);
+		SHANI_ROUNDS4(7);
+		SHANI_ROUNDS4(8);
+		SHANI_ROUNDS4(9);
+		SHANI_ROUNDS4(10);
+		SHANI_ROUNDS4(11);
+		SHANI_ROUNDS4(12);
+		SHANI_ROUNDS4(13);
+		SHANI_ROUNDS4(14);
+		SHANI_ROUNDS4(15);
+		SHANI_ROUNDS4(16);
+		SHANI_ROUNDS4(17);
+		SHANI_ROUNDS4(18);
+		SHANI_ROUNDS4(19);
+
+		e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)H, _mm_shuffle_epi32(abcd, 0x1b));
+	H[4] = (unsigned int)_mm_extract_epi32(e[0], 3);
+}
+
+
+/*
+ * Multi-buffer routines: one block of a different message in each
+ * 32-bit lane of a vector, so that the rounds of 4 or 8 messages
+ * run at once.  H holds the state word by word: H[lanes * i + l]
+ * is the i-th word of lane l.
+ */
+typedef unsigned int sha1_v4 __attribute__((vector_size(16)));
+typedef unsigned int sha1_v8 __attribute__((vector_size(32)));
+
+#define SHA_MB_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define SHA_MB_LOAD(W, blocks, lanes) do { \
+	int t, l; \
+	for (t = 0; t < 16; t++) \
+		for (l = 0; l < lanes; l++) { \
+			unsigned int v; \
+			memcpy(&v, blocks[l] + 4 * t, 4); \
+			W[t][l] = __builtin_bswap32(v); \
+		} \
+} while (0)
+
+#define SHA_MB_ROUNDS(vec, from, fn, k) do { \
+	int t; \
+	for (t = from; t < from + 20; t++) { \
+		vec T; \
+		if (t >= 16) \
+			W[t & 15] = SHA_MB_ROL(W[(t + 13) & 15] ^ W[(t + 8) & 15] ^ \
+				W[(t + 2) & 15] ^ W[t & 15], 1); \
+		T = SHA_MB_ROL(A, 5) + fn(B, C, D) + E + W[t & 15] + k; \
+		E = D; \
+		D = C; \
+		C = SHA_MB_ROL(B, 30); \
+		B = A; \
+		A = T; \
+	} \
+} while (0)
+
+#define SHA_MB_COMPRESS(vec, lanes) do { \
+	vec A, B, C, D, E, W[16]; \
+	memcpy(&A, H + 0 * lanes, sizeof(vec)); \
+	memcpy(&B, H + 1 * lanes, sizeof(vec)); \
+	memcpy(&C, H + 2 * lanes, sizeof(vec)); \
+	memcpy(&D, H + 3 * lanes, sizeof(vec)); \
+	memcpy(&E, H + 4 * lanes, sizeof(vec)); \
+	SHA_MB_LOAD(W, blocks, lanes); \
+	SHA_MB_ROUNDS(vec, 0, F_0_19, sha1_k[0]); \
+	SHA_MB_ROUNDS(vec, 20, F_20_39, sha1_k[1]); \
+	SHA_MB_ROUNDS(vec, 40, F_40_59, sha1_k[2]); \
+	SHA_MB_ROUNDS(vec, 60, F_60_79, sha1_k[3]); \
+	sha1_mb_add(H + 0 * lanes, A, lanes); \
+	sha1_mb_add(H + 1 * lanes, B, lanes); \
+	sha1_mb_add(H + 2 * lanes, C, lanes); \
+	sha1_mb_add(H + 3 * lanes, D, lanes); \
+	sha1_mb_add(H + 4 * lanes, E, lanes); \
+} while (0)
+
+#define sha1_mb_add(h, v, lanes) do { \
+	int l; \
+	for (l = 0; l < lanes; l++) \
+		(h)[l] += (v)[l]; \
+} while (0)
+
+__attribute__((target("sse2")))
+void git__blk_SHA1_Lanes_sse2(unsigned int *H, const unsigned char **blocks)
+{
+	SHA_MB_COMPRESS(sha1_v4, 4);
+}
+
+__attribute__((target("avx2")))
+void git__blk_SHA1_Lanes_avx2(unsigned int *H, const unsigned char **blocks)
+{
+	SHA_MB_COMPRESS(sha1_v8, 8);
+}
+
+#endif
@@ -7,6 +7,7 @@
  */
 
 #include "common.h"
+#include "cpu.h"
 #include "sha1.h"
 
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
@@ -113,16 +114,16 @@
 #define T_40_59(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, ((B&C)+(D&(B^C))) , 0x8f1bbcdc, A, B, C, D, E )
 #define T_60_79(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) ,  0xca62c1d6, A, B, C, D, E )
 
-static void blk_SHA1_Block(blk_SHA_CTX *ctx, const unsigned int *data)
+static void blk_SHA1_Block(unsigned int H[5], const unsigned int *data)
 {
 	unsigned int A,B,C,D,E;
 	unsigned int array[16];
 
-	A = ctx->H[0];
-	B = ctx->H[1];
-	C = ctx->H[2];
-	D = ctx->H[3];
-	E = ctx->H[4];
+	A = H[0];
+	B = H[1];
+	C = H[2];
+	D = H[3];
+	E = H[4];
 
 	/* Round 1 - iterations 0-16 take their input from 'data' */
 	T_0_15( 0, A, B, C, D, E);
@@ -214,11 +215,264 @@ static void blk_SHA1_Block(blk_SHA_CTX *ctx, const unsigned int *data)
 	T_60_79(78, C, D, E, A, B);
 	T_60_79(79, B, C, D, E, A);
 
-	ctx->H[0] += A;
-	ctx->H[1] += B;
-	ctx->H[2] += C;
-	ctx->H[3] += D;
-	ctx->H[4] += E;
+	H[0] += A;
+	H[1] += B;
+	H[2] += C;
+	H[3] += D;
+	H[4] += E;
+}
+
+static void blk_SHA1_Blocks(unsigned int H[5], const unsigned char *data, size_t n)
+{
+	for (; n; n--, data += 64)
+		blk_SHA1_Block(H, (const unsigned int *)data);
+}
+
+typedef void (*blk_SHA1_Blocks_fn)(unsigned int H[5], const unsigned char *data, size_t n);
+
+static const struct {
+	const char *name;
+	blk_SHA1_Blocks_fn blocks;
+} sha1_impls[] = {
+#ifdef BLK_SHA1_X86
+	{ "shani", git__blk_SHA1_Blocks_shani },
+	{ "avx2", git__blk_SHA1_Blocks_avx2 },
+#endif
+	{ "portable", blk_SHA1_Blocks },
+};
+
+static blk_SHA1_Blocks_fn sha1_blocks = blk_SHA1_Blocks;
+static const char *sha1_impl = "portable";
+
+#ifdef BLK_SHA1_X86
+static void select_impl(void) __attribute__((constructor));
+static void select_impl(void)
+{
+	git__blk_SHA1_use(NULL);
+	git__blk_SHA1_use_lanes(NULL);
+}
+#endif
+
+int git__blk_SHA1_use(const char *name)
+{
+	size_t j;
+
+	for (j = 0; j < sizeof(sha1_impls) / sizeof(sha1_impls[0]); j++) {
+		if (name && strcmp(name, sha1_impls[j].name))
+			continue;
+		if (!git__cpu_supports(sha1_impls[j].name))
+			continue;
+
+		sha1_blocks = sha1_impls[j].blocks;
+		sha1_impl = sha1_impls[j].name;
+		return GIT_SUCCESS;
+	}
+	return GIT_ENOTFOUND;
+}
+
+const char *git__blk_SHA1_impl(void)
+{
+	return sha1_impl;
+}
+
+typedef void (*blk_SHA1_Lanes_fn)(unsigned int *H, const unsigned char **blocks);
+
+#define SHA1_MAX_LANES 8
+
+static const struct {
+	const char *name;
+	blk_SHA1_Lanes_fn compress;
+	size_t lanes;
+} sha1_lanes_impls[] = {
+#ifdef BLK_SHA1_X86
+	{ "avx2", git__blk_SHA1_Lanes_avx2, 8 },
+	{ "sse2", git__blk_SHA1_Lanes_sse2, 4 },
+#endif
+	{ "none", NULL, 1 },
+};
+
+static blk_SHA1_Lanes_fn sha1_lanes = NULL;
+static size_t sha1_n_lanes = 1;
+static const char *sha1_lanes_impl = "none";
+
+int git__blk_SHA1_use_lanes(const char *name)
+{
+	size_t j;
+
+	for (j = 0; j < sizeof(sha1_lanes_impls) / sizeof(sha1_lanes_impls[0]); j++) {
+		if (name && strcmp(name, sha1_lanes_impls[j].name))
+			continue;
+		if (strcmp(sha1_lanes_impls[j].name, "none") && !git__cpu_supports(sha1_lanes_impls[j].name))
+			continue;
+		/* the SHA extensions beat four SSE2 lanes */
+		if (!name && sha1_lanes_impls[j].lanes == 4 && !strcmp(sha1_impl, "shani"))
+			continue;
+
+		sha1_lanes = sha1_lanes_impls[j].compress;
+		sha1_n_lanes = sha1_lanes_impls[j].lanes;
+		sha1_lanes_impl = sha1_lanes_impls[j].name;
+		return GIT_SUCCESS;
+	}
+	return GIT_ENOTFOUND;
+}
+
+const char *git__blk_SHA1_lanes_impl(void)
+{
+	return sha1_lanes_impl;
+}
+
+typedef struct {  /* a message hashed in a vector lane */
+	const git_buf_vec *vec;  /* its parts; NULL for an idle lane */
+	size_t parts, part, off;
+	unsigned long long size;
+	int padded, done;
+	git_oid *out;
+	unsigned char buf[64];   /* blocks spanning parts, and the padding */
+} sha1_lane;
+
+static void lane_start(sha1_lane *l, unsigned int *H, size_t lane, size_t n_lanes,
+		git_oid *out, const git_buf_vec *vec, size_t parts)
+{
+	static const unsigned int iv[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+	};
+	size_t j;
+
+	l->vec = vec;
+	l->parts = parts;
+	l->part = l->off = 0;
+	l->padded = l->done = 0;
+	l->out = out;
+
+	for (l->size = 0, j = 0; j < parts; j++)
+		l->size += vec[j].len;
+	for (j = 0; j < 5; j++)
+		H[j * n_lanes + lane] = iv[j];
+}
+
+/* The next block of the message of l, padded at the end. */
+static const unsigned char *lane_next_block(sha1_lane *l)
+{
+	size_t fill = 0;
+
+	while (l->part < l->parts && l->off == l->vec[l->part].len) {
+		l->part++;
+		l->off = 0;
+	}
+
+	if (l->part < l->parts && l->vec[l->part].len - l->off >= 64) {
+		const unsigned char *p = (const unsigned char *)l->vec[l->part].data + l->off;
+		l->off += 64;
+		return p;
+	}
+
+	while (fill < 64 && l->part < l->parts) {
+		size_t n = l->vec[l->part].len - l->off;
+
+		if (n > 64 - fill)
+			n = 64 - fill;
+		if (n)
+			memcpy(l->buf + fill, (const unsigned char *)l->vec[l->part].data + l->off, n);
+		fill += n;
+		if ((l->off += n) == l->vec[l->part].len) {
+			l->part++;
+			l->off = 0;
+		}
+	}
+	if (fill == 64)
+		return l->buf;
+
+	if (!l->padded) {
+		l->buf[fill++] = 0x80;
+		l->padded = 1;
+	}
+	if (fill <= 56) {
+		memset(l->buf + fill, 0, 56 - fill);
+		put_be32(l->buf + 56, (unsigned int)(l->size >> 29));
+		put_be32(l->buf + 60, (unsigned int)(l->size << 3));
+		l->done = 1;
+	} else
+		memset(l->buf + fill, 0, 64 - fill);
+
+	return l->buf;
+}
+
+static void lane_finish(sha1_lane *l, const unsigned int *H, size_t lane, size_t n_lanes)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		put_be32(l->out->id + i*4, H[i * n_lanes + lane]);
+	l->vec = NULL;
+}
+
+void git__blk_SHA1_Many(git_oid *out, const git_buf_vec *vec, size_t parts, size_t n)
+{
+	static const unsigned char idle_block[64];
+	sha1_lane lanes[SHA1_MAX_LANES];
+	const unsigned char *blocks[SHA1_MAX_LANES];
+	unsigned int H[5 * SHA1_MAX_LANES];
+	size_t n_lanes = sha1_n_lanes, next = 0, active = 0, j;
+
+	if (!sha1_lanes || n < 2) {
+		blk_SHA_CTX ctx;
+
+		for (; next < n; next++) {
+			git__blk_SHA1_Init(&ctx);
+			for (j = 0; j < parts; j++)
+				git__blk_SHA1_Update(&ctx, vec[next * parts + j].data, vec[next * parts + j].len);
+			git__blk_SHA1_Final(out[next].id, &ctx);
+		}
+		return;
+	}
+
+	for (j = 0; j < n_lanes; j++) {
+		lanes[j].vec = NULL;
+		if (next < n) {
+			lane_start(&lanes[j], H, j, n_lanes, &out[next], &vec[next * parts], parts);
+			next++;
+			active++;
+		}
+	}
+
+	/*
+	 * Run the lanes while enough of them are busy, then finish
+	 * the last messages one at a time.
+	 */
+	while (next < n || active > n_lanes / 2) {
+		for (j = 0; j < n_lanes; j++)
+			blocks[j] = lanes[j].vec ? lane_next_block(&lanes[j]) : idle_block;
+
+		sha1_lanes(H, blocks);
+
+		for (j = 0; j < n_lanes; j++) {
+			if (!lanes[j].vec || !lanes[j].done)
+				continue;
+
+			lane_finish(&lanes[j], H, j, n_lanes);
+			if (next < n) {
+				lane_start(&lanes[j], H, j, n_lanes, &out[next], &vec[next * parts], parts);
+				next++;
+			} else
+				active--;
+		}
+	}
+
+	for (j = 0; j < n_lanes; j++) {
+		unsigned int h[5];
+		int i;
+
+		if (!lanes[j].vec)
+			continue;
+
+		for (i = 0; i < 5; i++)
+			h[i] = H[i * n_lanes + j];
+		while (!lanes[j].done)
+			sha1_blocks(h, lane_next_block(&lanes[j]), 1);
+		for (i = 0; i < 5; i++)
+			H[i * n_lanes + j] = h[i];
+		lane_finish(&lanes[j], H, j, n_lanes);
+	}
 }
 
 void git__blk_SHA1_Init(blk_SHA_CTX *ctx)
@@ -250,12 +504,12 @@ void git__blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return;
-		blk_SHA1_Block(ctx, ctx->W);
+		sha1_blocks(ctx->H, (const unsigned char *)ctx->W, 1);
 	}
-	while (len >= 64) {
-		blk_SHA1_Block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		sha1_blocks(ctx->H, data, len / 64);
+		data = ((const char *)data + (len & ~63UL));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
@@ -6,6 +6,8 @@
  * none of the original Mozilla code remains.
  */
 
+#include "hash.h"
+
 typedef struct {
 	unsigned long long size;
 	unsigned int H[5];
@@ -16,6 +18,46 @@ void git__blk_SHA1_Init(blk_SHA_CTX *ctx);
 void git__blk_SHA1_Update(blk_SHA_CTX *ctx, const void *dataIn, unsigned long len);
 void git__blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
 
+/*
+ * Select the routine processing the 64-byte blocks by name
+ * ("portable", "avx2" or "shani"), or the fastest one
+ * the CPU supports if NULL, which is done at startup.  Returns
+ * GIT_ENOTFOUND if the CPU lacks the instructions needed.  Not
+ * thread-safe: meant for tests and benchmarks.
+ */
+int git__blk_SHA1_use(const char *name);
+const char *git__blk_SHA1_impl(void);
+
+/*
+ * The x86 routines are built with per-function target options,
+ * so that a single binary runs everywhere; they are only called
+ * when CPUID reports the instructions they use.
+ */
+#if (defined(__i386__) || defined(__x86_64__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define BLK_SHA1_X86
+
+void git__blk_SHA1_Blocks_avx2(unsigned int H[5], const unsigned char *data, size_t n);
+void git__blk_SHA1_Blocks_shani(unsigned int H[5], const unsigned char *data, size_t n);
+
+void git__blk_SHA1_Lanes_sse2(unsigned int *H, const unsigned char **blocks);
+void git__blk_SHA1_Lanes_avx2(unsigned int *H, const unsigned char **blocks);
+#endif
+
+/*
+ * Hash n messages, each made of the 'parts' consecutive buffers
+ * of vec, into out[0] to out[n - 1].  The messages are hashed 4
+ * or 8 at a time in vector lanes when the CPU allows.
+ */
+void git__blk_SHA1_Many(git_oid *out, const git_buf_vec *vec, size_t parts, size_t n);
+
+/*
+ * Select the multi-buffer routine by name ("none", "sse2" or
+ * "avx2"), or the fastest if NULL, as git__blk_SHA1_use() does.
+ */
+int git__blk_SHA1_use_lanes(const char *name);
+const char *git__blk_SHA1_lanes_impl(void);
+
 #define SHA_CTX		blk_SHA_CTX
 #define SHA1_Init	git__blk_SHA1_Init
 #define SHA1_Update	git__blk_SHA1_Update
@@ -46,9 +46,29 @@ static void clear_parents(git_commit *commit)
 	git_vector_clear(&commit->parents);
 }
 
+static int add_parent(git_commit *commit, const git_oid *id, git_commit *parent)
+{
+	git_oid *parent_oids;
+
+	parent_oids = git__realloc(commit->parent_oids,
+			(commit->parents.length + 1) * sizeof(git_oid));
+	if (parent_oids == NULL)
+		return GIT_ENOMEM;
+	commit->parent_oids = parent_oids;
+
+	if (id)
+		git_oid_cpy(&parent_oids[commit->parents.length], id);
+	else
+		memset(&parent_oids[commit->parents.length], 0x0, sizeof(git_oid));
+
+	return git_vector_insert(&commit->parents, parent);
+}
+
 void git_commit__free(git_commit *commit)
 {
 	clear_parents(commit);
+	git_vector_free(&commit->parents);
+	free(commit->parent_oids);
 
 	git_person__free(commit->author);
 	git_person__free(commit->committer);
@@ -67,16 +87,19 @@ int git_commit__writeback(git_commit *commit, git_odb_source *src)
 {
 	unsigned int i;
 
-	if (commit->tree == NULL)
+	if (commit->tree != NULL)
+		git__write_oid(src, "tree", git_tree_id(commit->tree));
+	else if (!commit->object.in_memory)
+		git__write_oid(src, "tree", &commit->tree_oid);
+	else
 		return GIT_EMISSINGOBJDATA;
 
-	git__write_oid(src, "tree", git_tree_id(commit->tree));
-
 	for (i = 0; i < commit->parents.length; ++i) {
 		git_commit *parent;
 
 		parent = git_vector_get(&commit->parents, i);
-		git__write_oid(src, "parent", git_commit_id(parent));
+		git__write_oid(src, "parent",
+				parent ? git_commit_id(parent) : &commit->parent_oids[i]);
 	}
 
 	if (commit->author == NULL)
@@ -114,10 +137,7 @@ int commit_parse_buffer(git_commit *commit, void *data, size_t len, unsigned int
 	clear_parents(commit);
 
 
-	if ((error = git__parse_oid(&oid, &buffer, buffer_end, "tree ")) < 0)
-		return error;
-
-	if ((error = git_repository_lookup((git_object **)&commit->tree, commit->object.repo, &oid, GIT_OBJ_TREE)) < 0)
+	if ((error = git__parse_oid(&commit->tree_oid, &buffer, buffer_end, "tree ")) < 0)
 		return error;
 
 	/*
@@ -125,12 +145,7 @@ int commit_parse_buffer(git_commit *commit, void *data, size_t len, unsigned int
 	 */
 
 	while (git__parse_oid(&oid, &buffer, buffer_end, "parent ") == 0) {
-		git_commit *parent;
-
-		if ((error = git_repository_lookup((git_object **)&parent, commit->object.repo, &oid, GIT_OBJ_COMMIT)) < 0)
-			return error;
-
-		if (git_vector_insert(&commit->parents, parent) < 0)
+		if (add_parent(commit, &oid, NULL) < 0)
 			return GIT_ENOMEM;
 	}
 
@@ -230,7 +245,6 @@ int git_commit__parse_full(git_commit *commit)
 	if (!commit->object.in_memory && !commit->full_parse)\
 		git_commit__parse_full(commit); 
 
-GIT_COMMIT_GETTER(git_tree *, tree)
 GIT_COMMIT_GETTER(git_person *, author)
 GIT_COMMIT_GETTER(git_person *, committer)
 GIT_COMMIT_GETTER(char *, message)
@@ -249,6 +263,20 @@ time_t git_commit_time(git_commit *commit)
 	return commit->commit_time;
 }
 
+const git_tree *git_commit_tree(git_commit *commit)
+{
+	assert(commit);
+
+	if (commit->tree)
+		return commit->tree;
+
+	if (!commit->object.in_memory)
+		git_repository_lookup((git_object **)&commit->tree,
+				commit->object.repo, &commit->tree_oid, GIT_OBJ_TREE);
+
+	return commit->tree;
+}
+
 unsigned int git_commit_parentcount(git_commit *commit)
 {
 	assert(commit);
@@ -257,8 +285,22 @@ unsigned int git_commit_parentcount(git_commit *commit)
 
 git_commit * git_commit_parent(git_commit *commit, unsigned int n)
 {
+	git_commit *parent;
+
 	assert(commit);
-	return git_vector_get(&commit->parents, n);
+
+	if (n >= commit->parents.length)
+		return NULL;
+
+	if ((parent = git_vector_get(&commit->parents, n)) == NULL) {
+		if (git_repository_lookup((git_object **)&parent,
+				commit->object.repo, &commit->parent_oids[n], GIT_OBJ_COMMIT) < 0)
+			return NULL;
+
+		commit->parents.contents[n] = parent;
+	}
+
+	return parent;
 }
 
 void git_commit_set_tree(git_commit *commit, git_tree *tree)
@@ -313,5 +355,5 @@ int git_commit_add_parent(git_commit *commit, git_commit *new_parent)
 {
 	CHECK_FULL_PARSE();
 	commit->object.modified = 1;
-	return git_vector_insert(&commit->parents, new_parent);
+	return add_parent(commit, git_commit_id(new_parent), new_parent);
 }
@@ -12,9 +12,16 @@ struct git_commit {
 	git_object object;
 
 	time_t commit_time;
+
+	/* Parents are looked up on demand: entries of 'parents'
+	 * stay NULL until git_commit_parent() resolves them from
+	 * the matching entry in 'parent_oids'. */
 	git_vector parents;
+	git_oid *parent_oids;
 
+	/* Looked up on demand from 'tree_oid' */
 	git_tree *tree;
+	git_oid tree_oid;
 	git_person *author;
 	git_person *committer;
 
@@ -0,0 +1,74 @@
+/*
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * In addition to the permissions in the GNU General Public License,
+ * the authors give you unlimited permission to link the compiled
+ * version of this file into combinations with other programs,
+ * and to distribute those combinations without any restriction
+ * coming from the use of this file.  (The General Public License
+ * restrictions do apply in other respects; for example, they cover
+ * modification of the file, and distribution when not linked into
+ * a combined executable.)
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "common.h"
+#include "cpu.h"
+
+#if (defined(__i386__) || defined(__x86_64__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <cpuid.h>
+
+#ifndef bit_AVX2
+# define bit_AVX2 (1 << 5)
+#endif
+#ifndef bit_SHA
+# define bit_SHA (1 << 29)
+#endif
+
+int git__cpu_supports(const char *name)
+{
+	unsigned int eax, ebx, ecx, edx, ecx1, xcr0 = 0;
+
+	if (!strcmp(name, "portable"))
+		return 1;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+		return 0;
+	if (!strcmp(name, "sse2"))
+		return (edx & bit_SSE2) != 0;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	if (!strcmp(name, "shani"))
+		return (ebx & bit_SHA) && (ecx1 & bit_SSSE3) && (ecx1 & bit_SSE4_1);
+
+	/* the OS must save the ymm registers as well */
+	if (ecx1 & bit_OSXSAVE)
+		__asm__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+	if (!strcmp(name, "avx2"))
+		return (ebx & bit_AVX2) && (ecx1 & bit_AVX) && (xcr0 & 6) == 6;
+
+	return 0;
+}
+
+#else
+
+int git__cpu_supports(const char *name)
+{
+	return !strcmp(name, "portable");
+}
+
+#endif
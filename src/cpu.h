@@ -0,0 +1,12 @@
+#ifndef INCLUDE_cpu_h__
+#define INCLUDE_cpu_h__
+
+/*
+ * Whether the CPU, and the OS, support the instructions of the
+ * routines named "sse2", "shani" or "avx2"; "portable" is always
+ * supported.  The builtin SHA-1 and hex routines pick their
+ * implementation with it.
+ */
+int git__cpu_supports(const char *name);
+
+#endif /* INCLUDE_cpu_h__ */
@@ -30,8 +30,24 @@ static int hdr_sz(
 	return 0;
 }
 
-int git__delta_apply(
-	git_rawobj *out,
+int git__delta_read_header(
+	size_t *base_sz,
+	size_t *res_sz,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	const unsigned char *delta_end = delta + delta_len;
+
+	if (hdr_sz(base_sz, &delta, delta_end) < 0)
+		return GIT_ERROR;
+	if (hdr_sz(res_sz, &delta, delta_end) < 0)
+		return GIT_ERROR;
+	return GIT_SUCCESS;
+}
+
+int git__delta_apply_to(
+	unsigned char *res_dp,
+	size_t res_len,
 	const unsigned char *base,
 	size_t base_len,
 	const unsigned char *delta,
@@ -39,7 +55,6 @@ int git__delta_apply(
 {
 	const unsigned char *delta_end = delta + delta_len;
 	size_t base_sz, res_sz;
-	unsigned char *res_dp;
 
 	/* Check that the base size matches the data we were given;
 	 * if not we would underflow while accessing data from the
@@ -48,15 +63,9 @@ int git__delta_apply(
 	if ((hdr_sz(&base_sz, &delta, delta_end) < 0) || (base_sz != base_len))
 		return GIT_ERROR;
 
-	if (hdr_sz(&res_sz, &delta, delta_end) < 0)
+	if ((hdr_sz(&res_sz, &delta, delta_end) < 0) || (res_sz != res_len))
 		return GIT_ERROR;
 
-	if ((res_dp = git__malloc(res_sz + 1)) == NULL)
-		return GIT_ERROR;
-	res_dp[res_sz] = '\0';
-	out->data = res_dp;
-	out->len = res_sz;
-
 	while (delta < delta_end) {
 		unsigned char cmd = *delta++;
 		if (cmd & 0x80) {
@@ -75,7 +84,7 @@ int git__delta_apply(
 			if (!len)       len  = 0x10000;
 
 			if (base_len < off + len || res_sz < len)
-				goto fail;
+				return GIT_ERROR;
 			memcpy(res_dp, base + off, len);
 			res_dp += len;
 			res_sz -= len;
@@ -85,7 +94,7 @@ int git__delta_apply(
 			 * the delta stream itself.
 			 */
 			if (delta_end - delta < cmd || res_sz < cmd)
-				goto fail;
+				return GIT_ERROR;
 			memcpy(res_dp, delta, cmd);
 			delta  += cmd;
 			res_dp += cmd;
@@ -94,16 +103,39 @@ int git__delta_apply(
 		} else {
 			/* cmd == 0 is reserved for future encodings.
 			 */
-			goto fail;
+			return GIT_ERROR;
 		}
 	}
 
 	if (delta != delta_end || res_sz)
-		goto fail;
+		return GIT_ERROR;
 	return GIT_SUCCESS;
+}
 
-fail:
-	free(out->data);
-	out->data = NULL;
-	return GIT_ERROR;
+int git__delta_apply(
+	git_rawobj *out,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	size_t base_sz, res_sz;
+	unsigned char *res_dp;
+
+	if (git__delta_read_header(&base_sz, &res_sz, delta, delta_len) < 0)
+		return GIT_ERROR;
+
+	if ((res_dp = git__malloc(res_sz + 1)) == NULL)
+		return GIT_ERROR;
+	res_dp[res_sz] = '\0';
+
+	if (git__delta_apply_to(res_dp, res_sz, base, base_len, delta, delta_len) < 0) {
+		free(res_dp);
+		out->data = NULL;
+		return GIT_ERROR;
+	}
+
+	out->data = res_dp;
+	out->len = res_sz;
+	return GIT_SUCCESS;
 }
@@ -22,4 +22,45 @@ extern int git__delta_apply(
 	const unsigned char *delta,
 	size_t delta_len);
 
+/**
+ * Read the base and result sizes recorded at the start of a delta.
+ *
+ * Only the first few bytes of the delta need to be available.
+ *
+ * @param base_sz size of the base the delta must be applied to.
+ * @param res_sz size of the data the delta produces.
+ * @param delta the (start of the) delta.
+ * @param delta_len number of bytes available at delta.
+ * @return
+ * - GIT_SUCCESS if both sizes were read.
+ * - GIT_ERROR if the header is truncated.
+ */
+extern int git__delta_read_header(
+	size_t *base_sz,
+	size_t *res_sz,
+	const unsigned char *delta,
+	size_t delta_len);
+
+/**
+ * Apply a git binary delta into a caller supplied buffer.
+ *
+ * @param res buffer receiving the original data.
+ * @param res_len size of res; must match the result size
+ *		recorded in the delta header.
+ * @param base the base to copy from during copy instructions.
+ * @param base_len number of bytes available at base.
+ * @param delta the delta to execute copy/insert instructions from.
+ * @param delta_len total number of bytes in the delta.
+ * @return
+ * - GIT_SUCCESS on a successful delta unpack.
+ * - GIT_ERROR if the delta is corrupt or doesn't match the base.
+ */
+extern int git__delta_apply_to(
+	unsigned char *res,
+	size_t res_len,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len);
+
 #endif
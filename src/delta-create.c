@@ -0,0 +1,304 @@
+#include "common.h"
+#include "git/odb.h"
+#include "delta-create.h"
+
+/*
+ * Deltas are found by hashing each DELTA_BLOCK bytes of the base,
+ * then rolling the same hash over the result: a window of the
+ * result whose hash is in the index is compared with the base,
+ * and the match extended as far as it goes in both directions.
+ * This is the approach of diff-delta.c in the GIT project, with
+ * a plain polynomial hash instead of a Rabin fingerprint.
+ */
+
+#define DELTA_BLOCK 16
+#define DELTA_HASH_MULT 0x01000193
+#define DELTA_MAX_CHAIN 64        /* index entries kept per bucket */
+#define DELTA_MAX_COPY 0x10000    /* bytes copied by one instruction */
+#define DELTA_MAX_INSERT 0x7f     /* bytes inserted by one instruction */
+
+typedef struct {
+	uint32_t hash;
+	uint32_t offset;
+	uint32_t next;  /* next entry of the bucket, plus one */
+} delta_entry;
+
+struct git__delta_index {
+	const unsigned char *base;
+	size_t base_len;
+	unsigned int shift;
+	uint32_t *buckets;  /* first entry of each bucket, plus one */
+	delta_entry *entries;
+	uint32_t outgoing[256];  /* hash weight of a byte leaving the window */
+};
+
+typedef struct {
+	unsigned char *data;
+	size_t len, alloc, max;
+} delta_out;
+
+static uint32_t block_hash(const unsigned char *data)
+{
+	uint32_t h = 0;
+	int j;
+
+	for (j = 0; j < DELTA_BLOCK; j++)
+		h = h * DELTA_HASH_MULT + data[j];
+	return h;
+}
+
+GIT_INLINE(uint32_t) bucket_of(const git__delta_index *index, uint32_t h)
+{
+	return index->shift < 32 ? (h * 0x9E3779B1u) >> index->shift : 0;
+}
+
+git__delta_index *git__delta_create_index(
+	const unsigned char *base,
+	size_t base_len)
+{
+	size_t n_blocks = base_len / DELTA_BLOCK, n_buckets = 16, j;
+	git__delta_index *index;
+	unsigned char *counts;
+	delta_entry *last = NULL;
+	uint32_t prev = 0, n = 0, w = 1;
+
+	/* copy instructions hold 32 bit offsets */
+	if ((uint64_t)base_len > 0xffffffff)
+		return NULL;
+
+	if ((index = git__calloc(1, sizeof(*index))) == NULL)
+		return NULL;
+
+	index->base = base;
+	index->base_len = base_len;
+	index->shift = 32 - 4;
+	while (n_buckets < n_blocks) {
+		n_buckets <<= 1;
+		index->shift--;
+	}
+
+	for (j = 0; j < DELTA_BLOCK - 1; j++)
+		w *= DELTA_HASH_MULT;
+	for (j = 0; j < 256; j++)
+		index->outgoing[j] = (uint32_t)j * w;
+
+	index->buckets = git__calloc(n_buckets, sizeof(*index->buckets));
+	index->entries = git__malloc((n_blocks + 1) * sizeof(*index->entries));
+	counts = git__calloc(n_buckets, sizeof(*counts));
+
+	if (!index->buckets || !index->entries || !counts) {
+		free(counts);
+		git__delta_free_index(index);
+		return NULL;
+	}
+
+	/*
+	 * Go backwards, so that each bucket lists the earliest blocks
+	 * first.  Runs of identical blocks are indexed once, and long
+	 * buckets are cut short to bound the search time.
+	 */
+	for (j = n_blocks; j-- > 0; ) {
+		uint32_t h = block_hash(base + j * DELTA_BLOCK), b;
+		delta_entry *e;
+
+		if (j + 1 < n_blocks && h == prev) {
+			if (last)
+				last->offset = (uint32_t)(j * DELTA_BLOCK);
+			continue;
+		}
+		prev = h;
+		last = NULL;
+
+		b = bucket_of(index, h);
+		if (counts[b] == DELTA_MAX_CHAIN)
+			continue;
+		counts[b]++;
+
+		last = e = &index->entries[n++];
+		e->hash = h;
+		e->offset = (uint32_t)(j * DELTA_BLOCK);
+		e->next = index->buckets[b];
+		index->buckets[b] = n;
+	}
+
+	free(counts);
+	return index;
+}
+
+void git__delta_free_index(git__delta_index *index)
+{
+	if (!index)
+		return;
+	free(index->buckets);
+	free(index->entries);
+	free(index);
+}
+
+static int out_reserve(delta_out *o, size_t len)
+{
+	if (o->max && o->len + len > o->max)
+		return GIT_ENOTFOUND;
+
+	if (o->len + len > o->alloc) {
+		size_t alloc = alloc_nr(o->alloc);
+		unsigned char *data;
+
+		if (alloc < o->len + len)
+			alloc = o->len + len;
+		if ((data = git__realloc(o->data, alloc)) == NULL)
+			return GIT_ENOMEM;
+		o->data = data;
+		o->alloc = alloc;
+	}
+	return GIT_SUCCESS;
+}
+
+static int emit_size(delta_out *o, size_t size)
+{
+	int error;
+
+	if ((error = out_reserve(o, 10)) < GIT_SUCCESS)
+		return error;
+
+	while (size >= 0x80) {
+		o->data[o->len++] = (unsigned char)(size | 0x80);
+		size >>= 7;
+	}
+	o->data[o->len++] = (unsigned char)size;
+	return GIT_SUCCESS;
+}
+
+static int emit_insert(delta_out *o, const unsigned char *data, size_t len)
+{
+	int error;
+
+	while (len > 0) {
+		size_t n = len < DELTA_MAX_INSERT ? len : DELTA_MAX_INSERT;
+
+		if ((error = out_reserve(o, n + 1)) < GIT_SUCCESS)
+			return error;
+		o->data[o->len++] = (unsigned char)n;
+		memcpy(o->data + o->len, data, n);
+		o->len += n;
+		data += n;
+		len -= n;
+	}
+	return GIT_SUCCESS;
+}
+
+static int emit_copy(delta_out *o, size_t offset, size_t len)
+{
+	int error;
+
+	while (len > 0) {
+		size_t n = len < DELTA_MAX_COPY ? len : DELTA_MAX_COPY;
+		unsigned char *cmd;
+		int j;
+
+		if ((error = out_reserve(o, 8)) < GIT_SUCCESS)
+			return error;
+
+		cmd = o->data + o->len++;
+		*cmd = 0x80;
+		for (j = 0; j < 4; j++)
+			if ((offset >> (8 * j)) & 0xff) {
+				*cmd |= 0x01 << j;
+				o->data[o->len++] = (unsigned char)(offset >> (8 * j));
+			}
+		for (j = 0; j < 3; j++)
+			if ((n >> (8 * j)) & 0xff) {
+				*cmd |= 0x10 << j;
+				o->data[o->len++] = (unsigned char)(n >> (8 * j));
+			}
+
+		offset += n;
+		len -= n;
+	}
+	return GIT_SUCCESS;
+}
+
+int git__delta_create(
+	void **out,
+	size_t *out_len,
+	const git__delta_index *index,
+	const unsigned char *res,
+	size_t res_len,
+	size_t max_len)
+{
+	const unsigned char *base = index->base;
+	size_t base_len = index->base_len;
+	size_t i = 0, ins = 0;  /* literal data is pending from ins to i */
+	delta_out o;
+	uint32_t h = 0;
+	int error;
+
+	memset(&o, 0x0, sizeof(o));
+	o.max = max_len;
+
+	if ((error = emit_size(&o, base_len)) < GIT_SUCCESS
+		|| (error = emit_size(&o, res_len)) < GIT_SUCCESS)
+		goto cleanup;
+
+	if (res_len >= DELTA_BLOCK)
+		h = block_hash(res);
+
+	while (i + DELTA_BLOCK <= res_len) {
+		size_t best_len = 0, best_off = 0;
+		uint32_t e;
+
+		for (e = index->buckets[bucket_of(index, h)]; e; e = index->entries[e - 1].next) {
+			const delta_entry *ent = &index->entries[e - 1];
+			size_t len = 0, max;
+
+			if (ent->hash != h)
+				continue;
+
+			max = base_len - ent->offset;
+			if (max > res_len - i)
+				max = res_len - i;
+			while (len < max && base[ent->offset + len] == res[i + len])
+				len++;
+
+			if (len > best_len) {
+				best_len = len;
+				best_off = ent->offset;
+				if (len == max)
+					break;
+			}
+		}
+
+		if (best_len < DELTA_BLOCK) {
+			if (i + DELTA_BLOCK < res_len)
+				h = (h - index->outgoing[res[i]]) * DELTA_HASH_MULT + res[i + DELTA_BLOCK];
+			i++;
+			continue;
+		}
+
+		/* the match may start within the pending literal data */
+		while (i > ins && best_off > 0 && base[best_off - 1] == res[i - 1]) {
+			i--;
+			best_off--;
+			best_len++;
+		}
+
+		if ((error = emit_insert(&o, res + ins, i - ins)) < GIT_SUCCESS
+			|| (error = emit_copy(&o, best_off, best_len)) < GIT_SUCCESS)
+			goto cleanup;
+
+		i += best_len;
+		ins = i;
+		if (i + DELTA_BLOCK <= res_len)
+			h = block_hash(res + i);
+	}
+
+	if ((error = emit_insert(&o, res + ins, res_len - ins)) < GIT_SUCCESS)
+		goto cleanup;
+
+	*out = o.data;
+	*out_len = o.len;
+	return GIT_SUCCESS;
+
+cleanup:
+	free(o.data);
+	return error;
+}
@@ -0,0 +1,56 @@
+#ifndef INCLUDE_delta_create_h__
+#define INCLUDE_delta_create_h__
+
+/** An index of the blocks of a delta base. */
+typedef struct git__delta_index git__delta_index;
+
+/**
+ * Index a delta base, so that deltas against it can be created.
+ *
+ * The index refers to the base data, which must stay available
+ * until the index is freed.
+ *
+ * @param base the base to index.
+ * @param base_len number of bytes at base.
+ * @return the index, or NULL if out of memory or if the base is
+ *		too large to be referred to by a delta.
+ */
+extern git__delta_index *git__delta_create_index(
+	const unsigned char *base,
+	size_t base_len);
+
+/**
+ * Free an index created by git__delta_create_index().
+ *
+ * @param index the index to free; may be NULL.
+ */
+extern void git__delta_free_index(git__delta_index *index);
+
+/**
+ * Create a git binary delta turning an indexed base into 'res'.
+ *
+ * The delta uses the format git__delta_apply() consumes: the
+ * sizes of the base and result, then instructions copying
+ * ranges of the base or inserting literal data.
+ *
+ * @param out receives the delta, allocated with git__malloc().
+ * @param out_len receives the size of the delta.
+ * @param index the index of the base.
+ * @param res the data the delta must produce.
+ * @param res_len number of bytes at res.
+ * @param max_len largest delta size acceptable to the caller;
+ *		0 for no limit.
+ * @return
+ * - GIT_SUCCESS if the delta was created.
+ * - GIT_ENOTFOUND if the delta would be larger than max_len.
+ * - GIT_ENOMEM if out of memory.
+ */
+extern int git__delta_create(
+	void **out,
+	size_t *out_len,
+	const git__delta_index *index,
+	const unsigned char *res,
+	size_t res_len,
+	size_t max_len);
+
+#endif
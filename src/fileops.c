@@ -33,6 +33,23 @@ int gitfo_read(git_file fd, void *buf, size_t cnt)
 	return GIT_SUCCESS;
 }
 
+/*
+ * Read at most cnt bytes, returning how many were read before
+ * the end of the file (0 if at the end already) or an error.
+ */
+ssize_t gitfo_read_some(git_file fd, void *buf, size_t cnt)
+{
+	for (;;) {
+		ssize_t r = read(fd, buf, cnt);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return git_os_error();
+		}
+		return r;
+	}
+}
+
 int gitfo_write(git_file fd, void *buf, size_t cnt)
 {
 	char *b = buf;
@@ -231,7 +248,7 @@ int gitfo_write_cached(gitfo_cache *ioc, void *buff, size_t len)
 		}
 
 		/* write too-large chunks immediately */
-		if (len > ioc->cache_size)
+		if (len >= ioc->cache_size)
 			return gitfo_write(ioc->fd, buf, len);
 	}
 }
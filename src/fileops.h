@@ -61,6 +61,7 @@ extern int gitfo_isdir(const char *path);
 #define gitfo_close(fd) close(fd)
 
 extern int gitfo_read(git_file fd, void *buf, size_t cnt);
+extern ssize_t gitfo_read_some(git_file fd, void *buf, size_t cnt);
 extern int gitfo_write(git_file fd, void *buf, size_t cnt);
 #define gitfo_lseek(f,n,w) lseek(f, n, w)
 extern off_t gitfo_size(git_file fd);
@@ -110,6 +110,9 @@
 /** The index file is not backed up by an existing repository */
 #define GIT_EBAREINDEX (GIT_ERROR -14)
 
+/** The abbreviated object id matches several objects */
+#define GIT_EAMBIGUOUS (GIT_ERROR -15)
+
 
 GIT_BEGIN_DECL
 
@@ -33,6 +33,177 @@ GIT_EXTERN(int) git_odb_open(git_odb **out, const char *objects_dir);
  */
 GIT_EXTERN(void) git_odb_close(git_odb *db);
 
+/**
+ * Set the memory limit of the delta base cache.
+ *
+ * Bases of deltified packed objects are kept in memory after
+ * being used, so that reading several objects deltified against
+ * the same base does not unpack the base again.  The default
+ * limit is 16 MiB; a limit of 0 disables the cache.
+ *
+ * @param db database to configure.
+ * @param limit maximum number of inflated bytes to keep cached.
+ */
+GIT_EXTERN(void) git_odb_set_delta_base_cache_limit(git_odb *db, size_t limit);
+
+/**
+ * Set the process-wide limits of the pack file memory maps.
+ *
+ * Pack files are mapped into memory in windows of a fixed size
+ * instead of as a whole.  When the windows of all the packs of
+ * all the open databases exceed either the mapped size or the
+ * window count limit, the least recently used windows are
+ * unmapped, whichever database they belong to.  The
+ * defaults are 1 GiB windows with an 8 GiB limit on 64-bit
+ * systems, 32 MiB windows with a 256 MiB limit otherwise, and
+ * at most 256 windows.
+ *
+ * @param window_size size of each window, rounded up to a
+ *        multiple of 128 KiB; 0 keeps the current value.
+ * @param mapped_limit maximum number of bytes mapped at once;
+ *        0 keeps the current value.
+ * @param open_limit maximum number of windows mapped at once;
+ *        0 keeps the current value.
+ */
+GIT_EXTERN(void) git_odb_set_pack_window_limits(
+		size_t window_size, size_t mapped_limit, unsigned int open_limit);
+
+/**
+ * Get the process-wide limits of the pack file memory maps.
+ *
+ * @param window_size size of each window.
+ * @param mapped_limit maximum number of bytes mapped at once.
+ * @param open_limit maximum number of windows mapped at once.
+ */
+GIT_EXTERN(void) git_odb_get_pack_window_limits(
+		size_t *window_size, size_t *mapped_limit, unsigned int *open_limit);
+
+/**
+ * Enable or disable the loose object cache.
+ *
+ * When enabled, each objects/xx directory is listed once and
+ * the listing is kept in memory, so that looking for an object
+ * does not need to check for its loose file first.  A listing
+ * is read again when the directory's mtime changes; objects
+ * written through this database are added to it directly.
+ * The cache is disabled by default.
+ *
+ * @param db database to configure.
+ * @param enabled true to enable the cache, false to disable it.
+ */
+GIT_EXTERN(void) git_odb_set_loose_cache(git_odb *db, int enabled);
+
+/**
+ * Enable or disable the filter of missing objects.
+ *
+ * When enabled, git_odb_exists() first checks a Bloom filter
+ * holding the ids of all the objects of the database and of
+ * its alternates, and reports most missing objects without
+ * searching the loose directories or the pack indexes.  The
+ * filter is built on first use, and objects written through
+ * this database are added to it.
+ *
+ * New packs, and objects added to the alternates through other
+ * databases, are noticed from the directory mtimes and make the
+ * filter be built again.  Loose objects added to this database
+ * by other processes are not seen by git_odb_exists() until the
+ * filter is enabled again, which rebuilds it.  The filter is
+ * disabled by default.
+ *
+ * @param db database to configure.
+ * @param enabled true to enable the filter, false to disable it.
+ */
+GIT_EXTERN(void) git_odb_set_exists_filter(git_odb *db, int enabled);
+
+/**
+ * Start writing new objects into a pack.
+ *
+ * Until the import is committed or aborted, objects written
+ * with git_odb_write() are appended to a new pack file rather
+ * than stored as loose objects.  They can be read back through
+ * the database while the import is in progress.
+ *
+ * @param db database to import objects into.
+ * @return
+ * - GIT_SUCCESS if the import was started;
+ * - GIT_EBUSY if an import is already in progress;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_begin_import(git_odb *db);
+
+/**
+ * Finish the import started by git_odb_begin_import().
+ *
+ * The pack gets its final name and an index is written for
+ * it.  No pack is created when no object was imported.
+ *
+ * @param db database with an import in progress.
+ * @return
+ * - GIT_SUCCESS if the pack was written;
+ * - an error code otherwise, in which case the imported
+ *   objects are discarded.
+ */
+GIT_EXTERN(int) git_odb_commit_import(git_odb *db);
+
+/**
+ * Discard the import started by git_odb_begin_import(), along
+ * with the objects written since.  Nothing is done if there is
+ * no import in progress.
+ *
+ * @param db database with an import in progress.
+ */
+GIT_EXTERN(void) git_odb_abort_import(git_odb *db);
+
+/**
+ * Add a pack file to the database.
+ *
+ * The pack is read and checked, the ids of its objects are
+ * computed, and an index is written for it.  Deltas are
+ * resolved by as many threads as there are online CPUs.
+ * The pack is then moved into the objects/pack directory of
+ * the database, and its objects can be read from there.
+ *
+ * Packs whose deltas have bases outside of the pack ("thin"
+ * packs) are not supported.
+ *
+ * @param pack_id the checksum of the pack, naming the files.
+ * @param db database to add the pack to.
+ * @param path path to the pack file.
+ * @return
+ * - GIT_SUCCESS if the pack was added;
+ * - GIT_EPACKCORRUPTED if the pack is corrupted or thin;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_index_pack(git_oid *pack_id, git_odb *db, const char *path);
+
+/**
+ * Write a set of objects of the database to a new pack.
+ *
+ * Objects are sorted by type and size, and each one is tried
+ * as a delta against the objects just before it in that order;
+ * the smallest delta found is stored if it is less than half
+ * the size of the object.  The search is split between as many
+ * threads as there are online CPUs.
+ *
+ * The pack and its index are written to the objects/pack
+ * directory of the database, named after the pack checksum.
+ *
+ * @param pack_id the checksum of the pack, naming the files.
+ * @param db database to read the objects from and write the
+ *        pack to.
+ * @param ids the objects to write; duplicates are written once.
+ * @param n number of ids.
+ * @param window number of objects each object is compared with,
+ *        plus one; 0 for the default of 10.
+ * @param depth longest chain of deltas to create; 0 for the
+ *        default of 50.
+ * @return
+ * - GIT_SUCCESS if the pack was written;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_write_pack(git_oid *pack_id, git_odb *db, const git_oid *ids, size_t n,
+		unsigned int window, unsigned int depth);
+
 /** Basic type (loose or packed) of any Git object. */
 typedef enum {
 	GIT_OBJ_ANY = -2,		/**< Object can be any of the following */
@@ -87,6 +258,126 @@ GIT_EXTERN(int) git_odb_read(git_rawobj *out, git_odb *db, const git_oid *id);
  */
 GIT_EXTERN(int) git_odb_read_header(git_rawobj *out, git_odb *db, const git_oid *id);
 
+/**
+ * Read a set of objects from the database.
+ *
+ * All the objects are looked up first, then read in the order
+ * they are stored: packed objects by pack and by offset, then
+ * loose objects.  Delta bases shared by several objects of the
+ * set are only unpacked once.
+ *
+ * Each object is passed to the callback, which must neither
+ * keep nor free it; its data is released when the callback
+ * returns.  The iteration stops as soon as the callback returns
+ * a value other than GIT_SUCCESS, and that value is returned.
+ *
+ * @param db database to search for the objects in.
+ * @param ids the objects to read.
+ * @param n number of ids.
+ * @param fn function called with payload for each object.
+ * @param payload passed through to fn.
+ * @return
+ * - GIT_SUCCESS if every object was read;
+ * - GIT_ENOTFOUND if an object is not in the database, in
+ *   which case none is read;
+ * - the value returned by fn if it stopped the iteration;
+ * - another error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_read_many(git_odb *db, const git_oid *ids, size_t n,
+		int (*fn)(void *payload, const git_oid *id, git_rawobj *obj), void *payload);
+
+/** A stream reading or writing the contents of an object. */
+typedef struct git_odb_stream git_odb_stream;
+
+/**
+ * Open a stream reading an object from the database.
+ *
+ * Loose objects and undeltified packed objects are inflated as
+ * they are read, so that reading a large object takes constant
+ * memory.  Deltified objects are unpacked when opened.
+ *
+ * The database must stay open as long as the stream.
+ *
+ * @param out location to store the stream, if opened.
+ * @param hdr object descriptor to populate with the type and
+ *        size of the object; its 'data' pointer is set to NULL.
+ * @param db database to search for the object in.
+ * @param id identity of the object to read.
+ * @return
+ * - GIT_SUCCESS if the stream was opened;
+ * - GIT_ENOTFOUND if the object is not in the database.
+ */
+GIT_EXTERN(int) git_odb_read_stream(git_odb_stream **out, git_rawobj *hdr, git_odb *db, const git_oid *id);
+
+/**
+ * Read the next chunk of an object from a stream.
+ *
+ * @param stream stream to read from.
+ * @param buffer buffer receiving the data.
+ * @param len size of the buffer.
+ * @return the number of bytes stored in the buffer, which is
+ *         only less than len at the end of the object and 0
+ *         once all of it has been read; or an error code.
+ */
+GIT_EXTERN(int) git_odb_stream_read(git_odb_stream *stream, void *buffer, size_t len);
+
+/**
+ * Open a stream writing an object to the database.
+ *
+ * The object is hashed, compressed and written to a temporary
+ * file as its contents are given, so that writing a large object
+ * takes constant memory.  It becomes part of the database once
+ * the stream is finalized.
+ *
+ * The database must stay open as long as the stream.
+ *
+ * @param out location to store the stream, if opened.
+ * @param db database to which the object should be written.
+ * @param size exact number of bytes that will be written.
+ * @param type type of the object.
+ * @return
+ * - GIT_SUCCESS if the stream was opened;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_open_wstream(git_odb_stream **out, git_odb *db, size_t size, git_otype type);
+
+/**
+ * Write the next chunk of an object to a stream.
+ *
+ * @param stream stream opened with git_odb_open_wstream().
+ * @param buffer data to write.
+ * @param len number of bytes of data; the total may not exceed
+ *        the size given when opening the stream.
+ * @return
+ * - GIT_SUCCESS if the data was written;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_stream_write(git_odb_stream *stream, const void *buffer, size_t len);
+
+/**
+ * Store the object written to a stream in the database.
+ *
+ * The stream must still be closed with git_odb_stream_close().
+ *
+ * @param id identity of the object written.
+ * @param stream stream opened with git_odb_open_wstream(), to
+ *        which exactly the declared number of bytes was written.
+ * @return
+ * - GIT_SUCCESS if the object was stored;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_stream_finalize(git_oid *id, git_odb_stream *stream);
+
+/**
+ * Close a stream.
+ *
+ * Closing a write stream which was not finalized discards the
+ * data written to it.
+ *
+ * @param stream stream to close.  If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_odb_stream_close(git_odb_stream *stream);
+
 /**
  * Read an object from the database using only pack files.
  *
@@ -115,6 +406,27 @@ GIT_EXTERN(int) git_odb__read_packed(git_rawobj *out, git_odb *db, const git_oid
  */
 GIT_EXTERN(int) git_odb__read_loose(git_rawobj *out, git_odb *db, const git_oid *id);
 
+/**
+ * Report the pack file windows mapped by the process.
+ *
+ * @param mapped number of bytes mapped.
+ * @param open number of windows mapped.
+ */
+GIT_EXTERN(void) git_odb__pack_window_usage(size_t *mapped, unsigned int *open);
+
+/**
+ * Tell whether the index of a pack is served by its .rev file.
+ *
+ * @param db database holding the pack.
+ * @param pack_name name of the pack ("pack-abc").
+ * @return
+ * - 1 if the reverse index was read from the .rev file;
+ * - 0 if it was computed from the pack index;
+ * - GIT_ENOTFOUND if the database has no such pack;
+ * - another error code if the pack index cannot be read.
+ */
+GIT_EXTERN(int) git_odb__pack_has_revindex(git_odb *db, const char *pack_name);
+
 /**
  * Write an object to the database.
  *
@@ -184,6 +496,23 @@ GIT_EXTERN(int) git_obj__loose_object_type(git_otype type);
  */
 GIT_EXTERN(int) git_obj_hash(git_oid *id, git_rawobj *obj);
 
+/**
+ * Determine the object-IDs of several git_rawobj at once.
+ *
+ * ids[i] receives the hash of objs[i].  Small objects are hashed
+ * several at a time where the CPU allows it, so this is faster
+ * than calling git_obj_hash() on each object in turn.
+ *
+ * @param ids the resulting object-IDs; n entries.
+ * @param objs the objects whose hashes are to be determined.
+ * @param n number of objects.
+ * @return
+ * - GIT_SUCCESS if all object-IDs were correctly determined.
+ * - GIT_ERROR if any of the given objects is malformed.
+ * - GIT_ENOMEM if out of memory.
+ */
+GIT_EXTERN(int) git_obj_hash_many(git_oid *ids, git_rawobj *objs, size_t n);
+
 /**
  * Determine if the given object can be found in the object database.
  *
@@ -195,6 +524,119 @@ GIT_EXTERN(int) git_obj_hash(git_oid *id, git_rawobj *obj);
  */
 GIT_EXTERN(int) git_odb_exists(git_odb *db, const git_oid *id);
 
+/**
+ * Find the object whose id starts with the given hex digits.
+ *
+ * Loose objects are looked up in the one directory named after
+ * the first two digits, and packed objects by a binary search
+ * of each pack index.  The alternates are searched as well.
+ *
+ * @param out the full id of the object, if found.
+ * @param db database to be searched for the object.
+ * @param hex the hex digits of the abbreviated id; need not be
+ *		nul-terminated.
+ * @param len number of digits at hex, between
+ *		GIT_OID_MINPREFIXLEN and GIT_OID_HEXSZ.
+ * @return
+ * - GIT_SUCCESS if a single object matches;
+ * - GIT_ENOTFOUND if no object matches;
+ * - GIT_EAMBIGUOUS if several objects match;
+ * - GIT_ENOTOID if hex is not a valid abbreviated id;
+ * - another error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_find_prefix(git_oid *out, git_odb *db, const char *hex, size_t len);
+
+/**
+ * List the objects of each pack by id, as their index does.
+ * This is the default order of git_odb_foreach().
+ */
+#define GIT_ODB_FOREACH_ID          (0)
+
+/**
+ * List the objects of each pack in the order they are stored,
+ * so that reading them as they are listed reads each pack from
+ * start to end.
+ */
+#define GIT_ODB_FOREACH_PACK_ORDER  (1 << 0)
+
+/**
+ * List all the objects of the database.
+ *
+ * The objects of each pack are listed first, a pack after the
+ * other, then the loose objects in the order of their ids.  An
+ * object stored several times is listed once for each copy.  The
+ * objects of the alternates are not listed.
+ *
+ * The iteration stops as soon as the callback returns a value
+ * other than GIT_SUCCESS, and that value is returned.
+ *
+ * @param db database whose objects should be listed.
+ * @param flags GIT_ODB_FOREACH_ID or GIT_ODB_FOREACH_PACK_ORDER.
+ * @param fn function called with payload for each object.
+ * @param payload passed through to fn.
+ * @return
+ * - GIT_SUCCESS if every object was listed;
+ * - the value returned by fn if it stopped the iteration;
+ * - another error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_foreach(git_odb *db, unsigned int flags,
+		int (*fn)(void *payload, const git_oid *id), void *payload);
+
+/**
+ * Write a multi-pack-index for all the packs of the database.
+ *
+ * The multi-pack-index (objects/pack/multi-pack-index) maps the
+ * id of every packed object to the pack holding it, so that an
+ * object can be found with a single lookup instead of a search
+ * through each pack index in turn.  Packs created after the
+ * file was written are still searched one by one.
+ *
+ * The file is used by pack lists scanned after it was written.
+ *
+ * @param db database whose packs should be indexed.
+ * @return
+ * - GIT_SUCCESS if the multi-pack-index was written;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_write_multi_pack_index(git_odb *db);
+
+/**
+ * Write a reverse index for each pack of the database lacking one.
+ *
+ * The reverse index (objects/pack/pack-*.rev) lists the objects
+ * of a pack in the order they are stored in it.  A pack with a
+ * valid reverse index is opened without sorting its index by
+ * offset, which otherwise happens each time the pack is opened.
+ *
+ * @param db database whose packs should be indexed.
+ * @return
+ * - GIT_SUCCESS if the reverse indexes were written;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_write_reverse_indexes(git_odb *db);
+
+/**
+ * Report how often each pack of the database was searched.
+ *
+ * The callback is called for each pack, largest first, with the
+ * name of the pack ("pack-abc") and the number of object lookups
+ * which found, or did not find, the object in the pack index
+ * since the pack was first listed.  The iteration stops as soon
+ * as the callback returns a value other than GIT_SUCCESS, and
+ * that value is returned.
+ *
+ * @param db database whose packs should be reported.
+ * @param fn function called with payload for each pack.
+ * @param payload passed through to fn.
+ * @return
+ * - GIT_SUCCESS if every pack was reported;
+ * - the value returned by fn if it stopped the iteration;
+ * - another error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_pack_stats(git_odb *db,
+		int (*fn)(void *payload, const char *pack_name, size_t hits, size_t misses),
+		void *payload);
+
 /** @} */
 GIT_END_DECL
 #endif
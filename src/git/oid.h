@@ -19,6 +19,9 @@ GIT_BEGIN_DECL
 /** Size (in bytes) of a hex formatted oid */
 #define GIT_OID_HEXSZ (GIT_OID_RAWSZ * 2)
 
+/** Minimum length (in hex digits) of an abbreviated oid */
+#define GIT_OID_MINPREFIXLEN 4
+
 /** Unique identity of any object (commit, tree, blob, tag). */
 typedef struct {
 	/** raw binary formatted id */
@@ -35,6 +38,22 @@ typedef struct {
  */
 GIT_EXTERN(int) git_oid_mkstr(git_oid *out, const char *str);
 
+/**
+ * Parse an array of hex formatted object ids.
+ * <p>
+ * The input is read in full, so this is faster than calling
+ * git_oid_mkstr() on each id in turn, but the buffer must hold
+ * all of the digits.  Every character is checked: the ids must
+ * not be separated by anything.
+ *
+ * @param out array of n oid structures the results are written
+ *        into; its contents are undefined on failure.
+ * @param str input hex string of n * 40 hex digits.
+ * @param n number of oids to parse.
+ * @return GIT_SUCCESS if all are valid; GIT_ENOTOID on failure.
+ */
+GIT_EXTERN(int) git_oid_mkstr_many(git_oid *out, const char *str, size_t n);
+
 /**
  * Copy an already raw oid into a git_oid structure.
  * @param out oid structure the result is written into.
@@ -56,6 +75,16 @@ GIT_INLINE(void) git_oid_mkraw(git_oid *out, const unsigned char *raw)
  */
 GIT_EXTERN(void) git_oid_fmt(char *str, const git_oid *oid);
 
+/**
+ * Format an array of git_oid into one hex string.
+ * @param str output hex string; must have room for n * 40 bytes.
+ *        The ids are written one after the other with no
+ *        separator or '\\0' terminator.
+ * @param ids array of n oid structures to format.
+ * @param n number of oids to format.
+ */
+GIT_EXTERN(void) git_oid_fmt_many(char *str, const git_oid *ids, size_t n);
+
 /**
  * Format a git_oid into a loose-object path string.
  * <p>
@@ -93,6 +93,21 @@ GIT_EXTERN(int) git_repository_open2(git_repository **repository,
  */
 GIT_EXTERN(int) git_repository_lookup(git_object **object, git_repository *repo, const git_oid *id, git_otype type);
 
+/**
+ * Make room in the repository's object cache for a number of
+ * objects.
+ *
+ * The cache grows as objects are looked up, moving its entries
+ * to the larger table a few at a time.  Callers that know how
+ * many objects they are going to look up (e.g. all the objects
+ * of a pack) can size the cache once beforehand instead.
+ *
+ * @param repo the repository whose cache to grow
+ * @param count the number of objects the cache must hold
+ * @return 0 on success; error code otherwise
+ */
+GIT_EXTERN(int) git_repository_reserve_objects(git_repository *repo, size_t count);
+
 /**
  * Get the object database behind a Git repository
  *
@@ -92,3 +92,58 @@ void git_hash_vec(git_oid *out, git_buf_vec *vec, size_t n)
 		SHA1_Update(&c, vec[i].data, vec[i].len);
 	SHA1_Final(out->id, &c);
 }
+
+void git_hash_many(git_oid *out, const git_buf_vec *bufs, size_t n)
+{
+	git_hash_vec_many(out, bufs, 1, n);
+}
+
+void git_hash_vec_many(git_oid *out, const git_buf_vec *vec, size_t parts, size_t n)
+{
+#if defined(PPC_SHA1) || defined(OPENSSL_SHA1)
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		git_hash_vec(&out[i], (git_buf_vec *)&vec[i * parts], parts);
+#else
+	git__blk_SHA1_Many(out, vec, parts, n);
+#endif
+}
+
+int git_hash__set_impl(const char *name)
+{
+#if defined(PPC_SHA1) || defined(OPENSSL_SHA1)
+	return name ? GIT_ENOTFOUND : GIT_SUCCESS;
+#else
+	return git__blk_SHA1_use(name);
+#endif
+}
+
+const char *git_hash__impl(void)
+{
+#if defined(PPC_SHA1)
+	return "ppc";
+#elif defined(OPENSSL_SHA1)
+	return "openssl";
+#else
+	return git__blk_SHA1_impl();
+#endif
+}
+
+int git_hash__set_many_impl(const char *name)
+{
+#if defined(PPC_SHA1) || defined(OPENSSL_SHA1)
+	return name ? GIT_ENOTFOUND : GIT_SUCCESS;
+#else
+	return git__blk_SHA1_use_lanes(name);
+#endif
+}
+
+const char *git_hash__many_impl(void)
+{
+#if defined(PPC_SHA1) || defined(OPENSSL_SHA1)
+	return "none";
+#else
+	return git__blk_SHA1_lanes_impl();
+#endif
+}
@@ -23,4 +23,24 @@ void git_hash_final(git_oid *out, git_hash_ctx *c);
 void git_hash_buf(git_oid *out, const void *data, size_t len);
 void git_hash_vec(git_oid *out, git_buf_vec *vec, size_t n);
 
+/*
+ * Hash n independent messages at once: out[i] receives the hash
+ * of bufs[i] for git_hash_many(), and of vec[i * parts] to
+ * vec[i * parts + parts - 1] for git_hash_vec_many().  The
+ * builtin routines hash several messages in parallel in vector
+ * registers, which is much faster for small messages.
+ */
+void git_hash_many(git_oid *out, const git_buf_vec *bufs, size_t n);
+void git_hash_vec_many(git_oid *out, const git_buf_vec *vec, size_t parts, size_t n);
+
+/*
+ * The builtin SHA-1 routines pick the fastest implementation the
+ * CPU supports at startup.  These select one by name instead, or
+ * the fastest again if name is NULL, for tests and benchmarks.
+ */
+int git_hash__set_impl(const char *name);
+const char *git_hash__impl(void);
+int git_hash__set_many_impl(const char *name);
+const char *git_hash__many_impl(void);
+
 #endif /* INCLUDE_hash_h__ */
@@ -26,6 +26,7 @@
 #include "common.h"
 #include "repository.h"
 #include "commit.h"
+#include "hashtable.h"
 
 static const int default_table_size = 32;
 static const double max_load_factor = 0.65;
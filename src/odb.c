@@ -30,13 +30,44 @@
 #include "hash.h"
 #include "odb.h"
 #include "delta-apply.h"
+#include "delta-create.h"
+#include "filelock.h"
 
 #define GIT_PACK_NAME_MAX (5 + 40 + 1)
 
+#define GIT_DELTA_BASE_CACHE_SIZE 256
+#define GIT_DELTA_BASE_CACHE_LIMIT (16 * 1024 * 1024)
+
+#define GIT_PACK_WINDOW_ALIGN (64 * 1024)
+#define GIT_PACK_WINDOW_SIZE \
+	(sizeof(void *) > 4 ? 1024 * 1024 * 1024 : 32 * 1024 * 1024)
+#define GIT_PACK_MAPPED_LIMIT \
+	(sizeof(void *) > 4 ? (size_t)2048 * 1024 * 1024 * 4 : 256 * 1024 * 1024)
+#define GIT_PACK_OPEN_WINDOWS 256
+
+/* longest entry header: type and size, then a REF_DELTA base id */
+#define PACK_ENTRY_HEADER_MAX 32
+
+#define GIT_ALTERNATES_MAX_DEPTH 5
+
+/* about 1% of false positives */
+#define GIT_EXISTS_FILTER_BITS 10
+#define GIT_EXISTS_FILTER_HASHES 7
+
+#define GIT_STREAM_BUFSIZE (16 * 1024)
+
+#define GIT_DELTA_WINDOW 10
+#define GIT_DELTA_DEPTH 50
+
 #define OBJ_LOCATION_NOTFOUND	GIT_ENOTFOUND
 #define OBJ_LOCATION_INPACK		1
 #define OBJ_LOCATION_LOOSE		2
 
+/* how a directory changed since the exists filter was built */
+#define STAMP_SAME		0
+#define STAMP_UNSURE	1  /* in the second the filter was built */
+#define STAMP_CHANGED	2
+
 typedef struct {
 	uint32_t      n;
 	unsigned char *oid;
@@ -54,10 +85,9 @@ struct git_pack {
 		uint32_t *,
 		struct git_pack *,
 		const git_oid *);
-	int (*idx_search_offset)(
-		uint32_t *,
+	off_t (*idx_offset)(
 		struct git_pack *,
-		off_t);
+		uint32_t n);
 	int (*idx_get)(
 		index_entry *,
 		struct git_pack *,
@@ -74,14 +104,19 @@ struct git_pack {
 	uint32_t *im_off_idx;
 	uint32_t *im_off_next;
 
+	/** The .rev file (index positions in pack order), if present. */
+	git_file rev_fd;
+	git_map rev_map;
+	uint32_t *im_rev;
+
 	/** Number of objects in this pack. */
 	uint32_t obj_cnt;
 
 	/** File descriptor for the .pack file. */
 	git_file pack_fd;
 
-	/** Memory map of the pack's contents */
-	git_map pack_map;
+	/** Mapped regions of the pack's contents. */
+	struct pack_window *windows;
 
 	/** The size of the .pack file. */
 	off_t pack_size;
@@ -94,21 +129,164 @@ struct git_pack {
 
 	/** Number of active users of the idx_map data. */
 	unsigned int idxcnt;
+
+	/** Lookups of an object which found it in this pack or not. */
+	size_t hits, misses;
 	unsigned
-		invalid:1 /* the pack is unable to be read by libgit2 */
+		invalid:1, /* the pack is unable to be read by libgit2 */
+		in_midx:1  /* the pack is covered by the multi-pack-index */
 		;
 
+	/** Objects of a pack still being written by a bulk import. */
+	struct pack_import *import;
+
 	/** Name of the pack file(s), without extension ("pack-abc"). */
 	char pack_name[GIT_PACK_NAME_MAX];
 };
 typedef struct git_pack git_pack;
 
+typedef struct {  /* an object of a pack, for writing its index */
+	git_oid oid;
+	off_t offset;
+	uint32_t crc;
+} pack_idx_entry;
+
+typedef struct pack_import {
+	git_lck lock;
+
+	/** Temporary path of the pack file. */
+	char tmp_path[GIT_PATH_MAX];
+
+	/** End of the last object written. */
+	off_t end;
+
+	/** The objects written, in pack order. */
+	pack_idx_entry *entries;
+	size_t n, alloc;
+
+	/** Hash table of entries, storing their index + 1. */
+	uint32_t *slots;
+	size_t n_slots;
+
+	/** Set once committing starts; the pack takes no more objects. */
+	int sealed;
+} pack_import;
+
+typedef struct {  /* objects/pack/multi-pack-index, mapped into memory */
+	git_file fd;
+	git_map map;
+
+	uint32_t n_packs;
+	uint32_t obj_cnt;
+
+	uint32_t *fanout;
+	unsigned char *oid;
+	uint32_t *offsets;
+	uint32_t *offsets64;
+	size_t n_offsets64;
+
+	/** Name of each pack ("pack-abc.idx"), pointing into map. */
+	const char **pack_names;
+	/** Pack of each name, if present in the pack list. */
+	git_pack **packs;
+} git_midx;
+
 typedef struct {
 	size_t n_packs;
 	unsigned int refcnt;
+	git_midx *midx;
+	git_pack *mru;   /* pack of the last object found, under db->lock */
+	time_t mtime;    /* mtime of objects/pack when scanned */
+	time_t scanned;  /* when objects/pack was scanned */
 	git_pack *packs[GIT_FLEX_ARRAY];
 } git_packlist;
 
+typedef struct delta_base_entry {
+	struct delta_base_entry *lru_prev, *lru_next;
+	git_pack *pack;
+	off_t offset;
+	git_rawobj obj;
+} delta_base_entry;
+
+typedef struct {
+	git_lck lock;
+
+	/** Maximum number of inflated bytes held by the cache. */
+	size_t limit;
+
+	/** Number of inflated bytes currently held by the cache. */
+	size_t used;
+
+	/** Least recently used entries come first. */
+	delta_base_entry lru;
+	delta_base_entry entries[GIT_DELTA_BASE_CACHE_SIZE];
+} delta_base_cache;
+
+typedef struct pack_window {
+	struct pack_window *next;  /* next window of the same pack */
+	struct pack_window *lru_prev, *lru_next;
+	git_pack *pack;
+	off_t offset;
+	git_map map;
+	unsigned int inuse;
+} pack_window;
+
+typedef struct {  /* shared by every database of the process */
+	git_lck lock;
+
+	/** Size of newly mapped windows. */
+	size_t window_size;
+
+	/** Maximum number of bytes mapped across all packs. */
+	size_t mapped_limit;
+
+	/** Maximum number of windows mapped across all packs. */
+	unsigned int open_limit;
+
+	size_t mapped;
+	unsigned int open;
+
+	/** Least recently used windows come first. */
+	pack_window lru;
+} pack_window_ctl;
+
+typedef struct {  /* the loose objects of one objects/xx directory */
+	unsigned loaded:1;
+	time_t mtime;     /* mtime of the directory when scanned */
+	time_t scanned;   /* when the directory was scanned */
+	size_t n, alloc;
+	git_oid *oids;    /* sorted */
+} loose_fanout;
+
+typedef struct {
+	git_lck lock;
+	int enabled;
+	loose_fanout fanout[256];
+} loose_cache;
+
+typedef struct {  /* what the exists filter saw of one database */
+	time_t pack_mtime;        /* mtime of objects/pack */
+	time_t loose_mtime[256];  /* mtimes of objects/xx, for alternates */
+} exists_stamp;
+
+typedef struct {  /* Bloom filter of the objects of a database */
+	git_lck lock;
+	int enabled;
+	uint32_t *bits;    /* NULL until built */
+	size_t n_bits;     /* a power of two */
+	size_t count;      /* objects added */
+	size_t capacity;   /* objects it was sized for */
+	time_t built;      /* when the databases were looked at */
+	exists_stamp *stamps;  /* the database, then its alternates */
+	size_t n_stamps;
+} exists_filter;
+
+typedef struct {  /* identity of a directory, whatever its path */
+	dev_t dev;
+	ino_t ino;
+	const char *path;  /* compared only without inode numbers */
+} dir_key;
+
 struct git_odb {
 	git_lck lock;
 
@@ -118,14 +296,31 @@ struct git_odb {
 	/** Known pack files from ${objects_dir}/packs. */
 	git_packlist *packlist;
 
-	/** Alternate databases to search. */
+	/** Alternate databases to search, NULL terminated. */
 	git_odb **alternates;
 	size_t n_alternates;
 
+	/** Next shared alternate database, and its number of users. */
+	git_odb *shared_next;
+	unsigned int shared_refcnt;
+	dir_key shared_key;
+
 	/** loose object zlib compression level. */
 	int object_zlib_level;
 	/** loose object file fsync flag. */
 	int fsync_object_files;
+
+	/** Recently used delta bases, keyed by (pack, offset). */
+	delta_base_cache delta_cache;
+
+	/** Listing of the loose object directories, if enabled. */
+	loose_cache loose;
+
+	/** Filter of the objects in the database, if enabled. */
+	exists_filter filter;
+
+	/** Pack receiving the written objects, during a bulk import. */
+	git_pack *import;
 };
 
 typedef struct {  /* object header data */
@@ -153,7 +348,8 @@ static struct {
 	{ "REF_DELTA", 0 }   /* 7 = GIT_OBJ_REF_DELTA */
 };
 
-typedef union obj_location {
+typedef struct obj_location {
+	git_odb *db;  /* the database, or alternate, holding the object */
 	char loose_path[GIT_PATH_MAX];
 	struct {
 		git_pack *ptr;
@@ -179,6 +375,19 @@ GIT_INLINE(uint64_t) decode64(void *b)
 	return (((uint64_t)ntohl(p[0])) << 32) | ntohl(p[1]);
 }
 
+GIT_INLINE(unsigned char *) encode32(unsigned char *b, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(b, &v, 4);
+	return b + 4;
+}
+
+GIT_INLINE(unsigned char *) encode64(unsigned char *b, uint64_t v)
+{
+	b = encode32(b, (uint32_t)(v >> 32));
+	return encode32(b, (uint32_t)v);
+}
+
 const char *git_obj_type_to_string(git_otype type)
 {
 	if (type < 0 || ((size_t) type) >= ARRAY_SIZE(obj_type_table))
@@ -258,6 +467,49 @@ int git_obj_hash(git_oid *id, git_rawobj *obj)
 	return hash_obj(id, hdr, sizeof(hdr), &hdrlen, obj);
 }
 
+int git_obj_hash_many(git_oid *ids, git_rawobj *objs, size_t n)
+{
+	git_buf_vec *vec;
+	char *hdr;
+	size_t i;
+	int hdrlen, error = GIT_SUCCESS;
+
+	assert(ids && (objs || !n));
+
+	if (!n)
+		return GIT_SUCCESS;
+
+	vec = git__malloc(2 * n * sizeof(*vec));
+	hdr = git__malloc(n * 64);
+	if (!vec || !hdr) {
+		error = GIT_ENOMEM;
+		goto cleanup;
+	}
+
+	for (i = 0; i < n; i++) {
+		git_rawobj *obj = &objs[i];
+
+		if (!git_obj__loose_object_type(obj->type)
+			|| (!obj->data && obj->len != 0)
+			|| (hdrlen = format_object_header(hdr + i * 64, 64, obj)) < 0) {
+			error = GIT_ERROR;
+			goto cleanup;
+		}
+
+		vec[2 * i].data = hdr + i * 64;
+		vec[2 * i].len  = hdrlen;
+		vec[2 * i + 1].data = obj->data;
+		vec[2 * i + 1].len  = obj->len;
+	}
+
+	git_hash_vec_many(ids, vec, 2, n);
+
+cleanup:
+	free(vec);
+	free(hdr);
+	return error;
+}
+
 static size_t object_file_name(char *name, size_t n, char *dir, const git_oid *id)
 {
 	size_t len = strlen(dir);
@@ -610,6 +862,51 @@ static int deflate_buf(z_stream *s, void *in, size_t len, int flush)
 	return status;
 }
 
+/* Deflate 'len' bytes of data on their own, as stored in packs. */
+static int deflate_data(gitfo_buf *buf, const void *data, size_t len, int level)
+{
+	z_stream zs;
+	size_t size;
+
+	init_stream(&zs, NULL, 0);
+	if (deflateInit(&zs, level) < Z_OK)
+		return GIT_EZLIB;
+
+	size = deflateBound(&zs, len);
+	if ((buf->data = git__malloc(size)) == NULL) {
+		deflateEnd(&zs);
+		return GIT_ENOMEM;
+	}
+
+	set_stream_output(&zs, buf->data, size);
+	if (deflate_buf(&zs, (void *)data, len, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&zs);
+		free(buf->data);
+		buf->data = NULL;
+		return GIT_EZLIB;
+	}
+
+	buf->len = zs.total_out;
+	deflateEnd(&zs);
+	return GIT_SUCCESS;
+}
+
+/*
+ * Format the header of a pack entry holding 'size' bytes of
+ * data of the given type, and return its length.
+ */
+static size_t pack_entry_header(unsigned char *hdr, git_otype type, size_t size)
+{
+	size_t len = 0;
+
+	hdr[len] = (unsigned char)((type << 4) | (size & 0xF));
+	for (size >>= 4; size; size >>= 7) {
+		hdr[len++] |= 0x80;
+		hdr[len] = (unsigned char)(size & 0x7F);
+	}
+	return len + 1;
+}
+
 static int deflate_obj(gitfo_buf *buf, char *hdr, int hdrlen, git_rawobj *obj, int level)
 {
 	z_stream zs;
@@ -704,20 +1001,36 @@ static int cmp_offset_idx_info(const void *lhs, const void *rhs)
 	return (a->offset < b->offset) ? -1 : (a->offset > b->offset) ? 1 : 0;
 }
 
-static int make_offset_index(git_pack *p, offset_idx_info *data)
+static int make_offset_index(git_pack *p)
 {
 	off_t min_off = 3 * 4, max_off = p->pack_size - GIT_OID_RAWSZ;
+	offset_idx_info *data;
 	uint32_t *idx, *next;
 	uint32_t j;
 
+	if ((data = git__malloc(sizeof(*data) * (p->obj_cnt+1))) == NULL)
+		return GIT_ERROR;
+
+	for (j = 0; j < p->obj_cnt; j++) {
+		data[j].offset = p->idx_offset(p, j);
+		data[j].n = j;
+	}
+	data[p->obj_cnt].offset = max_off;
+	data[p->obj_cnt].n = p->obj_cnt;
+
 	qsort(data, p->obj_cnt, sizeof(*data), cmp_offset_idx_info);
 
-	if (data[0].offset < min_off || data[p->obj_cnt].offset > max_off)
+	if (data[0].offset < min_off || data[p->obj_cnt].offset > max_off) {
+		free(data);
 		return GIT_ERROR;
+	}
 
-	if ((idx = git__malloc(sizeof(*idx) * (p->obj_cnt+1))) == NULL)
+	if ((idx = git__malloc(sizeof(*idx) * (p->obj_cnt+1))) == NULL) {
+		free(data);
 		return GIT_ERROR;
+	}
 	if ((next = git__malloc(sizeof(*next) * p->obj_cnt)) == NULL) {
+		free(data);
 		free(idx);
 		return GIT_ERROR;
 	}
@@ -732,11 +1045,241 @@ static int make_offset_index(git_pack *p, offset_idx_info *data)
 		next[idx[j]] = idx[j+1];
 	}
 
+	free(data);
 	p->im_off_idx = idx;
 	p->im_off_next = next;
 	return GIT_SUCCESS;
 }
 
+/* index position of the pos'th object in pack (offset) order */
+GIT_INLINE(uint32_t) pack_pos_to_index(git_pack *p, uint32_t pos)
+{
+	if (pos >= p->obj_cnt)
+		return p->obj_cnt;
+	if (p->im_rev)
+		return decode32(p->im_rev + pos);
+	return p->im_off_idx[pos];
+}
+
+/* offset of the object following object n (at offset) in the pack */
+static off_t next_offset(git_pack *p, uint32_t n, off_t offset)
+{
+	uint32_t next = p->obj_cnt;
+
+	if (p->im_off_next)
+		next = p->im_off_next[n];
+	else {
+		uint32_t lo = 0, hi = p->obj_cnt;
+		while (lo < hi) {
+			uint32_t mid = (lo + hi) >> 1;
+			off_t here = p->idx_offset(p, pack_pos_to_index(p, mid));
+			if (offset < here)
+				hi = mid;
+			else if (offset == here) {
+				next = pack_pos_to_index(p, mid + 1);
+				break;
+			} else
+				lo = mid + 1;
+		}
+	}
+
+	if (next < p->obj_cnt)
+		return p->idx_offset(p, next);
+	return p->pack_size - GIT_OID_RAWSZ;
+}
+
+static int pack_openrev(git_pack *p)
+{
+	char pb[GIT_PATH_MAX];
+	unsigned char *data, *idx_data = p->idx_map.data;
+	off_t min_off = 3 * 4, max_off = p->pack_size - GIT_OID_RAWSZ;
+	off_t len;
+	uint32_t j;
+
+	if (git__fmt(pb, sizeof(pb), "%s/pack/%s.rev",
+			p->db->objects_dir,
+			p->pack_name) < 0)
+		return GIT_ERROR;
+
+	if ((p->rev_fd = gitfo_open(pb, O_RDONLY)) < 0)
+		return GIT_ERROR;
+
+	if ((len = gitfo_size(p->rev_fd)) < 0
+		|| len != 12 + 4 * (off_t)p->obj_cnt + 2 * GIT_OID_RAWSZ
+		|| !git__is_sizet(len)
+		|| gitfo_map_ro(&p->rev_map, p->rev_fd, 0, (size_t)len)) {
+		gitfo_close(p->rev_fd);
+		return GIT_ERROR;
+	}
+	data = p->rev_map.data;
+
+	/* the .rev must describe this very pack */
+	if (decode32(data) != RIDX_SIG
+		|| decode32(data + 4) != RIDX_VERSION
+		|| decode32(data + 8) != RIDX_HASH_SHA1
+		|| memcmp(data + len - 2 * GIT_OID_RAWSZ,
+			idx_data + p->idx_map.len - 2 * GIT_OID_RAWSZ,
+			GIT_OID_RAWSZ))
+		goto invalid;
+
+	/*
+	 * Strictly increasing offsets imply that every object is
+	 * listed exactly once, which the binary searches rely on.
+	 */
+	p->im_rev = (uint32_t *)(data + 12);
+	for (j = 0; j < p->obj_cnt; j++) {
+		uint32_t n = decode32(p->im_rev + j);
+		off_t here;
+
+		if (n >= p->obj_cnt)
+			goto invalid;
+		here = p->idx_offset(p, n);
+		if (here < min_off || here >= max_off)
+			goto invalid;
+		min_off = here + 1;
+	}
+
+	return GIT_SUCCESS;
+
+invalid:
+	p->im_rev = NULL;
+	gitfo_free_map(&p->rev_map);
+	gitfo_close(p->rev_fd);
+	return GIT_ERROR;
+}
+
+static int rev_write(git_pack *p)
+{
+	char pb[GIT_PATH_MAX];
+	git_filelock lock;
+	unsigned char *buf, *b, *idx_data = p->idx_map.data;
+	size_t len = 12 + 4 * (size_t)p->obj_cnt + 2 * GIT_OID_RAWSZ;
+	git_oid checksum;
+	uint32_t j;
+	int error;
+
+	if ((buf = git__malloc(len)) == NULL)
+		return GIT_ENOMEM;
+
+	b = encode32(buf, RIDX_SIG);
+	b = encode32(b, RIDX_VERSION);
+	b = encode32(b, RIDX_HASH_SHA1);
+	for (j = 0; j < p->obj_cnt; j++)
+		b = encode32(b, pack_pos_to_index(p, j));
+
+	memcpy(b, idx_data + p->idx_map.len - 2 * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+	b += GIT_OID_RAWSZ;
+
+	git_hash_buf(&checksum, buf, b - buf);
+	memcpy(b, checksum.id, GIT_OID_RAWSZ);
+
+	if (git__fmt(pb, sizeof(pb), "%s/pack/%s.rev",
+			p->db->objects_dir,
+			p->pack_name) < 0) {
+		free(buf);
+		return GIT_ERROR;
+	}
+
+	if ((error = git_filelock_init(&lock, pb)) < 0
+		|| (error = git_filelock_lock(&lock, 0)) < 0) {
+		free(buf);
+		return error;
+	}
+
+	if ((error = git_filelock_write(&lock, buf, len)) < 0) {
+		git_filelock_unlock(&lock);
+		free(buf);
+		return error;
+	}
+
+	free(buf);
+	return git_filelock_commit(&lock);
+}
+
+static int cmp_pack_idx_entry(const void *lhs, const void *rhs)
+{
+	const pack_idx_entry *a = lhs;
+	const pack_idx_entry *b = rhs;
+	return git_oid_cmp(&a->oid, &b->oid);
+}
+
+/*
+ * Write a v2 index for the pack whose checksum is pack_id, to
+ * objects/pack/<pack_name>.idx.  The entries are sorted first.
+ */
+static int idx_write(git_odb *db, const char *pack_name,
+		pack_idx_entry *entries, size_t n, const git_oid *pack_id)
+{
+	char pb[GIT_PATH_MAX];
+	git_filelock lock;
+	size_t j, n_large = 0, len;
+	uint32_t fanout[256];
+	unsigned char *buf, *b;
+	git_oid checksum;
+	int error;
+
+	qsort(entries, n, sizeof(*entries), cmp_pack_idx_entry);
+
+	memset(fanout, 0x0, sizeof(fanout));
+	for (j = 0; j < n; j++) {
+		fanout[entries[j].oid.id[0]]++;
+		if (entries[j].offset > 0x7fffffff)
+			n_large++;
+	}
+	for (j = 1; j < 256; j++)
+		fanout[j] += fanout[j - 1];
+
+	len = 8 + 256 * 4 + n * (GIT_OID_RAWSZ + 4 + 4) + n_large * 8 + 2 * GIT_OID_RAWSZ;
+	if ((buf = git__malloc(len)) == NULL)
+		return GIT_ENOMEM;
+
+	b = encode32(buf, PACK_TOC);
+	b = encode32(b, 2);
+	for (j = 0; j < 256; j++)
+		b = encode32(b, fanout[j]);
+
+	for (j = 0; j < n; j++) {
+		memcpy(b, entries[j].oid.id, GIT_OID_RAWSZ);
+		b += GIT_OID_RAWSZ;
+	}
+	for (j = 0; j < n; j++)
+		b = encode32(b, entries[j].crc);
+	for (j = 0, n_large = 0; j < n; j++) {
+		if (entries[j].offset > 0x7fffffff)
+			b = encode32(b, 0x80000000 | (uint32_t)n_large++);
+		else
+			b = encode32(b, (uint32_t)entries[j].offset);
+	}
+	for (j = 0; j < n; j++)
+		if (entries[j].offset > 0x7fffffff)
+			b = encode64(b, (uint64_t)entries[j].offset);
+
+	memcpy(b, pack_id->id, GIT_OID_RAWSZ);
+	b += GIT_OID_RAWSZ;
+	git_hash_buf(&checksum, buf, b - buf);
+	memcpy(b, checksum.id, GIT_OID_RAWSZ);
+
+	if (git__fmt(pb, sizeof(pb), "%s/pack/%s.idx", db->objects_dir, pack_name) < 0) {
+		free(buf);
+		return GIT_ERROR;
+	}
+
+	if ((error = git_filelock_init(&lock, pb)) < 0
+		|| (error = git_filelock_lock(&lock, 0)) < 0) {
+		free(buf);
+		return error;
+	}
+
+	if ((error = git_filelock_write(&lock, buf, len)) < 0) {
+		git_filelock_unlock(&lock);
+		free(buf);
+		return error;
+	}
+
+	free(buf);
+	return git_filelock_commit(&lock);
+}
+
 static int idxv1_search(uint32_t *out, git_pack *p, const git_oid *id)
 {
 	unsigned char *data = p->im_oid;
@@ -758,45 +1301,18 @@ static int idxv1_search(uint32_t *out, git_pack *p, const git_oid *id)
 	return GIT_ENOTFOUND;
 }
 
-static int idxv1_search_offset(uint32_t *out, git_pack *p, off_t offset)
+static off_t idxv1_offset(git_pack *p, uint32_t n)
 {
-	if (offset > 0 && offset < (p->pack_size - GIT_OID_RAWSZ)) {
-		uint32_t lo = 0, hi = p->obj_cnt+1;
-		unsigned char *data = p->im_oid;
-		uint32_t *idx = p->im_off_idx;
-		do {
-			uint32_t mid = (lo + hi) >> 1;
-			uint32_t n = idx[mid];
-			uint32_t pos = n * (GIT_OID_RAWSZ + 4);
-			off_t here = decode32(data + pos);
-			if (offset < here)
-				hi = mid;
-			else if (offset == here) {
-				*out = n;
-				return GIT_SUCCESS;
-			} else
-				lo = mid + 1;
-		} while (lo < hi);
-	}
-	return GIT_ENOTFOUND;
+	return decode32(p->im_oid + n * (GIT_OID_RAWSZ + 4));
 }
 
 static int idxv1_get(index_entry *e, git_pack *p, uint32_t n)
 {
-	unsigned char *data = p->im_oid;
-	uint32_t *next = p->im_off_next;
-
 	if (n < p->obj_cnt) {
-		uint32_t pos = n * (GIT_OID_RAWSZ + 4);
-		off_t next_off = p->pack_size - GIT_OID_RAWSZ;
 		e->n = n;
-		e->oid = data + pos + 4;
-		e->offset = decode32(data + pos);
-		if (next[n] < p->obj_cnt) {
-			pos = next[n] * (GIT_OID_RAWSZ + 4);
-			next_off = decode32(data + pos);
-		}
-		e->size = next_off - e->offset;
+		e->oid = p->im_oid + n * (GIT_OID_RAWSZ + 4) + 4;
+		e->offset = idxv1_offset(p, n);
+		e->size = next_offset(p, n, e->offset) - e->offset;
 		return GIT_SUCCESS;
 	}
 	return GIT_ENOTFOUND;
@@ -806,7 +1322,6 @@ static int pack_openidx_v1(git_pack *p)
 {
 	uint32_t *src_fanout = p->idx_map.data;
 	uint32_t *im_fanout;
-	offset_idx_info *info;
 	size_t expsz;
 	uint32_t j;
 
@@ -831,30 +1346,15 @@ static int pack_openidx_v1(git_pack *p)
 	}
 
 	p->idx_search = idxv1_search;
-	p->idx_search_offset = idxv1_search_offset;
+	p->idx_offset = idxv1_offset;
 	p->idx_get = idxv1_get;
 	p->im_fanout = im_fanout;
 	p->im_oid = (unsigned char *)(src_fanout + 256);
 
-	if ((info = git__malloc(sizeof(*info) * (p->obj_cnt+1))) == NULL) {
-		free(im_fanout);
-		return GIT_ERROR;
-	}
-
-	for (j = 0; j < p->obj_cnt; j++) {
-		uint32_t pos = j * (GIT_OID_RAWSZ + 4);
-		info[j].offset = decode32(p->im_oid + pos);
-		info[j].n = j;
-	}
-	info[p->obj_cnt].offset = p->pack_size - GIT_OID_RAWSZ;
-	info[p->obj_cnt].n = p->obj_cnt;
-
-	if (make_offset_index(p, info)) {
+	if (pack_openrev(p) && make_offset_index(p)) {
 		free(im_fanout);
-		free(info);
 		return GIT_ERROR;
 	}
-	free(info);
 
 	return GIT_SUCCESS;
 }
@@ -880,58 +1380,23 @@ static int idxv2_search(uint32_t *out, git_pack *p, const git_oid *id)
 	return GIT_ENOTFOUND;
 }
 
-static int idxv2_search_offset(uint32_t *out, git_pack *p, off_t offset)
+static off_t idxv2_offset(git_pack *p, uint32_t n)
 {
-	if (offset > 0 && offset < (p->pack_size - GIT_OID_RAWSZ)) {
-		uint32_t lo = 0, hi = p->obj_cnt+1;
-		uint32_t *idx = p->im_off_idx;
-		do {
-			uint32_t mid = (lo + hi) >> 1;
-			uint32_t n = idx[mid];
-			uint32_t o32 = decode32(p->im_offset32 + n);
-			off_t here = o32;
-
-			if (o32 & 0x80000000) {
-				uint32_t o64_idx = (o32 & ~0x80000000);
-				here = decode64(p->im_offset64 + 2*o64_idx);
-			}
-
-			if (offset < here)
-				hi = mid;
-			else if (offset == here) {
-				*out = n;
-				return GIT_SUCCESS;
-			} else
-				lo = mid + 1;
-		} while (lo < hi);
+	uint32_t o32 = decode32(p->im_offset32 + n);
+	if (o32 & 0x80000000) {
+		uint32_t o64_idx = (o32 & ~0x80000000);
+		return decode64(p->im_offset64 + 2*o64_idx);
 	}
-	return GIT_ENOTFOUND;
+	return o32;
 }
 
 static int idxv2_get(index_entry *e, git_pack *p, uint32_t n)
 {
-	unsigned char *data = p->im_oid;
-	uint32_t *next = p->im_off_next;
-
 	if (n < p->obj_cnt) {
-		uint32_t o32 = decode32(p->im_offset32 + n);
-		off_t next_off = p->pack_size - GIT_OID_RAWSZ;
 		e->n = n;
-		e->oid = data + n * GIT_OID_RAWSZ;
-		e->offset = o32;
-		if (o32 & 0x80000000) {
-			uint32_t o64_idx = (o32 & ~0x80000000);
-			e->offset = decode64(p->im_offset64 + 2*o64_idx);
-		}
-		if (next[n] < p->obj_cnt) {
-			o32 = decode32(p->im_offset32 + next[n]);
-			next_off = o32;
-			if (o32 & 0x80000000) {
-				uint32_t o64_idx = (o32 & ~0x80000000);
-				next_off = decode64(p->im_offset64 + 2*o64_idx);
-			}
-		}
-		e->size = next_off - e->offset;
+		e->oid = p->im_oid + n * GIT_OID_RAWSZ;
+		e->offset = idxv2_offset(p, n);
+		e->size = next_offset(p, n, e->offset) - e->offset;
 		return GIT_SUCCESS;
 	}
 	return GIT_ENOTFOUND;
@@ -942,7 +1407,6 @@ static int pack_openidx_v2(git_pack *p)
 	unsigned char *data = p->idx_map.data;
 	uint32_t *src_fanout = (uint32_t *)(data + 8);
 	uint32_t *im_fanout;
-	offset_idx_info *info;
 	size_t sz, o64_sz, o64_len;
 	uint32_t j;
 
@@ -967,7 +1431,7 @@ static int pack_openidx_v2(git_pack *p)
 	}
 
 	p->idx_search = idxv2_search;
-	p->idx_search_offset = idxv2_search_offset;
+	p->idx_offset = idxv2_offset;
 	p->idx_get = idxv2_get;
 	p->im_fanout = im_fanout;
 	p->im_oid = (unsigned char *)(src_fanout + 256);
@@ -975,38 +1439,21 @@ static int pack_openidx_v2(git_pack *p)
 	p->im_offset32 = p->im_crc + p->obj_cnt;
 	p->im_offset64 = p->im_offset32 + p->obj_cnt;
 
-	if ((info = git__malloc(sizeof(*info) * (p->obj_cnt+1))) == NULL) {
-		free(im_fanout);
-		return GIT_ERROR;
-	}
-
 	/* check 64-bit offset table index values are within bounds */
 	o64_sz = p->idx_map.len - sz;
 	o64_len = o64_sz / 8;
 	for (j = 0; j < p->obj_cnt; j++) {
 		uint32_t o32 = decode32(p->im_offset32 + j);
-		off_t offset = o32;
-		if (o32 & 0x80000000) {
-			uint32_t o64_idx = (o32 & ~0x80000000);
-			if (o64_idx >= o64_len) {
-				free(im_fanout);
-				free(info);
-				return GIT_ERROR;
-			}
-			offset = decode64(p->im_offset64 + 2*o64_idx);
+		if ((o32 & 0x80000000) && (o32 & ~0x80000000) >= o64_len) {
+			free(im_fanout);
+			return GIT_ERROR;
 		}
-		info[j].offset = offset;
-		info[j].n = j;
 	}
-	info[p->obj_cnt].offset = p->pack_size - GIT_OID_RAWSZ;
-	info[p->obj_cnt].n = p->obj_cnt;
 
-	if (make_offset_index(p, info)) {
+	if (pack_openrev(p) && make_offset_index(p)) {
 		free(im_fanout);
-		free(info);
 		return GIT_ERROR;
 	}
-	free(info);
 
 	return GIT_SUCCESS;
 }
@@ -1018,359 +1465,477 @@ static int pack_openidx_v2(git_pack *p)
 
 /***********************************************************
  *
- * PACKFILE FUNCTIONS
+ * DELTA BASE CACHE
  *
- * Locate, open and access the contents of a packfile
+ * Keep the most recently used delta bases in memory, so
+ * that reading many objects deltified against the same
+ * base does not inflate the whole chain each time.
  * 
  ***********************************************************/
 
-static int pack_stat(git_pack *p)
+static void delta_cache_init(delta_base_cache *c)
 {
-	char pb[GIT_PATH_MAX];
-	struct stat sb;
+	gitlck_init(&c->lock);
+	c->limit = GIT_DELTA_BASE_CACHE_LIMIT;
+	c->used = 0;
+	c->lru.lru_prev = c->lru.lru_next = &c->lru;
+}
 
-	if (git__fmt(pb, sizeof(pb), "%s/pack/%s.pack",
-			p->db->objects_dir,
-			p->pack_name) < 0)
-		return GIT_ERROR;
+GIT_INLINE(delta_base_entry *) delta_cache_slot(delta_base_cache *c, git_pack *p, off_t offset)
+{
+	size_t hash = (size_t)p + (size_t)offset;
+	hash += (hash >> 8) + (hash >> 16);
+	return &c->entries[hash % GIT_DELTA_BASE_CACHE_SIZE];
+}
 
-	if (gitfo_stat(pb, &sb) || !S_ISREG(sb.st_mode))
-		return GIT_ERROR;
+static void delta_cache_release(delta_base_cache *c, delta_base_entry *ent)
+{
+	ent->lru_prev->lru_next = ent->lru_next;
+	ent->lru_next->lru_prev = ent->lru_prev;
+	ent->lru_prev = ent->lru_next = NULL;
 
-	if (sb.st_size < (3 * 4 + GIT_OID_RAWSZ))
-		return GIT_ERROR;
+	c->used -= ent->obj.len;
+	git_obj_close(&ent->obj);
+	ent->pack = NULL;
+}
 
-	p->pack_size = sb.st_size;
-	p->pack_mtime = sb.st_mtime;
+/*
+ * Look up the base stored at (p, offset).  On a hit the
+ * cached data is handed over to the caller, who is expected
+ * to give it back with delta_cache_put() once done.
+ */
+static int delta_cache_take(git_rawobj *out, git_pack *p, off_t offset)
+{
+	delta_base_cache *c = &p->db->delta_cache;
+	delta_base_entry *ent;
+	int error = GIT_ENOTFOUND;
+
+	gitlck_lock(&c->lock);
+	ent = delta_cache_slot(c, p, offset);
+	if (ent->pack == p && ent->offset == offset && ent->obj.data) {
+		*out = ent->obj;
+		ent->obj.data = NULL;
+		delta_cache_release(c, ent);
+		error = GIT_SUCCESS;
+	}
+	gitlck_unlock(&c->lock);
 
-	return GIT_SUCCESS;
+	return error;
 }
 
-static int pack_openidx(git_pack *p)
+/*
+ * Store the base at (p, offset), evicting the least recently
+ * used entries to stay within the memory limit.  On success the
+ * cache takes ownership of obj->data and obj->data is set to
+ * NULL; otherwise the data is left with the caller.
+ */
+static int delta_cache_put(git_pack *p, off_t offset, git_rawobj *obj)
 {
-	gitlck_lock(&p->lock);
+	delta_base_cache *c = &p->db->delta_cache;
+	delta_base_entry *ent;
 
-	if (p->invalid) {
-		gitlck_unlock(&p->lock);
+	gitlck_lock(&c->lock);
+
+	if (obj->len >= c->limit) {
+		gitlck_unlock(&c->lock);
 		return GIT_ERROR;
 	}
 
-	if (++p->idxcnt == 1 && !p->idx_search) {
-		int status, version;
-		uint32_t *data;
-
-		if (pack_stat(p) || pack_openidx_map(p)) {
-			p->invalid = 1;
-			p->idxcnt--;
-			gitlck_unlock(&p->lock);
-			return GIT_ERROR;
-		}
-		data = p->idx_map.data;
-		status = GIT_SUCCESS;
-		version = 1;
+	ent = delta_cache_slot(c, p, offset);
+	if (ent->obj.data)
+		delta_cache_release(c, ent);
 
-		if (decode32(&data[0]) == PACK_TOC)
-			version = decode32(&data[1]);
+	while (c->used + obj->len > c->limit && c->lru.lru_next != &c->lru)
+		delta_cache_release(c, c->lru.lru_next);
 
-		switch (version) {
-		case 1:
-			status = pack_openidx_v1(p);
-			break;
-		case 2:
-			status = pack_openidx_v2(p);
-			break;
-		default:
-			status = GIT_ERROR;
-		}
+	ent->pack = p;
+	ent->offset = offset;
+	ent->obj = *obj;
+	obj->data = NULL;
+	c->used += ent->obj.len;
 
-		if (status != GIT_SUCCESS) {
-			gitfo_free_map(&p->idx_map);
-			p->invalid = 1;
-			p->idxcnt--;
-			gitlck_unlock(&p->lock);
-			return status;
-		}
-	}
+	ent->lru_next = &c->lru;
+	ent->lru_prev = c->lru.lru_prev;
+	c->lru.lru_prev->lru_next = ent;
+	c->lru.lru_prev = ent;
 
-	gitlck_unlock(&p->lock);
+	gitlck_unlock(&c->lock);
 	return GIT_SUCCESS;
 }
 
-static void pack_decidx(git_pack *p)
+/* Drop every cached base belonging to p, or all of them if p is NULL. */
+static void delta_cache_purge(delta_base_cache *c, git_pack *p)
 {
-	gitlck_lock(&p->lock);
-	p->idxcnt--;
-	gitlck_unlock(&p->lock);
+	delta_base_entry *ent, *next;
+
+	gitlck_lock(&c->lock);
+	for (ent = c->lru.lru_next; ent != &c->lru; ent = next) {
+		next = ent->lru_next;
+		if (!p || ent->pack == p)
+			delta_cache_release(c, ent);
+	}
+	gitlck_unlock(&c->lock);
 }
 
-static int read_pack_hdr(pack_hdr *out, git_file fd)
+static void delta_cache_set_limit(delta_base_cache *c, size_t limit)
 {
-	pack_hdr hdr;
+	gitlck_lock(&c->lock);
+	c->limit = limit;
+	while (c->used > c->limit && c->lru.lru_next != &c->lru)
+		delta_cache_release(c, c->lru.lru_next);
+	gitlck_unlock(&c->lock);
+}
 
-	if (gitfo_read(fd, &hdr, sizeof(hdr)))
-		return GIT_ERROR;
 
-	out->sig = decode32(&hdr.sig);
-	out->ver = decode32(&hdr.ver);
-	out->cnt = decode32(&hdr.cnt);
 
-	return GIT_SUCCESS;
-}
 
-static int check_pack_hdr(git_pack *p)
-{
-	pack_hdr hdr;
 
-	if (read_pack_hdr(&hdr, p->pack_fd))
-		return GIT_ERROR;
 
-	if (hdr.sig != PACK_SIG
-		|| (hdr.ver != 2 && hdr.ver != 3)
-		|| hdr.cnt != p->obj_cnt)
-		return GIT_ERROR;
+/***********************************************************
+ *
+ * MULTI-PACK INDEX FUNCTIONS
+ *
+ * Read the multi-pack-index, which maps the objects of many
+ * packs to their pack and offset in one lookup table
+ * 
+ ***********************************************************/
 
-	return GIT_SUCCESS;
+static void midx_free(git_midx *m)
+{
+	if (!m)
+		return;
+
+	gitfo_free_map(&m->map);
+	gitfo_close(m->fd);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
 }
 
-static int check_pack_sha1(git_pack *p)
+static int midx_parse(git_midx *m)
 {
-	unsigned char *data = p->idx_map.data;
-	off_t pack_sha1_off = p->pack_size - GIT_OID_RAWSZ;
-	size_t idx_pack_sha1_off = p->idx_map.len - 2 * GIT_OID_RAWSZ;
-	git_oid pack_id, idx_pack_id;
+	unsigned char *data = m->map.data, *chunk, *end;
+	unsigned char *pnam = NULL, *pnam_end = NULL;
+	size_t oidl_len = 0, ooff_len = 0;
+	uint32_t n_chunks, j;
 
-	if (gitfo_lseek(p->pack_fd, pack_sha1_off, SEEK_SET) == -1)
+	if (m->map.len < 12 + 12 + GIT_OID_RAWSZ)
 		return GIT_ERROR;
 
-	if (gitfo_read(p->pack_fd, pack_id.id, sizeof(pack_id.id)))
+	if (decode32(data) != MIDX_SIG
+		|| data[4] != MIDX_VERSION
+		|| data[5] != MIDX_OID_VERSION
+		|| data[7] != 0)  /* incremental chains are not supported */
 		return GIT_ERROR;
 
-	git_oid_mkraw(&idx_pack_id, data + idx_pack_sha1_off);
+	n_chunks = data[6];
+	m->n_packs = decode32(data + 8);
+	end = data + m->map.len - GIT_OID_RAWSZ;
 
-	if (git_oid_cmp(&pack_id, &idx_pack_id))
+	if ((size_t)(end - data) < 12 + (n_chunks + 1) * 12)
 		return GIT_ERROR;
 
-	return GIT_SUCCESS;
-}
+	m->fanout = NULL;
+	m->oid = NULL;
+	m->offsets = NULL;
+	m->offsets64 = NULL;
+	m->n_offsets64 = 0;
 
-static int open_pack(git_pack *p)
-{
-	char pb[GIT_PATH_MAX];
-	struct stat sb;
+	for (j = 0, chunk = data + 12; j < n_chunks; j++, chunk += 12) {
+		uint64_t off = decode64(chunk + 4);
+		uint64_t next = decode64(chunk + 16);
+		unsigned char *start;
+		size_t len;
 
-	if (p->pack_fd != -1)
-		return GIT_SUCCESS;
+		if (off > next || next > (uint64_t)(end - data))
+			return GIT_ERROR;
+		start = data + off;
+		len = (size_t)(next - off);
 
-	if (git__fmt(pb, sizeof(pb), "%s/pack/%s.pack",
-			p->db->objects_dir,
-			p->pack_name) < 0)
-		return GIT_ERROR;
+		switch (decode32(chunk)) {
+		case MIDX_CHUNK_PNAM:
+			pnam = start;
+			pnam_end = start + len;
+			break;
+		case MIDX_CHUNK_OIDF:
+			if (len != 256 * 4)
+				return GIT_ERROR;
+			m->fanout = (uint32_t *)start;
+			break;
+		case MIDX_CHUNK_OIDL:
+			m->oid = start;
+			oidl_len = len;
+			break;
+		case MIDX_CHUNK_OOFF:
+			m->offsets = (uint32_t *)start;
+			ooff_len = len;
+			break;
+		case MIDX_CHUNK_LOFF:
+			m->offsets64 = (uint32_t *)start;
+			m->n_offsets64 = len / 8;
+			break;
+		default:
+			/* unknown chunks are optional by definition */
+			break;
+		}
+	}
 
-	if (pack_openidx(p))
+	if (!pnam || !m->fanout || !m->oid || !m->offsets)
 		return GIT_ERROR;
 
-	if ((p->pack_fd = gitfo_open(pb, O_RDONLY)) < 0)
-		goto error_cleanup;
+	for (j = 1; j < 256; j++)
+		if (decode32(&m->fanout[j]) < decode32(&m->fanout[j - 1]))
+			return GIT_ERROR;
+	m->obj_cnt = decode32(&m->fanout[255]);
 
-	if (gitfo_fstat(p->pack_fd, &sb)
-		|| !S_ISREG(sb.st_mode) || p->pack_size != sb.st_size
-		|| check_pack_hdr(p) || check_pack_sha1(p))
-		goto error_cleanup;
+	if (oidl_len != (size_t)m->obj_cnt * GIT_OID_RAWSZ
+		|| ooff_len != (size_t)m->obj_cnt * 8)
+		return GIT_ERROR;
 
-	if (!git__is_sizet(p->pack_size) ||
-		gitfo_map_ro(&p->pack_map, p->pack_fd, 0, (size_t)p->pack_size) < 0)
-		goto error_cleanup;
+	m->pack_names = git__calloc(m->n_packs + 1, sizeof(*m->pack_names));
+	m->packs = git__calloc(m->n_packs + 1, sizeof(*m->packs));
+	if (!m->pack_names || !m->packs)
+		return GIT_ENOMEM;
 
-	pack_decidx(p);
-	return GIT_SUCCESS;
+	for (j = 0; j < m->n_packs; j++) {
+		unsigned char *name_end = memchr(pnam, '\0', pnam_end - pnam);
+		if (!name_end)
+			return GIT_ERROR;
+		m->pack_names[j] = (const char *)pnam;
+		pnam = name_end + 1;
+	}
 
-error_cleanup:
-	gitfo_close(p->pack_fd);
-	p->pack_fd = -1;
-	pack_decidx(p);
-	return GIT_ERROR;
+	return GIT_SUCCESS;
 }
 
-static void pack_dec(git_pack *p)
+static git_midx *midx_open(git_odb *db)
 {
-	int need_free;
+	char pb[GIT_PATH_MAX];
+	git_midx *m;
+	off_t len;
 
-	gitlck_lock(&p->lock);
-	need_free = !--p->refcnt;
-	gitlck_unlock(&p->lock);
+	if (git__fmt(pb, sizeof(pb), "%s/pack/multi-pack-index", db->objects_dir) < 0)
+		return NULL;
 
-	if (need_free) {
-		if (p->idx_search) {
-			gitfo_free_map(&p->idx_map);
-			gitfo_close(p->idx_fd);
-			free(p->im_fanout);
-			free(p->im_off_idx);
-			free(p->im_off_next);
-			if (p->pack_fd != -1) {
-				gitfo_close(p->pack_fd);
-				gitfo_free_map(&p->pack_map);
-			}
-		}
+	if (gitfo_exists(pb) < 0)
+		return NULL;
 
-		gitlck_free(&p->lock);
-		free(p);
+	if ((m = git__calloc(1, sizeof(*m))) == NULL)
+		return NULL;
+
+	if ((m->fd = gitfo_open(pb, O_RDONLY)) < 0) {
+		free(m);
+		return NULL;
+	}
+
+	if ((len = gitfo_size(m->fd)) < 0
+		|| !git__is_sizet(len)
+		|| gitfo_map_ro(&m->map, m->fd, 0, (size_t)len)) {
+		gitfo_close(m->fd);
+		free(m);
+		return NULL;
+	}
+
+	if (midx_parse(m) < 0) {
+		midx_free(m);
+		return NULL;
 	}
+
+	return m;
 }
 
-static void packlist_dec(git_odb *db, git_packlist *pl)
+/* Find the pack holding id, according to the multi-pack-index. */
+static int midx_search(git_pack **p, git_midx *m, const git_oid *id)
 {
-	int need_free;
+	uint32_t lo = id->id[0] ? decode32(&m->fanout[id->id[0] - 1]) : 0;
+	uint32_t hi = decode32(&m->fanout[id->id[0]]);
 
-	assert(db && pl);
-
-	gitlck_lock(&db->lock);
-	need_free = !--pl->refcnt;
-	gitlck_unlock(&db->lock);
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) >> 1;
+		int cmp = memcmp(id->id, m->oid + mid * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+		if (cmp < 0)
+			hi = mid;
+		else if (!cmp) {
+			uint32_t pack_id = decode32(&m->offsets[2 * mid]);
 
-	if (need_free) {
-		size_t j;
-		for (j = 0; j < pl->n_packs; j++)
-			pack_dec(pl->packs[j]);
-		free(pl);
+			if (pack_id >= m->n_packs || !m->packs[pack_id])
+				return GIT_ENOTFOUND;
+			*p = m->packs[pack_id];
+			return GIT_SUCCESS;
+		} else
+			lo = mid + 1;
 	}
+	return GIT_ENOTFOUND;
 }
 
-static git_pack *alloc_pack(const char *pack_name)
+/* Match the packs named by the multi-pack-index with the pack list. */
+static void midx_attach(git_midx *m, git_packlist *pl)
 {
-	git_pack *p = git__calloc(1, sizeof(*p));
-	if (!p)
-		return NULL;
+	uint32_t j;
+	size_t k;
 
-	gitlck_init(&p->lock);
-	strcpy(p->pack_name, pack_name);
-	p->refcnt = 1;
-	p->pack_fd = -1;
-	return p;
+	for (j = 0; j < m->n_packs; j++) {
+		const char *name = m->pack_names[j];
+		size_t len = strlen(name);
+
+		if (len < 4 || strcmp(name + len - 4, ".idx"))
+			continue;
+
+		for (k = 0; k < pl->n_packs; k++) {
+			git_pack *p = pl->packs[k];
+			if (strlen(p->pack_name) == len - 4
+				&& !memcmp(p->pack_name, name, len - 4)) {
+				m->packs[j] = p;
+				p->in_midx = 1;
+				break;
+			}
+		}
+	}
 }
 
-struct scanned_pack {
-	struct scanned_pack *next;
-	git_pack *pack;
-};
 
-static int scan_one_pack(void *state, char *name)
-{
-	struct scanned_pack **ret = state, *r;
-	char *s = strrchr(name, '/'), *d;
 
-	if (git__prefixcmp(s + 1, "pack-")
-	 || git__suffixcmp(s, ".pack")
-	 || strlen(s + 1) != GIT_PACK_NAME_MAX + 4)
-		return 0;
 
-	d = strrchr(s + 1, '.');
-	strcpy(d + 1, "idx");    /* "pack-abc.pack" -> "pack-abc.idx" */
-	if (gitfo_exists(name))
-		return 0;
 
-	if ((r = git__malloc(sizeof(*r))) == NULL)
-		return GIT_ERROR;
 
-	*d = '\0';               /* "pack-abc.pack" -_> "pack-abc" */
-	if ((r->pack = alloc_pack(s + 1)) == NULL) {
-		free(r);
-		return GIT_ERROR;
-	}
+/***********************************************************
+ *
+ * MULTI-PACK INDEX WRITING
+ *
+ * Write a multi-pack-index covering every pack of the ODB
+ * 
+ ***********************************************************/
 
-	r->next = *ret;
-	*ret = r;
-	return 0;
+typedef struct {
+	const unsigned char *oid;
+	uint32_t pack_id;
+	off_t offset;
+} midx_entry;
+
+static int cmp_midx_entry(const void *lhs, const void *rhs)
+{
+	const midx_entry *a = lhs;
+	const midx_entry *b = rhs;
+	int cmp = memcmp(a->oid, b->oid, GIT_OID_RAWSZ);
+	if (cmp)
+		return cmp;
+	return (a->pack_id < b->pack_id) ? -1 : (a->pack_id > b->pack_id) ? 1 : 0;
 }
 
-static git_packlist *scan_packs(git_odb *db)
+static int cmp_pack_name(const void *lhs, const void *rhs)
 {
-	char pb[GIT_PATH_MAX];
-	struct scanned_pack *state = NULL, *c;
-	size_t cnt;
-	git_packlist *new_list;
+	const git_pack *a = *(const git_pack **)lhs;
+	const git_pack *b = *(const git_pack **)rhs;
+	return strcmp(a->pack_name, b->pack_name);
+}
 
-	if (git__fmt(pb, sizeof(pb), "%s/pack", db->objects_dir) < 0)
-		return NULL;
-	gitfo_dirent(pb, sizeof(pb), scan_one_pack, &state);
+static int midx_write(git_odb *db, git_pack **packs, size_t n_packs,
+		midx_entry *entries, size_t n_entries)
+{
+	char pb[GIT_PATH_MAX];
+	git_filelock lock;
+	size_t j, pnam_len = 0, n_large = 0, chunks, len;
+	uint32_t fanout[256];
+	unsigned char *buf, *b;
+	uint64_t off;
+	git_oid checksum;
+	int error;
 
-	/* TODO - merge old entries into the new array */
-	for (cnt = 0, c = state; c; c = c->next)
-		cnt++;
-	new_list = git__malloc(sizeof(*new_list)
-		+ (sizeof(new_list->packs[0]) * cnt));
-	if (!new_list)
-		goto fail;
+	for (j = 0; j < n_packs; j++)
+		pnam_len += strlen(packs[j]->pack_name) + 4 + 1;
+	pnam_len = (pnam_len + 3) & ~3;
 
-	for (cnt = 0, c = state; c; ) {
-		struct scanned_pack *n = c->next;
-		c->pack->db = db;
-		new_list->packs[cnt++] = c->pack;
-		free(c);
-		c = n;
+	memset(fanout, 0x0, sizeof(fanout));
+	for (j = 0; j < n_entries; j++) {
+		fanout[entries[j].oid[0]]++;
+		if (entries[j].offset > 0x7fffffff)
+			n_large++;
 	}
-	new_list->n_packs = cnt;
-	new_list->refcnt = 2;
-	db->packlist = new_list;
-	return new_list;
+	for (j = 1; j < 256; j++)
+		fanout[j] += fanout[j - 1];
 
-fail:
-	while (state) {
-		struct scanned_pack *n = state->next;
-		pack_dec(state->pack);
-		free(state);
-		state = n;
-	}
-	return NULL;
-}
+	chunks = n_large ? 5 : 4;
+	len = 12 + (chunks + 1) * 12 + pnam_len + 256 * 4
+		+ n_entries * (GIT_OID_RAWSZ + 8) + n_large * 8 + GIT_OID_RAWSZ;
 
-static git_packlist *packlist_get(git_odb *db)
-{
-	git_packlist *pl;
+	if ((buf = git__calloc(1, len)) == NULL)
+		return GIT_ENOMEM;
 
-	gitlck_lock(&db->lock);
-	if ((pl = db->packlist) != NULL)
-		pl->refcnt++;
-	else
-		pl = scan_packs(db);
-	gitlck_unlock(&db->lock);
-	return pl;
-}
+	b = encode32(buf, MIDX_SIG);
+	*b++ = MIDX_VERSION;
+	*b++ = MIDX_OID_VERSION;
+	*b++ = (unsigned char)chunks;
+	*b++ = 0;
+	b = encode32(b, (uint32_t)n_packs);
+
+	off = 12 + (chunks + 1) * 12;
+	b = encode32(b, MIDX_CHUNK_PNAM);
+	b = encode64(b, off);
+	off += pnam_len;
+	b = encode32(b, MIDX_CHUNK_OIDF);
+	b = encode64(b, off);
+	off += 256 * 4;
+	b = encode32(b, MIDX_CHUNK_OIDL);
+	b = encode64(b, off);
+	off += n_entries * GIT_OID_RAWSZ;
+	b = encode32(b, MIDX_CHUNK_OOFF);
+	b = encode64(b, off);
+	off += n_entries * 8;
+	if (n_large) {
+		b = encode32(b, MIDX_CHUNK_LOFF);
+		b = encode64(b, off);
+		off += n_large * 8;
+	}
+	b = encode32(b, 0);
+	b = encode64(b, off);
 
-static int search_packs(git_pack **p, uint32_t *n, git_odb *db, const git_oid *id)
-{
-	git_packlist *pl = packlist_get(db);
-	size_t j;
+	for (j = 0; j < n_packs; j++)
+		b += sprintf((char *)b, "%s.idx", packs[j]->pack_name) + 1;
+	b = buf + 12 + (chunks + 1) * 12 + pnam_len;
 
-	if (!pl)
-		return GIT_ENOTFOUND;
+	for (j = 0; j < 256; j++)
+		b = encode32(b, fanout[j]);
 
-	for (j = 0; j < pl->n_packs; j++) {
+	for (j = 0; j < n_entries; j++) {
+		memcpy(b, entries[j].oid, GIT_OID_RAWSZ);
+		b += GIT_OID_RAWSZ;
+	}
 
-		git_pack *pack = pl->packs[j];
-		uint32_t pos;
-		int res;
+	for (j = 0, n_large = 0; j < n_entries; j++) {
+		b = encode32(b, entries[j].pack_id);
+		if (entries[j].offset > 0x7fffffff)
+			b = encode32(b, 0x80000000 | (uint32_t)n_large++);
+		else
+			b = encode32(b, (uint32_t)entries[j].offset);
+	}
 
-		if (pack_openidx(pack))
-			continue;
-		res = pack->idx_search(&pos, pack, id);
-		pack_decidx(pack);
+	for (j = 0; j < n_entries; j++)
+		if (entries[j].offset > 0x7fffffff)
+			b = encode64(b, (uint64_t)entries[j].offset);
 
-		if (!res) {
-			packlist_dec(db, pl);
-			if (p)
-				*p = pack;
-			if (n)
-				*n = pos;
-			return GIT_SUCCESS;
-		}
+	git_hash_buf(&checksum, buf, b - buf);
+	memcpy(b, checksum.id, GIT_OID_RAWSZ);
 
+	if (git__fmt(pb, sizeof(pb), "%s/pack/multi-pack-index", db->objects_dir) < 0) {
+		free(buf);
+		return GIT_ERROR;
 	}
 
-	packlist_dec(db, pl);
-	return GIT_ENOTFOUND;
-}
+	if ((error = git_filelock_init(&lock, pb)) < 0
+		|| (error = git_filelock_lock(&lock, 0)) < 0) {
+		free(buf);
+		return error;
+	}
 
+	if ((error = git_filelock_write(&lock, buf, len)) < 0) {
+		git_filelock_unlock(&lock);
+		free(buf);
+		return error;
+	}
 
+	free(buf);
+	return git_filelock_commit(&lock);
+}
 
 
 
@@ -1379,543 +1944,4926 @@ static int search_packs(git_pack **p, uint32_t *n, git_odb *db, const git_oid *i
 
 /***********************************************************
  *
- * PACKFILE READING FUNCTIONS
+ * PACKFILE WINDOWS
  *
- * Read the contents of a packfile
+ * Map the pack files a window at a time, keeping the total
+ * mapped size and window count of the process bounded: the
+ * limits are about address space, so they cover the packs of
+ * every database open at once, not of each one.
  * 
  ***********************************************************/
 
-static int unpack_object(git_rawobj *out, git_pack *p, index_entry *e);
+static pack_window_ctl pack_windows = {
+	GITLCK_INIT,
+	GIT_PACK_WINDOW_SIZE,
+	GIT_PACK_MAPPED_LIMIT,
+	GIT_PACK_OPEN_WINDOWS,
+	0, 0,
+	{ 0 }  /* the list is set up on first use */
+};
 
-static int unpack_object_delta(git_rawobj *out, git_pack *p, 
-		index_entry *base_entry, 
-		uint8_t *delta_buffer, 
-		size_t delta_deflated_size,
-		size_t delta_inflated_size)
+static void pack_window_lock(pack_window_ctl *c)
 {
-	int res = 0;
-	uint8_t *delta = NULL;
-	git_rawobj base_obj;
-
-	base_obj.data = NULL;
-	base_obj.type = GIT_OBJ_BAD;
-	base_obj.len = 0;
-
-	if ((res = unpack_object(&base_obj, p, base_entry)) < 0)
-		goto cleanup;
+	gitlck_lock(&c->lock);
+	if (!c->lru.lru_next)
+		c->lru.lru_prev = c->lru.lru_next = &c->lru;
+}
 
-	delta = git__malloc(delta_inflated_size + 1);
+static void pack_window_release(pack_window_ctl *c, pack_window *w)
+{
+	pack_window **pw;
 
-	if ((res = inflate_buffer(delta_buffer, delta_deflated_size, 
-			delta, delta_inflated_size)) < 0)
-		goto cleanup;
+	assert(!w->inuse);
 
-	res = git__delta_apply(out, base_obj.data, base_obj.len, delta, delta_inflated_size);
+	for (pw = &w->pack->windows; *pw != w; pw = &(*pw)->next)
+		/* nothing */;
+	*pw = w->next;
 
-	out->type = base_obj.type;
+	w->lru_prev->lru_next = w->lru_next;
+	w->lru_next->lru_prev = w->lru_prev;
 
-cleanup:
-	free(delta);
-	git_obj_close(&base_obj);
-	return res;
+	c->mapped -= w->map.len;
+	c->open--;
+	gitfo_free_map(&w->map);
+	free(w);
 }
 
-static int unpack_object(git_rawobj *out, git_pack *p, index_entry *e)
+/*
+ * Unmap the least recently used windows not in use until 'len'
+ * more bytes fit within the limits.  Windows in use are never
+ * unmapped, so the limits may be exceeded for a while.
+ */
+static void pack_window_evict(pack_window_ctl *c, size_t len)
 {
-	git_otype object_type;
-	size_t inflated_size, deflated_size, shift;
-	uint8_t *buffer, byte;
+	pack_window *w, *next;
 
-	assert(out && p && e && git__is_sizet(e->size));
+	for (w = c->lru.lru_next; w != &c->lru; w = next) {
+		next = w->lru_next;
+		if (c->mapped + len <= c->mapped_limit && c->open < c->open_limit)
+			break;
+		if (!w->inuse)
+			pack_window_release(c, w);
+	}
+}
 
-	if (open_pack(p))
-		return GIT_ERROR;
+GIT_INLINE(int) pack_window_contains(pack_window *w, off_t offset, off_t len)
+{
+	return w->offset <= offset && offset + len <= w->offset + (off_t)w->map.len;
+}
 
-	buffer = (uint8_t *)p->pack_map.data + e->offset;
-	deflated_size = (size_t)e->size;
+/*
+ * Return a pointer to the pack data at 'offset', mapping a new
+ * window if needed, and store the number of bytes readable
+ * there in 'avail'.  At least PACK_ENTRY_HEADER_MAX bytes are
+ * readable unless the pack ends first.  The window stays
+ * mapped until released with pack_window_done().
+ */
+static unsigned char *pack_window_use(pack_window **out, git_pack *p,
+		off_t offset, size_t *avail)
+{
+	pack_window_ctl *c = &pack_windows;
+	off_t need = p->pack_size - offset;
+	pack_window *w;
 
-	if (deflated_size == 0)
-		deflated_size = (size_t)(p->pack_size - e->offset);
+	assert(offset >= 0 && offset < p->pack_size);
 
-	byte = *buffer++ & 0xFF;
-	deflated_size--;
-	object_type = (byte >> 4) & 0x7;
-	inflated_size = byte & 0xF;
-	shift = 4;
+	if (need > PACK_ENTRY_HEADER_MAX)
+		need = PACK_ENTRY_HEADER_MAX;
 
-	while (byte & 0x80) {
-		byte = *buffer++ & 0xFF;
-		deflated_size--;
-		inflated_size += (byte & 0x7F) << shift;
-		shift += 7;
-	}
+	pack_window_lock(c);
 
-	switch (object_type) {
-		case GIT_OBJ_COMMIT:
-		case GIT_OBJ_TREE:
-		case GIT_OBJ_BLOB:
-		case GIT_OBJ_TAG: {
+	for (w = p->windows; w; w = w->next)
+		if (pack_window_contains(w, offset, need))
+			break;
 
-			/* Handle a normal zlib stream */
-			out->len = inflated_size;
-			out->type = object_type;
-			out->data = git__malloc(inflated_size + 1);
+	if (!w) {
+		off_t align = c->window_size / 2;
+		off_t win_off = (offset / align) * align;
+		off_t len = p->pack_size - win_off;
 
-			if (inflate_buffer(buffer, deflated_size, out->data, out->len) < 0) {
-				free(out->data);
-				out->data = NULL;
-				return GIT_ERROR;
-			}
+		if (len > (off_t)c->window_size)
+			len = c->window_size;
 
-			return GIT_SUCCESS;
+		if ((w = git__calloc(1, sizeof(*w))) == NULL) {
+			gitlck_unlock(&c->lock);
+			return NULL;
 		}
 
-		case GIT_OBJ_OFS_DELTA: {
-
-			off_t delta_offset;
-			index_entry entry;
-
-			byte = *buffer++ & 0xFF;
-			delta_offset = byte & 0x7F;
-
-			while (byte & 0x80) {
-				delta_offset += 1;
-				byte = *buffer++ & 0xFF;
-				delta_offset <<= 7;
-				delta_offset += (byte & 0x7F);
+		pack_window_evict(c, (size_t)len);
+		if (gitfo_map_ro(&w->map, p->pack_fd, win_off, (size_t)len) < 0) {
+			/* retry once all idle windows are gone */
+			pack_window_evict(c, c->mapped_limit);
+			if (gitfo_map_ro(&w->map, p->pack_fd, win_off, (size_t)len) < 0) {
+				gitlck_unlock(&c->lock);
+				free(w);
+				return NULL;
 			}
+		}
 
-			entry.n = 0; 
-			entry.oid = NULL;
-			entry.offset = e->offset - delta_offset; 
-			entry.size = 0;
+		w->pack = p;
+		w->offset = win_off;
+		w->next = p->windows;
+		p->windows = w;
+		c->mapped += w->map.len;
+		c->open++;
+	} else {
+		w->lru_prev->lru_next = w->lru_next;
+		w->lru_next->lru_prev = w->lru_prev;
+	}
 
-			if (unpack_object_delta(out, p, &entry, 
-					buffer, deflated_size, inflated_size) < 0)
-				return GIT_ERROR;
-			
-			return GIT_SUCCESS;
-		}
+	w->lru_next = &c->lru;
+	w->lru_prev = c->lru.lru_prev;
+	c->lru.lru_prev->lru_next = w;
+	c->lru.lru_prev = w;
+	w->inuse++;
 
-		case GIT_OBJ_REF_DELTA: {
+	gitlck_unlock(&c->lock);
 
-			git_oid base_id;
-			uint32_t n;
-			index_entry entry;
-			int res = GIT_ERROR;
+	*out = w;
+	*avail = (size_t)(w->offset + w->map.len - offset);
+	return (unsigned char *)w->map.data + (offset - w->offset);
+}
 
-			git_oid_mkraw(&base_id, buffer);
+static void pack_window_done(pack_window *w)
+{
+	pack_window_ctl *c = &pack_windows;
 
-			if (!p->idx_search(&n, p, &base_id) &&
-				!p->idx_get(&entry, p, n)) {
+	pack_window_lock(c);
+	w->inuse--;
+	gitlck_unlock(&c->lock);
+}
 
-				res = unpack_object_delta(out, p, &entry, 
-					buffer + GIT_OID_RAWSZ, deflated_size, inflated_size);
-			}
+/* Unmap every window of p, which must not be in use. */
+static void pack_window_close_all(git_pack *p)
+{
+	pack_window_ctl *c = &pack_windows;
 
-			return res;
-		}
+	pack_window_lock(c);
+	while (p->windows)
+		pack_window_release(c, p->windows);
+	gitlck_unlock(&c->lock);
+}
 
-		default:
-			return GIT_EOBJCORRUPTED;
+static void pack_window_set_limits(pack_window_ctl *c,
+		size_t window_size, size_t mapped_limit, unsigned int open_limit)
+{
+	pack_window_lock(c);
+	if (window_size) {
+		/* windows start on a multiple of half their size */
+		size_t unit = 2 * GIT_PACK_WINDOW_ALIGN;
+		c->window_size = (window_size + unit - 1) / unit * unit;
 	}
+	if (mapped_limit)
+		c->mapped_limit = mapped_limit;
+	if (open_limit)
+		c->open_limit = open_limit;
+	pack_window_evict(c, 0);
+	gitlck_unlock(&c->lock);
 }
 
 
 
 
 
+
 /***********************************************************
  *
- * ODB OBJECT READING & WRITING
+ * PACKFILE FUNCTIONS
  *
- * Backend for the public API; read headers and full objects
- * from the ODB. Write raw data to the ODB.
+ * Locate, open and access the contents of a packfile
  * 
  ***********************************************************/
 
-static int open_alternates(git_odb *db)
+static int pack_stat(git_pack *p)
 {
-	unsigned n = 0;
-
-	gitlck_lock(&db->lock);
-	if (db->alternates) {
-		gitlck_unlock(&db->lock);
-		return 1;
-	}
-
-	/*
-	 * FIXME: broken, makes no sense.
-	 * n is always 0, the alternates array is always
-	 * empty!
-	 */
-
-	db->alternates = git__malloc(sizeof(*db->alternates) * (n + 1));
-	if (!db->alternates) {
-		gitlck_unlock(&db->lock);
-		return -1;
-	}
-
-	db->alternates[n] = NULL;
-	db->n_alternates = n;
-	gitlck_unlock(&db->lock);
-	return 0;
-}
+	char pb[GIT_PATH_MAX];
+	struct stat sb;
 
+	if (git__fmt(pb, sizeof(pb), "%s/pack/%s.pack",
+			p->db->objects_dir,
+			p->pack_name) < 0)
+		return GIT_ERROR;
 
-static int locate_object(obj_location *location, git_odb *db, const git_oid *id)
-{
-	memset(location, 0x0, sizeof(obj_location));
+	if (gitfo_stat(pb, &sb) || !S_ISREG(sb.st_mode))
+		return GIT_ERROR;
 
-	do {
-		if (object_file_name(location->loose_path, GIT_PATH_MAX, db->objects_dir, id) == GIT_SUCCESS &&
-			gitfo_exists(location->loose_path) == 0)
-			return OBJ_LOCATION_LOOSE;
+	if (sb.st_size < (3 * 4 + GIT_OID_RAWSZ))
+		return GIT_ERROR;
 
-		if (search_packs(&location->pack.ptr, &location->pack.n, db, id) == GIT_SUCCESS)
-			return OBJ_LOCATION_INPACK;
-	
-	} while (open_alternates(db) == GIT_SUCCESS);
+	p->pack_size = sb.st_size;
+	p->pack_mtime = sb.st_mtime;
 
-	return GIT_ENOTFOUND;
+	return GIT_SUCCESS;
 }
 
-static int read_packed(git_rawobj *out, const obj_location *loc)
+static int pack_openidx(git_pack *p)
 {
-	index_entry e;
-	int res;
+	gitlck_lock(&p->lock);
 
-	assert(out && loc);
+	if (p->invalid) {
+		gitlck_unlock(&p->lock);
+		return GIT_ERROR;
+	}
 
-	if (pack_openidx(loc->pack.ptr))
-		return GIT_EPACKCORRUPTED;
+	if (++p->idxcnt == 1 && !p->idx_search) {
+		int status, version;
+		uint32_t *data;
 
-	res = loc->pack.ptr->idx_get(&e, loc->pack.ptr, loc->pack.n);
+		if (pack_stat(p) || pack_openidx_map(p)) {
+			p->invalid = 1;
+			p->idxcnt--;
+			gitlck_unlock(&p->lock);
+			return GIT_ERROR;
+		}
+		data = p->idx_map.data;
+		status = GIT_SUCCESS;
+		version = 1;
 
-	if (!res)
-		res = unpack_object(out, loc->pack.ptr, &e);
+		if (decode32(&data[0]) == PACK_TOC)
+			version = decode32(&data[1]);
 
-	pack_decidx(loc->pack.ptr);
+		switch (version) {
+		case 1:
+			status = pack_openidx_v1(p);
+			break;
+		case 2:
+			status = pack_openidx_v2(p);
+			break;
+		default:
+			status = GIT_ERROR;
+		}
 
-	return res;
+		if (status != GIT_SUCCESS) {
+			gitfo_free_map(&p->idx_map);
+			p->invalid = 1;
+			p->idxcnt--;
+			gitlck_unlock(&p->lock);
+			return status;
+		}
+	}
+
+	gitlck_unlock(&p->lock);
+	return GIT_SUCCESS;
 }
 
-static int read_header_packed(git_rawobj *out, const obj_location *loc)
+static void pack_decidx(git_pack *p)
 {
-	git_pack *pack;
-	index_entry e;
-	int error = GIT_SUCCESS, shift;
-	uint8_t *buffer, byte;
+	gitlck_lock(&p->lock);
+	p->idxcnt--;
+	gitlck_unlock(&p->lock);
+}
 
-	assert(out && loc);
-		
-	pack = loc->pack.ptr;
+static int read_pack_hdr(pack_hdr *out, git_file fd)
+{
+	pack_hdr hdr;
 
-	if (pack_openidx(pack))
-		return GIT_EPACKCORRUPTED;
+	if (gitfo_read(fd, &hdr, sizeof(hdr)))
+		return GIT_ERROR;
 
-	if (pack->idx_get(&e, pack, loc->pack.n) < 0 ||
-		open_pack(pack) < 0) {
-		error = GIT_ENOTFOUND;
-		goto cleanup;
-	}
+	out->sig = decode32(&hdr.sig);
+	out->ver = decode32(&hdr.ver);
+	out->cnt = decode32(&hdr.cnt);
 
-	buffer = (uint8_t *)pack->pack_map.data + e.offset;
+	return GIT_SUCCESS;
+}
+
+static int check_pack_hdr(git_pack *p)
+{
+	pack_hdr hdr;
+
+	if (read_pack_hdr(&hdr, p->pack_fd))
+		return GIT_ERROR;
+
+	if (hdr.sig != PACK_SIG
+		|| (hdr.ver != 2 && hdr.ver != 3)
+		|| hdr.cnt != p->obj_cnt)
+		return GIT_ERROR;
+
+	return GIT_SUCCESS;
+}
+
+static int check_pack_sha1(git_pack *p)
+{
+	unsigned char *data = p->idx_map.data;
+	off_t pack_sha1_off = p->pack_size - GIT_OID_RAWSZ;
+	size_t idx_pack_sha1_off = p->idx_map.len - 2 * GIT_OID_RAWSZ;
+	git_oid pack_id, idx_pack_id;
+
+	if (gitfo_lseek(p->pack_fd, pack_sha1_off, SEEK_SET) == -1)
+		return GIT_ERROR;
+
+	if (gitfo_read(p->pack_fd, pack_id.id, sizeof(pack_id.id)))
+		return GIT_ERROR;
+
+	git_oid_mkraw(&idx_pack_id, data + idx_pack_sha1_off);
+
+	if (git_oid_cmp(&pack_id, &idx_pack_id))
+		return GIT_ERROR;
+
+	return GIT_SUCCESS;
+}
+
+static int open_pack(git_pack *p)
+{
+	char pb[GIT_PATH_MAX];
+	struct stat sb;
+
+	if (p->pack_fd != -1)
+		return GIT_SUCCESS;
+
+	if (git__fmt(pb, sizeof(pb), "%s/pack/%s.pack",
+			p->db->objects_dir,
+			p->pack_name) < 0)
+		return GIT_ERROR;
+
+	if (pack_openidx(p))
+		return GIT_ERROR;
+
+	if ((p->pack_fd = gitfo_open(pb, O_RDONLY)) < 0)
+		goto error_cleanup;
+
+	if (gitfo_fstat(p->pack_fd, &sb)
+		|| !S_ISREG(sb.st_mode) || p->pack_size != sb.st_size
+		|| check_pack_hdr(p) || check_pack_sha1(p))
+		goto error_cleanup;
+
+	pack_decidx(p);
+	return GIT_SUCCESS;
+
+error_cleanup:
+	gitfo_close(p->pack_fd);
+	p->pack_fd = -1;
+	pack_decidx(p);
+	return GIT_ERROR;
+}
+
+static void pack_inc(git_pack *p)
+{
+	gitlck_lock(&p->lock);
+	p->refcnt++;
+	gitlck_unlock(&p->lock);
+}
+
+static void pack_dec(git_pack *p)
+{
+	int need_free;
+
+	gitlck_lock(&p->lock);
+	need_free = !--p->refcnt;
+	gitlck_unlock(&p->lock);
+
+	if (need_free) {
+		if (p->db) {
+			delta_cache_purge(&p->db->delta_cache, p);
+			pack_window_close_all(p);
+		}
+
+		if (p->import) {
+			gitlck_free(&p->import->lock);
+			free(p->import->entries);
+			free(p->import->slots);
+			free(p->import);
+		}
+
+		if (p->idx_search) {
+			if (p->idx_fd >= 0) {
+				gitfo_free_map(&p->idx_map);
+				gitfo_close(p->idx_fd);
+			}
+			free(p->im_fanout);
+			free(p->im_off_idx);
+			free(p->im_off_next);
+			if (p->im_rev) {
+				gitfo_free_map(&p->rev_map);
+				gitfo_close(p->rev_fd);
+			}
+			if (p->pack_fd != -1)
+				gitfo_close(p->pack_fd);
+		}
+
+		gitlck_free(&p->lock);
+		free(p);
+	}
+}
+
+static void packlist_dec(git_odb *db, git_packlist *pl)
+{
+	int need_free;
+
+	assert(db && pl);
+
+	gitlck_lock(&db->lock);
+	need_free = !--pl->refcnt;
+	gitlck_unlock(&db->lock);
+
+	if (need_free) {
+		size_t j;
+		midx_free(pl->midx);
+		for (j = 0; j < pl->n_packs; j++)
+			pack_dec(pl->packs[j]);
+		free(pl);
+	}
+}
+
+static git_pack *alloc_pack(const char *pack_name)
+{
+	git_pack *p = git__calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	gitlck_init(&p->lock);
+	strcpy(p->pack_name, pack_name);
+	p->refcnt = 1;
+	p->idx_fd = -1;
+	p->pack_fd = -1;
+	return p;
+}
+
+struct scanned_pack {
+	struct scanned_pack *next;
+	git_pack *pack;
+	off_t idx_size;
+};
+
+/*
+ * The packs are listed by decreasing index size, hence by
+ * decreasing number of objects: the largest packs are the most
+ * likely to hold the objects looked for, and are searched first.
+ */
+static int scan_one_pack(void *state, char *name)
+{
+	struct scanned_pack **ret = state, *r;
+	char *s = strrchr(name, '/'), *d;
+	struct stat sb;
+
+	if (git__prefixcmp(s + 1, "pack-")
+	 || git__suffixcmp(s, ".pack")
+	 || strlen(s + 1) != GIT_PACK_NAME_MAX + 4)
+		return 0;
+
+	d = strrchr(s + 1, '.');
+	strcpy(d + 1, "idx");    /* "pack-abc.pack" -> "pack-abc.idx" */
+	if (gitfo_stat(name, &sb))
+		return 0;
+
+	if ((r = git__malloc(sizeof(*r))) == NULL)
+		return GIT_ERROR;
+
+	*d = '\0';               /* "pack-abc.pack" -_> "pack-abc" */
+	if ((r->pack = alloc_pack(s + 1)) == NULL) {
+		free(r);
+		return GIT_ERROR;
+	}
+	r->idx_size = sb.st_size;
+
+	while (*ret && (*ret)->idx_size >= r->idx_size)
+		ret = &(*ret)->next;
+	r->next = *ret;
+	*ret = r;
+	return 0;
+}
+
+static time_t pack_dir_mtime(git_odb *db)
+{
+	char pb[GIT_PATH_MAX];
+	struct stat sb;
+
+	if (git__fmt(pb, sizeof(pb), "%s/pack", db->objects_dir) < 0
+		|| gitfo_stat(pb, &sb) < 0)
+		return 0;
+	return sb.st_mtime;
+}
+
+static git_pack *packlist_find(git_packlist *pl, const char *pack_name)
+{
+	size_t j;
+
+	for (j = 0; j < pl->n_packs; j++)
+		if (!strcmp(pl->packs[j]->pack_name, pack_name))
+			return pl->packs[j];
+	return NULL;
+}
+
+/*
+ * Build a new pack list from the contents of objects/pack and
+ * make it the current one.  Packs already in 'old' are carried
+ * over with their open indexes and maps; the packs of 'old' no
+ * longer on disk are left out, and freed with the last list
+ * referencing them.  Must be called with db->lock held.
+ */
+static git_packlist *scan_packs(git_odb *db, git_packlist *old)
+{
+	char pb[GIT_PATH_MAX];
+	struct scanned_pack *state = NULL, *c;
+	size_t cnt;
+	git_packlist *new_list;
+	time_t mtime = pack_dir_mtime(db), scanned = time(NULL);
+
+	if (git__fmt(pb, sizeof(pb), "%s/pack", db->objects_dir) < 0)
+		return NULL;
+	gitfo_dirent(pb, sizeof(pb), scan_one_pack, &state);
+
+	for (cnt = 0, c = state; c; c = c->next)
+		cnt++;
+	new_list = git__malloc(sizeof(*new_list)
+		+ (sizeof(new_list->packs[0]) * cnt));
+	if (!new_list)
+		goto fail;
+
+	new_list->mru = NULL;
+	for (cnt = 0, c = state; c; ) {
+		struct scanned_pack *n = c->next;
+		git_pack *p, *known = old ? packlist_find(old, c->pack->pack_name) : NULL;
+
+		if (known && !known->invalid) {
+			pack_dec(c->pack);
+			pack_inc(known);
+			p = known;
+			if (known == old->mru)
+				new_list->mru = known;
+		} else {
+			p = c->pack;
+			p->db = db;
+		}
+		p->in_midx = 0;
+
+		new_list->packs[cnt++] = p;
+		free(c);
+		c = n;
+	}
+	new_list->n_packs = cnt;
+	new_list->refcnt = 2;
+	new_list->mtime = mtime;
+	new_list->scanned = scanned;
+
+	if ((new_list->midx = midx_open(db)) != NULL)
+		midx_attach(new_list->midx, new_list);
+
+	db->packlist = new_list;
+	return new_list;
+
+fail:
+	while (state) {
+		struct scanned_pack *n = state->next;
+		pack_dec(state->pack);
+		free(state);
+		state = n;
+	}
+	return NULL;
+}
+
+static git_packlist *packlist_get(git_odb *db)
+{
+	git_packlist *pl;
+
+	gitlck_lock(&db->lock);
+	if ((pl = db->packlist) != NULL)
+		pl->refcnt++;
+	else
+		pl = scan_packs(db, NULL);
+	gitlck_unlock(&db->lock);
+	return pl;
+}
+
+/*
+ * Re-scan objects/pack if it may have changed since 'pl' was
+ * scanned.  Returns the new list, with a reference held for the
+ * caller, or NULL when there is nothing new.
+ */
+static git_packlist *packlist_refresh(git_odb *db, git_packlist *pl)
+{
+	time_t mtime = pack_dir_mtime(db);
+	git_packlist *cur;
+
+	gitlck_lock(&db->lock);
+
+	if ((cur = db->packlist) != pl) {
+		/* already replaced by somebody else */
+		if (cur)
+			cur->refcnt++;
+		gitlck_unlock(&db->lock);
+		return cur;
+	}
+
+	/* see loose_cache_load() for why the same second is not trusted */
+	if (pl->mtime == mtime && pl->mtime < pl->scanned) {
+		gitlck_unlock(&db->lock);
+		return NULL;
+	}
+
+	cur = scan_packs(db, pl);
+	gitlck_unlock(&db->lock);
+
+	/* drop the reference the database held on the old list */
+	if (cur)
+		packlist_dec(db, pl);
+	return cur;
+}
+
+/* Release the index of p after looking for an object in it. */
+static void pack_searched(git_pack *p, int found)
+{
+	gitlck_lock(&p->lock);
+	if (found)
+		p->hits++;
+	else
+		p->misses++;
+	p->idxcnt--;
+	gitlck_unlock(&p->lock);
+}
+
+static int search_pack(uint32_t *n, git_pack *p, const git_oid *id)
+{
+	int res;
+
+	if (pack_openidx(p))
+		return GIT_ENOTFOUND;
+	res = p->idx_search(n, p, id);
+	pack_searched(p, !res);
+
+	return res ? GIT_ENOTFOUND : GIT_SUCCESS;
+}
+
+/*
+ * Look for id in the packs of pl.  On success a reference on the
+ * pack is handed to the caller, who releases it with pack_dec().
+ *
+ * The pack of the last object found is searched first, as the
+ * objects looked up together tend to come from the same pack.
+ */
+static int search_packlist(git_pack **p, uint32_t *n, git_odb *db, git_packlist *pl, const git_oid *id)
+{
+	int use_midx = pl->midx != NULL;
+	git_pack *mru;
+	size_t j;
+
+	/*
+	 * The multi-pack-index tells which pack holds the object;
+	 * only the packs it does not cover need to be searched.
+	 */
+	if (use_midx) {
+		git_pack *pack;
+		uint32_t pos;
+
+		if (!midx_search(&pack, pl->midx, id)) {
+			if (!search_pack(&pos, pack, id)) {
+				pack_inc(pack);
+				*p = pack;
+				*n = pos;
+				return GIT_SUCCESS;
+			}
+
+			/* the multi-pack-index is stale; search every pack */
+			use_midx = 0;
+		}
+	}
+
+	gitlck_lock(&db->lock);
+	mru = pl->mru;
+	gitlck_unlock(&db->lock);
+
+	if (mru && !(use_midx && mru->in_midx) && !search_pack(n, mru, id)) {
+		pack_inc(mru);
+		*p = mru;
+		return GIT_SUCCESS;
+	}
+
+	for (j = 0; j < pl->n_packs; j++) {
+		git_pack *pack = pl->packs[j];
+
+		if (pack == mru || (use_midx && pack->in_midx))
+			continue;
+
+		if (!search_pack(n, pack, id)) {
+			gitlck_lock(&db->lock);
+			pl->mru = pack;
+			gitlck_unlock(&db->lock);
+
+			pack_inc(pack);
+			*p = pack;
+			return GIT_SUCCESS;
+		}
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+static int search_packs(git_pack **p, uint32_t *n, git_odb *db, const git_oid *id)
+{
+	git_packlist *pl = packlist_get(db), *fresh;
+	int error;
+
+	if (!pl)
+		return GIT_ENOTFOUND;
+
+	error = search_packlist(p, n, db, pl, id);
+
+	/* the object may be in a pack created after pl was scanned */
+	if (error == GIT_ENOTFOUND && (fresh = packlist_refresh(db, pl)) != NULL) {
+		packlist_dec(db, pl);
+		pl = fresh;
+		error = search_packlist(p, n, db, pl, id);
+	}
+
+	packlist_dec(db, pl);
+	return error;
+}
+
+
+
+
+
+
+
+
+/***********************************************************
+ *
+ * PACKFILE READING FUNCTIONS
+ *
+ * Read the contents of a packfile
+ * 
+ ***********************************************************/
+
+typedef struct {  /* an entry of a '.pack' file */
+	off_t offset;       /* position of the entry header in the pack */
+	git_otype type;     /* type as recorded in the entry header */
+	size_t size;        /* inflated size of the entry data */
+	off_t data_offset;  /* position of the deflated entry data */
+	size_t data_len;    /* deflated bytes available there */
+	off_t base_offset;  /* position of the delta base, if a delta */
+} pack_entry;
+
+/*
+ * Parse the header of the entry at 'offset'.  If 'size' is not
+ * zero it bounds the space taken by the entry in the pack.  For
+ * deltas, the position of the base entry is resolved as well.
+ */
+static int parse_pack_entry(pack_entry *out, git_pack *p, off_t offset, off_t size)
+{
+	off_t end = p->pack_size - GIT_OID_RAWSZ;
+	uint8_t *start, *buffer, *buffer_end, byte;
+	pack_window *w;
+	size_t shift, avail;
+	int error = GIT_EPACKCORRUPTED;
+
+	if (offset < 3 * 4 || offset >= end)
+		return GIT_EPACKCORRUPTED;
+	if (size > 0 && size < end - offset)
+		end = offset + size;
+
+	if ((start = pack_window_use(&w, p, offset, &avail)) == NULL)
+		return GIT_ERROR;
+	if ((off_t)avail > end - offset)
+		avail = (size_t)(end - offset);
+
+	buffer = start;
+	buffer_end = start + avail;
+
+	byte = *buffer++;
+	out->offset = offset;
+	out->type = (byte >> 4) & 0x7;
+	out->size = byte & 0xF;
+	shift = 4;
+
+	while (byte & 0x80) {
+		if (buffer == buffer_end || sizeof(size_t) * 8 <= shift)
+			goto done;
+		byte = *buffer++;
+		out->size += (size_t)(byte & 0x7F) << shift;
+		shift += 7;
+	}
+
+	switch (out->type) {
+	case GIT_OBJ_OFS_DELTA: {
+		off_t delta_offset;
+
+		if (buffer == buffer_end)
+			goto done;
+		byte = *buffer++;
+		delta_offset = byte & 0x7F;
+
+		while (byte & 0x80) {
+			if (buffer == buffer_end)
+				goto done;
+			delta_offset += 1;
+			byte = *buffer++;
+			delta_offset <<= 7;
+			delta_offset += (byte & 0x7F);
+		}
+
+		if (delta_offset <= 0 || delta_offset >= offset)
+			goto done;
+		out->base_offset = offset - delta_offset;
+		break;
+	}
+
+	case GIT_OBJ_REF_DELTA: {
+		git_oid base_id;
+		index_entry base;
+		uint32_t n;
+
+		if (buffer_end - buffer < GIT_OID_RAWSZ)
+			goto done;
+		git_oid_mkraw(&base_id, buffer);
+		buffer += GIT_OID_RAWSZ;
+
+		if (p->idx_search(&n, p, &base_id) || p->idx_get(&base, p, n))
+			goto done;
+		out->base_offset = base.offset;
+		break;
+	}
+
+	case GIT_OBJ_COMMIT:
+	case GIT_OBJ_TREE:
+	case GIT_OBJ_BLOB:
+	case GIT_OBJ_TAG:
+		out->base_offset = 0;
+		break;
+
+	default:
+		error = GIT_EOBJCORRUPTED;
+		goto done;
+	}
+
+	out->data_offset = offset + (buffer - start);
+	out->data_len = (size_t)(end - out->data_offset);
+	error = GIT_SUCCESS;
+
+done:
+	pack_window_done(w);
+	return error;
+}
+
+/*
+ * Inflate the data of a pack entry into 'out', reading it one
+ * window at a time.  Unless 'partial' is set the data must
+ * inflate to exactly 'outlen' bytes; otherwise inflating stops
+ * once 'out' is full.  Returns the number of bytes inflated, or
+ * < 0 on error.
+ */
+static int pack_inflate(git_pack *p, pack_entry *ent, void *out, size_t outlen, int partial)
+{
+	off_t offset = ent->data_offset;
+	size_t left = ent->data_len;
+	z_stream zs;
+	int status = Z_OK;
+
+	init_stream(&zs, out, outlen);
+
+	if (inflateInit(&zs) < Z_OK)
+		return GIT_ERROR;
+
+	while (status == Z_OK && left > 0 && (!partial || zs.avail_out > 0)) {
+		pack_window *w;
+		unsigned char *in;
+		size_t avail, used;
+
+		if ((in = pack_window_use(&w, p, offset, &avail)) == NULL) {
+			inflateEnd(&zs);
+			return GIT_ERROR;
+		}
+		if (avail > left)
+			avail = left;
+
+		set_stream_input(&zs, in, avail);
+		status = inflate(&zs, Z_NO_FLUSH);
+		used = avail - zs.avail_in;
+		pack_window_done(w);
+
+		offset += used;
+		left -= used;
+	}
+
+	inflateEnd(&zs);
+
+	if (partial) {
+		if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+			return GIT_ERROR;
+	} else if (status != Z_STREAM_END || zs.total_out != outlen)
+		return GIT_ERROR;
+
+	return (int)zs.total_out;
+}
+
+/*
+ * Make sure 'buf' can hold at least 'len' bytes.  The previous
+ * contents are not preserved.
+ */
+static int reserve_buffer(void **buf, size_t *alloc, size_t len)
+{
+	if (*alloc >= len)
+		return GIT_SUCCESS;
+
+	free(*buf);
+	*alloc = 0;
+	if ((*buf = git__malloc(len)) == NULL)
+		return GIT_ENOMEM;
+	*alloc = len;
+	return GIT_SUCCESS;
+}
+
+/*
+ * Determine the type and size of an entry without unpacking it.
+ * For a delta, the size is read from the header at the start of
+ * the delta data, and the type is the one of the whole object at
+ * the bottom of the delta chain.
+ */
+static int unpack_object_header(git_rawobj *out, git_pack *p, index_entry *e)
+{
+	pack_entry ent;
+	size_t depth = 0;
+	int error;
+
+	assert(out && p && e);
+
+	out->data = NULL;
+
+	if (open_pack(p))
+		return GIT_ERROR;
+
+	if ((error = parse_pack_entry(&ent, p, e->offset, e->size)) < 0)
+		return error;
+
+	out->len = ent.size;
+
+	if (ent.type == GIT_OBJ_OFS_DELTA || ent.type == GIT_OBJ_REF_DELTA) {
+		/* two varints of at most 10 bytes each */
+		unsigned char hdr[20];
+		size_t base_sz;
+		int len;
+
+		len = pack_inflate(p, &ent, hdr,
+			ent.size < sizeof(hdr) ? ent.size : sizeof(hdr), 1);
+
+		if (len < 0 || git__delta_read_header(&base_sz, &out->len, hdr, len) < 0)
+			return GIT_EOBJCORRUPTED;
+	}
+
+	while (ent.type == GIT_OBJ_OFS_DELTA || ent.type == GIT_OBJ_REF_DELTA) {
+		/* a longer chain can only come from a delta loop */
+		if (++depth > p->obj_cnt)
+			return GIT_EPACKCORRUPTED;
+
+		if ((error = parse_pack_entry(&ent, p, ent.base_offset, 0)) < 0)
+			return error;
+	}
+
+	out->type = ent.type;
+	return GIT_SUCCESS;
+}
+
+static int unpack_object(git_rawobj *out, git_pack *p, index_entry *e)
+{
+	pack_entry ent, *chain = NULL;
+	size_t depth = 0, chain_alloc = 0;
+	git_rawobj base, res;
+	size_t base_alloc = 0, res_alloc = 0, delta_alloc = 0;
+	void *delta = NULL;
+	off_t base_offset;
+	int error;
+
+	assert(out && p && e && git__is_sizet(e->size));
+
+	out->data = NULL;
+	base.data = NULL;
+	res.data = NULL;
+
+	if (open_pack(p))
+		return GIT_ERROR;
+
+	if ((error = parse_pack_entry(&ent, p, e->offset, e->size)) < 0)
+		return error;
+
+	/*
+	 * Walk down the delta chain, remembering each delta, until
+	 * we reach either a whole object or a base we still have
+	 * in the delta base cache.
+	 */
+	while (ent.type == GIT_OBJ_OFS_DELTA || ent.type == GIT_OBJ_REF_DELTA) {
+		if (depth == chain_alloc) {
+			pack_entry *c;
+
+			/* a longer chain can only come from a delta loop */
+			if (depth > p->obj_cnt) {
+				error = GIT_EPACKCORRUPTED;
+				goto cleanup;
+			}
+
+			chain_alloc = alloc_nr(chain_alloc);
+			if ((c = git__realloc(chain, chain_alloc * sizeof(*c))) == NULL) {
+				error = GIT_ENOMEM;
+				goto cleanup;
+			}
+			chain = c;
+		}
+		chain[depth++] = ent;
+
+		if (delta_cache_take(&base, p, ent.base_offset) == GIT_SUCCESS) {
+			base_alloc = base.len + 1;
+			break;
+		}
+
+		if ((error = parse_pack_entry(&ent, p, ent.base_offset, 0)) < 0)
+			goto cleanup;
+	}
+
+	if (!base.data) {
+		if ((error = reserve_buffer(&base.data, &base_alloc, ent.size + 1)) < 0)
+			goto cleanup;
+
+		base.len = ent.size;
+		base.type = ent.type;
+		if (pack_inflate(p, &ent, base.data, base.len, 0) < 0) {
+			error = GIT_EOBJCORRUPTED;
+			goto cleanup;
+		}
+		((unsigned char *)base.data)[base.len] = '\0';
+	}
+
+	/*
+	 * Apply the deltas from the bottom of the chain upwards,
+	 * alternating between the base and result buffers.
+	 */
+	base_offset = depth ? chain[depth - 1].base_offset : ent.offset;
+
+	while (depth > 0) {
+		pack_entry *link = &chain[--depth];
+		size_t base_sz, res_sz;
+
+		if ((error = reserve_buffer(&delta, &delta_alloc, link->size)) < 0)
+			goto cleanup;
+
+		if (pack_inflate(p, link, delta, link->size, 0) < 0 ||
+			git__delta_read_header(&base_sz, &res_sz, delta, link->size) < 0 ||
+			base_sz != base.len) {
+			error = GIT_EOBJCORRUPTED;
+			goto cleanup;
+		}
+
+		if ((error = reserve_buffer(&res.data, &res_alloc, res_sz + 1)) < 0)
+			goto cleanup;
+
+		if (git__delta_apply_to(res.data, res_sz, base.data, base.len, delta, link->size) < 0) {
+			error = GIT_EOBJCORRUPTED;
+			goto cleanup;
+		}
+		((unsigned char *)res.data)[res_sz] = '\0';
+		res.len = res_sz;
+		res.type = base.type;
+
+		/*
+		 * The base is not needed anymore: keep it for later
+		 * reads in the delta base cache, or recycle its buffer
+		 * for the next result.
+		 */
+		if (delta_cache_put(p, base_offset, &base) == GIT_SUCCESS)
+			base_alloc = 0;
+
+		{
+			git_rawobj tmp = base;
+			size_t tmp_alloc = base_alloc;
+
+			base = res;
+			base_alloc = res_alloc;
+			res = tmp;
+			res_alloc = tmp_alloc;
+		}
+		base_offset = link->offset;
+	}
+
+	*out = base;
+	base.data = NULL;
+	error = GIT_SUCCESS;
+
+cleanup:
+	free(chain);
+	free(delta);
+	free(base.data);
+	free(res.data);
+	return error;
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * LOOSE OBJECT CACHE
+ *
+ * Remember the contents of the objects/xx directories, so
+ * that looking for a packed object does not need to stat()
+ * its loose path first.
+ * 
+ ***********************************************************/
+
+static void loose_cache_clear(loose_cache *c)
+{
+	size_t j;
+
+	for (j = 0; j < ARRAY_SIZE(c->fanout); j++) {
+		free(c->fanout[j].oids);
+		memset(&c->fanout[j], 0x0, sizeof(c->fanout[j]));
+	}
+}
+
+static int cmp_oid(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+struct loose_scan_state {
+	loose_fanout *f;
+	unsigned char first;
+};
+
+static int scan_one_loose(void *state, char *name)
+{
+	struct loose_scan_state *st = state;
+	loose_fanout *f = st->f;
+	char hex[GIT_OID_HEXSZ + 1];
+	char *s = strrchr(name, '/') + 1;
+	git_oid id;
+
+	if (strlen(s) != GIT_OID_HEXSZ - 2)
+		return 0;
+
+	sprintf(hex, "%02x%s", st->first, s);
+	if (git_oid_mkstr(&id, hex))
+		return 0;
+
+	if (f->n == f->alloc) {
+		size_t alloc = alloc_nr(f->alloc);
+		git_oid *oids = git__realloc(f->oids, alloc * sizeof(*oids));
+		if (!oids)
+			return GIT_ENOMEM;
+		f->oids = oids;
+		f->alloc = alloc;
+	}
+
+	git_oid_cpy(&f->oids[f->n++], &id);
+	return 0;
+}
+
+/*
+ * (Re)load the listing of the directory for id->id[0] if it
+ * has never been read, or if it changed since it was read.
+ * Must be called with the cache lock held.
+ */
+static loose_fanout *loose_cache_load(git_odb *db, const git_oid *id)
+{
+	loose_fanout *f = &db->loose.fanout[id->id[0]];
+	struct loose_scan_state state;
+	char pb[GIT_PATH_MAX];
+	struct stat sb;
+	time_t mtime = 0;
+
+	if (git__fmt(pb, sizeof(pb), "%s/%02x", db->objects_dir, id->id[0]) < 0)
+		return NULL;
+
+	if (gitfo_stat(pb, &sb) == 0)
+		mtime = sb.st_mtime;
+
+	/*
+	 * A directory modified in the same second it was scanned
+	 * may have changed after the scan without its mtime showing
+	 * it; never trust such a listing.
+	 */
+	if (f->loaded && f->mtime == mtime && f->mtime < f->scanned)
+		return f;
+
+	f->loaded = 0;
+	f->n = 0;
+	f->mtime = mtime;
+	f->scanned = time(NULL);
+
+	state.f = f;
+	state.first = id->id[0];
+	if (mtime && gitfo_dirent(pb, sizeof(pb), scan_one_loose, &state) < 0)
+		return NULL;
+
+	qsort(f->oids, f->n, sizeof(*f->oids), cmp_oid);
+	f->loaded = 1;
+	return f;
+}
+
+GIT_INLINE(int) loose_fanout_has(loose_fanout *f, const git_oid *id)
+{
+	return f->n && bsearch(id, f->oids, f->n, sizeof(*f->oids), cmp_oid) != NULL;
+}
+
+/*
+ * Look for id in the cached listing, without touching the
+ * filesystem unless the listing was never loaded.  When
+ * 'refresh' is set the directory is checked for changes.
+ */
+static int loose_cache_has(git_odb *db, const git_oid *id, int refresh)
+{
+	loose_fanout *f;
+	int found = 0;
+
+	gitlck_lock(&db->loose.lock);
+	f = &db->loose.fanout[id->id[0]];
+	if (!f->loaded || refresh)
+		f = loose_cache_load(db, id);
+	if (f)
+		found = loose_fanout_has(f, id);
+	gitlck_unlock(&db->loose.lock);
+
+	return found;
+}
+
+static void loose_cache_add(git_odb *db, const git_oid *id)
+{
+	loose_fanout *f;
+	size_t pos;
+
+	gitlck_lock(&db->loose.lock);
+	f = &db->loose.fanout[id->id[0]];
+
+	if (f->loaded && !loose_fanout_has(f, id)) {
+		if (f->n == f->alloc) {
+			size_t alloc = alloc_nr(f->alloc);
+			git_oid *oids = git__realloc(f->oids, alloc * sizeof(*oids));
+			if (!oids) {
+				f->loaded = 0;
+				gitlck_unlock(&db->loose.lock);
+				return;
+			}
+			f->oids = oids;
+			f->alloc = alloc;
+		}
+
+		for (pos = f->n; pos > 0 && git_oid_cmp(&f->oids[pos - 1], id) > 0; pos--)
+			;
+		memmove(&f->oids[pos + 1], &f->oids[pos], (f->n - pos) * sizeof(*f->oids));
+		git_oid_cpy(&f->oids[pos], id);
+		f->n++;
+	}
+
+	gitlck_unlock(&db->loose.lock);
+}
+
+/* Forget the listing for id's directory; it is read again on next use. */
+static void loose_cache_invalidate(git_odb *db, const git_oid *id)
+{
+	gitlck_lock(&db->loose.lock);
+	db->loose.fanout[id->id[0]].loaded = 0;
+	gitlck_unlock(&db->loose.lock);
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * EXISTS FILTER
+ *
+ * A Bloom filter of all the objects of the database, so that
+ * looking for a missing object does not need to search the
+ * loose directories and every pack index.
+ * 
+ ***********************************************************/
+
+static void exists_filter_clear(exists_filter *f)
+{
+	free(f->bits);
+	f->bits = NULL;
+	f->n_bits = 0;
+	f->count = 0;
+	f->capacity = 0;
+	free(f->stamps);
+	f->stamps = NULL;
+	f->n_stamps = 0;
+}
+
+/*
+ * Object ids are uniformly distributed already: two words of
+ * the id give the positions of the bits of an object.
+ */
+static void filter_bits(uint32_t *bits, const exists_filter *f, const git_oid *id)
+{
+	uint32_t h1 = decode32((void *)id->id), h2 = decode32((void *)(id->id + 4)) | 1;
+	int k;
+
+	for (k = 0; k < GIT_EXISTS_FILTER_HASHES; k++)
+		bits[k] = (h1 + k * h2) & (uint32_t)(f->n_bits - 1);
+}
+
+static void exists_filter_set(exists_filter *f, const git_oid *id)
+{
+	uint32_t bits[GIT_EXISTS_FILTER_HASHES];
+	int k;
+
+	filter_bits(bits, f, id);
+	for (k = 0; k < GIT_EXISTS_FILTER_HASHES; k++)
+		f->bits[bits[k] >> 5] |= 1u << (bits[k] & 31);
+	f->count++;
+}
+
+static int exists_filter_test(const exists_filter *f, const git_oid *id)
+{
+	uint32_t bits[GIT_EXISTS_FILTER_HASHES];
+	int k;
+
+	filter_bits(bits, f, id);
+	for (k = 0; k < GIT_EXISTS_FILTER_HASHES; k++)
+		if (!(f->bits[bits[k] >> 5] & (1u << (bits[k] & 31))))
+			return 0;
+	return 1;
+}
+
+/*
+ * Size the filter for 'count' objects and room to grow.  Must be
+ * called with the filter lock held.
+ */
+static int exists_filter_alloc(exists_filter *f, size_t count)
+{
+	size_t n_bits = 1024;
+
+	exists_filter_clear(f);
+
+	count = 2 * count + 1024;
+	while (n_bits / GIT_EXISTS_FILTER_BITS < count && n_bits < ((size_t)1 << 31))
+		n_bits <<= 1;
+
+	if ((f->bits = git__calloc(n_bits / 32, sizeof(*f->bits))) == NULL)
+		return GIT_ENOMEM;
+
+	f->n_bits = n_bits;
+	f->capacity = n_bits / GIT_EXISTS_FILTER_BITS;
+	return GIT_SUCCESS;
+}
+
+/*
+ * Record an object added to the database.  The filter is
+ * dropped when full, and built again on next use.
+ */
+static void exists_filter_add(git_odb *db, const git_oid *id)
+{
+	exists_filter *f = &db->filter;
+
+	gitlck_lock(&f->lock);
+	if (f->bits) {
+		if (f->count < f->capacity)
+			exists_filter_set(f, id);
+		else
+			exists_filter_clear(f);
+	}
+	gitlck_unlock(&f->lock);
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * BULK IMPORT
+ *
+ * Append written objects to a new pack instead of creating
+ * a loose file for each, and index the pack when done
+ * 
+ ***********************************************************/
+
+GIT_INLINE(size_t) import_slot(pack_import *imp, const git_oid *id)
+{
+	return decode32((void *)id->id) & (imp->n_slots - 1);
+}
+
+static int import_idx_search(uint32_t *out, git_pack *p, const git_oid *id)
+{
+	pack_import *imp = p->import;
+	int error = GIT_ENOTFOUND;
+	size_t j;
+
+	gitlck_lock(&imp->lock);
+	for (j = import_slot(imp, id); imp->n && imp->slots[j]; j = (j + 1) & (imp->n_slots - 1)) {
+		uint32_t n = imp->slots[j] - 1;
+		if (!git_oid_cmp(&imp->entries[n].oid, id)) {
+			*out = n;
+			error = GIT_SUCCESS;
+			break;
+		}
+	}
+	gitlck_unlock(&imp->lock);
+	return error;
+}
+
+static off_t import_idx_offset(git_pack *p, uint32_t n)
+{
+	return p->import->entries[n].offset;
+}
+
+static int import_idx_get(index_entry *e, git_pack *p, uint32_t n)
+{
+	pack_import *imp = p->import;
+	int error = GIT_ENOTFOUND;
+
+	gitlck_lock(&imp->lock);
+	if (n < imp->n) {
+		e->n = n;
+		e->oid = imp->entries[n].oid.id;
+		e->offset = imp->entries[n].offset;
+		e->size = (n + 1 < imp->n ? imp->entries[n + 1].offset : imp->end) - e->offset;
+		error = GIT_SUCCESS;
+	}
+	gitlck_unlock(&imp->lock);
+	return error;
+}
+
+/* Record an entry, growing the hash table to stay half empty. */
+static int import_add(pack_import *imp, const git_oid *id, off_t offset, uint32_t crc)
+{
+	size_t j;
+
+	if (imp->n == imp->alloc) {
+		size_t alloc = alloc_nr(imp->alloc);
+		pack_idx_entry *e = git__realloc(imp->entries, alloc * sizeof(*e));
+		if (!e)
+			return GIT_ENOMEM;
+		imp->entries = e;
+		imp->alloc = alloc;
+	}
+
+	if (2 * (imp->n + 1) > imp->n_slots) {
+		size_t n_slots = imp->n_slots ? 2 * imp->n_slots : 1024;
+		uint32_t *slots = git__calloc(n_slots, sizeof(*slots));
+		if (!slots)
+			return GIT_ENOMEM;
+
+		free(imp->slots);
+		imp->slots = slots;
+		imp->n_slots = n_slots;
+		for (j = 0; j < imp->n; j++) {
+			size_t k = import_slot(imp, &imp->entries[j].oid);
+			while (slots[k])
+				k = (k + 1) & (n_slots - 1);
+			slots[k] = (uint32_t)j + 1;
+		}
+	}
+
+	git_oid_cpy(&imp->entries[imp->n].oid, id);
+	imp->entries[imp->n].offset = offset;
+	imp->entries[imp->n].crc = crc;
+
+	for (j = import_slot(imp, id); imp->slots[j]; j = (j + 1) & (imp->n_slots - 1))
+		/* nothing */;
+	imp->slots[j] = (uint32_t)++imp->n;
+	return GIT_SUCCESS;
+}
+
+static git_pack *import_get(git_odb *db)
+{
+	git_pack *p;
+
+	gitlck_lock(&db->lock);
+	if ((p = db->import) != NULL)
+		pack_inc(p);
+	gitlck_unlock(&db->lock);
+
+	return p;
+}
+
+static int import_search(git_pack **p, uint32_t *n, git_odb *db, const git_oid *id)
+{
+	git_pack *pack;
+
+	if ((pack = import_get(db)) == NULL)
+		return GIT_ENOTFOUND;
+
+	if (import_idx_search(n, pack, id) < GIT_SUCCESS) {
+		pack_dec(pack);
+		return GIT_ENOTFOUND;
+	}
+
+	*p = pack;
+	return GIT_SUCCESS;
+}
+
+/*
+ * Append obj to the pack as an undeltified entry.  A zeroed
+ * trailer is kept past the last entry, so that the file always
+ * looks like a complete pack to the readers.
+ */
+static int import_write(git_pack *p, const git_oid *id, git_rawobj *obj, int level)
+{
+	pack_import *imp = p->import;
+	unsigned char hdr[16], trailer[GIT_OID_RAWSZ];
+	gitfo_buf buf = GITFO_BUF_INIT;
+	size_t hdrlen;
+	uint32_t crc;
+	int error;
+
+	hdrlen = pack_entry_header(hdr, obj->type, obj->len);
+	if ((error = deflate_data(&buf, obj->data, obj->len, level)) < GIT_SUCCESS)
+		return error;
+
+	crc = crc32(0, Z_NULL, 0);
+	crc = crc32(crc, hdr, hdrlen);
+	crc = crc32(crc, buf.data, buf.len);
+	memset(trailer, 0x0, sizeof(trailer));
+
+	gitlck_lock(&imp->lock);
+
+	if (imp->sealed)
+		error = GIT_EBUSY;
+	else if (gitfo_lseek(p->pack_fd, imp->end, SEEK_SET) == -1
+		|| gitfo_write(p->pack_fd, hdr, hdrlen) < 0
+		|| gitfo_write(p->pack_fd, buf.data, buf.len) < 0
+		|| gitfo_write(p->pack_fd, trailer, sizeof(trailer)) < 0)
+		error = GIT_EOSERR;
+	else
+		error = import_add(imp, id, imp->end, crc);
+
+	if (error == GIT_SUCCESS) {
+		imp->end += hdrlen + buf.len;
+		p->obj_cnt = (uint32_t)imp->n;
+		p->pack_size = imp->end + GIT_OID_RAWSZ;
+	}
+
+	gitlck_unlock(&imp->lock);
+	gitfo_free_buf(&buf);
+
+	if (error == GIT_SUCCESS)
+		exists_filter_add(p->db, id);
+	return error;
+}
+
+/* Stop p from taking objects, unless somebody else did already. */
+static int import_seal(git_pack *p)
+{
+	pack_import *imp = p->import;
+	int error = GIT_SUCCESS;
+
+	gitlck_lock(&imp->lock);
+	if (imp->sealed)
+		error = GIT_EBUSY;
+	imp->sealed = 1;
+	gitlck_unlock(&imp->lock);
+
+	return error;
+}
+
+static int import_begin(git_odb *db)
+{
+	char path[GIT_PATH_MAX];
+	unsigned char hdr[12 + GIT_OID_RAWSZ];
+	pack_import *imp;
+	git_pack *p;
+	git_file fd;
+
+	if ((imp = git__calloc(1, sizeof(*imp))) == NULL)
+		return GIT_ENOMEM;
+	gitlck_init(&imp->lock);
+
+	if (git__fmt(path, sizeof(path), "%s/pack/pack", db->objects_dir) < 0
+		|| make_temp_file(&fd, imp->tmp_path, sizeof(imp->tmp_path), path) < 0) {
+		gitlck_free(&imp->lock);
+		free(imp);
+		return GIT_EOSERR;
+	}
+
+	/* the object count is filled in when committing */
+	memset(hdr, 0x0, sizeof(hdr));
+	encode32(encode32(hdr, PACK_SIG), 2);
+
+	if (gitfo_write(fd, hdr, sizeof(hdr)) < 0
+		|| (p = alloc_pack(strrchr(imp->tmp_path, '/') + 1)) == NULL) {
+		gitfo_close(fd);
+		gitfo_unlink(imp->tmp_path);
+		gitlck_free(&imp->lock);
+		free(imp);
+		return GIT_EOSERR;
+	}
+
+	imp->end = 12;
+	p->db = db;
+	p->import = imp;
+	p->pack_fd = fd;
+	p->pack_size = imp->end + GIT_OID_RAWSZ;
+	p->idx_search = import_idx_search;
+	p->idx_offset = import_idx_offset;
+	p->idx_get = import_idx_get;
+
+	db->import = p;
+	return GIT_SUCCESS;
+}
+
+/*
+ * Finish the sealed pack of an import: fill in its header and
+ * trailer, write its index and give it its final name.  The
+ * entries stay as they are, for the readers still using them.
+ */
+static int import_finish(git_odb *db, git_pack *p)
+{
+	pack_import *imp = p->import;
+	char path[GIT_PATH_MAX], name[GIT_PACK_NAME_MAX];
+	unsigned char *buf, cnt[4];
+	pack_idx_entry *entries;
+	git_hash_ctx *ctx;
+	git_oid pack_id;
+	off_t pos;
+	int error = GIT_SUCCESS;
+
+	encode32(cnt, (uint32_t)imp->n);
+	if (gitfo_lseek(p->pack_fd, 8, SEEK_SET) == -1
+		|| gitfo_write(p->pack_fd, cnt, sizeof(cnt)) < 0)
+		return GIT_EOSERR;
+
+	if ((buf = git__malloc(GIT_STREAM_BUFSIZE)) == NULL)
+		return GIT_ENOMEM;
+	if ((ctx = git_hash_new_ctx()) == NULL) {
+		free(buf);
+		return GIT_ENOMEM;
+	}
+
+	if (gitfo_lseek(p->pack_fd, 0, SEEK_SET) == -1)
+		error = GIT_EOSERR;
+	for (pos = 0; error == GIT_SUCCESS && pos < imp->end; ) {
+		size_t len = GIT_STREAM_BUFSIZE;
+		if ((off_t)len > imp->end - pos)
+			len = (size_t)(imp->end - pos);
+		if (gitfo_read(p->pack_fd, buf, len) < 0)
+			error = GIT_EOSERR;
+		git_hash_update(ctx, buf, len);
+		pos += len;
+	}
+	git_hash_final(&pack_id, ctx);
+	git_hash_free_ctx(ctx);
+	free(buf);
+
+	if (error < GIT_SUCCESS
+		|| gitfo_write(p->pack_fd, pack_id.id, GIT_OID_RAWSZ) < 0)
+		return GIT_EOSERR;
+
+	if (db->fsync_object_files)
+		gitfo_fsync(p->pack_fd);
+
+	strcpy(name, "pack-");
+	git_oid_fmt(name + 5, &pack_id);
+	name[5 + GIT_OID_HEXSZ] = '\0';
+
+	if (git__fmt(path, sizeof(path), "%s/pack/%s.pack", db->objects_dir, name) < 0)
+		return GIT_ERROR;
+
+	/* idx_write() sorts the entries it is given */
+	if ((entries = git__malloc(imp->n * sizeof(*entries))) == NULL)
+		return GIT_ENOMEM;
+	memcpy(entries, imp->entries, imp->n * sizeof(*entries));
+
+	/* the index goes first: without its pack it is never used */
+	error = idx_write(db, name, entries, imp->n, &pack_id);
+	free(entries);
+	if (error < GIT_SUCCESS)
+		return error;
+
+	gitfo_chmod(imp->tmp_path, 0444);
+	if (gitfo_move_file(imp->tmp_path, path) < 0) {
+		if (git__fmt(path, sizeof(path), "%s/pack/%s.idx", db->objects_dir, name) == GIT_SUCCESS)
+			gitfo_unlink(path);
+		return GIT_EOSERR;
+	}
+
+	return GIT_SUCCESS;
+}
+
+/*
+ * Put the pack of an import in place, with its index, and make
+ * the pack list show it.  The readers keep finding the objects
+ * through db->import until then.
+ */
+static int import_commit(git_odb *db, git_pack *p)
+{
+	git_packlist *pl, *fresh;
+	int error;
+
+	if (p->import->n == 0) {
+		gitfo_unlink(p->import->tmp_path);
+		return GIT_SUCCESS;
+	}
+
+	if ((error = import_finish(db, p)) < GIT_SUCCESS) {
+		gitfo_unlink(p->import->tmp_path);
+		return error;
+	}
+
+	if ((pl = packlist_get(db)) == NULL)
+		return GIT_SUCCESS;
+	if ((fresh = packlist_refresh(db, pl)) != NULL)
+		packlist_dec(db, fresh);
+	packlist_dec(db, pl);
+
+	return GIT_SUCCESS;
+}
+
+/* Detach the import pack p from db, and drop the reference of db. */
+static void import_end(git_odb *db, git_pack *p)
+{
+	int detached = 0;
+
+	gitlck_lock(&db->lock);
+	if (db->import == p) {
+		db->import = NULL;
+		detached = 1;
+	}
+	gitlck_unlock(&db->lock);
+
+	if (detached)
+		pack_dec(p);
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * PACK INDEXING
+ *
+ * Build the index of a pack coming from elsewhere
+ * 
+ ***********************************************************/
+
+typedef struct {  /* an object of the pack being indexed */
+	pack_idx_entry e;   /* offset and crc; the id once resolved */
+	git_otype type;     /* type as recorded in the entry header */
+	size_t size;        /* inflated size of the entry data */
+	off_t data_offset;  /* position of the deflated entry data */
+} index_object;
+
+typedef struct {  /* an ofs-delta, by the offset of its base */
+	off_t base_offset;
+	uint32_t n;
+} index_ofs_link;
+
+typedef struct {  /* a ref-delta, by the id of its base */
+	git_oid base_id;
+	uint32_t n;
+} index_ref_link;
+
+typedef struct {  /* the state shared by the indexing threads */
+	git_lck lock;
+	git_pack *pack;
+	index_object *objects;
+	uint32_t n;
+	off_t end;               /* end of the last entry */
+	index_ofs_link *ofs;     /* sorted by base offset */
+	uint32_t n_ofs;
+	index_ref_link *ref;     /* sorted by base id */
+	uint32_t n_ref;
+	uint32_t next;           /* next object to be taken by a thread */
+	uint32_t n_resolved;     /* number of deltas resolved */
+	int error;
+} index_pack;
+
+typedef struct {  /* sequential reader over the pack being indexed */
+	git_file fd;
+	off_t base;              /* position of buf[0] in the pack */
+	off_t end;               /* position of the pack trailer */
+	size_t pos, len, mark;   /* bytes up to mark are checksummed */
+	git_hash_ctx *ctx;       /* checksum of the pack so far */
+	uint32_t crc;            /* crc32 of the current entry so far */
+	unsigned char buf[GIT_STREAM_BUFSIZE];
+} pack_reader;
+
+static void reader_flush(pack_reader *r)
+{
+	git_hash_update(r->ctx, r->buf + r->mark, r->pos - r->mark);
+	r->crc = crc32(r->crc, r->buf + r->mark, (uInt)(r->pos - r->mark));
+	r->mark = r->pos;
+}
+
+static int reader_fill(pack_reader *r)
+{
+	size_t len = sizeof(r->buf);
+
+	if (r->pos < r->len)
+		return GIT_SUCCESS;
+
+	reader_flush(r);
+	r->base += r->len;
+	r->pos = r->len = r->mark = 0;
+
+	if ((off_t)len > r->end - r->base)
+		len = (size_t)(r->end - r->base);
+	if (len == 0 || gitfo_read(r->fd, r->buf, len) < 0)
+		return GIT_EPACKCORRUPTED;
+
+	r->len = len;
+	return GIT_SUCCESS;
+}
+
+static int reader_byte(unsigned char *out, pack_reader *r)
+{
+	if (reader_fill(r) < 0)
+		return GIT_EPACKCORRUPTED;
+	*out = r->buf[r->pos++];
+	return GIT_SUCCESS;
+}
+
+/*
+ * Read the entry at the current position of the reader, which
+ * is the n'th object of the pack.  Whole objects are hashed on
+ * the way, and deltas are recorded to be resolved later.
+ */
+static int index_scan_entry(index_pack *ip, pack_reader *r, uint32_t n,
+		git_hash_ctx *ctx, unsigned char *out)
+{
+	index_object *obj = &ip->objects[n];
+	unsigned char c;
+	size_t shift = 4;
+	z_stream zs;
+	int status;
+
+	r->crc = crc32(0, Z_NULL, 0);
+	obj->e.offset = r->base + r->pos;
+
+	if (reader_byte(&c, r) < 0)
+		return GIT_EPACKCORRUPTED;
+	obj->type = (c >> 4) & 0x7;
+	obj->size = c & 0xF;
+
+	while (c & 0x80) {
+		if (sizeof(size_t) * 8 <= shift || reader_byte(&c, r) < 0)
+			return GIT_EPACKCORRUPTED;
+		obj->size += (size_t)(c & 0x7F) << shift;
+		shift += 7;
+	}
+
+	switch (obj->type) {
+	case GIT_OBJ_OFS_DELTA: {
+		index_ofs_link *link = &ip->ofs[ip->n_ofs++];
+		off_t delta_offset;
+
+		if (reader_byte(&c, r) < 0)
+			return GIT_EPACKCORRUPTED;
+		delta_offset = c & 0x7F;
+
+		while (c & 0x80) {
+			if (reader_byte(&c, r) < 0)
+				return GIT_EPACKCORRUPTED;
+			delta_offset += 1;
+			delta_offset <<= 7;
+			delta_offset += (c & 0x7F);
+		}
+
+		if (delta_offset <= 0 || delta_offset >= obj->e.offset)
+			return GIT_EPACKCORRUPTED;
+		link->base_offset = obj->e.offset - delta_offset;
+		link->n = n;
+		break;
+	}
+
+	case GIT_OBJ_REF_DELTA: {
+		index_ref_link *link = &ip->ref[ip->n_ref++];
+		size_t j;
+
+		for (j = 0; j < GIT_OID_RAWSZ; j++)
+			if (reader_byte(&link->base_id.id[j], r) < 0)
+				return GIT_EPACKCORRUPTED;
+		link->n = n;
+		break;
+	}
+
+	case GIT_OBJ_COMMIT:
+	case GIT_OBJ_TREE:
+	case GIT_OBJ_BLOB:
+	case GIT_OBJ_TAG: {
+		char hdr[64];
+		git_rawobj o;
+		int hdrlen;
+
+		o.type = obj->type;
+		o.len = obj->size;
+		if ((hdrlen = format_object_header(hdr, sizeof(hdr), &o)) < 0)
+			return GIT_ERROR;
+
+		git_hash_init(ctx);
+		git_hash_update(ctx, hdr, hdrlen);
+		break;
+	}
+
+	default:
+		return GIT_EOBJCORRUPTED;
+	}
+
+	obj->data_offset = r->base + r->pos;
+
+	init_stream(&zs, NULL, 0);
+	if (inflateInit(&zs) < Z_OK)
+		return GIT_EZLIB;
+
+	do {
+		size_t avail;
+
+		if (reader_fill(r) < 0) {
+			inflateEnd(&zs);
+			return GIT_EPACKCORRUPTED;
+		}
+
+		avail = r->len - r->pos;
+		set_stream_input(&zs, r->buf + r->pos, avail);
+		set_stream_output(&zs, out, GIT_STREAM_BUFSIZE);
+		status = inflate(&zs, Z_NO_FLUSH);
+		r->pos += avail - zs.avail_in;
+
+		if (obj->type != GIT_OBJ_OFS_DELTA && obj->type != GIT_OBJ_REF_DELTA)
+			git_hash_update(ctx, out, GIT_STREAM_BUFSIZE - zs.avail_out);
+	} while (status == Z_OK);
+
+	inflateEnd(&zs);
+
+	if (status != Z_STREAM_END || zs.total_out != obj->size)
+		return GIT_EOBJCORRUPTED;
+
+	reader_flush(r);
+	obj->e.crc = r->crc;
+
+	if (obj->type != GIT_OBJ_OFS_DELTA && obj->type != GIT_OBJ_REF_DELTA)
+		git_hash_final(&obj->e.oid, ctx);
+
+	return GIT_SUCCESS;
+}
+
+/*
+ * Read the whole pack once, checking its header and trailer and
+ * finding the bounds of each entry.
+ */
+static int index_scan(git_oid *pack_id, index_pack *ip, git_file fd, off_t size)
+{
+	unsigned char hdr[12], *out = NULL;
+	git_hash_ctx *ctx = NULL;
+	pack_reader *r;
+	git_oid trailer;
+	uint32_t j;
+	int error = GIT_SUCCESS;
+
+	if ((r = git__calloc(1, sizeof(*r))) == NULL)
+		return GIT_ENOMEM;
+
+	r->fd = fd;
+	r->end = size - GIT_OID_RAWSZ;
+	r->crc = crc32(0, Z_NULL, 0);
+
+	if ((r->ctx = git_hash_new_ctx()) == NULL
+		|| (ctx = git_hash_new_ctx()) == NULL
+		|| (out = git__malloc(GIT_STREAM_BUFSIZE)) == NULL) {
+		error = GIT_ENOMEM;
+		goto cleanup;
+	}
+
+	for (j = 0; j < sizeof(hdr); j++)
+		if (reader_byte(&hdr[j], r) < 0) {
+			error = GIT_EPACKCORRUPTED;
+			goto cleanup;
+		}
+	reader_flush(r);
+
+	if (decode32(hdr) != PACK_SIG
+		|| (decode32(hdr + 4) != 2 && decode32(hdr + 4) != 3)) {
+		error = GIT_EPACKCORRUPTED;
+		goto cleanup;
+	}
+
+	/* each entry takes at least two bytes */
+	ip->n = decode32(hdr + 8);
+	if ((off_t)ip->n > (r->end - 12) / 2) {
+		error = GIT_EPACKCORRUPTED;
+		goto cleanup;
+	}
+
+	if ((ip->objects = git__calloc(ip->n + 1, sizeof(*ip->objects))) == NULL
+		|| (ip->ofs = git__malloc((ip->n + 1) * sizeof(*ip->ofs))) == NULL
+		|| (ip->ref = git__malloc((ip->n + 1) * sizeof(*ip->ref))) == NULL) {
+		error = GIT_ENOMEM;
+		goto cleanup;
+	}
+
+	for (j = 0; j < ip->n && error == GIT_SUCCESS; j++)
+		error = index_scan_entry(ip, r, j, ctx, out);
+	if (error < GIT_SUCCESS)
+		goto cleanup;
+
+	/* nothing may follow the last entry but the trailer */
+	ip->end = r->base + r->pos;
+	if (ip->end != r->end) {
+		error = GIT_EPACKCORRUPTED;
+		goto cleanup;
+	}
+
+	reader_flush(r);
+	git_hash_final(pack_id, r->ctx);
+
+	if (gitfo_lseek(fd, r->end, SEEK_SET) == -1
+		|| gitfo_read(fd, trailer.id, GIT_OID_RAWSZ) < 0
+		|| git_oid_cmp(pack_id, &trailer))
+		error = GIT_EPACKCORRUPTED;
+
+cleanup:
+	if (r->ctx)
+		git_hash_free_ctx(r->ctx);
+	if (ctx)
+		git_hash_free_ctx(ctx);
+	free(out);
+	free(r);
+	return error;
+}
+
+static int cmp_ofs_link(const void *lhs, const void *rhs)
+{
+	const index_ofs_link *a = lhs;
+	const index_ofs_link *b = rhs;
+
+	if (a->base_offset != b->base_offset)
+		return a->base_offset < b->base_offset ? -1 : 1;
+	return a->n < b->n ? -1 : a->n > b->n;
+}
+
+static int cmp_ref_link(const void *lhs, const void *rhs)
+{
+	const index_ref_link *a = lhs;
+	const index_ref_link *b = rhs;
+	int cmp = git_oid_cmp(&a->base_id, &b->base_id);
+
+	if (cmp)
+		return cmp;
+	return a->n < b->n ? -1 : a->n > b->n;
+}
+
+/* the first ofs-delta based on the object at offset */
+static uint32_t index_find_ofs(index_pack *ip, off_t offset)
+{
+	uint32_t lo = 0, hi = ip->n_ofs;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) >> 1;
+		if (ip->ofs[mid].base_offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* the first ref-delta based on the object id */
+static uint32_t index_find_ref(index_pack *ip, const git_oid *id)
+{
+	uint32_t lo = 0, hi = ip->n_ref;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) >> 1;
+		if (git_oid_cmp(&ip->ref[mid].base_id, id) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int index_has_deltas(index_pack *ip, index_object *obj)
+{
+	uint32_t j = index_find_ofs(ip, obj->e.offset);
+	uint32_t k = index_find_ref(ip, &obj->e.oid);
+
+	return (j < ip->n_ofs && ip->ofs[j].base_offset == obj->e.offset)
+		|| (k < ip->n_ref && !git_oid_cmp(&ip->ref[k].base_id, &obj->e.oid));
+}
+
+static int index_inflate(void **out, index_pack *ip, uint32_t n)
+{
+	index_object *obj = &ip->objects[n];
+	off_t next = n + 1 < ip->n ? ip->objects[n + 1].e.offset : ip->end;
+	pack_entry ent;
+
+	ent.offset = obj->e.offset;
+	ent.type = obj->type;
+	ent.size = obj->size;
+	ent.data_offset = obj->data_offset;
+	ent.data_len = (size_t)(next - obj->data_offset);
+	ent.base_offset = 0;
+
+	if ((*out = git__malloc(obj->size + 1)) == NULL)
+		return GIT_ENOMEM;
+
+	if (pack_inflate(ip->pack, &ent, *out, obj->size, 0) < 0) {
+		free(*out);
+		*out = NULL;
+		return GIT_EOBJCORRUPTED;
+	}
+	((unsigned char *)*out)[obj->size] = '\0';
+	return GIT_SUCCESS;
+}
+
+typedef struct {  /* an inflated object, while deltas based on it wait */
+	git_rawobj data;
+	uint32_t refcnt;         /* deltas left to resolve against it */
+} index_base;
+
+typedef struct {  /* a delta to resolve, and its base */
+	uint32_t n;
+	index_base *base;
+} index_work;
+
+typedef struct {  /* the deltas waiting in one thread, as a stack */
+	index_work *items;
+	size_t n, alloc;
+} index_worklist;
+
+static void index_base_put(index_base *base)
+{
+	if (--base->refcnt)
+		return;
+	free(base->data.data);
+	free(base);
+}
+
+static int index_work_push(index_worklist *w, uint32_t n, index_base *base)
+{
+	if (w->n == w->alloc) {
+		size_t alloc = alloc_nr(w->alloc);
+		index_work *items = git__realloc(w->items, alloc * sizeof(*items));
+		if (!items)
+			return GIT_ENOMEM;
+		w->items = items;
+		w->alloc = alloc;
+	}
+
+	w->items[w->n].n = n;
+	w->items[w->n].base = base;
+	w->n++;
+	base->refcnt++;
+	return GIT_SUCCESS;
+}
+
+/*
+ * Queue the deltas based on obj, whose inflated data is handed
+ * over; the data is freed once they are all resolved, or now if
+ * there are none.
+ */
+static int index_push_deltas(index_worklist *w, index_pack *ip, index_object *obj, git_rawobj *data)
+{
+	index_base *base;
+	uint32_t j;
+	int error = GIT_SUCCESS;
+
+	if ((base = git__malloc(sizeof(*base))) == NULL) {
+		free(data->data);
+		return GIT_ENOMEM;
+	}
+	base->data = *data;
+	base->refcnt = 1;  /* held until all the deltas are queued */
+
+	for (j = index_find_ofs(ip, obj->e.offset);
+			error == GIT_SUCCESS && j < ip->n_ofs && ip->ofs[j].base_offset == obj->e.offset; j++)
+		error = index_work_push(w, ip->ofs[j].n, base);
+
+	for (j = index_find_ref(ip, &obj->e.oid);
+			error == GIT_SUCCESS && j < ip->n_ref && !git_oid_cmp(&ip->ref[j].base_id, &obj->e.oid); j++)
+		error = index_work_push(w, ip->ref[j].n, base);
+
+	index_base_put(base);
+	return error;
+}
+
+/* Apply the delta n to its base, and find the id of the result. */
+static int index_resolve_delta(git_rawobj *res, index_pack *ip, uint32_t n, git_rawobj *base)
+{
+	index_object *obj = &ip->objects[n];
+	size_t base_sz, res_sz;
+	void *delta;
+	char hdr[64];
+	int hdrlen, error;
+
+	gitlck_lock(&ip->lock);
+	error = ip->error;
+	gitlck_unlock(&ip->lock);
+	if (error < GIT_SUCCESS)
+		return error;
+
+	if ((error = index_inflate(&delta, ip, n)) < GIT_SUCCESS)
+		return error;
+
+	if (git__delta_read_header(&base_sz, &res_sz, delta, obj->size) < 0
+		|| base_sz != base->len) {
+		free(delta);
+		return GIT_EOBJCORRUPTED;
+	}
+
+	if ((res->data = git__malloc(res_sz + 1)) == NULL) {
+		free(delta);
+		return GIT_ENOMEM;
+	}
+
+	if (git__delta_apply_to(res->data, res_sz, base->data, base->len, delta, obj->size) < 0) {
+		free(delta);
+		free(res->data);
+		return GIT_EOBJCORRUPTED;
+	}
+	free(delta);
+
+	((unsigned char *)res->data)[res_sz] = '\0';
+	res->len = res_sz;
+	res->type = base->type;
+
+	if ((error = hash_obj(&obj->e.oid, hdr, sizeof(hdr), &hdrlen, res)) < GIT_SUCCESS)
+		free(res->data);
+	return error;
+}
+
+/*
+ * Resolve the deltas based on obj, whose inflated data is handed
+ * over, then theirs, and so on.  The deltas wait on a heap stack
+ * rather than in recursive calls, as a chain may be as long as
+ * the pack; taking the newest first keeps only the bases with
+ * deltas still waiting in memory.
+ */
+static int index_resolve_deltas(index_pack *ip, index_object *obj, git_rawobj *data, uint32_t *resolved)
+{
+	index_worklist w = { NULL, 0, 0 };
+	int error;
+
+	error = index_push_deltas(&w, ip, obj, data);
+
+	while (error == GIT_SUCCESS && w.n) {
+		index_work work = w.items[--w.n];
+		git_rawobj res;
+
+		error = index_resolve_delta(&res, ip, work.n, &work.base->data);
+		index_base_put(work.base);
+
+		if (error == GIT_SUCCESS) {
+			(*resolved)++;
+			error = index_push_deltas(&w, ip, &ip->objects[work.n], &res);
+		}
+	}
+
+	while (w.n)
+		index_base_put(w.items[--w.n].base);
+	free(w.items);
+	return error;
+}
+
+/*
+ * Take the whole objects of the pack one at a time, and resolve
+ * the deltas based on each of them.  Runs in each thread.
+ */
+static void *index_worker(void *arg)
+{
+	index_pack *ip = arg;
+	uint32_t resolved = 0;
+
+	for (;;) {
+		index_object *obj;
+		git_rawobj data;
+		int error;
+
+		gitlck_lock(&ip->lock);
+		if (ip->error < GIT_SUCCESS || ip->next == ip->n) {
+			gitlck_unlock(&ip->lock);
+			break;
+		}
+		obj = &ip->objects[ip->next++];
+		gitlck_unlock(&ip->lock);
+
+		if (obj->type == GIT_OBJ_OFS_DELTA || obj->type == GIT_OBJ_REF_DELTA
+			|| !index_has_deltas(ip, obj))
+			continue;
+
+		data.type = obj->type;
+		data.len = obj->size;
+		if ((error = index_inflate(&data.data, ip, (uint32_t)(obj - ip->objects))) == GIT_SUCCESS)
+			error = index_resolve_deltas(ip, obj, &data, &resolved);
+
+		if (error < GIT_SUCCESS) {
+			gitlck_lock(&ip->lock);
+			if (ip->error == GIT_SUCCESS)
+				ip->error = error;
+			gitlck_unlock(&ip->lock);
+		}
+	}
+
+	gitlck_lock(&ip->lock);
+	ip->n_resolved += resolved;
+	gitlck_unlock(&ip->lock);
+	return NULL;
+}
+
+static void index_run_workers(index_pack *ip)
+{
+#ifdef GIT_THREADS
+	int n_threads = git_online_cpus(), j, started = 0;
+	git_thread *threads = NULL;
+
+	if (n_threads > 1 && ip->n_ofs + ip->n_ref > 1)
+		threads = git__calloc(n_threads - 1, sizeof(*threads));
+
+	/* the calling thread is one of the workers */
+	if (threads)
+		for (; started < n_threads - 1; started++)
+			if (git_thread_create(&threads[started], index_worker, ip))
+				break;
+
+	index_worker(ip);
+
+	for (j = 0; j < started; j++)
+		git_thread_join(threads[j]);
+	free(threads);
+#else
+	index_worker(ip);
+#endif
+}
+
+static int index_pack_file(git_oid *pack_id, index_pack *ip, git_odb *db, git_file fd)
+{
+	off_t size;
+	int error;
+
+	if ((size = gitfo_size(fd)) < 12 + GIT_OID_RAWSZ)
+		return GIT_EPACKCORRUPTED;
+
+	if ((error = index_scan(pack_id, ip, fd, size)) < GIT_SUCCESS)
+		return error;
+
+	qsort(ip->ofs, ip->n_ofs, sizeof(*ip->ofs), cmp_ofs_link);
+	qsort(ip->ref, ip->n_ref, sizeof(*ip->ref), cmp_ref_link);
+
+	if ((ip->pack = alloc_pack("tmp_pack")) == NULL)
+		return GIT_ENOMEM;
+	ip->pack->db = db;
+	ip->pack->pack_fd = fd;
+	ip->pack->pack_size = size;
+
+	index_run_workers(ip);
+
+	if (ip->error < GIT_SUCCESS)
+		return ip->error;
+
+	/* deltas against missing objects, as in thin packs */
+	if (ip->n_resolved != ip->n_ofs + ip->n_ref)
+		return GIT_EPACKCORRUPTED;
+
+	return GIT_SUCCESS;
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * PACK WRITING
+ *
+ * Write a set of objects to a new pack, storing each one as
+ * a delta against a similar object where that saves space
+ * 
+ ***********************************************************/
+
+typedef struct {  /* an object to be written to a new pack */
+	git_oid id;
+	git_otype type;
+	size_t size;
+	void *delta;         /* delta against the base, if any */
+	size_t delta_len;
+	size_t base;         /* index of the base, if a delta */
+	unsigned int depth;  /* number of deltas down to a whole object */
+	off_t offset;        /* where the entry was written */
+} pack_object;
+
+typedef struct {  /* the state shared by the delta search threads */
+	git_lck lock;
+	git_odb *db;
+	pack_object *objects;
+	size_t n;
+	unsigned int window;
+	unsigned int depth;
+	int error;
+} pack_builder;
+
+typedef struct {  /* the objects searched by one thread */
+	pack_builder *pb;
+	size_t start, end;
+} delta_search;
+
+typedef struct {  /* a candidate base in the search window */
+	pack_object *obj;
+	git_rawobj data;
+	git__delta_index *index;
+} delta_window_entry;
+
+typedef struct {  /* the new pack file */
+	gitfo_cache *out;
+	git_hash_ctx *ctx;
+	off_t offset;
+	uint32_t crc;   /* crc32 of the current entry */
+} pack_output;
+
+static int cmp_pack_object_id(const void *lhs, const void *rhs)
+{
+	const pack_object *a = lhs;
+	const pack_object *b = rhs;
+	return git_oid_cmp(&a->id, &b->id);
+}
+
+/* bring similar objects together: same type, then close sizes */
+static int cmp_pack_object(const void *lhs, const void *rhs)
+{
+	const pack_object *a = lhs;
+	const pack_object *b = rhs;
+
+	if (a->type != b->type)
+		return a->type < b->type ? -1 : 1;
+	if (a->size != b->size)
+		return a->size > b->size ? -1 : 1;
+	return git_oid_cmp(&a->id, &b->id);
+}
+
+static void window_entry_clear(delta_window_entry *w)
+{
+	git__delta_free_index(w->index);
+	git_obj_close(&w->data);
+	w->index = NULL;
+	w->obj = NULL;
+}
+
+/*
+ * Find the best delta for 'cur' against the objects kept in the
+ * window.  Only deltas smaller than half the object are worth
+ * it; each base tried must beat the best delta found so far.
+ */
+static int delta_search_one(pack_builder *pb, delta_window_entry *win, size_t pos,
+		delta_window_entry *cur)
+{
+	pack_object *obj = cur->obj;
+	size_t max_len = obj->size / 2 > 20 ? obj->size / 2 - 20 : 0;
+	unsigned int k;
+
+	for (k = 1; max_len > 0 && k < pb->window; k++) {
+		delta_window_entry *base = &win[(pos + pb->window - k) % pb->window];
+		void *delta;
+		size_t len;
+		int error;
+
+		if (!base->obj || base->obj->type != obj->type || base->obj->depth >= pb->depth)
+			continue;
+
+		/* a much smaller base has too little in common */
+		if (base->data.len < obj->size / 32)
+			continue;
+
+		/* bases too large to index are not used */
+		if (!base->index
+			&& (base->index = git__delta_create_index(base->data.data, base->data.len)) == NULL)
+			continue;
+
+		error = git__delta_create(&delta, &len, base->index, cur->data.data, cur->data.len, max_len);
+		if (error == GIT_ENOTFOUND)
+			continue;
+		if (error < GIT_SUCCESS)
+			return error;
+
+		free(obj->delta);
+		obj->delta = delta;
+		obj->delta_len = len;
+		obj->base = base->obj - pb->objects;
+		obj->depth = base->obj->depth + 1;
+		max_len = len - 1;
+	}
+
+	return GIT_SUCCESS;
+}
+
+/*
+ * Slide a window over a range of the sorted objects, trying
+ * each object as a delta of those before it.  Runs in each
+ * thread, over a range of its own.
+ */
+static void *delta_search_worker(void *arg)
+{
+	delta_search *ds = arg;
+	pack_builder *pb = ds->pb;
+	delta_window_entry *win;
+	size_t j, pos = 0;
+	int error = GIT_SUCCESS;
+
+	if ((win = git__calloc(pb->window, sizeof(*win))) == NULL)
+		error = GIT_ENOMEM;
+
+	for (j = ds->start; error == GIT_SUCCESS && j < ds->end; j++) {
+		delta_window_entry *cur = &win[pos];
+
+		gitlck_lock(&pb->lock);
+		error = pb->error;
+		gitlck_unlock(&pb->lock);
+		if (error < GIT_SUCCESS)
+			break;
+
+		window_entry_clear(cur);
+		if ((error = git_odb_read(&cur->data, pb->db, &pb->objects[j].id)) < GIT_SUCCESS)
+			break;
+		cur->obj = &pb->objects[j];
+
+		error = delta_search_one(pb, win, pos, cur);
+		pos = (pos + 1) % pb->window;
+	}
+
+	if (win) {
+		for (j = 0; j < pb->window; j++)
+			window_entry_clear(&win[j]);
+		free(win);
+	}
+
+	if (error < GIT_SUCCESS) {
+		gitlck_lock(&pb->lock);
+		if (pb->error == GIT_SUCCESS)
+			pb->error = error;
+		gitlck_unlock(&pb->lock);
+	}
+	return NULL;
+}
+
+static int delta_search_run(pack_builder *pb)
+{
+	size_t n_threads = 1, j, started = 0;
+	delta_search *ds;
+
+#ifdef GIT_THREADS
+	git_thread *threads = NULL;
+
+	/* short ranges would lose too many deltas at their edges */
+	n_threads = git_online_cpus();
+	if (n_threads > pb->n / (4 * pb->window))
+		n_threads = pb->n / (4 * pb->window);
+	if (n_threads < 1)
+		n_threads = 1;
+#endif
+
+	if ((ds = git__calloc(n_threads, sizeof(*ds))) == NULL)
+		return GIT_ENOMEM;
+
+	for (j = 0; j < n_threads; j++) {
+		ds[j].pb = pb;
+		ds[j].start = pb->n * j / n_threads;
+		ds[j].end = pb->n * (j + 1) / n_threads;
+	}
+
+#ifdef GIT_THREADS
+	/* the calling thread searches the first range */
+	if (n_threads > 1 && (threads = git__calloc(n_threads - 1, sizeof(*threads))) != NULL)
+		for (; started < n_threads - 1; started++)
+			if (git_thread_create(&threads[started], delta_search_worker, &ds[started + 1]))
+				break;
+#endif
+
+	delta_search_worker(&ds[0]);
+
+	/* ranges no thread could be started for */
+	for (j = started + 1; j < n_threads; j++)
+		delta_search_worker(&ds[j]);
+
+#ifdef GIT_THREADS
+	for (j = 0; j < started; j++)
+		git_thread_join(threads[j]);
+	free(threads);
+#endif
+
+	free(ds);
+	return pb->error;
+}
+
+static int pack_output_write(pack_output *o, const void *data, size_t len)
+{
+	if (gitfo_write_cached(o->out, (void *)data, len) < 0)
+		return GIT_EOSERR;
+
+	git_hash_update(o->ctx, data, len);
+	o->crc = crc32(o->crc, data, (uInt)len);
+	o->offset += len;
+	return GIT_SUCCESS;
+}
+
+static int pack_output_object(pack_output *o, pack_builder *pb, pack_object *obj, pack_idx_entry *e)
+{
+	unsigned char hdr[32];
+	gitfo_buf buf = GITFO_BUF_INIT;
+	size_t hdrlen;
+	int error;
+
+	obj->offset = o->offset;
+	o->crc = crc32(0, Z_NULL, 0);
+
+	if (obj->delta) {
+		off_t ofs = obj->offset - pb->objects[obj->base].offset;
+		unsigned char ofs_buf[10];
+		size_t pos = sizeof(ofs_buf) - 1;
+
+		ofs_buf[pos] = ofs & 0x7F;
+		while (ofs >>= 7)
+			ofs_buf[--pos] = 0x80 | (--ofs & 0x7F);
+
+		hdrlen = pack_entry_header(hdr, GIT_OBJ_OFS_DELTA, obj->delta_len);
+		memcpy(hdr + hdrlen, ofs_buf + pos, sizeof(ofs_buf) - pos);
+		hdrlen += sizeof(ofs_buf) - pos;
+
+		error = deflate_data(&buf, obj->delta, obj->delta_len, pb->db->object_zlib_level);
+	} else {
+		git_rawobj data;
+
+		if ((error = git_odb_read(&data, pb->db, &obj->id)) < GIT_SUCCESS)
+			return error;
+
+		hdrlen = pack_entry_header(hdr, obj->type, data.len);
+		error = deflate_data(&buf, data.data, data.len, pb->db->object_zlib_level);
+		git_obj_close(&data);
+	}
+
+	if (error < GIT_SUCCESS)
+		return error;
+
+	if ((error = pack_output_write(o, hdr, hdrlen)) == GIT_SUCCESS)
+		error = pack_output_write(o, buf.data, buf.len);
+	gitfo_free_buf(&buf);
+
+	git_oid_cpy(&e->oid, &obj->id);
+	e->offset = obj->offset;
+	e->crc = o->crc;
+	return error;
+}
+
+/*
+ * Write the objects, in their sorted order, to a temporary
+ * pack file.  Bases come before their deltas in that order.
+ */
+static int pack_output_all(git_oid *pack_id, pack_builder *pb, pack_idx_entry *entries,
+		git_file fd)
+{
+	unsigned char hdr[12];
+	pack_output o;
+	size_t j;
+	int error;
+
+	memset(&o, 0x0, sizeof(o));
+	if ((o.ctx = git_hash_new_ctx()) == NULL)
+		return GIT_ENOMEM;
+	if ((o.out = gitfo_enable_caching(fd, 64 * 1024)) == NULL) {
+		git_hash_free_ctx(o.ctx);
+		return GIT_ENOMEM;
+	}
+
+	encode32(encode32(encode32(hdr, PACK_SIG), 2), (uint32_t)pb->n);
+	error = pack_output_write(&o, hdr, sizeof(hdr));
+
+	for (j = 0; error == GIT_SUCCESS && j < pb->n; j++)
+		error = pack_output_object(&o, pb, &pb->objects[j], &entries[j]);
+
+	if (error == GIT_SUCCESS) {
+		git_hash_final(pack_id, o.ctx);
+		if (gitfo_write_cached(o.out, pack_id->id, GIT_OID_RAWSZ) < 0
+			|| gitfo_flush_cached(o.out) < 0)
+			error = GIT_EOSERR;
+	}
+
+	if (error == GIT_SUCCESS && pb->db->fsync_object_files)
+		gitfo_fsync(fd);
+
+	if (gitfo_close_cached(o.out) < 0 && error == GIT_SUCCESS)
+		error = GIT_EOSERR;
+	git_hash_free_ctx(o.ctx);
+	return error;
+}
+
+/*
+ * Sort the objects and drop the duplicates, reading the type
+ * and size of each.
+ */
+static int pack_builder_init(pack_builder *pb, git_odb *db, const git_oid *ids, size_t n)
+{
+	size_t j, k;
+
+	if ((pb->objects = git__calloc(n + 1, sizeof(*pb->objects))) == NULL)
+		return GIT_ENOMEM;
+
+	for (j = 0; j < n; j++)
+		git_oid_cpy(&pb->objects[j].id, &ids[j]);
+	qsort(pb->objects, n, sizeof(*pb->objects), cmp_pack_object_id);
+
+	for (j = 0, k = 0; j < n; j++) {
+		git_rawobj hdr;
+		int error;
+
+		if (k > 0 && !git_oid_cmp(&pb->objects[k - 1].id, &pb->objects[j].id))
+			continue;
+
+		if ((error = git_odb_read_header(&hdr, db, &pb->objects[j].id)) < GIT_SUCCESS)
+			return error;
+
+		git_oid_cpy(&pb->objects[k].id, &pb->objects[j].id);
+		pb->objects[k].type = hdr.type;
+		pb->objects[k].size = hdr.len;
+		k++;
+	}
+
+	pb->n = k;
+	qsort(pb->objects, pb->n, sizeof(*pb->objects), cmp_pack_object);
+	return GIT_SUCCESS;
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * ODB OBJECT READING & WRITING
+ *
+ * Backend for the public API; read headers and full objects
+ * from the ODB. Write raw data to the ODB.
+ * 
+ ***********************************************************/
+
+/* Alternate databases, shared by every database borrowing from them. */
+static git_lck shared_alternates_lock = GITLCK_INIT;
+static git_odb *shared_alternates;
+
+/*
+ * Collapse "//", "/./" and "dir/../" in path, and strip any
+ * trailing '/', so that a directory is always named the same.
+ */
+static int normalize_dir(char *out, size_t n, const char *path)
+{
+	size_t len = 0, root = 0;
+	const char *p = path;
+
+	if (strlen(path) >= n)
+		return GIT_ERROR;
+
+	if (*p == '/') {
+		out[len++] = *p++;
+		root = 1;
+	}
+
+	while (*p) {
+		const char *end = strchr(p, '/');
+		size_t seg = end ? (size_t)(end - p) : strlen(p);
+
+		if (seg == 0 || (seg == 1 && p[0] == '.'))
+			/* nothing */;
+		else if (seg == 2 && p[0] == '.' && p[1] == '.' && len > root
+			&& !(len - root >= 2 && out[len - 1] == '.' && out[len - 2] == '.'
+				&& (len - root == 2 || out[len - 3] == '/'))) {
+			while (len > root && out[len - 1] != '/')
+				len--;
+			if (len > root)
+				len--;
+		} else {
+			if (len > root)
+				out[len++] = '/';
+			memcpy(out + len, p, seg);
+			len += seg;
+		}
+
+		p += seg;
+		if (*p)
+			p++;
+	}
+
+	if (len == 0)
+		out[len++] = '.';
+	out[len] = '\0';
+	return GIT_SUCCESS;
+}
+
+/*
+ * Identify the directory 'dir', which must be normalized, by its
+ * device and inode numbers: the same objects directory is often
+ * reached through symbolic links, or from repositories listing
+ * it with different relative paths.
+ */
+static int dir_key_get(dir_key *key, const char *dir)
+{
+	struct stat st;
+
+	if (gitfo_stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+		return GIT_ENOTFOUND;
+
+	key->dev = st.st_dev;
+	key->ino = st.st_ino;
+	key->path = dir;
+	return GIT_SUCCESS;
+}
+
+static int dir_key_equal(const dir_key *a, const dir_key *b)
+{
+	if (a->dev != b->dev || a->ino != b->ino)
+		return 0;
+
+	/* some filesystems, and win32, report no inode numbers */
+	return a->ino || !strcmp(a->path, b->path);
+}
+
+/*
+ * Get the shared database for the objects directory 'dir', which
+ * must be normalized.  Shared databases do not search alternates
+ * of their own: whoever borrows from them lists those as well.
+ */
+static int alternate_get(git_odb **out, const char *dir)
+{
+	git_odb *db;
+	dir_key key;
+	int error;
+
+	if (dir_key_get(&key, dir) < 0)
+		return GIT_ENOTFOUND;
+
+	gitlck_lock(&shared_alternates_lock);
+
+	for (db = shared_alternates; db; db = db->shared_next)
+		if (dir_key_equal(&db->shared_key, &key))
+			break;
+
+	if (!db) {
+		if ((error = git_odb_open(&db, dir)) < 0) {
+			gitlck_unlock(&shared_alternates_lock);
+			return error;
+		}
+		db->shared_key = key;
+		db->shared_key.path = db->objects_dir;
+
+		if ((db->alternates = git__calloc(1, sizeof(*db->alternates))) == NULL) {
+			git_odb_close(db);
+			gitlck_unlock(&shared_alternates_lock);
+			return GIT_ENOMEM;
+		}
+
+		db->shared_next = shared_alternates;
+		shared_alternates = db;
+	}
+
+	db->shared_refcnt++;
+	gitlck_unlock(&shared_alternates_lock);
+
+	*out = db;
+	return GIT_SUCCESS;
+}
+
+static void alternate_release(git_odb *db)
+{
+	int need_free = 0;
+
+	gitlck_lock(&shared_alternates_lock);
+	if (!--db->shared_refcnt) {
+		git_odb **pdb;
+
+		for (pdb = &shared_alternates; *pdb != db; pdb = &(*pdb)->shared_next)
+			/* nothing */;
+		*pdb = db->shared_next;
+		need_free = 1;
+	}
+	gitlck_unlock(&shared_alternates_lock);
+
+	if (need_free)
+		git_odb_close(db);
+}
+
+/*
+ * Add the alternates listed in objects_dir/info/alternates to
+ * db, followed by their own alternates, up to a nesting depth
+ * of GIT_ALTERNATES_MAX_DEPTH.  Missing directories, and the
+ * ones already known, are skipped.
+ */
+static int add_alternates(git_odb *db, const dir_key *self,
+		const char *objects_dir, int depth, size_t *alloc)
+{
+	char pb[GIT_PATH_MAX], dir[GIT_PATH_MAX];
+	gitfo_buf buf = GITFO_BUF_INIT;
+	char *line, *next, *end;
+	int error = GIT_SUCCESS;
+
+	if (depth > GIT_ALTERNATES_MAX_DEPTH)
+		return GIT_SUCCESS;
+
+	if (git__fmt(pb, sizeof(pb), "%s/info/alternates", objects_dir) < 0)
+		return GIT_ERROR;
+
+	if (gitfo_exists(pb) || gitfo_read_file(&buf, pb) < 0)
+		return GIT_SUCCESS;
+
+	end = (char *)buf.data + buf.len;
+	for (line = buf.data; line < end && error == GIT_SUCCESS; line = next) {
+		git_odb *alt;
+		dir_key key;
+		size_t len, j;
+
+		if ((next = memchr(line, '\n', end - line)) == NULL)
+			next = end;
+		len = next - line;
+		*next++ = '\0';
+
+		if (len && line[len - 1] == '\r')
+			line[--len] = '\0';
+		if (!len || line[0] == '#')
+			continue;
+
+		if (line[0] == '/' || (len > 2 && line[1] == ':'))
+			error = git__fmt(pb, sizeof(pb), "%s", line);
+		else
+			error = git__fmt(pb, sizeof(pb), "%s/%s", objects_dir, line);
+		if (error < 0 || normalize_dir(dir, sizeof(dir), pb) < 0
+			|| dir_key_get(&key, dir) < 0) {
+			error = GIT_SUCCESS;
+			continue;
+		}
+		error = GIT_SUCCESS;
+
+		if (dir_key_equal(&key, self))
+			continue;
+		for (j = 0; j < db->n_alternates; j++)
+			if (dir_key_equal(&db->alternates[j]->shared_key, &key))
+				break;
+		if (j < db->n_alternates || alternate_get(&alt, dir) < 0)
+			continue;
+
+		if (db->n_alternates + 1 >= *alloc) {
+			size_t new_alloc = alloc_nr(*alloc);
+			git_odb **a = git__realloc(db->alternates, new_alloc * sizeof(*a));
+
+			if (!a) {
+				alternate_release(alt);
+				error = GIT_ENOMEM;
+				break;
+			}
+			db->alternates = a;
+			*alloc = new_alloc;
+		}
+		db->alternates[db->n_alternates++] = alt;
+		db->alternates[db->n_alternates] = NULL;
+
+		error = add_alternates(db, self, alt->objects_dir, depth + 1, alloc);
+	}
+
+	gitfo_free_buf(&buf);
+	return error;
+}
+
+/* Load the alternates of db, the first time it is called. */
+static int open_alternates(git_odb *db)
+{
+	char self[GIT_PATH_MAX];
+	dir_key self_key;
+	size_t alloc = 0;
+	int error = GIT_SUCCESS;
+
+	gitlck_lock(&db->lock);
+	if (db->alternates) {
+		gitlck_unlock(&db->lock);
+		return GIT_SUCCESS;
+	}
+
+	/* a directory gone since opening has no alternates either */
+	if (normalize_dir(self, sizeof(self), db->objects_dir) < 0)
+		error = GIT_ERROR;
+	else if (dir_key_get(&self_key, self) == GIT_SUCCESS
+		&& add_alternates(db, &self_key, db->objects_dir, 1, &alloc) < 0)
+		error = GIT_ERROR;
+
+	if (!db->alternates) {
+		/* remember that there are none */
+		if ((db->alternates = git__calloc(1, sizeof(*db->alternates))) == NULL)
+			error = GIT_ENOMEM;
+	}
+
+	gitlck_unlock(&db->lock);
+	return error;
+}
+
+/* Look for id in db itself, ignoring its alternates. */
+static int locate_local(obj_location *location, git_odb *db, const git_oid *id)
+{
+	location->db = db;
+
+	if (object_file_name(location->loose_path, GIT_PATH_MAX, db->objects_dir, id) != GIT_SUCCESS)
+		return GIT_ENOTFOUND;
+
+	if (db->loose.enabled) {
+		/*
+		 * Trust the cached listing, and search the packs
+		 * before checking whether the directory changed.
+		 */
+		if (loose_cache_has(db, id, 0))
+			return OBJ_LOCATION_LOOSE;
+
+		if (search_packs(&location->pack.ptr, &location->pack.n, db, id) == GIT_SUCCESS
+			|| import_search(&location->pack.ptr, &location->pack.n, db, id) == GIT_SUCCESS)
+			return OBJ_LOCATION_INPACK;
+
+		if (loose_cache_has(db, id, 1))
+			return OBJ_LOCATION_LOOSE;
+
+	} else {
+		if (gitfo_exists(location->loose_path) == 0)
+			return OBJ_LOCATION_LOOSE;
+
+		if (search_packs(&location->pack.ptr, &location->pack.n, db, id) == GIT_SUCCESS
+			|| import_search(&location->pack.ptr, &location->pack.n, db, id) == GIT_SUCCESS)
+			return OBJ_LOCATION_INPACK;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+/*
+ * Find where id is stored.  For a packed object, the caller gets
+ * a reference on the pack, which read_packed() and
+ * read_header_packed() release.
+ */
+static int locate_object(obj_location *location, git_odb *db, const git_oid *id)
+{
+	size_t j;
+	int found;
+
+	memset(location, 0x0, sizeof(obj_location));
+
+	if ((found = locate_local(location, db, id)) != GIT_ENOTFOUND)
+		return found;
+
+	if (open_alternates(db) < GIT_SUCCESS)
+		return GIT_ENOTFOUND;
+
+	for (j = 0; j < db->n_alternates; j++)
+		if ((found = locate_local(location, db->alternates[j], id)) != GIT_ENOTFOUND)
+			return found;
+
+	return GIT_ENOTFOUND;
+}
+
+typedef struct {  /* the objects matching an abbreviated id */
+	git_oid prefix;   /* zero-padded */
+	size_t len;       /* number of hex digits in prefix */
+	git_oid found;
+	int n_found;      /* distinct matches, up to 2 */
+} prefix_search;
+
+static int prefix_cmp(const prefix_search *s, const unsigned char *id)
+{
+	size_t n = s->len / 2;
+	int cmp = memcmp(s->prefix.id, id, n);
+
+	if (!cmp && (s->len & 1))
+		cmp = (int)s->prefix.id[n] - (int)(id[n] & 0xf0);
+	return cmp;
+}
+
+static void prefix_add(prefix_search *s, const unsigned char *id)
+{
+	if (prefix_cmp(s, id))
+		return;
+
+	if (!s->n_found) {
+		git_oid_mkraw(&s->found, id);
+		s->n_found = 1;
+	} else if (memcmp(s->found.id, id, GIT_OID_RAWSZ))
+		s->n_found = 2;
+}
+
+/*
+ * The matches of a pack follow the first index entry not below
+ * the prefix, within the fanout range of its first byte.
+ */
+static void prefix_search_pack(prefix_search *s, git_pack *p)
+{
+	unsigned char first = s->prefix.id[0];
+	uint32_t lo, hi;
+	index_entry e;
+
+	if (pack_openidx(p))
+		return;
+
+	lo = first ? p->im_fanout[first - 1] : 0;
+	hi = p->im_fanout[first];
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (p->idx_get(&e, p, mid) < 0)
+			break;
+		if (prefix_cmp(s, e.oid) > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	while (s->n_found < 2 && p->idx_get(&e, p, lo++) == GIT_SUCCESS && !prefix_cmp(s, e.oid))
+		prefix_add(s, e.oid);
+
+	pack_decidx(p);
+}
+
+static void prefix_search_packlist(prefix_search *s, git_packlist *pl)
+{
+	size_t j;
+
+	for (j = 0; s->n_found < 2 && j < pl->n_packs; j++)
+		prefix_search_pack(s, pl->packs[j]);
+}
+
+/* Look for the objects matching the prefix in db, but not its alternates. */
+static int prefix_search_local(prefix_search *s, git_odb *db)
+{
+	struct loose_scan_state state;
+	char pb[GIT_PATH_MAX];
+	git_packlist *pl, *fresh;
+	loose_fanout lf;
+	git_pack *p;
+	size_t j;
+	int error;
+
+	/* loose objects: only the directory of the first byte */
+	memset(&lf, 0x0, sizeof(lf));
+	state.f = &lf;
+	state.first = s->prefix.id[0];
+	if (git__fmt(pb, sizeof(pb), "%s/%02x", db->objects_dir, (unsigned int)state.first) < 0)
+		return GIT_ERROR;
+	if (gitfo_isdir(pb) == 0
+		&& (error = gitfo_dirent(pb, sizeof(pb), scan_one_loose, &state)) < GIT_SUCCESS) {
+		free(lf.oids);
+		return error;
+	}
+	for (j = 0; j < lf.n; j++)
+		prefix_add(s, lf.oids[j].id);
+	free(lf.oids);
+
+	if ((pl = packlist_get(db)) != NULL) {
+		prefix_search_packlist(s, pl);
+
+		/*
+		 * A pack created after pl was scanned may hold the object,
+		 * or another one which makes the prefix ambiguous.
+		 */
+		if (s->n_found < 2 && (fresh = packlist_refresh(db, pl)) != NULL) {
+			packlist_dec(db, pl);
+			pl = fresh;
+			prefix_search_packlist(s, pl);
+		}
+		packlist_dec(db, pl);
+	}
+
+	if ((p = import_get(db)) != NULL) {
+		gitlck_lock(&p->import->lock);
+		for (j = 0; s->n_found < 2 && j < p->import->n; j++)
+			prefix_add(s, p->import->entries[j].oid.id);
+		gitlck_unlock(&p->import->lock);
+		pack_dec(p);
+	}
+
+	return GIT_SUCCESS;
+}
+
+static int foreach_pack(git_pack *p, unsigned int flags,
+		int (*fn)(void *payload, const git_oid *id), void *payload)
+{
+	uint32_t j;
+	int error = GIT_SUCCESS;
+
+	/* skipping the pack would silently leave out its objects */
+	if (pack_openidx(p))
+		return GIT_EPACKCORRUPTED;
+
+	for (j = 0; error == GIT_SUCCESS && j < p->obj_cnt; j++) {
+		uint32_t n = (flags & GIT_ODB_FOREACH_PACK_ORDER) ? pack_pos_to_index(p, j) : j;
+		index_entry e;
+		git_oid id;
+
+		if (p->idx_get(&e, p, n) < 0) {
+			error = GIT_EPACKCORRUPTED;
+			break;
+		}
+		git_oid_mkraw(&id, e.oid);
+		error = fn(payload, &id);
+	}
+
+	pack_decidx(p);
+	return error;
+}
+
+static int foreach_loose(git_odb *db,
+		int (*fn)(void *payload, const git_oid *id), void *payload)
+{
+	loose_fanout lf;
+	size_t j, k;
+	int error = GIT_SUCCESS;
+
+	memset(&lf, 0x0, sizeof(lf));
+	for (j = 0; error == GIT_SUCCESS && j < 256; j++) {
+		struct loose_scan_state state;
+		char pb[GIT_PATH_MAX];
+
+		if (git__fmt(pb, sizeof(pb), "%s/%02x", db->objects_dir, (unsigned int)j) < 0) {
+			error = GIT_ERROR;
+			break;
+		}
+		if (gitfo_isdir(pb) < 0)
+			continue;
+
+		lf.n = 0;
+		state.f = &lf;
+		state.first = (unsigned char)j;
+		if ((error = gitfo_dirent(pb, sizeof(pb), scan_one_loose, &state)) < GIT_SUCCESS)
+			break;
+
+		if (lf.n)
+			qsort(lf.oids, lf.n, sizeof(*lf.oids), cmp_oid);
+		for (k = 0; error == GIT_SUCCESS && k < lf.n; k++)
+			error = fn(payload, &lf.oids[k]);
+	}
+	free(lf.oids);
+
+	return error;
+}
+
+/* Add the objects of db, loose and packed, to the filter. */
+static int exists_filter_scan(exists_filter *f, git_odb *db, int count_only, size_t *count)
+{
+	git_packlist *pl, *fresh;
+	git_pack *p;
+	loose_fanout lf;
+	size_t j;
+	int error = GIT_SUCCESS;
+
+	if ((pl = packlist_get(db)) == NULL)
+		return GIT_ERROR;
+
+	/* the filter is built again when a pack was added */
+	if ((fresh = packlist_refresh(db, pl)) != NULL) {
+		packlist_dec(db, pl);
+		pl = fresh;
+	}
+
+	for (j = 0; error == GIT_SUCCESS && j < pl->n_packs; j++) {
+		uint32_t k;
+
+		p = pl->packs[j];
+		if (pack_openidx(p))
+			continue;
+
+		*count += p->obj_cnt;
+		for (k = 0; !count_only && k < p->obj_cnt; k++) {
+			index_entry e;
+			git_oid id;
+
+			if (p->idx_get(&e, p, k) < 0) {
+				error = GIT_EPACKCORRUPTED;
+				break;
+			}
+			git_oid_mkraw(&id, e.oid);
+			exists_filter_set(f, &id);
+		}
+		pack_decidx(p);
+	}
+	packlist_dec(db, pl);
+
+	if ((p = import_get(db)) != NULL) {
+		gitlck_lock(&p->import->lock);
+		*count += p->import->n;
+		for (j = 0; !count_only && j < p->import->n; j++)
+			exists_filter_set(f, &p->import->entries[j].oid);
+		gitlck_unlock(&p->import->lock);
+		pack_dec(p);
+	}
+
+	memset(&lf, 0x0, sizeof(lf));
+	for (j = 0; error == GIT_SUCCESS && j < 256; j++) {
+		struct loose_scan_state state;
+		char pb[GIT_PATH_MAX];
+		size_t k;
+
+		if (git__fmt(pb, sizeof(pb), "%s/%02x", db->objects_dir, (unsigned int)j) < 0) {
+			error = GIT_ERROR;
+			break;
+		}
+		if (gitfo_isdir(pb) < 0)
+			continue;
+
+		lf.n = 0;
+		state.f = &lf;
+		state.first = (unsigned char)j;
+		if ((error = gitfo_dirent(pb, sizeof(pb), scan_one_loose, &state)) < GIT_SUCCESS)
+			break;
+
+		*count += lf.n;
+		for (k = 0; !count_only && k < lf.n; k++)
+			exists_filter_set(f, &lf.oids[k]);
+	}
+	free(lf.oids);
+
+	return error;
+}
+
+static time_t loose_dir_mtime(git_odb *db, unsigned int first)
+{
+	char pb[GIT_PATH_MAX];
+	struct stat sb;
+
+	if (git__fmt(pb, sizeof(pb), "%s/%02x", db->objects_dir, first) < 0
+		|| gitfo_stat(pb, &sb) < 0)
+		return 0;
+	return sb.st_mtime;
+}
+
+/*
+ * Remember the mtimes of the directories which get new objects,
+ * before the filter is filled: objects/pack of db and of each
+ * alternate, and the loose directories of the alternates, which
+ * other databases write into.  The loose objects written to db
+ * itself go through this database, or another process.
+ */
+static int exists_filter_stamp(exists_filter *f, git_odb *db)
+{
+	size_t j;
+	unsigned int k;
+
+	f->n_stamps = 1 + db->n_alternates;
+	if ((f->stamps = git__calloc(f->n_stamps, sizeof(*f->stamps))) == NULL)
+		return GIT_ENOMEM;
+
+	f->built = time(NULL);
+	f->stamps[0].pack_mtime = pack_dir_mtime(db);
+
+	for (j = 0; j < db->n_alternates; j++) {
+		exists_stamp *st = &f->stamps[j + 1];
+
+		st->pack_mtime = pack_dir_mtime(db->alternates[j]);
+		for (k = 0; k < 256; k++)
+			st->loose_mtime[k] = loose_dir_mtime(db->alternates[j], k);
+	}
+
+	return GIT_SUCCESS;
+}
+
+/* see loose_cache_load() for why the same second is not trusted */
+GIT_INLINE(int) stamp_check(const exists_filter *f, int res, time_t then, time_t now)
+{
+	int c = now != then ? STAMP_CHANGED : then >= f->built ? STAMP_UNSURE : STAMP_SAME;
+	return c > res ? c : res;
+}
+
+/*
+ * Whether objects may have been added, where id would be, since
+ * the filter was built.  Must be called with the filter lock held.
+ */
+static int exists_filter_changed(git_odb *db, const git_oid *id)
+{
+	exists_filter *f = &db->filter;
+	unsigned int first = id->id[0];
+	int res;
+	size_t j;
+
+	res = stamp_check(f, STAMP_SAME, f->stamps[0].pack_mtime, pack_dir_mtime(db));
+
+	for (j = 0; res != STAMP_CHANGED && j < db->n_alternates; j++) {
+		exists_stamp *st = &f->stamps[j + 1];
+		git_odb *alt = db->alternates[j];
+
+		res = stamp_check(f, res, st->pack_mtime, pack_dir_mtime(alt));
+		res = stamp_check(f, res, st->loose_mtime[first], loose_dir_mtime(alt, first));
+	}
+
+	return res;
+}
+
+/*
+ * Build the filter of db from its objects and the ones of its
+ * alternates.  Must be called with the filter lock held.
+ */
+static int exists_filter_build(git_odb *db)
+{
+	exists_filter *f = &db->filter;
+	size_t count = 0, j;
+	int pass, error = GIT_SUCCESS;
+
+	if (open_alternates(db) < GIT_SUCCESS)
+		return GIT_ERROR;
+
+	/* count the objects first, to size the filter */
+	for (pass = 0; error == GIT_SUCCESS && pass < 2; pass++) {
+		if (pass == 1 && ((error = exists_filter_alloc(f, count)) < GIT_SUCCESS
+				|| (error = exists_filter_stamp(f, db)) < GIT_SUCCESS))
+			break;
+
+		error = exists_filter_scan(f, db, !pass, &count);
+		for (j = 0; error == GIT_SUCCESS && j < db->n_alternates; j++)
+			error = exists_filter_scan(f, db->alternates[j], !pass, &count);
+	}
+
+	if (error < GIT_SUCCESS)
+		exists_filter_clear(f);
+	return error;
+}
+
+/*
+ * Whether id is certainly not in db, as its filter says.  False
+ * when the filter is disabled or cannot be built.  When a pack
+ * or an alternate changed since the filter was built, it is
+ * built again; while that cannot be told, id is looked for.
+ */
+static int exists_filter_excludes(git_odb *db, const git_oid *id)
+{
+	exists_filter *f = &db->filter;
+	int excluded = 0;
+
+	gitlck_lock(&f->lock);
+	if (f->enabled && (f->bits || exists_filter_build(db) == GIT_SUCCESS)
+		&& !exists_filter_test(f, id)) {
+		switch (exists_filter_changed(db, id)) {
+		case STAMP_SAME:
+			excluded = 1;
+			break;
+		case STAMP_UNSURE:
+			/* building again once the second is over settles it */
+			if (time(NULL) == f->built)
+				break;
+			/* fall through */
+		case STAMP_CHANGED:
+			if (exists_filter_build(db) == GIT_SUCCESS)
+				excluded = !exists_filter_test(f, id);
+			break;
+		}
+	}
+	gitlck_unlock(&f->lock);
+
+	return excluded;
+}
+
+static int read_packed(git_rawobj *out, const obj_location *loc)
+{
+	index_entry e;
+	int res;
+
+	assert(out && loc);
+
+	if (pack_openidx(loc->pack.ptr)) {
+		pack_dec(loc->pack.ptr);
+		return GIT_EPACKCORRUPTED;
+	}
+
+	res = loc->pack.ptr->idx_get(&e, loc->pack.ptr, loc->pack.n);
+
+	if (!res)
+		res = unpack_object(out, loc->pack.ptr, &e);
+
+	pack_decidx(loc->pack.ptr);
+	pack_dec(loc->pack.ptr);
+
+	return res;
+}
+
+static int read_header_packed(git_rawobj *out, const obj_location *loc)
+{
+	index_entry e;
+	int res;
+
+	assert(out && loc);
+
+	if (pack_openidx(loc->pack.ptr)) {
+		pack_dec(loc->pack.ptr);
+		return GIT_EPACKCORRUPTED;
+	}
+
+	if (loc->pack.ptr->idx_get(&e, loc->pack.ptr, loc->pack.n) < 0)
+		res = GIT_ENOTFOUND;
+	else
+		res = unpack_object_header(out, loc->pack.ptr, &e);
+
+	pack_decidx(loc->pack.ptr);
+	pack_dec(loc->pack.ptr);
+
+	return res;
+}
+
+static int read_loose(git_rawobj *out, git_odb *db, const obj_location *loc)
+{
+	int error;
+	gitfo_buf obj = GITFO_BUF_INIT;
+
+	assert(out && db && loc);
+
+	out->data = NULL;
+	out->len  = 0;
+	out->type = GIT_OBJ_BAD;
+
+	if (gitfo_read_file(&obj, loc->loose_path) < 0)
+		return GIT_ENOTFOUND;
+
+	error = inflate_disk_obj(out, &obj);
+	gitfo_free_buf(&obj);
+
+	return error;
+}
+
+static int read_header_loose(git_rawobj *out, git_odb *db, const obj_location *loc)
+{
+	int error = GIT_SUCCESS, z_return = Z_ERRNO, read_bytes;
+	git_file fd;
+	z_stream zs;
+	obj_hdr header_obj;
+	unsigned char raw_buffer[16], inflated_buffer[64];
+
+	assert(out && db && loc);
+
+	out->data = NULL;
+
+	if ((fd = gitfo_open(loc->loose_path, O_RDONLY)) < 0)
+		return GIT_ENOTFOUND;
+
+	init_stream(&zs, inflated_buffer, sizeof(inflated_buffer));
+
+	if (inflateInit(&zs) < Z_OK) {
+		error = GIT_EZLIB;
+		goto cleanup;
+	}
+
+	do {
+		if ((read_bytes = read(fd, raw_buffer, sizeof(raw_buffer))) > 0) {
+			set_stream_input(&zs, raw_buffer, read_bytes);
+			z_return = inflate(&zs, 0);
+		}
+	} while (z_return == Z_OK);
+
+	if ((z_return != Z_STREAM_END && z_return != Z_BUF_ERROR)
+		|| get_object_header(&header_obj, inflated_buffer) == 0 
+		|| git_obj__loose_object_type(header_obj.type) == 0) {
+		error = GIT_EOBJCORRUPTED;
+		goto cleanup;
+	}
+
+	out->len  = header_obj.size;
+	out->type = header_obj.type;
+
+cleanup:
+	finish_inflate(&zs);
+	gitfo_close(fd);
+	return error;
+}
+
+static int write_obj(gitfo_buf *buf, git_oid *id, git_odb *db)
+{
+	char file[GIT_PATH_MAX];
+	char temp[GIT_PATH_MAX];
+	git_file fd;
+
+	if (object_file_name(file, sizeof(file), db->objects_dir, id))
+		return GIT_EOSERR;
+
+	if (make_temp_file(&fd, temp, sizeof(temp), file) < 0)
+		return GIT_EOSERR;
+
+	if (gitfo_write(fd, buf->data, buf->len) < 0) {
+		gitfo_close(fd);
+		gitfo_unlink(temp);
+		return GIT_EOSERR;
+	}
+
+	if (db->fsync_object_files)
+		gitfo_fsync(fd);
+	gitfo_close(fd);
+	gitfo_chmod(temp, 0444);
+
+	if (gitfo_move_file(temp, file) < 0) {
+		gitfo_unlink(temp);
+		return GIT_EOSERR;
+	}
+
+	if (db->loose.enabled)
+		loose_cache_add(db, id);
+	exists_filter_add(db, id);
+
+	return GIT_SUCCESS;
+}
+
+typedef struct {  /* an object requested from git_odb_read_many() */
+	const git_oid *id;
+	git_pack *pack;      /* NULL for a loose object */
+	index_entry e;
+	int is_base;         /* the base of another object of the batch */
+} batch_object;
+
+static int cmp_batch_object(const void *lhs, const void *rhs)
+{
+	const batch_object *a = lhs;
+	const batch_object *b = rhs;
+
+	/* packed objects first, by pack and offset */
+	if (a->pack != b->pack) {
+		if (!a->pack || !b->pack)
+			return a->pack ? -1 : 1;
+		return (size_t)a->pack < (size_t)b->pack ? -1 : 1;
+	}
+	if (a->pack && a->e.offset != b->e.offset)
+		return a->e.offset < b->e.offset ? -1 : 1;
+	return git_oid_cmp(a->id, b->id);
+}
+
+static batch_object *batch_find(batch_object *objs, size_t n, git_pack *p, off_t offset)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) >> 1;
+		batch_object *b = &objs[mid];
+
+		if (b->pack == p && b->e.offset == offset)
+			return b;
+		if (!b->pack || (size_t)p < (size_t)b->pack
+			|| (b->pack == p && offset < b->e.offset))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/*
+ * Find each object of the batch, keeping the index of its pack
+ * open until batch_release(); then mark the objects which are
+ * delta bases of others, so that they can be kept until those
+ * are read.
+ */
+static int batch_locate(batch_object *objs, size_t n, git_odb *db)
+{
+	obj_location loc;
+	size_t j;
+
+	for (j = 0; j < n; j++) {
+		batch_object *b = &objs[j];
+		git_pack *p;
+
+		switch (locate_object(&loc, db, b->id)) {
+		case OBJ_LOCATION_LOOSE:
+			break;
+
+		case OBJ_LOCATION_INPACK:
+			p = loc.pack.ptr;
+			if (pack_openidx(p)) {
+				pack_dec(p);
+				return GIT_EPACKCORRUPTED;
+			}
+			b->pack = p;
+			if (p->idx_get(&b->e, p, loc.pack.n) || open_pack(p))
+				return GIT_EPACKCORRUPTED;
+			break;
+
+		default:
+			return GIT_ENOTFOUND;
+		}
+	}
+
+	qsort(objs, n, sizeof(*objs), cmp_batch_object);
+
+	for (j = 0; j < n && objs[j].pack; j++) {
+		batch_object *base;
+		pack_entry ent;
+
+		if (parse_pack_entry(&ent, objs[j].pack, objs[j].e.offset, objs[j].e.size) < 0)
+			return GIT_EPACKCORRUPTED;
+
+		if ((ent.type == GIT_OBJ_OFS_DELTA || ent.type == GIT_OBJ_REF_DELTA)
+			&& (base = batch_find(objs, n, objs[j].pack, ent.base_offset)) != NULL)
+			base->is_base = 1;
+	}
+
+	return GIT_SUCCESS;
+}
+
+static void batch_release(batch_object *objs, size_t n)
+{
+	size_t j;
+
+	for (j = 0; j < n; j++)
+		if (objs[j].pack) {
+			pack_decidx(objs[j].pack);
+			pack_dec(objs[j].pack);
+		}
+}
+
+static int batch_read(git_rawobj *out, git_odb *db, batch_object *b)
+{
+	if (!b->pack)
+		return git_odb_read(out, db, b->id);
+	return unpack_object(out, b->pack, &b->e);
+}
+
+/*
+ * Done with an object read in a batch: a base of later objects
+ * goes to the delta base cache, where unpack_object() finds it.
+ */
+static void batch_done(git_rawobj *obj, batch_object *b)
+{
+	if (b->is_base && delta_cache_put(b->pack, b->e.offset, obj) == GIT_SUCCESS)
+		return;
+	git_obj_close(obj);
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * OBJECT STREAMS
+ *
+ * Read and write objects a chunk at a time, without holding
+ * their whole contents in memory
+ * 
+ ***********************************************************/
+
+struct git_odb_stream {
+	git_otype type;
+	size_t size;  /* inflated size of the object */
+	size_t done;  /* bytes handed out so far */
+
+	/** The whole object, when it cannot be inflated piecewise. */
+	git_rawobj obj;
+
+	z_stream zs;
+	int zs_status;
+	unsigned zs_open:1;
+
+	/** Inflated bytes of a loose object following its header. */
+	unsigned char head[64];
+	size_t head_off, head_len;
+
+	/** Source of a loose object. */
+	git_file fd;
+	unsigned char *inbuf;
+
+	/** Source of a packed object. */
+	git_pack *pack;
+	off_t offset;
+	size_t left;
+
+	/** Destination of a written object, deflated into 'fd'. */
+	git_odb *db;
+	git_hash_ctx *hash;
+	unsigned char *outbuf;
+	char tmp_path[GIT_PATH_MAX];
+};
+
+/*
+ * Inflate into out until it is full or the stream ends, and
+ * store the number of bytes inflated in 'got'.
+ */
+static int stream_inflate(git_odb_stream *s, unsigned char *out, size_t len, size_t *got)
+{
+	s->zs.next_out = out;
+	s->zs.avail_out = len;
+
+	while (s->zs.avail_out > 0 && s->zs_status == Z_OK) {
+		if (s->pack) {
+			pack_window *w;
+			unsigned char *in;
+			size_t avail, used;
+
+			if (!s->left)
+				return GIT_EOBJCORRUPTED;
+			if ((in = pack_window_use(&w, s->pack, s->offset, &avail)) == NULL)
+				return GIT_ERROR;
+			if (avail > s->left)
+				avail = s->left;
+
+			set_stream_input(&s->zs, in, avail);
+			s->zs_status = inflate(&s->zs, Z_NO_FLUSH);
+			used = avail - s->zs.avail_in;
+			pack_window_done(w);
+
+			/* the window may go away before the next call */
+			set_stream_input(&s->zs, NULL, 0);
+			s->offset += used;
+			s->left -= used;
+		} else {
+			if (s->zs.avail_in == 0) {
+				ssize_t r = gitfo_read_some(s->fd, s->inbuf, GIT_STREAM_BUFSIZE);
+
+				if (r <= 0)
+					return GIT_EOBJCORRUPTED;
+				set_stream_input(&s->zs, s->inbuf, r);
+			}
+			s->zs_status = inflate(&s->zs, Z_NO_FLUSH);
+		}
+	}
+
+	if (s->zs_status != Z_OK && s->zs_status != Z_STREAM_END)
+		return GIT_EOBJCORRUPTED;
+
+	*got = len - s->zs.avail_out;
+	return GIT_SUCCESS;
+}
+
+static int stream_open_packed(git_odb_stream *s, const obj_location *loc)
+{
+	git_pack *p = loc->pack.ptr;
+	pack_entry ent;
+	index_entry e;
+	int error;
+
+	if (pack_openidx(p)) {
+		pack_dec(p);
+		return GIT_EPACKCORRUPTED;
+	}
+
+	if ((error = p->idx_get(&e, p, loc->pack.n)) == GIT_SUCCESS) {
+		if (open_pack(p))
+			error = GIT_ERROR;
+		else
+			error = parse_pack_entry(&ent, p, e.offset, e.size);
+	}
+
+	/* a delta needs its base: build the whole object */
+	if (error == GIT_SUCCESS &&
+		(ent.type == GIT_OBJ_OFS_DELTA || ent.type == GIT_OBJ_REF_DELTA)) {
+		if ((error = unpack_object(&s->obj, p, &e)) == GIT_SUCCESS) {
+			s->type = s->obj.type;
+			s->size = s->obj.len;
+		}
+		pack_decidx(p);
+		pack_dec(p);
+		return error;
+	}
+
+	pack_decidx(p);
+
+	if (error == GIT_SUCCESS && inflateInit(&s->zs) < Z_OK)
+		error = GIT_EZLIB;
+	if (error < GIT_SUCCESS) {
+		pack_dec(p);
+		return error;
+	}
+
+	s->zs_open = 1;
+	s->zs_status = Z_OK;
+	s->type = ent.type;
+	s->size = ent.size;
+	s->pack = p;
+	s->offset = ent.data_offset;
+	s->left = ent.data_len;
+	return GIT_SUCCESS;
+}
+
+static int stream_open_loose(git_odb_stream *s, git_odb *db, const obj_location *loc)
+{
+	obj_hdr hdr;
+	ssize_t r;
+	size_t got, used;
+	int error;
+
+	if ((s->fd = gitfo_open(loc->loose_path, O_RDONLY)) < 0)
+		return GIT_ENOTFOUND;
+
+	if ((s->inbuf = git__malloc(GIT_STREAM_BUFSIZE)) == NULL)
+		return GIT_ENOMEM;
+
+	if ((r = gitfo_read_some(s->fd, s->inbuf, GIT_STREAM_BUFSIZE)) < 2)
+		return GIT_EOBJCORRUPTED;
+
+	/* the old pack-like format is rare enough to be read at once */
+	if (!is_zlib_compressed_data(s->inbuf)) {
+		gitfo_close(s->fd);
+		s->fd = -1;
+		if ((error = read_loose(&s->obj, db, loc)) < GIT_SUCCESS)
+			return error;
+		s->type = s->obj.type;
+		s->size = s->obj.len;
+		return GIT_SUCCESS;
+	}
+
+	set_stream_input(&s->zs, s->inbuf, r);
+	if (inflateInit(&s->zs) < Z_OK)
+		return GIT_EZLIB;
+	s->zs_open = 1;
+	s->zs_status = Z_OK;
+
+	/* keep a terminating '\0' for get_object_header() */
+	if ((error = stream_inflate(s, s->head, sizeof(s->head) - 1, &got)) < GIT_SUCCESS)
+		return error;
+	s->head[got] = '\0';
+
+	if ((used = get_object_header(&hdr, s->head)) == 0
+		|| used > got
+		|| !git_obj__loose_object_type(hdr.type))
+		return GIT_EOBJCORRUPTED;
+
+	s->type = hdr.type;
+	s->size = hdr.size;
+	s->head_off = used;
+	s->head_len = got;
+	return GIT_SUCCESS;
+}
+
+/*
+ * Deflate len bytes of data into the temporary file of a write
+ * stream; with Z_FINISH, terminate the zlib stream as well.
+ */
+static int stream_deflate(git_odb_stream *s, const void *data, size_t len, int flush)
+{
+	int status;
+
+	set_stream_input(&s->zs, (void *)data, len);
+
+	do {
+		size_t n;
+
+		set_stream_output(&s->zs, s->outbuf, GIT_STREAM_BUFSIZE);
+		if ((status = deflate(&s->zs, flush)) == Z_STREAM_ERROR)
+			return GIT_EZLIB;
+
+		n = GIT_STREAM_BUFSIZE - s->zs.avail_out;
+		if (n && gitfo_write(s->fd, s->outbuf, n) < 0)
+			return GIT_EOSERR;
+	} while (s->zs.avail_out == 0);
+
+	if (flush == Z_FINISH && status != Z_STREAM_END)
+		return GIT_EZLIB;
+
+	return GIT_SUCCESS;
+}
+
+/* Move the finished temporary file of a write stream into place. */
+static int stream_store(git_oid *id, git_odb_stream *s)
+{
+	char file[GIT_PATH_MAX], dir[GIT_PATH_MAX];
+	int dirlen;
+
+	if (object_file_name(file, sizeof(file), s->db->objects_dir, id))
+		return GIT_EOSERR;
+
+	/* somebody else may have written it meanwhile */
+	if (git_odb_exists(s->db, id)) {
+		gitfo_unlink(s->tmp_path);
+		s->tmp_path[0] = '\0';
+		return GIT_SUCCESS;
+	}
+
+	if ((dirlen = git__dirname(dir, sizeof(dir), file)) < 0)
+		return GIT_EOSERR;
+	if (gitfo_exists(dir) < 0 && gitfo_mkdir(dir, 0755) < 0 && gitfo_isdir(dir))
+		return GIT_EOSERR;
+
+	gitfo_chmod(s->tmp_path, 0444);
+	if (gitfo_move_file(s->tmp_path, file) < 0)
+		return GIT_EOSERR;
+	s->tmp_path[0] = '\0';
+
+	if (s->db->loose.enabled)
+		loose_cache_add(s->db, id);
+	exists_filter_add(s->db, id);
+
+	return GIT_SUCCESS;
+}
+
+/* Check that the stream ends right after the last object byte. */
+static int stream_check_end(git_odb_stream *s)
+{
+	unsigned char extra;
+	size_t got;
+
+	if (s->head_off < s->head_len)
+		return GIT_EOBJCORRUPTED;
+
+	if (s->zs_status != Z_STREAM_END) {
+		if (stream_inflate(s, &extra, 1, &got) < GIT_SUCCESS
+			|| got != 0 || s->zs_status != Z_STREAM_END)
+			return GIT_EOBJCORRUPTED;
+	}
+
+	return GIT_SUCCESS;
+}
+
+
+
+
+
+
+/***********************************************************
+ *
+ * OBJECT DATABASE PUBLIC API
+ *
+ * Public calls for the ODB functionality
+ * 
+ ***********************************************************/
+
+int git_odb_open(git_odb **out, const char *objects_dir)
+{
+	git_odb *db = git__calloc(1, sizeof(*db));
+	if (!db)
+		return GIT_ENOMEM;
+
+	db->objects_dir = git__strdup(objects_dir);
+	if (!db->objects_dir) {
+		free(db);
+		return GIT_ENOMEM;
+	}
+
+	gitlck_init(&db->lock);
+
+	db->object_zlib_level = Z_BEST_SPEED;
+	db->fsync_object_files = 0;
+
+	delta_cache_init(&db->delta_cache);
+	gitlck_init(&db->loose.lock);
+	gitlck_init(&db->filter.lock);
+
+	*out = db;
+	return GIT_SUCCESS;
+}
+
+void git_odb_close(git_odb *db)
+{
+	git_packlist *pl;
+
+	if (!db)
+		return;
+
+	git_odb_abort_import(db);
+
+	gitlck_lock(&db->lock);
+
+	pl = db->packlist;
+	db->packlist = NULL;
+
+	if (db->alternates) {
+		git_odb **alt;
+		for (alt = db->alternates; *alt; alt++)
+			alternate_release(*alt);
+		free(db->alternates);
+	}
+
+	free(db->objects_dir);
+
+	gitlck_unlock(&db->lock);
+	if (pl)
+		packlist_dec(db, pl);
+
+	delta_cache_purge(&db->delta_cache, NULL);
+	gitlck_free(&db->delta_cache.lock);
+	loose_cache_clear(&db->loose);
+	gitlck_free(&db->loose.lock);
+	exists_filter_clear(&db->filter);
+	gitlck_free(&db->filter.lock);
+	gitlck_free(&db->lock);
+	free(db);
+}
+
+void git_odb_set_delta_base_cache_limit(git_odb *db, size_t limit)
+{
+	assert(db);
+	delta_cache_set_limit(&db->delta_cache, limit);
+}
+
+void git_odb_set_pack_window_limits(
+		size_t window_size, size_t mapped_limit, unsigned int open_limit)
+{
+	pack_window_set_limits(&pack_windows, window_size, mapped_limit, open_limit);
+}
+
+void git_odb_get_pack_window_limits(
+		size_t *window_size, size_t *mapped_limit, unsigned int *open_limit)
+{
+	assert(window_size && mapped_limit && open_limit);
+
+	pack_window_lock(&pack_windows);
+	*window_size = pack_windows.window_size;
+	*mapped_limit = pack_windows.mapped_limit;
+	*open_limit = pack_windows.open_limit;
+	gitlck_unlock(&pack_windows.lock);
+}
 
-	byte = *buffer++ & 0xFF;
-	out->type = (byte >> 4) & 0x7;
-	out->len = byte & 0xF;
-	shift = 4;
+void git_odb__pack_window_usage(size_t *mapped, unsigned int *open)
+{
+	pack_window_lock(&pack_windows);
+	*mapped = pack_windows.mapped;
+	*open = pack_windows.open;
+	gitlck_unlock(&pack_windows.lock);
+}
 
-	while (byte & 0x80) {
-		byte = *buffer++ & 0xFF;
-		out->len += (byte & 0x7F) << shift;
-		shift += 7;
+int git_odb__pack_has_revindex(git_odb *db, const char *pack_name)
+{
+	git_packlist *pl;
+	size_t j;
+	int error = GIT_ENOTFOUND;
+
+	assert(db && pack_name);
+
+	if ((pl = packlist_get(db)) == NULL)
+		return GIT_ENOTFOUND;
+
+	for (j = 0; j < pl->n_packs; j++) {
+		git_pack *p = pl->packs[j];
+
+		if (strcmp(p->pack_name, pack_name))
+			continue;
+
+		if ((error = pack_openidx(p)) == GIT_SUCCESS) {
+			error = p->im_rev != NULL;
+			pack_decidx(p);
+		}
+		break;
 	}
 
-	/* 
-	 * FIXME: if the object is not packed as a whole,
-	 * we need to do a full load and apply the deltas before
-	 * being able to read the header.
-	 *
-	 * I don't think there are any workarounds for this.'
-	 */
+	packlist_dec(db, pl);
+	return error;
+}
+
+void git_odb_set_loose_cache(git_odb *db, int enabled)
+{
+	assert(db);
+
+	gitlck_lock(&db->loose.lock);
+	db->loose.enabled = !!enabled;
+	if (!enabled)
+		loose_cache_clear(&db->loose);
+	gitlck_unlock(&db->loose.lock);
+}
+
+void git_odb_set_exists_filter(git_odb *db, int enabled)
+{
+	assert(db);
+
+	gitlck_lock(&db->filter.lock);
+	db->filter.enabled = !!enabled;
+	exists_filter_clear(&db->filter);
+	gitlck_unlock(&db->filter.lock);
+}
+
+int git_odb__read_packed(git_rawobj *out, git_odb *db, const git_oid *id)
+{
+	obj_location loc;
+
+	if (locate_object(&loc, db, id) != OBJ_LOCATION_INPACK)
+		return GIT_ENOTFOUND;
+
+	return read_packed(out, &loc);
+}
+
+int git_odb__read_loose(git_rawobj *out, git_odb *db, const git_oid *id)
+{
+	obj_location loc;
+
+	switch (locate_object(&loc, db, id)) {
+	case OBJ_LOCATION_LOOSE:
+		break;
+	case OBJ_LOCATION_INPACK:
+		pack_dec(loc.pack.ptr);
+		/* fall through */
+	default:
+		return GIT_ENOTFOUND;
+	}
+
+	return read_loose(out, db, &loc);
+}
+
+int git_odb_foreach(git_odb *db, unsigned int flags,
+		int (*fn)(void *payload, const git_oid *id), void *payload)
+{
+	git_packlist *pl;
+	size_t j;
+	int error = GIT_SUCCESS;
+
+	assert(db && fn);
+
+	if ((pl = packlist_get(db)) == NULL)
+		return GIT_ERROR;
+
+	for (j = 0; error == GIT_SUCCESS && j < pl->n_packs; j++)
+		error = foreach_pack(pl->packs[j], flags, fn, payload);
+	packlist_dec(db, pl);
+
+	if (error == GIT_SUCCESS)
+		error = foreach_loose(db, fn, payload);
+	return error;
+}
+
+int git_odb_find_prefix(git_oid *out, git_odb *db, const char *hex, size_t len)
+{
+	char padded[GIT_OID_HEXSZ];
+	prefix_search s;
+	size_t j;
+	int error;
+
+	assert(out && db && hex);
+
+	if (len < GIT_OID_MINPREFIXLEN || len > GIT_OID_HEXSZ)
+		return GIT_ENOTOID;
+
+	memset(padded, '0', sizeof(padded));
+	memcpy(padded, hex, len);
+	memset(&s, 0x0, sizeof(s));
+	if (git_oid_mkstr(&s.prefix, padded) < GIT_SUCCESS)
+		return GIT_ENOTOID;
+	s.len = len;
+
+	if ((error = prefix_search_local(&s, db)) < GIT_SUCCESS)
+		return error;
+
+	if (s.n_found < 2 && open_alternates(db) == GIT_SUCCESS)
+		for (j = 0; s.n_found < 2 && j < db->n_alternates; j++)
+			if ((error = prefix_search_local(&s, db->alternates[j])) < GIT_SUCCESS)
+				return error;
+
+	if (!s.n_found)
+		return GIT_ENOTFOUND;
+	if (s.n_found > 1)
+		return GIT_EAMBIGUOUS;
+
+	git_oid_cpy(out, &s.found);
+	return GIT_SUCCESS;
+}
+
+int git_odb_exists(git_odb *db, const git_oid *id)
+{
+	obj_location loc;
+	int found;
+
+	assert(db && id);
+
+	if (exists_filter_excludes(db, id))
+		return 0;
+
+	if ((found = locate_object(&loc, db, id)) == OBJ_LOCATION_INPACK)
+		pack_dec(loc.pack.ptr);
+	return found != OBJ_LOCATION_NOTFOUND;
+}
+
+int git_odb_read_header(git_rawobj *out, git_odb *db, const git_oid *id)
+{
+	obj_location loc;
+	int found, error = 0;
+
+	assert(out && db);
+
+	found = locate_object(&loc, db, id);
+
+	switch (found) {
+	case OBJ_LOCATION_LOOSE: 
+		error = read_header_loose(out, db, &loc);
+		if (error == GIT_ENOTFOUND && loc.db->loose.enabled) {
+			/* the cached listing was stale; look again */
+			loose_cache_invalidate(loc.db, id);
+			if (locate_object(&loc, db, id) == OBJ_LOCATION_INPACK)
+				error = read_header_packed(out, &loc);
+		}
+		break;
+
+	case OBJ_LOCATION_INPACK:
+		error = read_header_packed(out, &loc);
+		break;
+
+	case OBJ_LOCATION_NOTFOUND:
+		error = GIT_ENOTFOUND;
+		break;
+	}
+
+	return error;
+}
+
+int git_odb_read(
+	git_rawobj *out,
+	git_odb *db,
+	const git_oid *id)
+{
+	obj_location loc;
+	int found, error = 0;
+
+	assert(out && db);
 
-	if (out->type == GIT_OBJ_OFS_DELTA || out->type == GIT_OBJ_REF_DELTA) {
-		error = unpack_object(out, pack, &e);
-		git_obj_close(out);
-	} 
+	found = locate_object(&loc, db, id);
+
+	switch (found) {
+	case OBJ_LOCATION_LOOSE:
+		error = read_loose(out, db, &loc);
+		if (error == GIT_ENOTFOUND && loc.db->loose.enabled) {
+			/* the cached listing was stale; look again */
+			loose_cache_invalidate(loc.db, id);
+			if (locate_object(&loc, db, id) == OBJ_LOCATION_INPACK)
+				error = read_packed(out, &loc);
+		}
+		break;
+
+	case OBJ_LOCATION_INPACK:
+		error = read_packed(out, &loc);
+		break;
+
+	case OBJ_LOCATION_NOTFOUND:
+		error = GIT_ENOTFOUND;
+		break;
+	}
+
+	return error;
+}
+
+int git_odb_read_many(git_odb *db, const git_oid *ids, size_t n,
+		int (*fn)(void *payload, const git_oid *id, git_rawobj *obj), void *payload)
+{
+	batch_object *objs;
+	size_t j;
+	int error;
+
+	assert(db && (ids || !n) && fn);
+
+	if ((objs = git__calloc(n + 1, sizeof(*objs))) == NULL)
+		return GIT_ENOMEM;
+
+	for (j = 0; j < n; j++)
+		objs[j].id = &ids[j];
+
+	error = batch_locate(objs, n, db);
+
+	for (j = 0; error == GIT_SUCCESS && j < n; j++) {
+		git_rawobj obj;
+
+		if ((error = batch_read(&obj, db, &objs[j])) < GIT_SUCCESS)
+			break;
+
+		error = fn(payload, objs[j].id, &obj);
+		batch_done(&obj, &objs[j]);
+	}
+
+	batch_release(objs, n);
+	free(objs);
+	return error;
+}
+
+int git_odb_write(git_oid *id, git_odb *db, git_rawobj *obj)
+{
+	char hdr[64];
+	int  hdrlen;
+	gitfo_buf buf = GITFO_BUF_INIT;
+	git_pack *import;
+	int error;
+
+	assert(id && db && obj);
+
+	if ((error = hash_obj(id, hdr, sizeof(hdr), &hdrlen, obj)) < 0)
+		return error;
+
+	if (git_odb_exists(db, id))
+		return GIT_SUCCESS;
+
+	if ((import = import_get(db)) != NULL) {
+		error = import_write(import, id, obj, db->object_zlib_level);
+		pack_dec(import);
+
+		/* unless the import is being committed */
+		if (error != GIT_EBUSY)
+			return error;
+	}
+
+	if ((error = deflate_obj(&buf, hdr, hdrlen, obj, db->object_zlib_level)) < 0)
+		return error;
+
+	if ((error = write_obj(&buf, id, db)) < 0) {
+		gitfo_free_buf(&buf);
+		return error;
+	}
+
+	gitfo_free_buf(&buf);
+
+	return GIT_SUCCESS;
+}
+
+int git_odb_write_multi_pack_index(git_odb *db)
+{
+	git_packlist *pl;
+	git_pack **packs = NULL;
+	midx_entry *entries = NULL;
+	size_t j, n_packs = 0, n_entries = 0, n_opened = 0, cnt = 0;
+	int error = GIT_SUCCESS;
+
+	assert(db);
+
+	if ((pl = packlist_get(db)) == NULL)
+		return GIT_ERROR;
+
+	if ((packs = git__malloc((pl->n_packs + 1) * sizeof(*packs))) == NULL) {
+		error = GIT_ENOMEM;
+		goto cleanup;
+	}
+
+	/* the idx maps must stay open while the entries point into them */
+	for (j = 0; j < pl->n_packs; j++) {
+		if (pack_openidx(pl->packs[j]))
+			continue;
+		packs[n_packs++] = pl->packs[j];
+		cnt += pl->packs[j]->obj_cnt;
+	}
+	n_opened = n_packs;
+
+	qsort(packs, n_packs, sizeof(*packs), cmp_pack_name);
+
+	if ((entries = git__malloc((cnt + 1) * sizeof(*entries))) == NULL) {
+		error = GIT_ENOMEM;
+		goto cleanup;
+	}
+
+	for (j = 0; j < n_packs; j++) {
+		git_pack *p = packs[j];
+		uint32_t k;
+
+		for (k = 0; k < p->obj_cnt; k++) {
+			index_entry e;
+
+			if (p->idx_get(&e, p, k) < 0) {
+				error = GIT_EPACKCORRUPTED;
+				goto cleanup;
+			}
+
+			entries[n_entries].oid = e.oid;
+			entries[n_entries].pack_id = (uint32_t)j;
+			entries[n_entries].offset = e.offset;
+			n_entries++;
+		}
+	}
+
+	/* objects stored in several packs are listed once */
+	qsort(entries, n_entries, sizeof(*entries), cmp_midx_entry);
+	for (j = 0, cnt = 0; j < n_entries; j++) {
+		if (cnt && !memcmp(entries[cnt - 1].oid, entries[j].oid, GIT_OID_RAWSZ))
+			continue;
+		entries[cnt++] = entries[j];
+	}
+
+	error = midx_write(db, packs, n_packs, entries, cnt);
 
 cleanup:
-	pack_decidx(loc->pack.ptr);
+	for (j = 0; j < n_opened; j++)
+		pack_decidx(packs[j]);
+	free(entries);
+	free(packs);
+	packlist_dec(db, pl);
+	return error;
+}
+
+int git_odb_write_reverse_indexes(git_odb *db)
+{
+	git_packlist *pl;
+	size_t j;
+	int error = GIT_SUCCESS;
+
+	assert(db);
+
+	if ((pl = packlist_get(db)) == NULL)
+		return GIT_ERROR;
+
+	for (j = 0; j < pl->n_packs && error == GIT_SUCCESS; j++) {
+		git_pack *p = pl->packs[j];
+
+		if (pack_openidx(p))
+			continue;
+		if (!p->im_rev)
+			error = rev_write(p);
+		pack_decidx(p);
+	}
+
+	packlist_dec(db, pl);
+	return error;
+}
+
+int git_odb_pack_stats(git_odb *db,
+		int (*fn)(void *payload, const char *pack_name, size_t hits, size_t misses),
+		void *payload)
+{
+	git_packlist *pl;
+	size_t j;
+	int error = GIT_SUCCESS;
+
+	assert(db && fn);
+
+	if ((pl = packlist_get(db)) == NULL)
+		return GIT_ERROR;
+
+	for (j = 0; j < pl->n_packs && error == GIT_SUCCESS; j++) {
+		git_pack *p = pl->packs[j];
+		size_t hits, misses;
+
+		gitlck_lock(&p->lock);
+		hits = p->hits;
+		misses = p->misses;
+		gitlck_unlock(&p->lock);
+
+		error = fn(payload, p->pack_name, hits, misses);
+	}
+
+	packlist_dec(db, pl);
 	return error;
 }
 
-static int read_loose(git_rawobj *out, git_odb *db, const obj_location *loc)
+int git_odb_read_stream(git_odb_stream **out, git_rawobj *hdr, git_odb *db, const git_oid *id)
 {
+	git_odb_stream *s;
+	obj_location loc;
 	int error;
-	gitfo_buf obj = GITFO_BUF_INIT;
 
-	assert(out && db && loc);
+	assert(out && hdr && db && id);
 
-	out->data = NULL;
-	out->len  = 0;
-	out->type = GIT_OBJ_BAD;
+	*out = NULL;
+	hdr->data = NULL;
 
-	if (gitfo_read_file(&obj, loc->loose_path) < 0)
-		return GIT_ENOTFOUND;
+	if ((s = git__calloc(1, sizeof(*s))) == NULL)
+		return GIT_ENOMEM;
+	s->fd = -1;
 
-	error = inflate_disk_obj(out, &obj);
-	gitfo_free_buf(&obj);
+	switch (locate_object(&loc, db, id)) {
+	case OBJ_LOCATION_LOOSE:
+		error = stream_open_loose(s, loc.db, &loc);
+		if (error == GIT_ENOTFOUND && loc.db->loose.enabled) {
+			/* the cached listing was stale; look again */
+			loose_cache_invalidate(loc.db, id);
+			if (locate_object(&loc, db, id) == OBJ_LOCATION_INPACK)
+				error = stream_open_packed(s, &loc);
+		}
+		break;
 
-	return error;
-}
+	case OBJ_LOCATION_INPACK:
+		error = stream_open_packed(s, &loc);
+		break;
 
-static int read_header_loose(git_rawobj *out, git_odb *db, const obj_location *loc)
-{
-	int error = GIT_SUCCESS, z_return = Z_ERRNO, read_bytes;
-	git_file fd;
-	z_stream zs;
-	obj_hdr header_obj;
-	unsigned char raw_buffer[16], inflated_buffer[64];
+	default:
+		error = GIT_ENOTFOUND;
+		break;
+	}
 
-	assert(out && db && loc);
+	if (error < GIT_SUCCESS) {
+		git_odb_stream_close(s);
+		return error;
+	}
 
-	out->data = NULL;
+	hdr->type = s->type;
+	hdr->len = s->size;
+	*out = s;
+	return GIT_SUCCESS;
+}
 
-	if ((fd = gitfo_open(loc->loose_path, O_RDONLY)) < 0)
-		return GIT_ENOTFOUND;
+int git_odb_stream_read(git_odb_stream *s, void *buffer, size_t len)
+{
+	unsigned char *buf = buffer;
+	size_t want = s->size - s->done, n = 0;
+	int error;
 
-	init_stream(&zs, inflated_buffer, sizeof(inflated_buffer));
+	assert(s && buffer);
 
-	if (inflateInit(&zs) < Z_OK) {
-		error = GIT_EZLIB;
-		goto cleanup;
-	}
+	if (s->hash)
+		return GIT_ERROR;
 
-	do {
-		if ((read_bytes = read(fd, raw_buffer, sizeof(raw_buffer))) > 0) {
-			set_stream_input(&zs, raw_buffer, read_bytes);
-			z_return = inflate(&zs, 0);
+	if (len > INT_MAX)
+		len = INT_MAX;
+	if (want > len)
+		want = len;
+
+	if (s->obj.data) {
+		memcpy(buf, (unsigned char *)s->obj.data + s->done, want);
+		n = want;
+	} else {
+		size_t got;
+
+		if (s->head_off < s->head_len) {
+			n = s->head_len - s->head_off;
+			if (n > want)
+				n = want;
+			memcpy(buf, s->head + s->head_off, n);
+			s->head_off += n;
 		}
-	} while (z_return == Z_OK);
 
-	if ((z_return != Z_STREAM_END && z_return != Z_BUF_ERROR)
-		|| get_object_header(&header_obj, inflated_buffer) == 0 
-		|| git_obj__loose_object_type(header_obj.type) == 0) {
-		error = GIT_EOBJCORRUPTED;
-		goto cleanup;
+		if (n < want) {
+			if ((error = stream_inflate(s, buf + n, want - n, &got)) < GIT_SUCCESS)
+				return error;
+			if (got < want - n)
+				return GIT_EOBJCORRUPTED;
+			n += got;
+		}
 	}
 
-	out->len  = header_obj.size;
-	out->type = header_obj.type;
+	s->done += n;
 
-cleanup:
-	finish_inflate(&zs);
-	gitfo_close(fd);
-	return error;
+	/* an empty object has trailing garbage to detect as well */
+	if (s->done == s->size && !s->obj.data
+		&& (error = stream_check_end(s)) < GIT_SUCCESS)
+		return error;
+
+	return (int)n;
 }
 
-static int write_obj(gitfo_buf *buf, git_oid *id, git_odb *db)
+void git_odb_stream_close(git_odb_stream *s)
 {
-	char file[GIT_PATH_MAX];
-	char temp[GIT_PATH_MAX];
-	git_file fd;
+	if (!s)
+		return;
 
-	if (object_file_name(file, sizeof(file), db->objects_dir, id))
-		return GIT_EOSERR;
+	if (s->zs_open) {
+		if (s->hash)
+			deflateEnd(&s->zs);
+		else
+			inflateEnd(&s->zs);
+	}
+	if (s->fd >= 0)
+		gitfo_close(s->fd);
+	if (s->pack)
+		pack_dec(s->pack);
+
+	/* a write stream that was not finalized leaves nothing behind */
+	if (s->tmp_path[0])
+		gitfo_unlink(s->tmp_path);
+	if (s->hash)
+		git_hash_free_ctx(s->hash);
+
+	free(s->inbuf);
+	free(s->outbuf);
+	git_obj_close(&s->obj);
+	free(s);
+}
 
-	if (make_temp_file(&fd, temp, sizeof(temp), file) < 0)
-		return GIT_EOSERR;
+int git_odb_open_wstream(git_odb_stream **out, git_odb *db, size_t size, git_otype type)
+{
+	git_odb_stream *s;
+	git_rawobj obj;
+	char hdr[64];
+	int hdrlen, error;
 
-	if (gitfo_write(fd, buf->data, buf->len) < 0) {
-		gitfo_close(fd);
-		gitfo_unlink(temp);
+	assert(out && db);
+
+	*out = NULL;
+
+	if (!git_obj__loose_object_type(type))
+		return GIT_ERROR;
+
+	obj.data = NULL;
+	obj.len = size;
+	obj.type = type;
+	if ((hdrlen = format_object_header(hdr, sizeof(hdr), &obj)) < 0)
+		return GIT_ERROR;
+
+	if ((s = git__calloc(1, sizeof(*s))) == NULL)
+		return GIT_ENOMEM;
+	s->fd = -1;
+	s->db = db;
+	s->type = type;
+	s->size = size;
+
+	if ((s->hash = git_hash_new_ctx()) == NULL
+		|| (s->outbuf = git__malloc(GIT_STREAM_BUFSIZE)) == NULL) {
+		git_odb_stream_close(s);
+		return GIT_ENOMEM;
+	}
+	git_hash_update(s->hash, hdr, hdrlen);
+
+	if (git__fmt(s->tmp_path, sizeof(s->tmp_path), "%s/tmp_obj_XXXXXX", db->objects_dir) < 0
+		|| (s->fd = gitfo_mkstemp(s->tmp_path)) < 0) {
+		s->tmp_path[0] = '\0';
+		git_odb_stream_close(s);
 		return GIT_EOSERR;
 	}
 
-	if (db->fsync_object_files)
-		gitfo_fsync(fd);
-	gitfo_close(fd);
-	gitfo_chmod(temp, 0444);
+	init_stream(&s->zs, NULL, 0);
+	if (deflateInit(&s->zs, db->object_zlib_level) < Z_OK) {
+		git_odb_stream_close(s);
+		return GIT_EZLIB;
+	}
+	s->zs_open = 1;
 
-	if (gitfo_move_file(temp, file) < 0) {
-		gitfo_unlink(temp);
-		return GIT_EOSERR;
+	if ((error = stream_deflate(s, hdr, hdrlen, Z_NO_FLUSH)) < GIT_SUCCESS) {
+		git_odb_stream_close(s);
+		return error;
 	}
 
+	*out = s;
 	return GIT_SUCCESS;
 }
 
+int git_odb_stream_write(git_odb_stream *s, const void *buffer, size_t len)
+{
+	int error;
 
+	assert(s && (buffer || !len));
 
+	if (!s->hash || !s->tmp_path[0] || len > s->size - s->done)
+		return GIT_ERROR;
 
+	git_hash_update(s->hash, buffer, len);
+	if ((error = stream_deflate(s, buffer, len, Z_NO_FLUSH)) < GIT_SUCCESS)
+		return error;
 
+	s->done += len;
+	return GIT_SUCCESS;
+}
 
-/***********************************************************
- *
- * OBJECT DATABASE PUBLIC API
- *
- * Public calls for the ODB functionality
- * 
- ***********************************************************/
-
-int git_odb_open(git_odb **out, const char *objects_dir)
+int git_odb_stream_finalize(git_oid *id, git_odb_stream *s)
 {
-	git_odb *db = git__calloc(1, sizeof(*db));
-	if (!db)
-		return GIT_ENOMEM;
+	int error;
 
-	db->objects_dir = git__strdup(objects_dir);
-	if (!db->objects_dir) {
-		free(db);
-		return GIT_ENOMEM;
-	}
+	assert(id && s);
 
-	gitlck_init(&db->lock);
+	if (!s->hash || !s->tmp_path[0] || s->done != s->size)
+		return GIT_ERROR;
 
-	db->object_zlib_level = Z_BEST_SPEED;
-	db->fsync_object_files = 0;
+	if ((error = stream_deflate(s, NULL, 0, Z_FINISH)) < GIT_SUCCESS)
+		return error;
 
-	*out = db;
-	return GIT_SUCCESS;
+	if (s->db->fsync_object_files)
+		gitfo_fsync(s->fd);
+	gitfo_close(s->fd);
+	s->fd = -1;
+
+	git_hash_final(id, s->hash);
+	return stream_store(id, s);
 }
 
-void git_odb_close(git_odb *db)
+int git_odb_begin_import(git_odb *db)
 {
-	git_packlist *pl;
+	int error;
 
-	if (!db)
-		return;
+	assert(db);
 
 	gitlck_lock(&db->lock);
-
-	pl = db->packlist;
-	db->packlist = NULL;
-
-	if (db->alternates) {
-		git_odb **alt;
-		for (alt = db->alternates; *alt; alt++)
-			git_odb_close(*alt);
-		free(db->alternates);
-	}
-
-	free(db->objects_dir);
-
+	error = db->import ? GIT_EBUSY : import_begin(db);
 	gitlck_unlock(&db->lock);
-	if (pl)
-		packlist_dec(db, pl);
-	gitlck_free(&db->lock);
-	free(db);
+
+	return error;
 }
 
-int git_odb__read_packed(git_rawobj *out, git_odb *db, const git_oid *id)
+int git_odb_commit_import(git_odb *db)
 {
-	obj_location loc;
+	git_pack *p;
+	int error;
 
-	if (locate_object(&loc, db, id) != OBJ_LOCATION_INPACK)
-		return GIT_ENOTFOUND;
+	assert(db);
 
-	return read_packed(out, &loc);
+	if ((p = import_get(db)) == NULL)
+		return GIT_ERROR;
+
+	/* objects written from now on go to loose files */
+	if ((error = import_seal(p)) == GIT_SUCCESS) {
+		error = import_commit(db, p);
+		import_end(db, p);
+	}
+
+	pack_dec(p);
+	return error;
 }
 
-int git_odb__read_loose(git_rawobj *out, git_odb *db, const git_oid *id)
+void git_odb_abort_import(git_odb *db)
 {
-	obj_location loc;
+	git_pack *p;
 
-	if (locate_object(&loc, db, id) != OBJ_LOCATION_LOOSE)
-		return GIT_ENOTFOUND;
+	assert(db);
 
-	return read_loose(out, db, &loc);
-}
+	if ((p = import_get(db)) == NULL)
+		return;
 
-int git_odb_exists(git_odb *db, const git_oid *id)
-{
-	obj_location loc;
-	assert(db && id);
-	return locate_object(&loc, db, id) != OBJ_LOCATION_NOTFOUND;
+	/* leave a pack being committed alone */
+	if (import_seal(p) == GIT_SUCCESS) {
+		import_end(db, p);
+		gitfo_unlink(p->import->tmp_path);
+	}
+
+	pack_dec(p);
 }
 
-int git_odb_read_header(git_rawobj *out, git_odb *db, const git_oid *id)
+int git_odb_index_pack(git_oid *pack_id, git_odb *db, const char *path)
 {
-	obj_location loc;
-	int found, error = 0;
+	char from[GIT_PATH_MAX], to[GIT_PATH_MAX], name[GIT_PACK_NAME_MAX];
+	pack_idx_entry *entries = NULL;
+	index_pack ip;
+	git_file fd;
+	uint32_t j;
+	int error;
 
-	assert(out && db);
+	assert(pack_id && db && path);
 
-	found = locate_object(&loc, db, id);
+	if (git__fmt(from, sizeof(from), "%s", path) < 0)
+		return GIT_ERROR;
+	if ((fd = gitfo_open(from, O_RDONLY)) < 0)
+		return GIT_EOSERR;
 
-	switch (found) {
-	case OBJ_LOCATION_LOOSE: 
-		error = read_header_loose(out, db, &loc);
-		break;
+	memset(&ip, 0x0, sizeof(ip));
+	gitlck_init(&ip.lock);
 
-	case OBJ_LOCATION_INPACK:
-		error = read_header_packed(out, &loc);
-		break;
+	error = index_pack_file(pack_id, &ip, db, fd);
 
-	case OBJ_LOCATION_NOTFOUND:
-		error = GIT_ENOTFOUND;
-		break;
+	if (ip.pack) {
+		/* the pack does not own the descriptor */
+		ip.pack->pack_fd = -1;
+		pack_dec(ip.pack);
 	}
+	gitfo_close(fd);
 
-	return error;
-}
-
-int git_odb_read(
-	git_rawobj *out,
-	git_odb *db,
-	const git_oid *id)
-{
-	obj_location loc;
-	int found, error = 0;
+	if (error == GIT_SUCCESS && (entries = git__malloc((ip.n + 1) * sizeof(*entries))) == NULL)
+		error = GIT_ENOMEM;
 
-	assert(out && db);
+	if (error == GIT_SUCCESS) {
+		for (j = 0; j < ip.n; j++)
+			entries[j] = ip.objects[j].e;
 
-	found = locate_object(&loc, db, id);
+		strcpy(name, "pack-");
+		git_oid_fmt(name + 5, pack_id);
+		name[5 + GIT_OID_HEXSZ] = '\0';
 
-	switch (found) {
-	case OBJ_LOCATION_LOOSE:
-		error = read_loose(out, db, &loc);
-		break;
+		if (git__fmt(to, sizeof(to), "%s/pack", db->objects_dir) < 0)
+			error = GIT_ERROR;
+		else if (gitfo_exists(to) < 0 && gitfo_mkdir(to, 0755) < 0)
+			error = GIT_EOSERR;
+		else
+			/* the index goes first: without its pack it is never used */
+			error = idx_write(db, name, entries, ip.n, pack_id);
+	}
 
-	case OBJ_LOCATION_INPACK:
-		error = read_packed(out, &loc);
-		break;
+	if (error == GIT_SUCCESS) {
+		if (git__fmt(to, sizeof(to), "%s/pack/%s.pack", db->objects_dir, name) < 0)
+			error = GIT_ERROR;
+		else if (gitfo_move_file(from, to) < 0)
+			error = GIT_EOSERR;
 
-	case OBJ_LOCATION_NOTFOUND:
-		error = GIT_ENOTFOUND;
-		break;
+		if (error < GIT_SUCCESS
+			&& git__fmt(to, sizeof(to), "%s/pack/%s.idx", db->objects_dir, name) == GIT_SUCCESS)
+			gitfo_unlink(to);
 	}
 
+	if (error == GIT_SUCCESS)
+		for (j = 0; j < ip.n; j++)
+			exists_filter_add(db, &ip.objects[j].e.oid);
+
+	gitlck_free(&ip.lock);
+	free(entries);
+	free(ip.objects);
+	free(ip.ofs);
+	free(ip.ref);
 	return error;
 }
 
-int git_odb_write(git_oid *id, git_odb *db, git_rawobj *obj)
+int git_odb_write_pack(git_oid *pack_id, git_odb *db, const git_oid *ids, size_t n,
+		unsigned int window, unsigned int depth)
 {
-	char hdr[64];
-	int  hdrlen;
-	gitfo_buf buf = GITFO_BUF_INIT;
+	char tmp[GIT_PATH_MAX], path[GIT_PATH_MAX], name[GIT_PACK_NAME_MAX];
+	pack_idx_entry *entries = NULL;
+	pack_builder pb;
+	git_file fd;
+	size_t j;
 	int error;
 
-	assert(id && db && obj);
+	assert(pack_id && db && (ids || !n));
 
-	if ((error = hash_obj(id, hdr, sizeof(hdr), &hdrlen, obj)) < 0)
-		return error;
+	memset(&pb, 0x0, sizeof(pb));
+	gitlck_init(&pb.lock);
+	pb.db = db;
+	pb.window = window ? window : GIT_DELTA_WINDOW;
+	pb.depth = depth ? depth : GIT_DELTA_DEPTH;
 
-	if (git_odb_exists(db, id))
-		return GIT_SUCCESS;
+	if ((error = pack_builder_init(&pb, db, ids, n)) < GIT_SUCCESS
+		|| (error = delta_search_run(&pb)) < GIT_SUCCESS)
+		goto cleanup;
 
-	if ((error = deflate_obj(&buf, hdr, hdrlen, obj, db->object_zlib_level)) < 0)
-		return error;
+	if ((entries = git__malloc((pb.n + 1) * sizeof(*entries))) == NULL) {
+		error = GIT_ENOMEM;
+		goto cleanup;
+	}
 
-	if ((error = write_obj(&buf, id, db)) < 0) {
-		gitfo_free_buf(&buf);
-		return error;
+	if (git__fmt(path, sizeof(path), "%s/pack/pack", db->objects_dir) < 0
+		|| make_temp_file(&fd, tmp, sizeof(tmp), path) < 0) {
+		error = GIT_EOSERR;
+		goto cleanup;
 	}
 
-	gitfo_free_buf(&buf);
+	if ((error = pack_output_all(pack_id, &pb, entries, fd)) < GIT_SUCCESS) {
+		gitfo_unlink(tmp);
+		goto cleanup;
+	}
 
-	return GIT_SUCCESS;
-}
+	strcpy(name, "pack-");
+	git_oid_fmt(name + 5, pack_id);
+	name[5 + GIT_OID_HEXSZ] = '\0';
 
+	/* the index goes first: without its pack it is never used */
+	if ((error = idx_write(db, name, entries, pb.n, pack_id)) < GIT_SUCCESS) {
+		gitfo_unlink(tmp);
+		goto cleanup;
+	}
+
+	gitfo_chmod(tmp, 0444);
+	if (git__fmt(path, sizeof(path), "%s/pack/%s.pack", db->objects_dir, name) < 0
+		|| gitfo_move_file(tmp, path) < 0) {
+		gitfo_unlink(tmp);
+		if (git__fmt(path, sizeof(path), "%s/pack/%s.idx", db->objects_dir, name) == GIT_SUCCESS)
+			gitfo_unlink(path);
+		error = GIT_EOSERR;
+	}
+
+cleanup:
+	if (pb.objects)
+		for (j = 0; j < pb.n; j++)
+			free(pb.objects[j].delta);
+	free(pb.objects);
+	free(entries);
+	gitlck_free(&pb.lock);
+	return error;
+}
@@ -19,4 +19,25 @@
 /** First 4 bytes of a pack-*.pack file header. */
 #define PACK_SIG 0x5041434b /* PACK */
 
+/** First 4 bytes of the objects/pack/multi-pack-index file. */
+#define MIDX_SIG 0x4d494458 /* MIDX */
+
+/** Multi-pack-index file format and object id versions. */
+#define MIDX_VERSION 1
+#define MIDX_OID_VERSION 1
+
+/** Chunk identifiers of a multi-pack-index file. */
+#define MIDX_CHUNK_PNAM 0x504e414d /* pack names */
+#define MIDX_CHUNK_OIDF 0x4f494446 /* object id fanout */
+#define MIDX_CHUNK_OIDL 0x4f49444c /* object id lookup */
+#define MIDX_CHUNK_OOFF 0x4f4f4646 /* object offsets */
+#define MIDX_CHUNK_LOFF 0x4c4f4646 /* large offsets */
+
+/** First 4 bytes of a pack-*.rev reverse index file. */
+#define RIDX_SIG 0x52494458 /* RIDX */
+
+/** Reverse index file format version and hash function id. */
+#define RIDX_VERSION 1
+#define RIDX_HASH_SHA1 1
+
 #endif
@@ -23,9 +23,16 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#if defined(__i386__) || defined(__x86_64__)
+/* before common.h, which forbids the malloc() it uses */
+# include <immintrin.h>
+#endif
+
 #include "common.h"
 #include "git/oid.h"
 #include "repository.h"
+#include "cpu.h"
+#include "oid.h"
 #include <string.h>
 
 static signed char from_hex[] = {
@@ -68,22 +75,288 @@ GIT_INLINE(char) *fmt_one(char *str, unsigned int val)
 	return str;
 }
 
-void git_oid_fmt(char *str, const git_oid *oid)
+/*
+ * Conversion of n raw bytes to or from 2n hex digits.  Unlike
+ * git_oid_mkstr(), which stops at the first bad digit so that it
+ * never reads past the end of a short string, decoding reads all
+ * of its input and only then reports whether it was valid.
+ */
+typedef void (*hex_encode_fn)(char *str, const unsigned char *raw, size_t n);
+typedef int (*hex_decode_fn)(unsigned char *raw, const char *str, size_t n);
+
+static void hex_encode_portable(char *str, const unsigned char *raw, size_t n)
+{
+	while (n--)
+		str = fmt_one(str, *raw++);
+}
+
+static int hex_decode_portable(unsigned char *raw, const char *str, size_t n)
+{
+	int bad = 0;
+
+	for (; n--; str += 2) {
+		int hi = from_hex[(unsigned char)str[0]];
+		int lo = from_hex[(unsigned char)str[1]];
+
+		bad |= hi | lo;
+		*raw++ = (unsigned char)(((unsigned int)hi << 4) | (unsigned int)lo);
+	}
+	return bad < 0 ? GIT_ENOTOID : GIT_SUCCESS;
+}
+
+/*
+ * The x86 versions convert 16 or 32 bytes per step, computing
+ * the digits with vector compares instead of table lookups.  A
+ * run that is not a multiple of the step ends with a step
+ * overlapping the previous one.  Like the SHA-1 block routines
+ * they are compiled with per-function target options and only
+ * used when the CPU has the instructions.
+ */
+#if (defined(__i386__) || defined(__x86_64__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define OID_HEX_X86
+
+/* the hex digits of 16 nibbles */
+__attribute__((target("sse2")))
+static inline __m128i hex_digits_sse2(__m128i v)
+{
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(9)),
+			_mm_set1_epi8('a' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(v, _mm_set1_epi8('0')), alpha);
+}
+
+/* the values of 16 hex digits; clears bytes of ok for bad digits */
+__attribute__((target("sse2")))
+static inline __m128i hex_values_sse2(__m128i c, __m128i *ok)
+{
+	__m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	__m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	__m128i is_l = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+
+	*ok = _mm_and_si128(*ok, _mm_or_si128(is_d, is_l));
+	return _mm_or_si128(_mm_and_si128(is_d, d),
+		_mm_and_si128(is_l, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+/* the bytes of 8 pairs of digit values, in the low byte of each word */
+__attribute__((target("sse2")))
+static inline __m128i hex_pairs_sse2(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)), 4),
+		_mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static void hex_encode_sse2(char *str, const unsigned char *raw, size_t n)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i, j;
+
+	if (n < 16) {
+		hex_encode_portable(str, raw, n);
+		return;
+	}
+
+	for (i = 0; i < n; i += 16) {
+		__m128i x, hi, lo;
+
+		j = i + 16 <= n ? i : n - 16;
+		x = _mm_loadu_si128((const __m128i *)(raw + j));
+		hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+		lo = _mm_and_si128(x, mask);
+		_mm_storeu_si128((__m128i *)(str + 2 * j),
+			hex_digits_sse2(_mm_unpacklo_epi8(hi, lo)));
+		_mm_storeu_si128((__m128i *)(str + 2 * j + 16),
+			hex_digits_sse2(_mm_unpackhi_epi8(hi, lo)));
+	}
+}
+
+__attribute__((target("sse2")))
+static int hex_decode_sse2(unsigned char *raw, const char *str, size_t n)
+{
+	__m128i ok = _mm_set1_epi8(-1);
+	size_t i, j;
+
+	if (n < 16)
+		return hex_decode_portable(raw, str, n);
+
+	for (i = 0; i < n; i += 16) {
+		__m128i a, b;
+
+		j = i + 16 <= n ? i : n - 16;
+		a = hex_values_sse2(_mm_loadu_si128((const __m128i *)(str + 2 * j)), &ok);
+		b = hex_values_sse2(_mm_loadu_si128((const __m128i *)(str + 2 * j + 16)), &ok);
+		_mm_storeu_si128((__m128i *)(raw + j),
+			_mm_packus_epi16(hex_pairs_sse2(a), hex_pairs_sse2(b)));
+	}
+	return _mm_movemask_epi8(ok) == 0xffff ? GIT_SUCCESS : GIT_ENOTOID;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_digits_avx2(__m256i v)
+{
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(9)),
+			_mm256_set1_epi8('a' - '0' - 10));
+	return _mm256_add_epi8(_mm256_add_epi8(v, _mm256_set1_epi8('0')), alpha);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_values_avx2(__m256i c, __m256i *ok)
+{
+	__m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+	__m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i is_d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+	__m256i is_l = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+
+	*ok = _mm256_and_si256(*ok, _mm256_or_si256(is_d, is_l));
+	return _mm256_or_si256(_mm256_and_si256(is_d, d),
+		_mm256_and_si256(is_l, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_pairs_avx2(__m256i v)
+{
+	return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0xff)), 4),
+		_mm256_srli_epi16(v, 8));
+}
+
+__attribute__((target("avx2")))
+static void hex_encode_avx2(char *str, const unsigned char *raw, size_t n)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i, j;
+
+	if (n < 32) {
+		hex_encode_sse2(str, raw, n);
+		return;
+	}
+
+	for (i = 0; i < n; i += 32) {
+		__m256i x, hi, lo, a, b;
+
+		j = i + 32 <= n ? i : n - 32;
+		x = _mm256_loadu_si256((const __m256i *)(raw + j));
+		hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), mask);
+		lo = _mm256_and_si256(x, mask);
+
+		/* the unpacks work within 128 bit lanes */
+		a = _mm256_unpacklo_epi8(hi, lo);
+		b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *)(str + 2 * j),
+			hex_digits_avx2(_mm256_permute2x128_si256(a, b, 0x20)));
+		_mm256_storeu_si256((__m256i *)(str + 2 * j + 32),
+			hex_digits_avx2(_mm256_permute2x128_si256(a, b, 0x31)));
+	}
+}
+
+__attribute__((target("avx2")))
+static int hex_decode_avx2(unsigned char *raw, const char *str, size_t n)
+{
+	__m256i ok = _mm256_set1_epi8(-1);
+	size_t i, j;
+
+	if (n < 32)
+		return hex_decode_sse2(raw, str, n);
+
+	for (i = 0; i < n; i += 32) {
+		__m256i a, b;
+
+		j = i + 32 <= n ? i : n - 32;
+		a = hex_values_avx2(_mm256_loadu_si256((const __m256i *)(str + 2 * j)), &ok);
+		b = hex_values_avx2(_mm256_loadu_si256((const __m256i *)(str + 2 * j + 32)), &ok);
+
+		/* the pack works within 128 bit lanes too */
+		_mm256_storeu_si256((__m256i *)(raw + j), _mm256_permute4x64_epi64(
+			_mm256_packus_epi16(hex_pairs_avx2(a), hex_pairs_avx2(b)), 0xd8));
+	}
+	return _mm256_movemask_epi8(ok) == -1 ? GIT_SUCCESS : GIT_ENOTOID;
+}
+#endif
+
+static const struct {
+	const char *name;
+	hex_encode_fn encode;
+	hex_decode_fn decode;
+} hex_impls[] = {
+#ifdef OID_HEX_X86
+	{ "avx2", hex_encode_avx2, hex_decode_avx2 },
+	{ "sse2", hex_encode_sse2, hex_decode_sse2 },
+#endif
+	{ "portable", hex_encode_portable, hex_decode_portable },
+};
+
+static hex_encode_fn hex_encode = hex_encode_portable;
+static hex_decode_fn hex_decode = hex_decode_portable;
+static const char *hex_impl = "portable";
+
+#ifdef OID_HEX_X86
+static void select_impl(void) __attribute__((constructor));
+static void select_impl(void)
+{
+	git_oid__set_impl(NULL);
+}
+#endif
+
+int git_oid__set_impl(const char *name)
+{
+	size_t j;
+
+	for (j = 0; j < ARRAY_SIZE(hex_impls); j++) {
+		if (name && strcmp(name, hex_impls[j].name))
+			continue;
+		if (!git__cpu_supports(hex_impls[j].name))
+			continue;
+
+		hex_encode = hex_impls[j].encode;
+		hex_decode = hex_impls[j].decode;
+		hex_impl = hex_impls[j].name;
+		return GIT_SUCCESS;
+	}
+	return GIT_ENOTFOUND;
+}
+
+const char *git_oid__impl(void)
+{
+	return hex_impl;
+}
+
+int git_oid_mkstr_many(git_oid *out, const char *str, size_t n)
 {
 	size_t i;
+	int error = GIT_SUCCESS;
 
-	for (i = 0; i < sizeof(oid->id); i++)
-		str = fmt_one(str, oid->id[i]);
+	if (sizeof(*out) == GIT_OID_RAWSZ)
+		return hex_decode(out->id, str, n * GIT_OID_RAWSZ);
+
+	for (i = 0; i < n; i++)
+		error |= hex_decode(out[i].id, str + i * GIT_OID_HEXSZ, GIT_OID_RAWSZ);
+	return error ? GIT_ENOTOID : GIT_SUCCESS;
 }
 
-void git_oid_pathfmt(char *str, const git_oid *oid)
+void git_oid_fmt(char *str, const git_oid *oid)
+{
+	hex_encode(str, oid->id, sizeof(oid->id));
+}
+
+void git_oid_fmt_many(char *str, const git_oid *ids, size_t n)
 {
 	size_t i;
 
+	if (sizeof(*ids) == GIT_OID_RAWSZ) {
+		hex_encode(str, ids->id, n * GIT_OID_RAWSZ);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		hex_encode(str + i * GIT_OID_HEXSZ, ids[i].id, GIT_OID_RAWSZ);
+}
+
+void git_oid_pathfmt(char *str, const git_oid *oid)
+{
 	str = fmt_one(str, oid->id[0]);
 	*str++ = '/';
-	for (i = 1; i < sizeof(oid->id); i++)
-		str = fmt_one(str, oid->id[i]);
+	hex_encode(str, oid->id + 1, sizeof(oid->id) - 1);
 }
 
 char *git_oid_allocfmt(const git_oid *oid)
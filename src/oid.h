@@ -0,0 +1,16 @@
+#ifndef INCLUDE_oid_h__
+#define INCLUDE_oid_h__
+
+#include "git/oid.h"
+
+/*
+ * Select the routines converting oids to and from hex by name
+ * ("portable", "sse2" or "avx2"), or the fastest one the CPU
+ * supports if NULL, which is done at startup.  Returns
+ * GIT_ENOTFOUND if the CPU lacks the instructions needed.  Not
+ * thread-safe: meant for tests and benchmarks.
+ */
+int git_oid__set_impl(const char *name);
+const char *git_oid__impl(void);
+
+#endif /* INCLUDE_oid_h__ */
@@ -0,0 +1,346 @@
+/*
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * In addition to the permissions in the GNU General Public License,
+ * the authors give you unlimited permission to link the compiled
+ * version of this file into combinations with other programs,
+ * and to distribute those combinations without any restriction
+ * coming from the use of this file.  (The General Public License
+ * restrictions do apply in other respects; for example, they cover
+ * modification of the file, and distribution when not linked into
+ * a combined executable.)
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "common.h"
+#include "oidmap.h"
+
+static const unsigned int default_map_size = 32;
+static const double max_load_factor = 0.8;
+
+/* old slots moved to the new array by each insertion or lookup */
+static const unsigned int migrate_step = 64;
+
+/* the value of entries removed from the old array while migrating */
+static char removed_entry;
+#define REMOVED ((void *)&removed_entry)
+
+GIT_INLINE(uint32_t) oid_hash(const git_oid *id)
+{
+	uint32_t r;
+	memcpy(&r, id->id, sizeof(r));
+	return r;
+}
+
+/* how far a slot is from the one its hash points to */
+GIT_INLINE(unsigned int) slot_distance(const git_oidmap_slot *slots,
+		unsigned int size_mask, unsigned int pos)
+{
+	return (pos - slots[pos].hash) & size_mask;
+}
+
+/*
+ * Entries further from their home slot take the place of those
+ * closer to theirs, which then move on: this keeps every entry
+ * near its home slot, and lets a lookup stop as soon as it meets
+ * an entry closer to home than the one looked for would be.
+ */
+static void place_entry(git_oidmap *map, git_oidmap_slot entry)
+{
+	unsigned int pos = entry.hash & map->size_mask, dist = 0;
+
+	for (;;) {
+		git_oidmap_slot *slot = &map->slots[pos];
+		unsigned int d;
+
+		if (slot->value == NULL) {
+			*slot = entry;
+			return;
+		}
+
+		if ((d = slot_distance(map->slots, map->size_mask, pos)) < dist) {
+			git_oidmap_slot tmp = *slot;
+			*slot = entry;
+			entry = tmp;
+			dist = d;
+		}
+
+		pos = (pos + 1) & map->size_mask;
+		dist++;
+	}
+}
+
+/*
+ * Find id in a slot array.  In the old array during a resize,
+ * the slots before 'from' were already moved to the new array,
+ * and removed entries are kept until the array is freed.
+ */
+static int find_slot(const git_oidmap_slot *slots, unsigned int size_mask,
+		unsigned int from, const git_oid *id, unsigned int *pos_out)
+{
+	uint32_t hash = oid_hash(id);
+	unsigned int pos = hash & size_mask, dist = 0;
+
+	for (;;) {
+		const git_oidmap_slot *slot = &slots[pos];
+
+		if (slot->value == NULL || slot_distance(slots, size_mask, pos) < dist)
+			return GIT_ENOTFOUND;
+
+		if (slot->hash == hash && pos >= from && slot->value != REMOVED &&
+			git_oid_cmp(&slot->id, id) == 0) {
+			*pos_out = pos;
+			return GIT_SUCCESS;
+		}
+
+		pos = (pos + 1) & size_mask;
+		dist++;
+	}
+}
+
+/* move up to n slots of the old array to the new one */
+static void migrate_slots(git_oidmap *map, unsigned int n)
+{
+	if (map->old_slots == NULL)
+		return;
+
+	while (n-- > 0 && map->migrated <= map->old_size_mask) {
+		git_oidmap_slot *slot = &map->old_slots[map->migrated++];
+
+		if (slot->value != NULL && slot->value != REMOVED)
+			place_entry(map, *slot);
+	}
+
+	if (map->migrated > map->old_size_mask) {
+		free(map->old_slots);
+		map->old_slots = NULL;
+	}
+}
+
+/*
+ * Resizing only allocates the new slot array: the entries are
+ * moved to it a few at a time by the following insertions and
+ * lookups, which look in both arrays until they are all moved.
+ * This keeps a single insertion from rehashing the whole map.
+ */
+static int oidmap_resize(git_oidmap *map, unsigned int new_size)
+{
+	git_oidmap_slot *new_slots;
+
+	/* finish any earlier resize first */
+	migrate_slots(map, UINT_MAX);
+
+	new_slots = git__calloc(new_size, sizeof(git_oidmap_slot));
+	if (new_slots == NULL)
+		return GIT_ENOMEM;
+
+	map->old_slots = map->slots;
+	map->old_size_mask = map->size_mask;
+	map->migrated = 0;
+
+	map->slots = new_slots;
+	map->size_mask = new_size - 1;
+	map->max_count = (unsigned int)(new_size * max_load_factor);
+
+	return GIT_SUCCESS;
+}
+
+git_oidmap *git_oidmap_alloc(unsigned int min_size)
+{
+	git_oidmap *map;
+	unsigned int size = default_map_size;
+
+	if ((map = git__malloc(sizeof(git_oidmap))) == NULL)
+		return NULL;
+
+	while (size < min_size && size < 0x80000000)
+		size <<= 1;
+
+	memset(map, 0x0, sizeof(git_oidmap));
+	map->size_mask = size - 1;
+	map->max_count = (unsigned int)(size * max_load_factor);
+
+	map->slots = git__calloc(size, sizeof(git_oidmap_slot));
+	if (map->slots == NULL) {
+		free(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+int git_oidmap_reserve(git_oidmap *map, unsigned int count)
+{
+	unsigned int size;
+
+	assert(map);
+
+	if (count <= map->max_count)
+		return GIT_SUCCESS;
+
+	size = map->size_mask + 1;
+	while ((unsigned int)(size * max_load_factor) < count && size < 0x80000000)
+		size <<= 1;
+
+	if (oidmap_resize(map, size) < GIT_SUCCESS)
+		return GIT_ENOMEM;
+
+	/* the caller is about to fill the map: move everything now */
+	migrate_slots(map, UINT_MAX);
+	return GIT_SUCCESS;
+}
+
+void git_oidmap_clear(git_oidmap *map)
+{
+	assert(map);
+
+	free(map->old_slots);
+	map->old_slots = NULL;
+
+	memset(map->slots, 0x0, (map->size_mask + 1) * sizeof(git_oidmap_slot));
+	map->count = 0;
+}
+
+void git_oidmap_free(git_oidmap *map)
+{
+	assert(map);
+
+	free(map->old_slots);
+	free(map->slots);
+	free(map);
+}
+
+int git_oidmap_insert(git_oidmap *map, const git_oid *id, void *value)
+{
+	git_oidmap_slot entry;
+
+	assert(map && id && value);
+
+	if (map->count + 1 > map->max_count &&
+		oidmap_resize(map, (map->size_mask + 1) * 2) < GIT_SUCCESS)
+		return GIT_ENOMEM;
+
+	migrate_slots(map, migrate_step);
+
+	git_oid_cpy(&entry.id, id);
+	entry.hash = oid_hash(id);
+	entry.value = value;
+
+	place_entry(map, entry);
+	map->count++;
+
+	return GIT_SUCCESS;
+}
+
+void *git_oidmap_lookup(git_oidmap *map, const git_oid *id)
+{
+	unsigned int pos;
+
+	assert(map && id);
+
+	migrate_slots(map, migrate_step);
+
+	if (find_slot(map->slots, map->size_mask, 0, id, &pos) == GIT_SUCCESS)
+		return map->slots[pos].value;
+
+	if (map->old_slots != NULL &&
+		find_slot(map->old_slots, map->old_size_mask, map->migrated, id, &pos) == GIT_SUCCESS)
+		return map->old_slots[pos].value;
+
+	return NULL;
+}
+
+int git_oidmap_remove(git_oidmap *map, const git_oid *id)
+{
+	unsigned int pos, next;
+
+	assert(map && id);
+
+	if (find_slot(map->slots, map->size_mask, 0, id, &pos) < GIT_SUCCESS) {
+		if (map->old_slots == NULL ||
+			find_slot(map->old_slots, map->old_size_mask, map->migrated, id, &pos) < GIT_SUCCESS)
+			return GIT_ENOTFOUND;
+
+		/* moving entries of the old array could move them before 'migrated' */
+		map->old_slots[pos].value = REMOVED;
+		map->count--;
+		return GIT_SUCCESS;
+	}
+
+	/* move the following entries back, up to one already at home */
+	for (;;) {
+		next = (pos + 1) & map->size_mask;
+		if (map->slots[next].value == NULL ||
+			slot_distance(map->slots, map->size_mask, next) == 0)
+			break;
+
+		map->slots[pos] = map->slots[next];
+		pos = next;
+	}
+
+	map->slots[pos].value = NULL;
+	map->count--;
+
+	return GIT_SUCCESS;
+}
+
+
+
+void git_oidmap_iterator_init(git_oidmap *map, git_oidmap_iterator *it)
+{
+	assert(map && it);
+
+	/* iterate over a single array */
+	migrate_slots(map, UINT_MAX);
+
+	memset(it, 0x0, sizeof(git_oidmap_iterator));
+
+	it->map = map;
+
+	/*
+	 * Start after an empty slot: removing an entry moves the
+	 * ones after it back by one slot, which must never move
+	 * them from the end of the iteration to its start.
+	 */
+	while (it->start <= map->size_mask && map->slots[it->start].value != NULL)
+		it->start++;
+	it->start++;
+}
+
+void *git_oidmap_iterator_next(git_oidmap_iterator *it)
+{
+	git_oidmap *map;
+	git_oidmap_slot *slot;
+
+	assert(it);
+
+	map = it->map;
+
+	/* the last entry was removed, and the next moved into its slot */
+	if (it->last != NULL) {
+		slot = &map->slots[it->pos];
+		if (slot->value != NULL && slot->value != it->last)
+			return it->last = slot->value;
+	}
+
+	while (it->visited <= map->size_mask) {
+		it->pos = (it->start + it->visited++) & map->size_mask;
+		slot = &map->slots[it->pos];
+
+		if (slot->value != NULL)
+			return it->last = slot->value;
+	}
+
+	return it->last = NULL;
+}
@@ -0,0 +1,74 @@
+#ifndef INCLUDE_oidmap_h__
+#define INCLUDE_oidmap_h__
+
+#include "git/common.h"
+#include "git/oid.h"
+
+/*
+ * A hash table from object ids to pointers, using open addressing
+ * with Robin Hood probing: the ids, their hashes and the values
+ * are stored in the slot array itself, so inserting needs no
+ * allocation and a lookup usually touches a single cache line.
+ *
+ * Growing the map is incremental: the entries are moved to the
+ * larger slot array a few at a time by the insertions and lookups
+ * that follow, so lookups may change the map.
+ *
+ * Like git_hashtable, inserting does not check whether the id is
+ * already present.  Values must not be NULL.
+ */
+
+struct git_oidmap_slot {
+	git_oid id;
+	uint32_t hash;
+	void *value;  /* NULL for an empty slot */
+};
+
+struct git_oidmap {
+	struct git_oidmap_slot *slots;
+
+	unsigned int size_mask;
+	unsigned int count;
+	unsigned int max_count;
+
+	/* the slots being moved to the new array, if growing */
+	struct git_oidmap_slot *old_slots;
+	unsigned int old_size_mask;
+	unsigned int migrated;
+};
+
+struct git_oidmap_iterator {
+	struct git_oidmap *map;
+	void *last;
+	unsigned int start;
+	unsigned int pos;
+	unsigned int visited;
+};
+
+typedef struct git_oidmap_slot git_oidmap_slot;
+typedef struct git_oidmap git_oidmap;
+typedef struct git_oidmap_iterator git_oidmap_iterator;
+
+git_oidmap *git_oidmap_alloc(unsigned int min_size);
+
+/*
+ * Grow the map at once, so that it holds count entries without
+ * resizing again.
+ */
+int git_oidmap_reserve(git_oidmap *map, unsigned int count);
+
+int git_oidmap_insert(git_oidmap *map, const git_oid *id, void *value);
+void *git_oidmap_lookup(git_oidmap *map, const git_oid *id);
+int git_oidmap_remove(git_oidmap *map, const git_oid *id);
+void git_oidmap_free(git_oidmap *map);
+void git_oidmap_clear(git_oidmap *map);
+
+/*
+ * The value returned last by git_oidmap_iterator_next() may be
+ * removed from the map before the next call; other changes to
+ * the map, including lookups, end the iteration.
+ */
+void *git_oidmap_iterator_next(git_oidmap_iterator *it);
+void git_oidmap_iterator_init(git_oidmap *map, git_oidmap_iterator *it);
+
+#endif
@@ -50,29 +50,6 @@ static const size_t object_sizes[] = {
 };
 
 
-uint32_t git__objtable_hash(const void *key)
-{
-	uint32_t r;
-	git_oid *id;
-
-	id = (git_oid *)key;
-	memcpy(&r, id->id, sizeof(r));
-	return r;
-}
-
-int git__objtable_haskey(void *object, const void *key)
-{
-	git_object *obj;
-	git_oid *oid;
-
-	obj = (git_object *)object;
-	oid = (git_oid *)key;
-
-	return (git_oid_cmp(oid, &obj->id) == 0);
-}
-
-
-
 static int assign_repository_folders(git_repository *repo,
 		const char *git_dir,
 		const char *git_object_directory,
@@ -199,10 +176,7 @@ git_repository *git_repository__alloc()
 
 	memset(repo, 0x0, sizeof(git_repository));
 
-	repo->objects = git_hashtable_alloc(
-			default_table_size, 
-			git__objtable_hash,
-			git__objtable_haskey);
+	repo->objects = git_oidmap_alloc(default_table_size);
 
 	if (repo->objects == NULL) {
 		free(repo);
@@ -277,7 +251,7 @@ cleanup:
 
 void git_repository_free(git_repository *repo)
 {
-	git_hashtable_iterator it;
+	git_oidmap_iterator it;
 	git_object *object;
 
 	assert(repo);
@@ -287,13 +261,13 @@ void git_repository_free(git_repository *repo)
 	free(repo->path_repository);
 	free(repo->path_odb);
 
-	git_hashtable_iterator_init(repo->objects, &it);
+	git_oidmap_iterator_init(repo->objects, &it);
 
 	while ((object = (git_object *)
-				git_hashtable_iterator_next(&it)) != NULL)
+				git_oidmap_iterator_next(&it)) != NULL)
 		git_object_free(object);
 
-	git_hashtable_free(repo->objects);
+	git_oidmap_free(repo->objects);
 	git_odb_close(repo->db);
 	git_index_free(repo->index);
 	free(repo);
@@ -408,10 +382,10 @@ static int write_back(git_object *object)
 		return error;
 
 	if (!object->in_memory)
-		git_hashtable_remove(object->repo->objects, &object->id);
+		git_oidmap_remove(object->repo->objects, &object->id);
 
 	git_oid_cpy(&object->id, &new_id);
-	git_hashtable_insert(object->repo->objects, &object->id, object);
+	git_oidmap_insert(object->repo->objects, &object->id, object);
 
 	object->source.write_ptr = NULL;
 	object->source.written_bytes = 0;
@@ -498,7 +472,7 @@ void git_object_free(git_object *object)
 	assert(object);
 
 	git_object__source_close(object);
-	git_hashtable_remove(object->repo->objects, &object->id);
+	git_oidmap_remove(object->repo->objects, &object->id);
 
 	switch (object->source.raw.type) {
 	case GIT_OBJ_COMMIT:
@@ -523,6 +497,16 @@ void git_object_free(git_object *object)
 	}
 }
 
+int git_repository_reserve_objects(git_repository *repo, size_t count)
+{
+	assert(repo);
+
+	if (count > UINT_MAX)
+		return GIT_ENOMEM;
+
+	return git_oidmap_reserve(repo->objects, (unsigned int)count);
+}
+
 git_odb *git_repository_database(git_repository *repo)
 {
 	assert(repo);
@@ -594,7 +578,7 @@ int git_repository_lookup(git_object **object_out, git_repository *repo, const g
 
 	assert(repo && object_out && id);
 
-	object = git_hashtable_lookup(repo->objects, id);
+	object = git_oidmap_lookup(repo->objects, id);
 	if (object != NULL) {
 		*object_out = object;
 		return GIT_SUCCESS;
@@ -650,7 +634,7 @@ int git_repository_lookup(git_object **object_out, git_repository *repo, const g
 	}
 
 	git_object__source_close(object);
-	git_hashtable_insert(repo->objects, &object->id, object);
+	git_oidmap_insert(repo->objects, &object->id, object);
 
 	*object_out = object;
 	return GIT_SUCCESS;
@@ -6,7 +6,7 @@
 #include "git/odb.h"
 #include "git/repository.h"
 
-#include "hashtable.h"
+#include "oidmap.h"
 #include "index.h"
 
 typedef struct {
@@ -26,7 +26,7 @@ struct git_object {
 struct git_repository {
 	git_odb *db;
 	git_index *index;
-	git_hashtable *objects;
+	git_oidmap *objects;
 
 	char *path_repository;
 	char *path_index;
@@ -143,7 +143,8 @@ static git_revwalk_commit *insert_commit(git_revwalk *walk, git_commit *commit_o
 		git_commit *parent_object;
 		git_revwalk_commit *parent;
 
-		parent_object = git_vector_get(&commit->commit_object->parents, i);
+		if ((parent_object = git_commit_parent(commit->commit_object, i)) == NULL)
+			return NULL;
 
 		if ((parent = commit_to_walkcommit(walk, parent_object)) == NULL)
 			return NULL;
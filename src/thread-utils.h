@@ -9,6 +9,10 @@ typedef pthread_mutex_t git_lck;
 # define gitlck_unlock(a) pthread_mutex_unlock(a)
 # define gitlck_free(a)   pthread_mutex_destroy(a)
 
+typedef pthread_t git_thread;
+# define git_thread_create(t, fn, arg) pthread_create(t, NULL, fn, arg)
+# define git_thread_join(t)            pthread_join(t, NULL)
+
 # if defined(GIT_HAS_ASM_ATOMIC)
 #  include <asm/atomic.h>
 typedef atomic_t git_refcnt;
@@ -70,7 +74,7 @@ GIT_INLINE(int) gitrc_dec(git_refcnt *p)
 
 #else
 typedef struct { int dummy; } git_lck;
-# define GIT_MUTEX_INIT   {}
+# define GITLCK_INIT      { 0 }
 # define gitlck_init(a)   (void)0
 # define gitlck_lock(a)   (void)0
 # define gitlck_unlock(a) (void)0
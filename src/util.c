@@ -19,6 +19,14 @@ void *git__calloc(size_t a, size_t b)
 	return r;
 }
 
+void *git__realloc(void *ptr, size_t n)
+{
+	void *r = realloc(ptr, n);
+	if (!r)
+		return git_ptr_error(GIT_ENOMEM);
+	return r;
+}
+
 char *git__strdup(const char *s)
 {
 	char *r = strdup(s);
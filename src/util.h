@@ -5,6 +5,7 @@
 
 extern void *git__malloc(size_t);
 extern void *git__calloc(size_t, size_t);
+extern void *git__realloc(void *, size_t);
 extern char *git__strdup(const char *);
 
 #ifndef GIT__NO_HIDE_MALLOC
@@ -20,6 +21,11 @@ extern char *git__strdup(const char *);
 # endif
 # define calloc(a,b)        GIT__FORBID_MALLOC
 
+# ifdef realloc
+#  undef realloc
+# endif
+# define realloc(a,b)       GIT__FORBID_MALLOC
+
 # ifdef strdup
 #  undef strdup
 # endif
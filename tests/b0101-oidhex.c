@@ -0,0 +1,125 @@
+/*
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * In addition to the permissions in the GNU General Public License,
+ * the authors give you unlimited permission to link the compiled
+ * version of this file into combinations with other programs,
+ * and to distribute those combinations without any restriction
+ * coming from the use of this file.  (The General Public License
+ * restrictions do apply in other respects; for example, they cover
+ * modification of the file, and distribution when not linked into
+ * a combined executable.)
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Benchmark of the oid hex routines: each implementation the CPU
+ * supports, against the portable one, in batches and one oid at
+ * a time.  Built along with the tests but not run by them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "oid.h"
+
+#define N_IDS 4096
+#define ROUNDS 200
+#define RUNS 10
+
+static git_oid ids[N_IDS], back[N_IDS];
+static char hex[N_IDS * GIT_OID_HEXSZ];
+
+static void fmt_many(void)
+{
+	git_oid_fmt_many(hex, ids, N_IDS);
+}
+
+static void mkstr_many(void)
+{
+	git_oid_mkstr_many(back, hex, N_IDS);
+}
+
+static void fmt_each(void)
+{
+	size_t i;
+
+	for (i = 0; i < N_IDS; i++)
+		git_oid_fmt(hex + i * GIT_OID_HEXSZ, &ids[i]);
+}
+
+static void mkstr_each(void)
+{
+	size_t i;
+
+	for (i = 0; i < N_IDS; i++)
+		git_oid_mkstr(&back[i], hex + i * GIT_OID_HEXSZ);
+}
+
+/* the best time of RUNS runs, in nanoseconds per oid */
+static double measure(void (*fn)(void))
+{
+	double best = 0;
+	int run, r;
+
+	for (run = 0; run < RUNS; run++) {
+		clock_t start = clock();
+		double ns;
+
+		for (r = 0; r < ROUNDS; r++)
+			fn();
+		ns = (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / ROUNDS / N_IDS;
+		if (!run || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+int main(void)
+{
+	static const char *impls[] = { "portable", "sse2", "avx2", NULL };
+	size_t i;
+	int k;
+
+	for (i = 0; i < sizeof(ids); i++)
+		ids[i / GIT_OID_RAWSZ].id[i % GIT_OID_RAWSZ] = (unsigned char)(i * 131 + 7);
+
+	printf("%-10s %12s %12s %12s %12s  (ns per oid)\n",
+		"", "fmt_many", "mkstr_many", "fmt", "mkstr");
+
+	for (k = 0; impls[k]; k++) {
+		double t[4];
+
+		if (git_oid__set_impl(impls[k]) < GIT_SUCCESS)
+			continue;
+
+		t[0] = measure(fmt_many);
+		t[1] = measure(mkstr_many);
+		t[2] = measure(fmt_each);
+		t[3] = measure(mkstr_each);
+
+		memset(back, 0x0, sizeof(back));
+		mkstr_many();
+		if (memcmp(ids, back, sizeof(ids))) {
+			fprintf(stderr, "%s: the ids do not round-trip\n", impls[k]);
+			return 1;
+		}
+
+		printf("%-10s %12.2f %12.2f %12.2f %12.2f\n", impls[k], t[0], t[1], t[2], t[3]);
+	}
+
+	git_oid__set_impl(NULL);
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include "test_lib.h"
 #include <git/oid.h>
+#include "oid.h"
 
 BEGIN_TEST(oid_szs)
 	git_oid out;
@@ -276,3 +277,72 @@ BEGIN_TEST(oid_to_string_big)
 	must_be_true(str && str == big && *(str+GIT_OID_HEXSZ+3) == 'Z');
 END_TEST
 
+
+static const char *hex_impls[] = { "portable", "sse2", "avx2", NULL };
+
+BEGIN_TEST(oid_fmt_many)
+	static git_oid ids[9], back[9];
+	static char exp[9 * GIT_OID_HEXSZ + 1], out[9 * GIT_OID_HEXSZ + 1];
+	unsigned int i, n;
+	int k;
+
+	for (i = 0; i < sizeof(ids); i++)
+		ids[i / GIT_OID_RAWSZ].id[i % GIT_OID_RAWSZ] = (unsigned char)(i * 157 + 11);
+	for (i = 0; i < 9; i++)
+		git_oid_to_string(exp + i * GIT_OID_HEXSZ, GIT_OID_HEXSZ + 1, &ids[i]);
+
+	for (k = 0; hex_impls[k]; k++) {
+		if (git_oid__set_impl(hex_impls[k]) < GIT_SUCCESS)
+			continue;
+		must_be_true(!strcmp(git_oid__impl(), hex_impls[k]));
+
+		/* every batch size around the vector widths */
+		for (n = 0; n <= 9; n++) {
+			memset(out, 'Z', sizeof(out));
+			git_oid_fmt_many(out, ids, n);
+			must_pass(memcmp(exp, out, n * GIT_OID_HEXSZ));
+			must_be_true(out[n * GIT_OID_HEXSZ] == 'Z');
+
+			memset(back, 0x0, sizeof(back));
+			must_pass(git_oid_mkstr_many(back, exp, n));
+			must_pass(memcmp(ids, back, n * sizeof(git_oid)));
+		}
+	}
+
+	must_be_true(git_oid__set_impl("nonexistent") == GIT_ENOTFOUND);
+	must_pass(git_oid__set_impl(NULL));
+END_TEST
+
+BEGIN_TEST(oid_mkstr_many_invalid)
+	static git_oid out[4];
+	static char in[4 * GIT_OID_HEXSZ];
+	unsigned int i, c;
+	int k;
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = "0123456789abcdefABCDEF"[(i * 7) % 22];
+
+	for (k = 0; hex_impls[k]; k++) {
+		if (git_oid__set_impl(hex_impls[k]) < GIT_SUCCESS)
+			continue;
+
+		must_pass(git_oid_mkstr_many(out, in, 4));
+
+		/* a bad character anywhere fails the whole batch */
+		for (i = 0; i < sizeof(in); i++) {
+			char save = in[i];
+
+			for (c = 0; c < 256; c++) {
+				if (from_hex(c) >= 0)
+					continue;
+				in[i] = (char)c;
+				if (!git_oid_mkstr_many(out, in, 4))
+					test_die("line %d: %s must not accept %02x at %u",
+						 __LINE__, hex_impls[k], c, i);
+			}
+			in[i] = save;
+		}
+	}
+
+	must_pass(git_oid__set_impl(NULL));
+END_TEST
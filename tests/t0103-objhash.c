@@ -421,3 +421,30 @@ BEGIN_TEST(hash_some)
 END_TEST
 
 
+
+BEGIN_TEST(hash_many)
+    git_rawobj objs[7];
+    git_oid ids[7], id;
+    char *hex[7];
+    size_t j;
+
+    objs[0] = commit_obj; hex[0] = commit_id;
+    objs[1] = tree_obj;   hex[1] = tree_id;
+    objs[2] = tag_obj;    hex[2] = tag_id;
+    objs[3] = zero_obj;   hex[3] = zero_id;
+    objs[4] = one_obj;    hex[4] = one_id;
+    objs[5] = two_obj;    hex[5] = two_id;
+    objs[6] = some_obj;   hex[6] = some_id;
+
+    must_pass(git_obj_hash_many(ids, objs, 7));
+    for (j = 0; j < 7; j++) {
+        must_pass(git_oid_mkstr(&id, hex[j]));
+        must_be_true(git_oid_cmp(&id, &ids[j]) == 0);
+    }
+
+    must_pass(git_obj_hash_many(ids, NULL, 0));
+
+    /* one malformed object fails the whole batch: */
+    objs[4].type = GIT_OBJ_OFS_DELTA;
+    must_fail(git_obj_hash_many(ids, objs, 7));
+END_TEST
@@ -0,0 +1,177 @@
+#include "test_lib.h"
+#include "hash.h"
+#include <git/oid.h>
+
+static char *hello_id = "22596363b3de40b06f981fb85d82312e8c0ed511";
+static char *hello_text = "hello world\n";
+
+static char *bye_id = "ce08fe4884650f067bd5703b6a59a8b3b3c99a09";
+static char *bye_text = "bye world\n";
+
+BEGIN_TEST(hash_iuf)
+    git_hash_ctx *ctx;
+    git_oid id1, id2;
+
+    must_be_true((ctx = git_hash_new_ctx()) != NULL);
+
+	/* should already be init'd */
+    git_hash_update(ctx, hello_text, strlen(hello_text));
+    git_hash_final(&id2, ctx);
+    must_pass(git_oid_mkstr(&id1, hello_id));
+    must_be_true(git_oid_cmp(&id1, &id2) == 0);
+
+	/* reinit should permit reuse */
+    git_hash_init(ctx);
+    git_hash_update(ctx, bye_text, strlen(bye_text));
+    git_hash_final(&id2, ctx);
+    must_pass(git_oid_mkstr(&id1, bye_id));
+    must_be_true(git_oid_cmp(&id1, &id2) == 0);
+
+    git_hash_free_ctx(ctx);
+END_TEST
+
+BEGIN_TEST(hash_buf)
+    git_oid id1, id2;
+
+    must_pass(git_oid_mkstr(&id1, hello_id));
+
+    git_hash_buf(&id2, hello_text, strlen(hello_text));
+
+    must_be_true(git_oid_cmp(&id1, &id2) == 0);
+END_TEST
+
+BEGIN_TEST(hash_vec)
+    git_oid id1, id2;
+    git_buf_vec vec[2];
+
+    must_pass(git_oid_mkstr(&id1, hello_id));
+
+    vec[0].data = hello_text;
+    vec[0].len  = 4;
+    vec[1].data = hello_text+4;
+    vec[1].len  = strlen(hello_text)-4;
+
+    git_hash_vec(&id2, vec, 2);
+
+    must_be_true(git_oid_cmp(&id1, &id2) == 0);
+END_TEST
+
+static const char *impls[] = { "portable", "avx2", "shani", NULL };
+
+static void hash_lengths(git_oid *ids, const unsigned char *data, size_t n)
+{
+    git_hash_ctx *ctx;
+    size_t len, j, step;
+
+    must_be_true((ctx = git_hash_new_ctx()) != NULL);
+
+    for (len = 0; len < n; len++) {
+        /* unaligned data, fed in uneven pieces */
+        git_hash_init(ctx);
+        for (j = 0; j < len; j += step) {
+            step = 1 + (j * 7) % 150;
+            if (step > len - j)
+                step = len - j;
+            git_hash_update(ctx, data + 1 + j, step);
+        }
+        git_hash_final(&ids[len], ctx);
+    }
+
+    git_hash_free_ctx(ctx);
+}
+
+BEGIN_TEST(hash_impls)
+    static unsigned char data[1025];
+    static git_oid expected[1024], ids[1024];
+    git_oid id1, id2;
+    size_t j;
+    int k;
+
+    for (j = 0; j < sizeof(data); j++)
+        data[j] = (unsigned char)(j * 131 + (j >> 8));
+
+    must_pass(git_hash__set_impl("portable"));
+    must_be_true(!strcmp(git_hash__impl(), "portable"));
+    hash_lengths(expected, data, 1024);
+
+    for (k = 0; impls[k]; k++) {
+        if (git_hash__set_impl(impls[k]) < GIT_SUCCESS)
+            continue;
+
+        must_pass(git_oid_mkstr(&id1, hello_id));
+        git_hash_buf(&id2, hello_text, strlen(hello_text));
+        must_be_true(git_oid_cmp(&id1, &id2) == 0);
+
+        hash_lengths(ids, data, 1024);
+        for (j = 0; j < 1024; j++) {
+            must_be_true(git_oid_cmp(&expected[j], &ids[j]) == 0);
+            git_hash_buf(&id2, data + 1, j);
+            must_be_true(git_oid_cmp(&expected[j], &id2) == 0);
+        }
+    }
+
+    must_be_true(git_hash__set_impl("nonexistent") == GIT_ENOTFOUND);
+    must_pass(git_hash__set_impl(NULL));
+END_TEST
+
+static const char *many_impls[] = { "none", "sse2", "avx2", NULL };
+
+BEGIN_TEST(hash_many)
+    static unsigned char data[1024];
+    static git_buf_vec bufs[300], vec[3 * 100];
+    static git_oid expected[300], ids[300];
+    size_t j, off;
+    int k;
+
+    for (j = 0; j < sizeof(data); j++)
+        data[j] = (unsigned char)(j * 151 + (j >> 7));
+
+    /* single buffers of every length around the padding boundaries */
+    for (j = 0; j < 300; j++) {
+        bufs[j].data = data + (j % 5);
+        bufs[j].len  = (j * 37) % 300;
+        git_hash_buf(&expected[j], bufs[j].data, bufs[j].len);
+    }
+
+    for (k = 0; many_impls[k]; k++) {
+        if (git_hash__set_many_impl(many_impls[k]) < GIT_SUCCESS)
+            continue;
+        must_be_true(!strcmp(git_hash__many_impl(), many_impls[k]));
+
+        memset(ids, 0x0, sizeof(ids));
+        git_hash_many(ids, bufs, 300);
+        for (j = 0; j < 300; j++)
+            must_be_true(git_oid_cmp(&expected[j], &ids[j]) == 0);
+
+        /* batches smaller than the number of lanes */
+        memset(ids, 0x0, sizeof(ids));
+        git_hash_many(ids, bufs + 7, 3);
+        for (j = 0; j < 3; j++)
+            must_be_true(git_oid_cmp(&expected[j + 7], &ids[j]) == 0);
+    }
+
+    /* messages in three parts, some of them empty */
+    for (j = 0, off = 0; j < 100; j++) {
+        vec[3 * j].data = data + off % 512;
+        vec[3 * j].len  = j % 70;
+        vec[3 * j + 1].data = data + 3;
+        vec[3 * j + 1].len  = (j * 13) % 3 ? (j * 29) % 200 : 0;
+        vec[3 * j + 2].data = data + 600;
+        vec[3 * j + 2].len  = (j * 11) % 90;
+        git_hash_vec(&expected[j], &vec[3 * j], 3);
+        off += 17;
+    }
+
+    for (k = 0; many_impls[k]; k++) {
+        if (git_hash__set_many_impl(many_impls[k]) < GIT_SUCCESS)
+            continue;
+
+        memset(ids, 0x0, sizeof(ids));
+        git_hash_vec_many(ids, vec, 3, 100);
+        for (j = 0; j < 100; j++)
+            must_be_true(git_oid_cmp(&expected[j], &ids[j]) == 0);
+    }
+
+    must_be_true(git_hash__set_many_impl("nonexistent") == GIT_ENOTFOUND);
+    must_pass(git_hash__set_many_impl(NULL));
+END_TEST
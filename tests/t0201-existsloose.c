@@ -1,6 +1,7 @@
 #include "test_lib.h"
 #include "test_helpers.h"
 #include <git/odb.h>
+#include "fileops.h"
 
 static char *odb_dir = "test-objects";
 
@@ -25,6 +26,60 @@ static object_data one = {
     sizeof(one_data),
 };
 
+/* two == 8b5014c7b4dc2bdb711f6ca0a365a7baa70abb50 */
+static unsigned char two_bytes[] = {
+    0x78, 0x9c, 0x4b, 0xca, 0xc9, 0x4f, 0x52, 0xb0,
+    0x60, 0x28, 0x29, 0xcf, 0x57, 0x30, 0x35, 0x30,
+    0xe5, 0x02, 0x00, 0x25, 0x73, 0x04, 0x16,
+};
+
+static unsigned char two_data[] = {
+    0x74, 0x77, 0x6f, 0x20, 0x35, 0x30, 0x35, 0x0a,
+};
+
+static object_data two = {
+    two_bytes,
+    sizeof(two_bytes),
+    "8b5014c7b4dc2bdb711f6ca0a365a7baa70abb50",
+    "blob",
+    "test-objects/8b",
+    "test-objects/8b/5014c7b4dc2bdb711f6ca0a365a7baa70abb50",
+    two_data,
+    sizeof(two_data),
+};
+
+/* three == 8b0cca49868c933185cb8c939ca8723e1f86de87 */
+static unsigned char three_bytes[] = {
+    0x78, 0x9c, 0x4b, 0xca, 0xc9, 0x4f, 0x52, 0x30,
+    0x34, 0x60, 0x28, 0xc9, 0x28, 0x4a, 0x4d, 0x55,
+    0x30, 0xb2, 0x34, 0xe1, 0x02, 0x00, 0x34, 0xb3,
+    0x05, 0x02,
+};
+
+static unsigned char three_data[] = {
+    0x74, 0x68, 0x72, 0x65, 0x65, 0x20, 0x32, 0x39,
+    0x34, 0x0a,
+};
+
+static object_data three = {
+    three_bytes,
+    sizeof(three_bytes),
+    "8b0cca49868c933185cb8c939ca8723e1f86de87",
+    "blob",
+    "test-objects/8b",
+    "test-objects/8b/0cca49868c933185cb8c939ca8723e1f86de87",
+    three_data,
+    sizeof(three_data),
+};
+
+static void wait_next_second(void)
+{
+    time_t now = time(NULL);
+
+    while (time(NULL) == now)
+        ;
+}
+
 
 BEGIN_TEST(exists_loose_one)
     git_odb *db;
@@ -43,3 +98,60 @@ BEGIN_TEST(exists_loose_one)
     git_odb_close(db);
     must_pass(remove_object_files(odb_dir, &one));
 END_TEST
+
+BEGIN_TEST(exists_loose_cached)
+    git_odb *db;
+    git_oid id, id2;
+    git_rawobj obj;
+
+    must_pass(write_object_files(odb_dir, &one));
+    must_pass(git_odb_open(&db, odb_dir));
+    git_odb_set_loose_cache(db, 1);
+    must_pass(git_oid_mkstr(&id, one.id));
+
+    must_be_true(git_odb_exists(db, &id));
+    must_pass(git_odb_read(&obj, db, &id));
+    must_be_true(obj.len == one.dlen);
+    git_obj_close(&obj);
+
+    must_pass(git_oid_mkstr(&id2, "8b137891791fe96927ad78e64b0aad7bded08baa"));
+    must_be_true(0 == git_odb_exists(db, &id2));
+
+    git_odb_close(db);
+    must_pass(remove_object_files(odb_dir, &one));
+END_TEST
+
+BEGIN_TEST(exists_loose_cache_changes)
+    git_odb *db;
+    git_oid id, id2, id3;
+    git_rawobj obj;
+
+    must_pass(git_oid_mkstr(&id, one.id));
+    must_pass(git_oid_mkstr(&id2, two.id));
+    must_pass(git_oid_mkstr(&id3, three.id));
+
+    /* the listing is read in the second the directory changed */
+    wait_next_second();
+    must_pass(write_object_files(odb_dir, &one));
+    must_pass(git_odb_open(&db, odb_dir));
+    git_odb_set_loose_cache(db, 1);
+    must_be_true(git_odb_exists(db, &id));
+
+    /* so an object written in that second, unseen by mtime, is found */
+    must_pass(write_object_data(two.file, two.bytes, two.blen));
+    must_be_true(git_odb_exists(db, &id2));
+    must_pass(git_odb_read(&obj, db, &id2));
+    must_be_true(obj.len == two.dlen);
+    git_obj_close(&obj);
+
+    /* a later write shows in the directory's mtime */
+    wait_next_second();
+    must_be_true(0 == git_odb_exists(db, &id3));
+    must_pass(write_object_data(three.file, three.bytes, three.blen));
+    must_be_true(git_odb_exists(db, &id3));
+
+    git_odb_close(db);
+    must_pass(gitfo_unlink(two.file));
+    must_pass(gitfo_unlink(three.file));
+    must_pass(remove_object_files(odb_dir, &one));
+END_TEST
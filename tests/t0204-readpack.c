@@ -1,6 +1,7 @@
 #include "test_lib.h"
 #include "test_helpers.h"
 #include <git/odb.h>
+#include "fileops.h"
 
 static const char *packed_objects[] = {
 	"0266163a49e280c4f5ed1e08facd36a2bd716bcf",
@@ -150,3 +151,259 @@ BEGIN_TEST(readpacked_test)
 
     git_odb_close(db);
 END_TEST
+
+BEGIN_TEST(readpacked_deltacache_test)
+	unsigned int i;
+	git_odb *db, *db_nocache;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+	must_pass(git_odb_open(&db_nocache, ODB_FOLDER));
+	git_odb_set_delta_base_cache_limit(db_nocache, 0);
+
+	/* twice: the second pass is served from the warm cache */
+	for (i = 0; i < 2 * ARRAY_SIZE(packed_objects); ++i) {
+		git_oid id;
+		git_rawobj obj, expected;
+
+		must_pass(git_oid_mkstr(&id, packed_objects[i % ARRAY_SIZE(packed_objects)]));
+		must_pass(git_odb__read_packed(&obj, db, &id));
+		must_pass(git_odb__read_packed(&expected, db_nocache, &id));
+
+		must_be_true(obj.type == expected.type);
+		must_be_true(obj.len == expected.len);
+		must_be_true(memcmp(obj.data, expected.data, obj.len) == 0);
+
+		git_obj_close(&obj);
+		git_obj_close(&expected);
+	}
+
+	git_odb_close(db);
+	git_odb_close(db_nocache);
+END_TEST
+
+static int sum_misses(void *payload, const char *GIT_UNUSED(pack_name), size_t GIT_UNUSED(hits), size_t misses)
+{
+	GIT_UNUSED_ARG(pack_name)
+	GIT_UNUSED_ARG(hits)
+	*(size_t *)payload += misses;
+	return GIT_SUCCESS;
+}
+
+BEGIN_TEST(readpacked_midx_test)
+	unsigned int i;
+	size_t misses = 0;
+	git_odb *db;
+	git_oid id;
+
+	must_pass(copydir_recurs(ODB_FOLDER, TEMP_ODB_FOLDER));
+
+	/* without the multi-pack-index, the packs are searched in turn */
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_rawobj obj;
+
+		must_pass(git_oid_mkstr(&id, packed_objects[i]));
+		must_pass(git_odb__read_packed(&obj, db, &id));
+		git_obj_close(&obj);
+	}
+	must_pass(git_odb_pack_stats(db, sum_misses, &misses));
+	must_be_true(misses > 0);
+
+	must_pass(git_odb_write_multi_pack_index(db));
+	git_odb_close(db);
+
+	must_pass(gitfo_exists(TEMP_ODB_FOLDER "pack/multi-pack-index"));
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_rawobj obj;
+
+		must_pass(git_oid_mkstr(&id, packed_objects[i]));
+		must_be_true(git_odb_exists(db, &id) == 1);
+		must_pass(git_odb__read_packed(&obj, db, &id));
+
+		git_obj_close(&obj);
+	}
+
+	/* with it, every object is looked up in its own pack only */
+	misses = 0;
+	must_pass(git_odb_pack_stats(db, sum_misses, &misses));
+	must_be_true(misses == 0);
+
+	must_pass(git_oid_mkstr(&id, "8b137891791fe96927ad78e64b0aad7bded08baa"));
+	must_be_true(git_odb_exists(db, &id) == 0);
+
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+#define REV_PACK "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+
+BEGIN_TEST(readpacked_revindex_test)
+	unsigned int i;
+	char entry[4];
+	gitfo_buf buf;
+	git_odb *db;
+	git_oid id;
+
+	must_pass(copydir_recurs(ODB_FOLDER, TEMP_ODB_FOLDER));
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_be_true(git_odb__pack_has_revindex(db, REV_PACK) == 0);
+	must_be_true(git_odb__pack_has_revindex(db, "pack-none") == GIT_ENOTFOUND);
+	must_pass(git_odb_write_reverse_indexes(db));
+	git_odb_close(db);
+
+	must_pass(gitfo_exists(TEMP_ODB_FOLDER "pack/" REV_PACK ".rev"));
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_be_true(git_odb__pack_has_revindex(db, REV_PACK) == 1);
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_rawobj obj;
+
+		must_pass(git_oid_mkstr(&id, packed_objects[i]));
+		must_be_true(git_odb_exists(db, &id) == 1);
+		must_pass(git_odb__read_packed(&obj, db, &id));
+
+		git_obj_close(&obj);
+	}
+
+	git_odb_close(db);
+
+	/* a .rev listing two objects out of order is not used */
+	must_pass(gitfo_read_file(&buf, TEMP_ODB_FOLDER "pack/" REV_PACK ".rev"));
+	memcpy(entry, (char *)buf.data + 12, 4);
+	memcpy((char *)buf.data + 12, (char *)buf.data + 16, 4);
+	memcpy((char *)buf.data + 16, entry, 4);
+	must_pass(gitfo_unlink(TEMP_ODB_FOLDER "pack/" REV_PACK ".rev"));
+	must_pass(write_object_data(TEMP_ODB_FOLDER "pack/" REV_PACK ".rev", buf.data, buf.len));
+	gitfo_free_buf(&buf);
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_be_true(git_odb__pack_has_revindex(db, REV_PACK) == 0);
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_rawobj obj;
+
+		must_pass(git_oid_mkstr(&id, packed_objects[i]));
+		must_pass(git_odb__read_packed(&obj, db, &id));
+		git_obj_close(&obj);
+	}
+
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+BEGIN_TEST(readpacked_windows_test)
+	size_t window_size, mapped_limit, size, mapped;
+	unsigned int open_limit, open;
+	unsigned int i, pass;
+	git_odb *db;
+	git_oid id;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	/* small windows, so that objects straddle them and get evicted */
+	git_odb_get_pack_window_limits(&window_size, &mapped_limit, &open_limit);
+	git_odb_set_pack_window_limits(1, 256 * 1024, 2);
+	git_odb_set_delta_base_cache_limit(db, 0);
+
+	for (pass = 0; pass < 2; ++pass) {
+		for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+			git_rawobj obj, hdr;
+
+			must_pass(git_oid_mkstr(&id, packed_objects[i]));
+			must_pass(git_odb__read_packed(&obj, db, &id));
+			must_pass(git_odb_read_header(&hdr, db, &id));
+
+			must_be_true(obj.type == hdr.type);
+			must_be_true(obj.len == hdr.len);
+
+			git_obj_close(&obj);
+		}
+	}
+
+	git_odb_close(db);
+
+	/* the window size was rounded up; the limits are put back */
+	git_odb_get_pack_window_limits(&size, &mapped, &open);
+	must_be_true(size == 128 * 1024 && mapped == 256 * 1024 && open == 2);
+	git_odb_set_pack_window_limits(window_size, mapped_limit, open_limit);
+	git_odb_get_pack_window_limits(&size, &mapped, &open);
+	must_be_true(size == window_size && mapped == mapped_limit && open == open_limit);
+END_TEST
+
+BEGIN_TEST(readpacked_windows_shared_test)
+	size_t window_size, mapped_limit;
+	unsigned int open_limit;
+	unsigned int i, open;
+	size_t mapped;
+	git_odb *a, *b;
+	git_oid id;
+
+	must_pass(copydir_recurs(ODB_FOLDER, TEMP_ODB_FOLDER));
+	must_pass(git_odb_open(&a, ODB_FOLDER));
+	must_pass(git_odb_open(&b, TEMP_ODB_FOLDER));
+
+	/* the limits cover the windows of both databases together */
+	git_odb_get_pack_window_limits(&window_size, &mapped_limit, &open_limit);
+	git_odb_set_pack_window_limits(1, 256 * 1024, 2);
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_rawobj obj;
+
+		must_pass(git_oid_mkstr(&id, packed_objects[i]));
+		must_pass(git_odb__read_packed(&obj, i % 2 ? a : b, &id));
+		git_obj_close(&obj);
+
+		git_odb__pack_window_usage(&mapped, &open);
+		must_be_true(open <= 2);
+		must_be_true(mapped <= 256 * 1024);
+	}
+
+	git_odb_close(a);
+	git_odb_close(b);
+
+	git_odb__pack_window_usage(&mapped, &open);
+	must_be_true(open == 0 && mapped == 0);
+
+	git_odb_set_pack_window_limits(window_size, mapped_limit, open_limit);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+#define NEW_PACK "pack/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a"
+
+BEGIN_TEST(readpacked_refresh_test)
+	git_odb *db;
+	git_rawobj obj;
+	git_oid in_new, in_old;
+
+	must_pass(git_oid_mkstr(&in_new, "53fc32d17276939fc79ed05badaef2db09990016"));
+	must_pass(git_oid_mkstr(&in_old, "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"));
+
+	must_pass(copydir_recurs(ODB_FOLDER, TEMP_ODB_FOLDER));
+	must_pass(gitfo_unlink(TEMP_ODB_FOLDER NEW_PACK ".pack"));
+	must_pass(gitfo_unlink(TEMP_ODB_FOLDER NEW_PACK ".idx"));
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_pass(git_odb__read_packed(&obj, db, &in_old));
+	git_obj_close(&obj);
+	must_be_true(git_odb_exists(db, &in_new) == 0);
+
+	/* a pack arriving while the database is open is found */
+	must_pass(copy_file(ODB_FOLDER NEW_PACK ".pack", TEMP_ODB_FOLDER NEW_PACK ".pack"));
+	must_pass(copy_file(ODB_FOLDER NEW_PACK ".idx", TEMP_ODB_FOLDER NEW_PACK ".idx"));
+
+	must_be_true(git_odb_exists(db, &in_new) == 1);
+	must_pass(git_odb__read_packed(&obj, db, &in_new));
+	git_obj_close(&obj);
+
+	/* the packs known before are still readable */
+	must_pass(git_odb__read_packed(&obj, db, &in_old));
+	git_obj_close(&obj);
+
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
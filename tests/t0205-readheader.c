@@ -205,3 +205,43 @@ BEGIN_TEST(readheader_loose_test)
     git_odb_close(db);
 END_TEST
 
+
+/* deltas in the packs, from depth 1 to the longest chain of 50 */
+static const char *deltified_objects[] = {
+	"edc438eedf6854c51e1a0d7954a6849046f5a4f6", /* commit, depth 1 */
+	"acf362a92101202f5f09c9b51db352be27b5bf7e", /* commit, depth 1 */
+	"8157f9e57bd9de5ab95b89fb9c7192a5668322f4", /* blob, depth 1 */
+	"0985c00bcf2bc8403f5d0c4957f3c2c8bc2808b4", /* blob, depth 5 */
+	"e719ec29cf9da6022610b46b463b80d393d22778", /* blob, depth 26 */
+	"c545d2d17706399afcf4482163359b03b485fa7c", /* blob, depth 26 */
+	"ac8237e18da19ff375f051a973bac91d6dbb2f56", /* tree, depth 1 */
+	"e044baa468a1c74f9f9da36805445f6888358b49", /* tree, depth 10 */
+	"121c862c3a2bc66c12b64903e508d8bb8d2904c3", /* tree, depth 25 */
+	"f6b73d281810e3ecb7e984ab7c951ba52b72c10c", /* tree, depth 50 */
+};
+
+BEGIN_TEST(readheader_deltified_test)
+	unsigned int i;
+	git_odb *db;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	for (i = 0; i < ARRAY_SIZE(deltified_objects); ++i) {
+		git_oid id;
+		git_rawobj obj, header;
+
+		must_pass(git_oid_mkstr(&id, deltified_objects[i]));
+
+		/* before the read fills the delta base cache */
+		must_pass(git_odb_read_header(&header, db, &id));
+		must_pass(git_odb_read(&obj, db, &id));
+
+		must_be_true(header.data == NULL);
+		must_be_true(obj.len == header.len);
+		must_be_true(obj.type == header.type);
+
+		git_obj_close(&obj);
+	}
+
+	git_odb_close(db);
+END_TEST
@@ -0,0 +1,106 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+
+#define FORK1_FOLDER "test-fork1"
+#define FORK2_FOLDER "test-fork2"
+#define PARENT_LINK "test-parent-link"
+#define FORK1_LINK "test-fork1-link"
+
+static const char *borrowed_objects[] = {
+	"8496071c1b46c854b31185ea97743be6a8774479", /* loose */
+	"0266163a49e280c4f5ed1e08facd36a2bd716bcf", /* packed */
+	"fe3a6a42c87ff1239370c741a265f3997add87c1", /* packed */
+};
+
+static int make_fork(const char *dir, const char *alternates)
+{
+	char path[GIT_PATH_MAX];
+
+	if (gitfo_mkdir(dir, 0755) < 0)
+		return -1;
+	if (git__fmt(path, sizeof(path), "%s/info", dir) < 0
+		|| gitfo_mkdir(path, 0755) < 0)
+		return -1;
+	if (git__fmt(path, sizeof(path), "%s/info/alternates", dir) < 0)
+		return -1;
+	return write_object_data(path, (void *)alternates, strlen(alternates));
+}
+
+BEGIN_TEST(alternates_read_test)
+	git_odb *fork1, *fork2;
+	unsigned int i;
+	git_oid id;
+
+	/* fork1 -> fork2 -> parent, and back from fork2 to fork1 */
+	must_pass(make_fork(FORK1_FOLDER, "# borrowed\n../" FORK2_FOLDER "\n"));
+	must_pass(make_fork(FORK2_FOLDER,
+		"../" ODB_FOLDER "\r\n"
+		"../" FORK1_FOLDER "/\n"
+		"missing-directory\n"));
+
+	must_pass(git_odb_open(&fork1, FORK1_FOLDER));
+	must_pass(git_odb_open(&fork2, FORK2_FOLDER));
+
+	for (i = 0; i < ARRAY_SIZE(borrowed_objects); ++i) {
+		git_rawobj obj, hdr;
+
+		must_pass(git_oid_mkstr(&id, borrowed_objects[i]));
+
+		must_be_true(git_odb_exists(fork1, &id) == 1);
+		must_pass(git_odb_read(&obj, fork1, &id));
+		must_pass(git_odb_read_header(&hdr, fork2, &id));
+		must_be_true(obj.type == hdr.type && obj.len == hdr.len);
+
+		git_obj_close(&obj);
+	}
+
+	must_pass(git_oid_mkstr(&id, "8b137891791fe96927ad78e64b0aad7bded08baa"));
+	must_be_true(git_odb_exists(fork1, &id) == 0);
+	must_be_true(git_odb_exists(fork2, &id) == 0);
+
+	git_odb_close(fork1);
+	git_odb_close(fork2);
+
+	must_pass(rmdir_recurs(FORK1_FOLDER));
+	must_pass(rmdir_recurs(FORK2_FOLDER));
+END_TEST
+
+BEGIN_TEST(alternates_symlink_test)
+	git_odb *fork1, *fork2;
+	unsigned int open1, open2;
+	size_t mapped1, mapped2;
+	git_rawobj obj;
+	git_oid id;
+
+	/* the same parent, through a link and directly */
+	must_pass(symlink(ODB_FOLDER, PARENT_LINK));
+	must_pass(symlink(FORK1_FOLDER, FORK1_LINK));
+	must_pass(make_fork(FORK1_FOLDER,
+		"../" ODB_FOLDER "\n"
+		"../" FORK1_LINK "\n"));
+	must_pass(make_fork(FORK2_FOLDER, "../" PARENT_LINK "\n"));
+
+	must_pass(git_odb_open(&fork1, FORK1_FOLDER));
+	must_pass(git_odb_open(&fork2, FORK2_FOLDER));
+	must_pass(git_oid_mkstr(&id, borrowed_objects[1]));
+
+	must_pass(git_odb_read(&obj, fork1, &id));
+	git_obj_close(&obj);
+	git_odb__pack_window_usage(&mapped1, &open1);
+
+	/* both forks share the parent, and the windows it mapped */
+	must_pass(git_odb_read(&obj, fork2, &id));
+	git_obj_close(&obj);
+	git_odb__pack_window_usage(&mapped2, &open2);
+	must_be_true(open1 > 0 && open2 == open1 && mapped2 == mapped1);
+
+	git_odb_close(fork1);
+	git_odb_close(fork2);
+
+	must_pass(gitfo_unlink(PARENT_LINK));
+	must_pass(gitfo_unlink(FORK1_LINK));
+	must_pass(rmdir_recurs(FORK1_FOLDER));
+	must_pass(rmdir_recurs(FORK2_FOLDER));
+END_TEST
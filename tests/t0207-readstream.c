@@ -0,0 +1,111 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+
+static const char *streamed_objects[] = {
+	"8496071c1b46c854b31185ea97743be6a8774479", /* loose */
+	"e69de29bb2d1d6434b8b29ae775ad8c2e48c5391", /* loose, empty */
+	"0266163a49e280c4f5ed1e08facd36a2bd716bcf", /* packed */
+	"53fc32d17276939fc79ed05badaef2db09990016", /* packed */
+	"fe3a6a42c87ff1239370c741a265f3997add87c1", /* packed */
+	"fd8430bc864cfcd5f10e5590f8a447e01b942bfe", /* packed */
+};
+
+static int stream_matches(git_odb *db, const char *id_str, size_t chunk)
+{
+	unsigned char buf[64];
+	git_odb_stream *stream;
+	git_rawobj obj, hdr;
+	size_t done = 0;
+	git_oid id;
+	int n = 0, match = 1;
+
+	if (git_oid_mkstr(&id, id_str) < 0 || git_odb_read(&obj, db, &id) < 0)
+		return 0;
+
+	if (git_odb_read_stream(&stream, &hdr, db, &id) < 0) {
+		git_obj_close(&obj);
+		return 0;
+	}
+
+	if (hdr.type != obj.type || hdr.len != obj.len || hdr.data != NULL)
+		match = 0;
+
+	while (match && (n = git_odb_stream_read(stream, buf, chunk)) > 0) {
+		if (done + n > obj.len || memcmp(buf, (char *)obj.data + done, n))
+			match = 0;
+		done += n;
+	}
+	if (n < 0 || done != obj.len)
+		match = 0;
+
+	git_odb_stream_close(stream);
+	git_obj_close(&obj);
+	return match;
+}
+
+BEGIN_TEST(readstream_chunks)
+	unsigned int i;
+	git_odb *db;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	for (i = 0; i < ARRAY_SIZE(streamed_objects); ++i) {
+		must_be_true(stream_matches(db, streamed_objects[i], 1));
+		must_be_true(stream_matches(db, streamed_objects[i], 7));
+		must_be_true(stream_matches(db, streamed_objects[i], 64));
+	}
+
+	git_odb_close(db);
+END_TEST
+
+BEGIN_TEST(readstream_notfound)
+	git_odb_stream *stream;
+	git_rawobj hdr;
+	git_odb *db;
+	git_oid id;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+	must_pass(git_oid_mkstr(&id, "8b137891791fe96927ad78e64b0aad7bded08baa"));
+	must_be_true(git_odb_read_stream(&stream, &hdr, db, &id) == GIT_ENOTFOUND);
+	must_be_true(stream == NULL);
+	git_odb_close(db);
+END_TEST
+
+/* e69de29bb2d1d6434b8b29ae775ad8c2e48c5391, with bytes past its end */
+static unsigned char empty_garbage_bytes[] = {
+    0x78, 0x9c, 0x4b, 0xca, 0xc9, 0x4f, 0x52, 0x30,
+    0x60, 0x48, 0x4f, 0x2c, 0x4a, 0x4a, 0x4c, 0x4f,
+    0x05, 0x00, 0x22, 0x6f, 0x04, 0xb9,
+};
+
+static object_data empty_garbage = {
+    empty_garbage_bytes,
+    sizeof(empty_garbage_bytes),
+    "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391",
+    "blob",
+    "test-objects-tmp/e6",
+    "test-objects-tmp/e6/9de29bb2d1d6434b8b29ae775ad8c2e48c5391",
+    NULL,
+    0,
+};
+
+BEGIN_TEST(readstream_empty_trailing)
+	unsigned char buf[16];
+	git_odb_stream *stream;
+	git_rawobj hdr;
+	git_odb *db;
+	git_oid id;
+
+	must_pass(write_object_files(TEMP_ODB_FOLDER, &empty_garbage));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_pass(git_oid_mkstr(&id, empty_garbage.id));
+
+	must_pass(git_odb_read_stream(&stream, &hdr, db, &id));
+	must_be_true(hdr.type == GIT_OBJ_BLOB && hdr.len == 0);
+	must_be_true(git_odb_stream_read(stream, buf, sizeof(buf)) == GIT_EOBJCORRUPTED);
+	git_odb_stream_close(stream);
+
+	git_odb_close(db);
+	must_pass(remove_object_files(TEMP_ODB_FOLDER, &empty_garbage));
+END_TEST
@@ -0,0 +1,113 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+
+#define PACK_IDX ODB_FOLDER "pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"
+
+static const char *loose_objects[] = {
+	"8496071c1b46c854b31185ea97743be6a8774479",
+	"e69de29bb2d1d6434b8b29ae775ad8c2e48c5391",
+	"75057dd4114e74cca1d750d0aee1647c903cb60a",
+	NULL
+};
+
+struct read_many_state {
+	git_odb *db;
+	size_t count;
+	size_t stop_at;
+	int loose_seen;
+	int failed;
+};
+
+static int check_object(void *payload, const git_oid *id, git_rawobj *obj)
+{
+	struct read_many_state *st = payload;
+	git_rawobj exp;
+	size_t j;
+
+	if (git_odb_read(&exp, st->db, id) < GIT_SUCCESS)
+		st->failed = 1;
+	else {
+		if (exp.type != obj->type || exp.len != obj->len
+			|| memcmp(exp.data, obj->data, exp.len))
+			st->failed = 1;
+		git_obj_close(&exp);
+	}
+
+	/* loose objects come after all the packed ones */
+	for (j = 0; loose_objects[j]; j++) {
+		git_oid loose;
+		git_oid_mkstr(&loose, loose_objects[j]);
+		if (!git_oid_cmp(&loose, id))
+			break;
+	}
+	if (loose_objects[j])
+		st->loose_seen = 1;
+	else if (st->loose_seen)
+		st->failed = 1;
+
+	if (++st->count == st->stop_at)
+		return GIT_EBUSY;
+	return GIT_SUCCESS;
+}
+
+static git_oid *read_ids(size_t *n)
+{
+	gitfo_buf buf;
+	git_oid *ids;
+	size_t j, n_packed;
+
+	if (gitfo_read_file(&buf, PACK_IDX) < 0)
+		return NULL;
+
+	n_packed = ntohl(((uint32_t *)buf.data)[2 + 255]);
+	*n = n_packed + 3;
+
+	if ((ids = git__malloc(*n * sizeof(*ids))) != NULL) {
+		/* interleave the loose objects with the packed ones */
+		for (j = 0; j < n_packed; j++)
+			git_oid_mkraw(&ids[j + 3], (unsigned char *)buf.data + 8 + 256 * 4 + j * 20);
+		for (j = 0; j < 3; j++) {
+			ids[j] = ids[3 + j * 100];
+			git_oid_mkstr(&ids[3 + j * 100], loose_objects[j]);
+		}
+	}
+
+	gitfo_free_buf(&buf);
+	return ids;
+}
+
+BEGIN_TEST(readmany_test)
+	struct read_many_state st;
+	git_oid *ids;
+	git_odb *db;
+	size_t n;
+
+	must_be_true((ids = read_ids(&n)) != NULL);
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	memset(&st, 0x0, sizeof(st));
+	st.db = db;
+	must_pass(git_odb_read_many(db, ids, n, check_object, &st));
+	must_be_true(st.count == n && st.loose_seen && !st.failed);
+
+	/* the callback can stop the iteration */
+	memset(&st, 0x0, sizeof(st));
+	st.db = db;
+	st.stop_at = 10;
+	must_be_true(git_odb_read_many(db, ids, n, check_object, &st) == GIT_EBUSY);
+	must_be_true(st.count == 10 && !st.failed);
+
+	/* nothing is read when an object is missing */
+	memset(&st, 0x0, sizeof(st));
+	st.db = db;
+	must_pass(git_oid_mkstr(&ids[n / 2], "0000000000000000000000000000000000000001"));
+	must_be_true(git_odb_read_many(db, ids, n, check_object, &st) == GIT_ENOTFOUND);
+	must_be_true(st.count == 0);
+
+	must_pass(git_odb_read_many(db, ids, 0, check_object, &st));
+
+	git_odb_close(db);
+	free(ids);
+END_TEST
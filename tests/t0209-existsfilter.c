@@ -0,0 +1,159 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+
+#define PACK_FOLDER ODB_FOLDER "pack/"
+#define NEW_PACK TEMP_ODB_FOLDER "new.pack"
+#define PACK_IDX PACK_FOLDER "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"
+
+static const char *loose_objects[] = {
+	"8496071c1b46c854b31185ea97743be6a8774479",
+	"e69de29bb2d1d6434b8b29ae775ad8c2e48c5391",
+	"75057dd4114e74cca1d750d0aee1647c903cb60a",
+	NULL
+};
+
+static void make_blob(git_rawobj *obj, char *buf, unsigned int n)
+{
+	sprintf(buf, "exists filter blob %u\n", n);
+	obj->data = buf;
+	obj->len = strlen(buf);
+	obj->type = GIT_OBJ_BLOB;
+}
+
+/* ids close to id, which are not in the test repository */
+static void check_missing(git_odb *db, const git_oid *id)
+{
+	git_oid missing;
+	int j;
+
+	for (j = 0; j < GIT_OID_RAWSZ; j++) {
+		git_oid_cpy(&missing, id);
+		missing.id[j] ^= 0x5a;
+		must_be_true(!git_odb_exists(db, &missing));
+	}
+}
+
+BEGIN_TEST(existsfilter_repository)
+	gitfo_buf buf;
+	git_oid id;
+	git_odb *db;
+	uint32_t j, n;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+	git_odb_set_exists_filter(db, 1);
+
+	for (j = 0; loose_objects[j]; j++) {
+		must_pass(git_oid_mkstr(&id, loose_objects[j]));
+		must_be_true(git_odb_exists(db, &id));
+		check_missing(db, &id);
+	}
+
+	must_pass(gitfo_read_file(&buf, PACK_IDX));
+	n = ntohl(((uint32_t *)buf.data)[2 + 255]);
+	for (j = 0; j < n; j++) {
+		git_oid_mkraw(&id, (unsigned char *)buf.data + 8 + 256 * 4 + j * 20);
+		must_be_true(git_odb_exists(db, &id));
+		if (j % 50 == 0)
+			check_missing(db, &id);
+	}
+	gitfo_free_buf(&buf);
+
+	git_odb_set_exists_filter(db, 0);
+	must_be_true(git_odb_exists(db, &id));
+	git_odb_close(db);
+END_TEST
+
+BEGIN_TEST(existsfilter_writes)
+	git_oid ids[3], pack_id;
+	git_rawobj obj;
+	char buf[64];
+	git_odb *db;
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	git_odb_set_exists_filter(db, 1);
+
+	/* the filter is built on first use, with no object */
+	make_blob(&obj, buf, 0);
+	must_pass(git_obj_hash(&ids[0], &obj));
+	must_be_true(!git_odb_exists(db, &ids[0]));
+
+	/* loose objects are added to the filter */
+	must_pass(git_odb_write(&ids[0], db, &obj));
+	must_be_true(git_odb_exists(db, &ids[0]));
+
+	/* and so are the objects of an import */
+	must_pass(git_odb_begin_import(db));
+	make_blob(&obj, buf, 1);
+	must_pass(git_odb_write(&ids[1], db, &obj));
+	must_be_true(git_odb_exists(db, &ids[1]));
+	must_pass(git_odb_commit_import(db));
+	must_be_true(git_odb_exists(db, &ids[1]));
+
+	/* and the objects of an indexed pack */
+	must_pass(git_oid_mkstr(&ids[2], "6336846bd5c88d32f93ae57d846683e61ab5c530"));
+	must_be_true(!git_odb_exists(db, &ids[2]));
+	must_pass(copy_file(PACK_FOLDER "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.pack", NEW_PACK));
+	must_pass(git_odb_index_pack(&pack_id, db, NEW_PACK));
+	must_be_true(git_odb_exists(db, &ids[2]));
+	git_odb_close(db);
+
+	/* a new filter sees all of them */
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	git_odb_set_exists_filter(db, 1);
+	must_be_true(git_odb_exists(db, &ids[0]));
+	must_be_true(git_odb_exists(db, &ids[1]));
+	must_be_true(git_odb_exists(db, &ids[2]));
+	check_missing(db, &ids[2]);
+	git_odb_close(db);
+
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+#define FORK_FOLDER "test-fork"
+
+BEGIN_TEST(existsfilter_changes)
+	char path[GIT_PATH_MAX];
+	git_odb *fork, *parent;
+	git_oid ids[2];
+	git_rawobj obj;
+	char buf[64];
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(gitfo_mkdir(FORK_FOLDER, 0755));
+	must_pass(gitfo_mkdir(FORK_FOLDER "/info", 0755));
+	strcpy(path, FORK_FOLDER "/info/alternates");
+	must_pass(write_object_data(path, "../" TEMP_ODB_FOLDER "\n", strlen("../" TEMP_ODB_FOLDER "\n")));
+
+	must_pass(git_odb_open(&fork, FORK_FOLDER));
+	git_odb_set_exists_filter(fork, 1);
+
+	make_blob(&obj, buf, 2);
+	must_pass(git_obj_hash(&ids[0], &obj));
+	must_be_true(!git_odb_exists(fork, &ids[0]));
+
+	/* an object written to the alternate through another database */
+	must_pass(git_odb_open(&parent, TEMP_ODB_FOLDER));
+	must_pass(git_odb_write(&ids[0], parent, &obj));
+	git_odb_close(parent);
+	must_be_true(git_odb_exists(fork, &ids[0]));
+
+	/* a pack added to the database by somebody else */
+	must_pass(git_oid_mkstr(&ids[1], "6336846bd5c88d32f93ae57d846683e61ab5c530"));
+	must_be_true(!git_odb_exists(fork, &ids[1]));
+	must_pass(gitfo_mkdir(FORK_FOLDER "/pack", 0755));
+	must_pass(copy_file(PACK_FOLDER "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx",
+		FORK_FOLDER "/pack/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	must_pass(copy_file(PACK_FOLDER "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.pack",
+		FORK_FOLDER "/pack/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.pack"));
+	must_be_true(git_odb_exists(fork, &ids[1]));
+
+	check_missing(fork, &ids[0]);
+	check_missing(fork, &ids[1]);
+	git_odb_close(fork);
+
+	must_pass(rmdir_recurs(FORK_FOLDER));
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
@@ -0,0 +1,85 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+
+#define N_PACKS 3
+
+static const char *packs[N_PACKS] = {
+	"pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695",
+	"pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5",
+	"pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a",
+};
+
+struct pack_stats {
+	size_t count;
+	size_t hits[N_PACKS], misses[N_PACKS];
+};
+
+static int get_stats(void *payload, const char *pack_name, size_t hits, size_t misses)
+{
+	struct pack_stats *st = payload;
+	int j;
+
+	/* the largest pack is listed first */
+	if (st->count++ == 0 && strcmp(pack_name, packs[0]))
+		return GIT_ERROR;
+
+	for (j = 0; j < N_PACKS; j++)
+		if (!strcmp(pack_name, packs[j])) {
+			st->hits[j] = hits;
+			st->misses[j] = misses;
+			return GIT_SUCCESS;
+		}
+	return GIT_ERROR;
+}
+
+static int stop_stats(void *GIT_UNUSED(payload), const char *GIT_UNUSED(pack_name),
+		size_t GIT_UNUSED(hits), size_t GIT_UNUSED(misses))
+{
+	GIT_UNUSED_ARG(payload)
+	GIT_UNUSED_ARG(pack_name)
+	GIT_UNUSED_ARG(hits)
+	GIT_UNUSED_ARG(misses)
+	return GIT_EBUSY;
+}
+
+BEGIN_TEST(packstats_mru)
+	struct pack_stats st;
+	git_oid id;
+	git_odb *db;
+	int j;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	memset(&st, 0x0, sizeof(st));
+	must_pass(git_odb_pack_stats(db, get_stats, &st));
+	must_be_true(st.count == N_PACKS);
+	for (j = 0; j < N_PACKS; j++)
+		must_be_true(st.hits[j] == 0 && st.misses[j] == 0);
+
+	/* an object of a small pack is searched in the largest one first */
+	must_pass(git_oid_mkstr(&id, "6336846bd5c88d32f93ae57d846683e61ab5c530"));
+	must_be_true(git_odb_exists(db, &id));
+	memset(&st, 0x0, sizeof(st));
+	must_pass(git_odb_pack_stats(db, get_stats, &st));
+	must_be_true(st.hits[0] == 0 && st.misses[0] == 1);
+	must_be_true(st.hits[2] == 1 && st.misses[2] == 0);
+
+	/* then its pack is searched first */
+	must_be_true(git_odb_exists(db, &id));
+	memset(&st, 0x0, sizeof(st));
+	must_pass(git_odb_pack_stats(db, get_stats, &st));
+	must_be_true(st.hits[0] == 0 && st.misses[0] == 1);
+	must_be_true(st.hits[2] == 2 && st.misses[2] == 0);
+
+	/* a missing object is searched in every pack */
+	must_pass(git_oid_mkstr(&id, "0000000000000000000000000000000000000001"));
+	must_be_true(!git_odb_exists(db, &id));
+	memset(&st, 0x0, sizeof(st));
+	must_pass(git_odb_pack_stats(db, get_stats, &st));
+	must_be_true(st.misses[0] == 2 && st.misses[2] == 1);
+
+	must_be_true(git_odb_pack_stats(db, stop_stats, NULL) == GIT_EBUSY);
+
+	git_odb_close(db);
+END_TEST
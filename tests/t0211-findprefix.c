@@ -0,0 +1,91 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+
+static void must_find(git_odb *db, const char *hex, const char *expected)
+{
+	git_oid id, exp;
+
+	must_pass(git_oid_mkstr(&exp, expected));
+	must_pass(git_odb_find_prefix(&id, db, hex, strlen(hex)));
+	must_be_true(git_oid_cmp(&id, &exp) == 0);
+}
+
+BEGIN_TEST(findprefix_unique)
+	git_odb *db;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	/* loose objects */
+	must_find(db, "8496071", "8496071c1b46c854b31185ea97743be6a8774479");
+	must_find(db, "e69de29bb2d1", "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391");
+	must_find(db, "1810d", "1810dff58d8a660512d4832e740f692884338ccd");
+
+	/* packed objects, with an odd number of digits */
+	must_find(db, "498bc0", "498bc0906810bd43c6fbc73385fecb7f2d04be3a");
+	must_find(db, "498bcc", "498bccdfec1fc223c27c0d84030ff419058e452d");
+	must_find(db, "6336846", "6336846bd5c88d32f93ae57d846683e61ab5c530");
+	must_find(db, "2ef4e", "2ef4e5d838b6507bd61d457cf6466662b791c5c0");
+
+	/* a full id */
+	must_find(db, "75057dd4114e74cca1d750d0aee1647c903cb60a",
+		"75057dd4114e74cca1d750d0aee1647c903cb60a");
+
+	git_odb_close(db);
+END_TEST
+
+BEGIN_TEST(findprefix_errors)
+	git_oid id;
+	git_odb *db;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	must_be_true(git_odb_find_prefix(&id, db, "1810", 4) == GIT_EAMBIGUOUS);
+	must_be_true(git_odb_find_prefix(&id, db, "498bc", 5) == GIT_EAMBIGUOUS);
+	must_be_true(git_odb_find_prefix(&id, db, "1fd9", 4) == GIT_EAMBIGUOUS);
+
+	must_be_true(git_odb_find_prefix(&id, db, "0000000", 7) == GIT_ENOTFOUND);
+	must_be_true(git_odb_find_prefix(&id, db, "8496071d", 8) == GIT_ENOTFOUND);
+
+	must_be_true(git_odb_find_prefix(&id, db, "849", 3) == GIT_ENOTOID);
+	must_be_true(git_odb_find_prefix(&id, db, "849x", 4) == GIT_ENOTOID);
+
+	/* only len digits are read */
+	must_be_true(git_odb_find_prefix(&id, db, "8496zzzz", 4) == GIT_SUCCESS);
+
+	git_odb_close(db);
+END_TEST
+
+BEGIN_TEST(findprefix_new_pack)
+	git_odb *db, *writer;
+	git_rawobj obj;
+	git_oid id;
+
+	/* 1810 is unique until 1810dff comes in a new pack */
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER "18", 0755));
+	must_pass(copy_file(ODB_FOLDER "18/1037049a54a1eb5fab404658a3a250b44335d7",
+		TEMP_ODB_FOLDER "18/1037049a54a1eb5fab404658a3a250b44335d7"));
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_find(db, "1810", "181037049a54a1eb5fab404658a3a250b44335d7");
+
+	must_pass(git_odb_open(&writer, ODB_FOLDER));
+	must_pass(git_oid_mkstr(&id, "1810dff58d8a660512d4832e740f692884338ccd"));
+	must_pass(git_odb_read(&obj, writer, &id));
+	git_odb_close(writer);
+
+	must_pass(git_odb_open(&writer, TEMP_ODB_FOLDER));
+	must_pass(git_odb_begin_import(writer));
+	must_pass(git_odb_write(&id, writer, &obj));
+	must_pass(git_odb_commit_import(writer));
+	git_odb_close(writer);
+	git_obj_close(&obj);
+
+	must_be_true(git_odb_find_prefix(&id, db, "1810", 4) == GIT_EAMBIGUOUS);
+	must_find(db, "1810d", "1810dff58d8a660512d4832e740f692884338ccd");
+
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
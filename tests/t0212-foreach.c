@@ -0,0 +1,115 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+
+#define N_OBJECTS 1661
+#define N_LARGEST_PACK 1628
+#define N_LOOSE 21
+
+struct foreach_state {
+	git_oid ids[N_OBJECTS];
+	size_t count;
+	size_t stop_at;
+};
+
+static int add_object(void *payload, const git_oid *id)
+{
+	struct foreach_state *st = payload;
+
+	if (st->count == N_OBJECTS)
+		return GIT_ERROR;
+	git_oid_cpy(&st->ids[st->count], id);
+
+	if (++st->count == st->stop_at)
+		return GIT_EBUSY;
+	return GIT_SUCCESS;
+}
+
+static int is_sorted(git_oid *ids, size_t n)
+{
+	size_t j;
+
+	for (j = 1; j < n; j++)
+		if (git_oid_cmp(&ids[j - 1], &ids[j]) >= 0)
+			return 0;
+	return 1;
+}
+
+static int cmp_ids(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static struct foreach_state by_id, by_offset;
+
+BEGIN_TEST(foreach_orders)
+	git_oid first, second;
+	git_odb *db;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	must_pass(git_odb_foreach(db, GIT_ODB_FOREACH_ID, add_object, &by_id));
+	must_be_true(by_id.count == N_OBJECTS);
+
+	/* the largest pack is listed first, then the loose objects */
+	must_be_true(is_sorted(by_id.ids, N_LARGEST_PACK));
+	must_be_true(is_sorted(by_id.ids + N_OBJECTS - N_LOOSE, N_LOOSE));
+
+	must_pass(git_odb_foreach(db, GIT_ODB_FOREACH_PACK_ORDER, add_object, &by_offset));
+	must_be_true(by_offset.count == N_OBJECTS);
+
+	must_pass(git_oid_mkstr(&first, "fb20a5a4b6185d9188d82c874db3d9729ef31f3b"));
+	must_pass(git_oid_mkstr(&second, "0129895fa52dfb06cfe4f1f456d57d8e16453686"));
+	must_be_true(git_oid_cmp(&by_offset.ids[0], &first) == 0);
+	must_be_true(git_oid_cmp(&by_offset.ids[1], &second) == 0);
+	must_be_true(!is_sorted(by_offset.ids, N_LARGEST_PACK));
+
+	/* both list the same objects, each of them once */
+	qsort(by_id.ids, N_OBJECTS, sizeof(git_oid), cmp_ids);
+	qsort(by_offset.ids, N_OBJECTS, sizeof(git_oid), cmp_ids);
+	must_be_true(is_sorted(by_id.ids, N_OBJECTS));
+	must_be_true(memcmp(by_id.ids, by_offset.ids, sizeof(by_id.ids)) == 0);
+
+	git_odb_close(db);
+END_TEST
+
+BEGIN_TEST(foreach_stop)
+	git_odb *db;
+
+	must_pass(git_odb_open(&db, ODB_FOLDER));
+
+	memset(&by_id, 0x0, sizeof(by_id));
+	by_id.stop_at = 10;
+	must_be_true(git_odb_foreach(db, GIT_ODB_FOREACH_ID, add_object, &by_id) == GIT_EBUSY);
+	must_be_true(by_id.count == 10);
+
+	/* in the loose objects as well */
+	memset(&by_id, 0x0, sizeof(by_id));
+	by_id.stop_at = N_OBJECTS - 5;
+	must_be_true(git_odb_foreach(db, GIT_ODB_FOREACH_PACK_ORDER, add_object, &by_id) == GIT_EBUSY);
+	must_be_true(by_id.count == N_OBJECTS - 5);
+
+	git_odb_close(db);
+END_TEST
+
+BEGIN_TEST(foreach_bad_index)
+	gitfo_buf buf;
+	git_odb *db;
+	char path[GIT_PATH_MAX] = TEMP_ODB_FOLDER
+		"pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx";
+
+	/* a pack whose index cannot be read is not skipped */
+	must_pass(copydir_recurs(ODB_FOLDER, TEMP_ODB_FOLDER));
+	must_pass(gitfo_read_file(&buf, path));
+	must_pass(gitfo_unlink(path));
+	must_pass(write_object_data(path, buf.data, 16));
+	gitfo_free_buf(&buf);
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	memset(&by_id, 0x0, sizeof(by_id));
+	must_be_true(git_odb_foreach(db, GIT_ODB_FOREACH_ID, add_object, &by_id) == GIT_EPACKCORRUPTED);
+	git_odb_close(db);
+
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
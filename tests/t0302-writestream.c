@@ -0,0 +1,93 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+
+#define BLOB_SIZE (100 * 1024 + 17)
+
+static unsigned char *make_blob(void)
+{
+	unsigned char *data = git__malloc(BLOB_SIZE);
+	unsigned int j, x = 12345;
+
+	if (!data)
+		return NULL;
+	for (j = 0; j < BLOB_SIZE; j++) {
+		x = x * 1103515245 + 12345;
+		data[j] = (unsigned char)(x >> 16);
+	}
+	return data;
+}
+
+static int count_tmp_files(void *state, char *path)
+{
+	if (strstr(path, "tmp_obj_"))
+		(*(int *)state)++;
+	return 0;
+}
+
+BEGIN_TEST(writestream_blob)
+	char path[GIT_PATH_MAX] = TEMP_ODB_FOLDER;
+	git_odb_stream *stream;
+	git_rawobj obj, blob;
+	git_oid id1, id2;
+	unsigned char *data;
+	size_t done;
+	int n_tmp = 0;
+	git_odb *db;
+
+	must_be_true((data = make_blob()) != NULL);
+	blob.data = data;
+	blob.len = BLOB_SIZE;
+	blob.type = GIT_OBJ_BLOB;
+	must_pass(git_obj_hash(&id1, &blob));
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+	must_pass(git_odb_open_wstream(&stream, db, BLOB_SIZE, GIT_OBJ_BLOB));
+	for (done = 0; done < BLOB_SIZE; done += 999) {
+		size_t len = BLOB_SIZE - done < 999 ? BLOB_SIZE - done : 999;
+		must_pass(git_odb_stream_write(stream, data + done, len));
+	}
+	must_fail(git_odb_stream_write(stream, data, 1));
+	must_pass(git_odb_stream_finalize(&id2, stream));
+	git_odb_stream_close(stream);
+
+	must_be_true(git_oid_cmp(&id1, &id2) == 0);
+	must_pass(git_odb__read_loose(&obj, db, &id1));
+	must_be_true(obj.type == GIT_OBJ_BLOB && obj.len == BLOB_SIZE);
+	must_be_true(memcmp(obj.data, data, BLOB_SIZE) == 0);
+	git_obj_close(&obj);
+
+	/* writing it again keeps the existing object */
+	must_pass(git_odb_open_wstream(&stream, db, BLOB_SIZE, GIT_OBJ_BLOB));
+	must_pass(git_odb_stream_write(stream, data, BLOB_SIZE));
+	must_pass(git_odb_stream_finalize(&id2, stream));
+	git_odb_stream_close(stream);
+	must_be_true(git_oid_cmp(&id1, &id2) == 0);
+
+	/* a short or abandoned stream stores nothing */
+	must_pass(git_odb_open_wstream(&stream, db, BLOB_SIZE, GIT_OBJ_BLOB));
+	must_pass(git_odb_stream_write(stream, data, 10));
+	must_fail(git_odb_stream_finalize(&id2, stream));
+	git_odb_stream_close(stream);
+
+	must_pass(gitfo_dirent(path, sizeof(path), count_tmp_files, &n_tmp));
+	must_be_true(n_tmp == 0);
+
+	git_odb_close(db);
+	free(data);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+BEGIN_TEST(writestream_bad_type)
+	git_odb_stream *stream;
+	git_odb *db;
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_fail(git_odb_open_wstream(&stream, db, 10, GIT_OBJ_OFS_DELTA));
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
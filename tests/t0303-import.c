@@ -0,0 +1,154 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+
+#define N_BLOBS 200
+
+static void make_blob(git_rawobj *obj, char *buf, size_t len, unsigned int n)
+{
+	unsigned int j;
+
+	for (j = 0; j < len; j++)
+		buf[j] = 'a' + (char)((n * 7 + j * 13) % 26);
+	sprintf(buf, "blob %u\n", n);
+
+	obj->data = buf;
+	obj->len = len;
+	obj->type = GIT_OBJ_BLOB;
+}
+
+static size_t blob_len(unsigned int n)
+{
+	return 20 + (n * 37) % 5000;
+}
+
+static int count_files(void *state, char *path)
+{
+	int *cnt = state;
+
+	if (strstr(path, "tmp_obj_"))
+		cnt[0]++;
+	else if (!git__suffixcmp(path, ".pack"))
+		cnt[1]++;
+	else if (!git__suffixcmp(path, ".idx"))
+		cnt[2]++;
+	else
+		cnt[3]++;
+	return 0;
+}
+
+static int count_loose(void *state, char *path)
+{
+	if (git__suffixcmp(path, "/pack"))
+		(*(int *)state)++;
+	return 0;
+}
+
+/* count temporary files, packs, indexes and other files */
+static void count_odb_files(int *cnt)
+{
+	char path[GIT_PATH_MAX] = TEMP_ODB_FOLDER;
+
+	memset(cnt, 0x0, 4 * sizeof(*cnt));
+	must_pass(gitfo_dirent(path, sizeof(path), count_loose, &cnt[3]));
+
+	strcpy(path, TEMP_ODB_FOLDER "pack");
+	if (gitfo_exists(path) == 0)
+		must_pass(gitfo_dirent(path, sizeof(path), count_files, cnt));
+}
+
+static void check_blobs(git_odb *db, git_oid *ids, char *buf)
+{
+	git_rawobj obj, exp;
+	unsigned int j;
+
+	for (j = 0; j < N_BLOBS; j++) {
+		make_blob(&exp, buf, blob_len(j), j);
+		must_pass(git_odb_read(&obj, db, &ids[j]));
+		must_be_true(obj.type == GIT_OBJ_BLOB && obj.len == exp.len);
+		must_be_true(memcmp(obj.data, exp.data, exp.len) == 0);
+		git_obj_close(&obj);
+	}
+}
+
+BEGIN_TEST(import_pack)
+	git_oid ids[N_BLOBS];
+	git_rawobj obj;
+	char buf[5100];
+	int cnt[4];
+	unsigned int j;
+	git_odb *db;
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+	must_pass(git_odb_begin_import(db));
+	must_be_true(git_odb_begin_import(db) == GIT_EBUSY);
+
+	for (j = 0; j < N_BLOBS; j++) {
+		make_blob(&obj, buf, blob_len(j), j);
+		must_pass(git_odb_write(&ids[j], db, &obj));
+		/* a second write of the same object is a no-op */
+		must_pass(git_odb_write(&ids[j], db, &obj));
+		must_be_true(git_odb_exists(db, &ids[j]));
+	}
+
+	/* the imported objects are readable before the commit */
+	check_blobs(db, ids, buf);
+
+	count_odb_files(cnt);
+	must_be_true(cnt[0] == 1 && cnt[1] == 0 && cnt[2] == 0 && cnt[3] == 0);
+
+	must_pass(git_odb_commit_import(db));
+	must_fail(git_odb_commit_import(db));
+
+	count_odb_files(cnt);
+	must_be_true(cnt[0] == 0 && cnt[1] == 1 && cnt[2] == 1 && cnt[3] == 0);
+
+	check_blobs(db, ids, buf);
+	git_odb_close(db);
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	check_blobs(db, ids, buf);
+	git_odb_close(db);
+
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+BEGIN_TEST(import_abort)
+	git_oid id;
+	git_rawobj obj;
+	char buf[100];
+	int cnt[4];
+	git_odb *db;
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+	/* an empty import creates no pack */
+	must_pass(git_odb_begin_import(db));
+	must_pass(git_odb_commit_import(db));
+	count_odb_files(cnt);
+	must_be_true(cnt[0] == 0 && cnt[1] == 0 && cnt[2] == 0 && cnt[3] == 0);
+
+	must_pass(git_odb_begin_import(db));
+	make_blob(&obj, buf, sizeof(buf), 1);
+	must_pass(git_odb_write(&id, db, &obj));
+	must_be_true(git_odb_exists(db, &id));
+	git_odb_abort_import(db);
+
+	must_be_true(!git_odb_exists(db, &id));
+	count_odb_files(cnt);
+	must_be_true(cnt[0] == 0 && cnt[1] == 0 && cnt[2] == 0 && cnt[3] == 0);
+
+	/* closing the database discards an import in progress */
+	must_pass(git_odb_begin_import(db));
+	must_pass(git_odb_write(&id, db, &obj));
+	git_odb_close(db);
+
+	count_odb_files(cnt);
+	must_be_true(cnt[0] == 0 && cnt[1] == 0 && cnt[2] == 0 && cnt[3] == 0);
+
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
@@ -0,0 +1,275 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+#include "hash.h"
+#include <zlib.h>
+
+#define PACK_FOLDER ODB_FOLDER "pack/"
+#define NEW_PACK TEMP_ODB_FOLDER "new.pack"
+
+static const char *packs[] = {
+	"pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695",
+	"pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5",
+	"pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a",
+	NULL
+};
+
+static int cmp_files(const char *a, const char *b)
+{
+	gitfo_buf ba, bb;
+	int cmp = -1;
+
+	if (gitfo_read_file(&ba, a) < 0)
+		return -1;
+	if (gitfo_read_file(&bb, b) == 0) {
+		cmp = ba.len != bb.len || memcmp(ba.data, bb.data, ba.len);
+		gitfo_free_buf(&bb);
+	}
+	gitfo_free_buf(&ba);
+	return cmp;
+}
+
+BEGIN_TEST(indexpack_matches_git)
+	char src[GIT_PATH_MAX], dst[GIT_PATH_MAX], hex[GIT_OID_HEXSZ + 1];
+	git_oid pack_id, expected;
+	gitfo_buf buf;
+	git_rawobj obj;
+	git_odb *db;
+	int j;
+
+	for (j = 0; packs[j]; j++) {
+		must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+		must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+		sprintf(src, PACK_FOLDER "%s.pack", packs[j]);
+		must_pass(copy_file(src, NEW_PACK));
+		must_pass(git_odb_index_pack(&pack_id, db, NEW_PACK));
+
+		/* the pack is named after its checksum */
+		must_pass(gitfo_read_file(&buf, src));
+		git_oid_mkraw(&expected, (unsigned char *)buf.data + buf.len - GIT_OID_RAWSZ);
+		gitfo_free_buf(&buf);
+		must_be_true(git_oid_cmp(&pack_id, &expected) == 0);
+		must_be_true(gitfo_exists(NEW_PACK) < 0);
+
+		git_oid_fmt(hex, &pack_id);
+		hex[GIT_OID_HEXSZ] = '\0';
+		sprintf(dst, TEMP_ODB_FOLDER "pack/pack-%s.pack", hex);
+		must_be_true(cmp_files(src, dst) == 0);
+
+		/* the index is the one git wrote */
+		sprintf(src, PACK_FOLDER "%s.idx", packs[j]);
+		sprintf(dst, TEMP_ODB_FOLDER "pack/pack-%s.idx", hex);
+		must_be_true(cmp_files(src, dst) == 0);
+
+		git_odb_close(db);
+		must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+	}
+
+	/* the objects can be read through the new index */
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_pass(copy_file(PACK_FOLDER "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.pack", NEW_PACK));
+	must_pass(git_odb_index_pack(&pack_id, db, NEW_PACK));
+	must_pass(git_oid_mkstr(&expected, "6336846bd5c88d32f93ae57d846683e61ab5c530"));
+	must_pass(git_odb_read(&obj, db, &expected));
+	git_obj_close(&obj);
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+BEGIN_TEST(indexpack_corrupted)
+	char src[GIT_PATH_MAX], pb[GIT_PATH_MAX];
+	gitfo_buf buf;
+	git_oid pack_id;
+	git_odb *db;
+	size_t len;
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+	sprintf(src, PACK_FOLDER "%s.pack", packs[0]);
+	must_pass(gitfo_read_file(&buf, src));
+	len = buf.len;
+
+	/* a flipped bit breaks the checksum */
+	((unsigned char *)buf.data)[len / 2] ^= 0x10;
+	must_pass(write_object_data(NEW_PACK, buf.data, len));
+	must_fail(git_odb_index_pack(&pack_id, db, NEW_PACK));
+	((unsigned char *)buf.data)[len / 2] ^= 0x10;
+
+	/* so does a truncated pack */
+	must_pass(write_object_data(NEW_PACK, buf.data, len - 1000));
+	must_fail(git_odb_index_pack(&pack_id, db, NEW_PACK));
+
+	must_pass(write_object_data(NEW_PACK, buf.data, 16));
+	must_fail(git_odb_index_pack(&pack_id, db, NEW_PACK));
+
+	/* nothing was added to the database */
+	strcpy(pb, TEMP_ODB_FOLDER "pack");
+	must_be_true(gitfo_exists(pb) < 0);
+
+	gitfo_free_buf(&buf);
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+BEGIN_TEST(indexpack_idx_fails)
+	char src[GIT_PATH_MAX], pb[GIT_PATH_MAX], hex[GIT_OID_HEXSZ + 1];
+	git_oid pack_id;
+	gitfo_buf buf;
+	git_odb *db;
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER "pack", 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+	sprintf(src, PACK_FOLDER "%s.pack", packs[0]);
+	must_pass(copy_file(src, NEW_PACK));
+	must_pass(gitfo_read_file(&buf, src));
+	git_oid_mkraw(&pack_id, (unsigned char *)buf.data + buf.len - GIT_OID_RAWSZ);
+	gitfo_free_buf(&buf);
+	git_oid_fmt(hex, &pack_id);
+	hex[GIT_OID_HEXSZ] = '\0';
+
+	/* the index cannot be locked */
+	sprintf(pb, TEMP_ODB_FOLDER "pack/pack-%s.idx.lock", hex);
+	must_pass(gitfo_mkdir(pb, 0755));
+	must_fail(git_odb_index_pack(&pack_id, db, NEW_PACK));
+
+	/* the pack was left where it was */
+	must_pass(gitfo_exists(NEW_PACK));
+	sprintf(pb, TEMP_ODB_FOLDER "pack/pack-%s.pack", hex);
+	must_be_true(gitfo_exists(pb) < 0);
+	sprintf(pb, TEMP_ODB_FOLDER "pack/pack-%s.idx", hex);
+	must_be_true(gitfo_exists(pb) < 0);
+
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+#define CHAIN_LEN 50000
+#define CHAIN_OBJ_LEN 64
+
+static unsigned char *put_entry_header(unsigned char *b, int type, size_t size)
+{
+	*b = (unsigned char)((type << 4) | (size & 15));
+	for (size >>= 4; size; size >>= 7) {
+		*b++ |= 0x80;
+		*b = size & 0x7f;
+	}
+	return b + 1;
+}
+
+static unsigned char *put_ofs(unsigned char *b, size_t ofs)
+{
+	unsigned char tmp[16];
+	size_t pos = sizeof(tmp) - 1;
+
+	tmp[pos] = ofs & 0x7f;
+	while (ofs >>= 7)
+		tmp[--pos] = 0x80 | (--ofs & 0x7f);
+	memcpy(b, tmp + pos, sizeof(tmp) - pos);
+	return b + sizeof(tmp) - pos;
+}
+
+static unsigned char *put_deflated(unsigned char *b, const void *data, size_t len)
+{
+	uLongf out = 64 + 2 * len;
+
+	if (compress2(b, &out, data, len, Z_BEST_SPEED) != Z_OK)
+		return NULL;
+	return b + out;
+}
+
+/*
+ * A blob followed by CHAIN_LEN ofs-deltas, each based on the
+ * previous entry: drop the first two bytes, append the delta
+ * number.  Returns the last object in 'last'.
+ */
+static int write_chain_pack(const char *path, git_rawobj *last)
+{
+	static unsigned char content[CHAIN_OBJ_LEN];
+	unsigned char *pack, *b, *prev;
+	git_hash_ctx *ctx;
+	git_oid checksum;
+	unsigned int k;
+	int error;
+
+	if ((pack = git__malloc(12 + (CHAIN_LEN + 1) * 64 + GIT_OID_RAWSZ)) == NULL)
+		return GIT_ENOMEM;
+
+	memcpy(pack, "PACK\0\0\0\2", 8);
+	pack[8] = (unsigned char)((CHAIN_LEN + 1) >> 24);
+	pack[9] = (unsigned char)((CHAIN_LEN + 1) >> 16);
+	pack[10] = (unsigned char)((CHAIN_LEN + 1) >> 8);
+	pack[11] = (unsigned char)(CHAIN_LEN + 1);
+
+	for (k = 0; k < CHAIN_OBJ_LEN; k++)
+		content[k] = 'a' + k % 26;
+	prev = b = pack + 12;
+	b = put_entry_header(b, GIT_OBJ_BLOB, CHAIN_OBJ_LEN);
+	b = put_deflated(b, content, CHAIN_OBJ_LEN);
+
+	for (k = 1; b && k <= CHAIN_LEN; k++) {
+		unsigned char delta[] = {
+			CHAIN_OBJ_LEN, CHAIN_OBJ_LEN,    /* base and result sizes */
+			0x91, 2, CHAIN_OBJ_LEN - 2,      /* copy from offset 2 */
+			2, 0, 0,                         /* insert the number */
+		};
+		unsigned char *entry = b;
+
+		delta[6] = (unsigned char)(k >> 8);
+		delta[7] = (unsigned char)k;
+
+		b = put_entry_header(b, GIT_OBJ_OFS_DELTA, sizeof(delta));
+		b = put_ofs(b, entry - prev);
+		b = put_deflated(b, delta, sizeof(delta));
+		prev = entry;
+
+		memmove(content, content + 2, CHAIN_OBJ_LEN - 2);
+		content[CHAIN_OBJ_LEN - 2] = delta[6];
+		content[CHAIN_OBJ_LEN - 1] = delta[7];
+	}
+
+	if (!b || (ctx = git_hash_new_ctx()) == NULL) {
+		free(pack);
+		return GIT_ERROR;
+	}
+	git_hash_update(ctx, pack, b - pack);
+	git_hash_final(&checksum, ctx);
+	git_hash_free_ctx(ctx);
+	memcpy(b, checksum.id, GIT_OID_RAWSZ);
+	b += GIT_OID_RAWSZ;
+
+	error = write_object_data((char *)path, pack, b - pack);
+	free(pack);
+
+	last->data = content;
+	last->len = CHAIN_OBJ_LEN;
+	last->type = GIT_OBJ_BLOB;
+	return error;
+}
+
+BEGIN_TEST(indexpack_long_chain)
+	git_rawobj last, obj;
+	git_oid pack_id, id;
+	git_odb *db;
+
+	must_pass(gitfo_mkdir(TEMP_ODB_FOLDER, 0755));
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+
+	/* resolving the chain must not take a stack frame per delta */
+	must_pass(write_chain_pack(NEW_PACK, &last));
+	must_pass(git_odb_index_pack(&pack_id, db, NEW_PACK));
+
+	must_pass(git_obj_hash(&id, &last));
+	must_pass(git_odb_read(&obj, db, &id));
+	must_be_true(obj.type == last.type && obj.len == last.len);
+	must_be_true(memcmp(obj.data, last.data, last.len) == 0);
+	git_obj_close(&obj);
+
+	git_odb_close(db);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
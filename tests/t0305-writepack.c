@@ -0,0 +1,207 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include <git/odb.h>
+#include "fileops.h"
+#include "delta-apply.h"
+#include "delta-create.h"
+
+#define PACK_NAME "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+#define NEW_ODB_FOLDER "test-objects-new/"
+#define DATA_SIZE (64 * 1024)
+
+static unsigned char *random_data(size_t len, unsigned int seed)
+{
+	unsigned char *data = git__malloc(len);
+	size_t j;
+
+	if (!data)
+		return NULL;
+	for (j = 0; j < len; j++) {
+		seed = seed * 1103515245 + 12345;
+		data[j] = (unsigned char)(seed >> 16);
+	}
+	return data;
+}
+
+static int delta_roundtrip(const unsigned char *base, size_t base_len,
+		const unsigned char *res, size_t res_len, size_t *delta_len)
+{
+	git__delta_index *index;
+	git_rawobj out;
+	void *delta;
+	int error;
+
+	if ((index = git__delta_create_index(base, base_len)) == NULL)
+		return GIT_ENOMEM;
+
+	error = git__delta_create(&delta, delta_len, index, res, res_len, 0);
+	git__delta_free_index(index);
+	if (error < GIT_SUCCESS)
+		return error;
+
+	error = git__delta_apply(&out, base, base_len, delta, *delta_len);
+	free(delta);
+	if (error < GIT_SUCCESS)
+		return error;
+
+	if (out.len != res_len || memcmp(out.data, res, res_len))
+		error = GIT_ERROR;
+	free(out.data);
+	return error;
+}
+
+BEGIN_TEST(delta_create)
+	unsigned char *base, *res;
+	git__delta_index *index;
+	size_t len, j;
+	void *delta;
+
+	must_be_true((base = random_data(DATA_SIZE, 1)) != NULL);
+	must_be_true((res = git__malloc(2 * DATA_SIZE)) != NULL);
+
+	/* identical data is one run of copies */
+	must_pass(delta_roundtrip(base, DATA_SIZE, base, DATA_SIZE, &len));
+	must_be_true(len < 32);
+
+	/* a few edits cost little more than the new bytes */
+	memcpy(res, base, 1000);
+	memcpy(res + 1000, "inserted", 8);
+	memcpy(res + 1008, base + 1000, 20000);
+	memcpy(res + 21008, base + 30000, DATA_SIZE - 30000);
+	for (j = 5000; j < DATA_SIZE - 20000; j += 7919)
+		res[j] ^= 0xff;
+	len = 21008 + DATA_SIZE - 30000;
+	must_pass(delta_roundtrip(base, DATA_SIZE, res, len, &j));
+	must_be_true(j < 512);
+
+	/* unrelated data is all literal */
+	free(res);
+	must_be_true((res = random_data(DATA_SIZE, 2)) != NULL);
+	must_pass(delta_roundtrip(base, DATA_SIZE, res, DATA_SIZE, &len));
+	must_be_true(len > DATA_SIZE);
+
+	/* and is not worth a delta */
+	must_be_true((index = git__delta_create_index(base, DATA_SIZE)) != NULL);
+	must_be_true(git__delta_create(&delta, &len, index, res, DATA_SIZE, DATA_SIZE / 2) == GIT_ENOTFOUND);
+	git__delta_free_index(index);
+
+	/* short and empty data */
+	must_pass(delta_roundtrip(base, 10, res, 5, &len));
+	must_pass(delta_roundtrip(base, 0, res, 100, &len));
+	must_pass(delta_roundtrip(base, 100, res, 0, &len));
+
+	free(base);
+	free(res);
+END_TEST
+
+static git_oid *read_idx_ids(const char *path, size_t *n)
+{
+	gitfo_buf buf;
+	git_oid *ids;
+	size_t j;
+
+	if (gitfo_read_file(&buf, path) < 0)
+		return NULL;
+
+	*n = ntohl(((uint32_t *)buf.data)[2 + 255]);
+	if ((ids = git__malloc(*n * sizeof(*ids))) != NULL)
+		for (j = 0; j < *n; j++)
+			git_oid_mkraw(&ids[j], (unsigned char *)buf.data + 8 + 256 * 4 + j * 20);
+
+	gitfo_free_buf(&buf);
+	return ids;
+}
+
+BEGIN_TEST(write_pack)
+	char src[GIT_PATH_MAX], dst[GIT_PATH_MAX], hex[GIT_OID_HEXSZ + 1];
+	git_odb *db, *new_db;
+	git_oid pack_id, *ids;
+	git_rawobj a, b;
+	gitfo_buf buf;
+	size_t n, j;
+
+	must_pass(copydir_recurs(ODB_FOLDER, TEMP_ODB_FOLDER));
+	must_be_true((ids = read_idx_ids(TEMP_ODB_FOLDER "pack/" PACK_NAME ".idx", &n)) != NULL);
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_pass(git_odb_write_pack(&pack_id, db, ids, n, 0, 0));
+
+	/* move the new pack to an empty database */
+	git_oid_fmt(hex, &pack_id);
+	hex[GIT_OID_HEXSZ] = '\0';
+	must_pass(gitfo_mkdir(NEW_ODB_FOLDER, 0755));
+	must_pass(gitfo_mkdir(NEW_ODB_FOLDER "pack", 0755));
+	sprintf(src, TEMP_ODB_FOLDER "pack/pack-%s.pack", hex);
+	sprintf(dst, NEW_ODB_FOLDER "pack/pack-%s.pack", hex);
+	must_pass(gitfo_move_file(src, dst));
+	sprintf(src, TEMP_ODB_FOLDER "pack/pack-%s.idx", hex);
+	sprintf(dst, NEW_ODB_FOLDER "pack/pack-%s.idx", hex);
+	must_pass(gitfo_move_file(src, dst));
+
+	/* most objects of that pack are deltas, as in the original */
+	sprintf(dst, NEW_ODB_FOLDER "pack/pack-%s.pack", hex);
+	must_pass(gitfo_read_file(&buf, dst));
+	must_be_true(buf.len < 2 * 386089);
+	gitfo_free_buf(&buf);
+
+	must_pass(git_odb_open(&new_db, NEW_ODB_FOLDER));
+	for (j = 0; j < n; j++) {
+		must_pass(git_odb_read(&a, db, &ids[j]));
+		must_pass(git_odb_read(&b, new_db, &ids[j]));
+		must_be_true(a.type == b.type && a.len == b.len);
+		must_be_true(memcmp(a.data, b.data, a.len) == 0);
+		git_obj_close(&a);
+		git_obj_close(&b);
+	}
+
+	/* duplicates are written once; an object must exist */
+	must_pass(git_odb_write_pack(&pack_id, db, ids, 1, 0, 0));
+	ids[1] = ids[0];
+	must_pass(git_odb_write_pack(&pack_id, db, ids, 2, 0, 0));
+	memset(&ids[0], 0x0, sizeof(ids[0]));
+	must_fail(git_odb_write_pack(&pack_id, db, ids, 1, 0, 0));
+
+	git_odb_close(new_db);
+	git_odb_close(db);
+	free(ids);
+	must_pass(rmdir_recurs(NEW_ODB_FOLDER));
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
+
+BEGIN_TEST(write_pack_idx_fails)
+	char path[GIT_PATH_MAX], hex[GIT_OID_HEXSZ + 1];
+	git_oid pack_id, *ids;
+	git_odb *db;
+	size_t n;
+
+	must_pass(copydir_recurs(ODB_FOLDER, TEMP_ODB_FOLDER));
+	must_be_true((ids = read_idx_ids(TEMP_ODB_FOLDER "pack/" PACK_NAME ".idx", &n)) != NULL);
+
+	/* find the name of the pack, and take it away again */
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_pass(git_odb_write_pack(&pack_id, db, ids, 1, 0, 0));
+	git_odb_close(db);
+	git_oid_fmt(hex, &pack_id);
+	hex[GIT_OID_HEXSZ] = '\0';
+	sprintf(path, TEMP_ODB_FOLDER "pack/pack-%s.pack", hex);
+	must_pass(gitfo_unlink(path));
+	sprintf(path, TEMP_ODB_FOLDER "pack/pack-%s.idx", hex);
+	must_pass(gitfo_unlink(path));
+
+	/* the index cannot be locked */
+	sprintf(path, TEMP_ODB_FOLDER "pack/pack-%s.idx.lock", hex);
+	must_pass(gitfo_mkdir(path, 0755));
+
+	must_pass(git_odb_open(&db, TEMP_ODB_FOLDER));
+	must_fail(git_odb_write_pack(&pack_id, db, ids, 1, 0, 0));
+	git_odb_close(db);
+
+	/* no pack was left without its index */
+	sprintf(path, TEMP_ODB_FOLDER "pack/pack-%s.pack", hex);
+	must_be_true(gitfo_exists(path) < 0);
+	sprintf(path, TEMP_ODB_FOLDER "pack/pack-%s.idx", hex);
+	must_be_true(gitfo_exists(path) < 0);
+
+	free(ids);
+	must_pass(rmdir_recurs(TEMP_ODB_FOLDER));
+END_TEST
@@ -63,3 +63,33 @@ BEGIN_TEST(query_details_test)
 
 	git_repository_free(repo);
 END_TEST
+
+BEGIN_TEST(lazy_parents_test)
+	git_repository *repo;
+	git_oid id;
+	git_commit *commit, *parent;
+	const git_tree *tree;
+
+	must_pass(git_repository_open(&repo, REPOSITORY_FOLDER));
+
+	git_oid_mkstr(&id, commit_ids[0]);
+	must_pass(git_commit_lookup(&commit, repo, &id));
+
+	/* neither the tree nor the parents are loaded by the lookup */
+	must_be_true(git_commit_parentcount(commit) >= 1);
+	must_be_true(git_vector_get(&commit->parents, 0) == NULL);
+	must_be_true(git_oidmap_lookup(repo->objects, &commit->parent_oids[0]) == NULL);
+	must_be_true(commit->tree == NULL);
+	must_be_true(git_oidmap_lookup(repo->objects, &commit->tree_oid) == NULL);
+
+	parent = git_commit_parent(commit, 0);
+	must_be_true(parent != NULL);
+	must_be_true(git_oid_cmp(git_commit_id(parent), &commit->parent_oids[0]) == 0);
+	must_be_true(git_commit_parent(commit, 0) == parent);
+
+	tree = git_commit_tree(commit);
+	must_be_true(tree != NULL);
+	must_be_true(git_oid_cmp(git_tree_id((git_tree *)tree), &commit->tree_oid) == 0);
+
+	git_repository_free(repo);
+END_TEST
@@ -123,3 +123,32 @@ BEGIN_TEST(simple_walk_test)
 	git_revwalk_free(walk);
 	git_repository_free(repo);
 END_TEST
+
+BEGIN_TEST(walk_new_commits)
+	git_repository *repo;
+	git_revwalk *walk;
+	git_commit *a, *b, *commit;
+	int n = 0;
+
+	must_pass(git_repository_open(&repo, REPOSITORY_FOLDER));
+	must_pass(git_revwalk_new(&walk, repo));
+
+	/* neither commit has been written, so both have the zero id */
+	must_pass(git_commit_new(&a, repo));
+	must_pass(git_commit_new(&b, repo));
+	must_be_true(git_oid_cmp(&a->object.id, &b->object.id) == 0);
+
+	must_pass(git_revwalk_push(walk, a));
+	must_pass(git_revwalk_push(walk, b));
+
+	while ((commit = git_revwalk_next(walk)) != NULL) {
+		must_be_true(commit == a || commit == b);
+		n++;
+	}
+	must_be_true(n == 2);
+
+	git_revwalk_free(walk);
+	git_object_free((git_object *)a);
+	git_object_free((git_object *)b);
+	git_repository_free(repo);
+END_TEST
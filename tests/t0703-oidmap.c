@@ -0,0 +1,248 @@
+#include "test_lib.h"
+#include "test_helpers.h"
+#include "repository.h"
+#include "oidmap.h"
+#include "hash.h"
+
+typedef struct map_item {
+	git_oid id;
+	int visited;
+} map_item;
+
+static map_item *make_items(int n)
+{
+	map_item *items;
+	int i;
+
+	items = git__malloc(n * sizeof(map_item));
+	memset(items, 0x0, n * sizeof(map_item));
+
+	for (i = 0; i < n; ++i)
+		git_hash_buf(&(items[i].id), &i, sizeof(int));
+
+	return items;
+}
+
+BEGIN_TEST(oidmap_create)
+
+	git_oidmap *map = NULL;
+
+	map = git_oidmap_alloc(55);
+	must_be_true(map != NULL);
+	must_be_true(map->size_mask + 1 == 64);
+	must_be_true(map->count == 0);
+
+	git_oidmap_free(map);
+
+END_TEST
+
+BEGIN_TEST(oidmap_populate)
+
+	const int items_n = 1000;
+	int i;
+	map_item *items;
+	git_oidmap *map = NULL;
+
+	/* start small, so that the map grows several times */
+	map = git_oidmap_alloc(0);
+	must_be_true(map != NULL);
+
+	items = make_items(items_n);
+
+	for (i = 0; i < items_n; ++i)
+		must_pass(git_oidmap_insert(map, &(items[i].id), &(items[i])));
+
+	must_be_true(map->count == (unsigned int)items_n);
+	must_be_true(map->size_mask + 1 >= (unsigned int)items_n);
+
+	/* make sure all the inserted items can be found */
+	for (i = 0; i < items_n; ++i)
+		must_be_true(git_oidmap_lookup(map, &(items[i].id)) == &(items[i]));
+
+	/* make sure we cannot find inexisting items */
+	for (i = items_n; i < items_n + 200; ++i) {
+		git_oid id;
+
+		git_hash_buf(&id, &i, sizeof(int));
+		must_be_true(git_oidmap_lookup(map, &id) == NULL);
+	}
+
+	git_oidmap_free(map);
+	free(items);
+
+END_TEST
+
+BEGIN_TEST(oidmap_remove)
+
+	const int items_n = 500;
+	int i;
+	map_item *items;
+	git_oidmap *map = NULL;
+
+	map = git_oidmap_alloc(0);
+	must_be_true(map != NULL);
+
+	items = make_items(items_n);
+
+	for (i = 0; i < items_n; ++i)
+		must_pass(git_oidmap_insert(map, &(items[i].id), &(items[i])));
+
+	/* remove every third item */
+	for (i = 0; i < items_n; i += 3)
+		must_pass(git_oidmap_remove(map, &(items[i].id)));
+
+	for (i = 0; i < items_n; i += 3)
+		must_be_true(git_oidmap_remove(map, &(items[i].id)) == GIT_ENOTFOUND);
+
+	/* the others are still there, after being moved around */
+	for (i = 0; i < items_n; ++i) {
+		void *item = git_oidmap_lookup(map, &(items[i].id));
+		must_be_true(item == ((i % 3) ? &(items[i]) : NULL));
+	}
+
+	git_oidmap_clear(map);
+	must_be_true(map->count == 0);
+	for (i = 0; i < items_n; ++i)
+		must_be_true(git_oidmap_lookup(map, &(items[i].id)) == NULL);
+
+	git_oidmap_free(map);
+	free(items);
+
+END_TEST
+
+BEGIN_TEST(oidmap_iterator)
+
+	const int items_n = 700;
+	int i;
+	map_item *items, *item;
+	git_oidmap *map = NULL;
+	git_oidmap_iterator iterator;
+
+	map = git_oidmap_alloc(0);
+	must_be_true(map != NULL);
+
+	items = make_items(items_n);
+
+	for (i = 0; i < items_n; ++i)
+		must_pass(git_oidmap_insert(map, &(items[i].id), &(items[i])));
+
+	git_oidmap_iterator_init(map, &iterator);
+
+	/* visit every item once, even when removing them on the way */
+	while ((item = (map_item *)git_oidmap_iterator_next(&iterator)) != NULL) {
+		item->visited++;
+		if ((item - items) % 2)
+			must_pass(git_oidmap_remove(map, &item->id));
+	}
+
+	for (i = 0; i < items_n; ++i)
+		must_be_true(items[i].visited == 1);
+
+	must_be_true(map->count == (unsigned int)(items_n / 2));
+
+	git_oidmap_free(map);
+	free(items);
+
+END_TEST
+
+BEGIN_TEST(oidmap_incremental_resize)
+
+	const int items_n = 3000;
+	int i, j, resizing = 0;
+	map_item *items;
+	git_oidmap *map = NULL;
+
+	map = git_oidmap_alloc(0);
+	must_be_true(map != NULL);
+
+	items = make_items(items_n);
+
+	for (i = 0; i < items_n; ++i) {
+		must_pass(git_oidmap_insert(map, &(items[i].id), &(items[i])));
+
+		if (map->old_slots == NULL)
+			continue;
+		resizing++;
+
+		/* entries can be removed from either array */
+		for (j = i % 5; j < i; j += 400) {
+			must_pass(git_oidmap_remove(map, &(items[j].id)));
+			must_be_true(git_oidmap_remove(map, &(items[j].id)) == GIT_ENOTFOUND);
+			must_pass(git_oidmap_insert(map, &(items[j].id), &(items[j])));
+		}
+
+		/* everything can be found while the entries are moved */
+		for (j = 0; j <= i; j += 7)
+			must_be_true(git_oidmap_lookup(map, &(items[j].id)) == &(items[j]));
+	}
+
+	/* resizes did not move all the entries at once */
+	must_be_true(resizing > 0);
+	must_be_true(map->count == (unsigned int)items_n);
+
+	for (i = 0; i < items_n; ++i)
+		must_be_true(git_oidmap_lookup(map, &(items[i].id)) == &(items[i]));
+
+	git_oidmap_free(map);
+	free(items);
+
+END_TEST
+
+BEGIN_TEST(oidmap_reserve)
+
+	const int items_n = 5000;
+	int i;
+	unsigned int size;
+	map_item *items;
+	git_oidmap *map = NULL;
+	git_oidmap_iterator iterator;
+
+	map = git_oidmap_alloc(0);
+	must_be_true(map != NULL);
+
+	items = make_items(items_n);
+
+	for (i = 0; i < 100; ++i)
+		must_pass(git_oidmap_insert(map, &(items[i].id), &(items[i])));
+
+	must_pass(git_oidmap_reserve(map, items_n));
+	must_be_true(map->old_slots == NULL);
+	must_be_true(map->max_count >= (unsigned int)items_n);
+	size = map->size_mask + 1;
+
+	/* no more resizes */
+	for (i = 100; i < items_n; ++i)
+		must_pass(git_oidmap_insert(map, &(items[i].id), &(items[i])));
+	must_be_true(map->size_mask + 1 == size);
+
+	/* a smaller reservation changes nothing */
+	must_pass(git_oidmap_reserve(map, 10));
+	must_be_true(map->size_mask + 1 == size);
+
+	git_oidmap_iterator_init(map, &iterator);
+	while (git_oidmap_iterator_next(&iterator) != NULL)
+		i--;
+	must_be_true(i == 0);
+
+	git_oidmap_free(map);
+	free(items);
+
+END_TEST
+
+BEGIN_TEST(repository_reserve)
+
+	git_repository *repo;
+	git_object *object;
+	git_oid id;
+
+	must_pass(git_repository_open(&repo, REPOSITORY_FOLDER));
+	must_pass(git_repository_reserve_objects(repo, 10000));
+	must_be_true(repo->objects->max_count >= 10000);
+
+	must_pass(git_oid_mkstr(&id, "a4a7dce85cf63874e984719f4fdd239f5145052f"));
+	must_pass(git_repository_lookup(&object, repo, &id, GIT_OBJ_COMMIT));
+	must_be_true(git_oidmap_lookup(repo->objects, &id) == object);
+
+	git_repository_free(repo);
+
+END_TEST
@@ -133,3 +133,99 @@ int cmp_objects(git_rawobj *o, object_data *d)
 		return -1;
 	return 0;
 }
+
+int copy_file(const char *src, const char *dst)
+{
+	gitfo_buf source_buf;
+	git_file dst_fd;
+	int error = GIT_ERROR;
+
+	if (gitfo_read_file(&source_buf, src) < GIT_SUCCESS)
+		return GIT_ENOTFOUND;
+
+	dst_fd = gitfo_creat(dst, 0644);
+	if (dst_fd < 0)
+		goto cleanup;
+
+	error = gitfo_write(dst_fd, source_buf.data, source_buf.len);
+
+cleanup:
+	gitfo_free_buf(&source_buf);
+	gitfo_close(dst_fd);
+
+	return error;
+}
+
+typedef struct {
+	size_t src_len, dst_len;
+	char *dst;
+} copydir_data;
+
+static int copy_filesystem_element_recurs(void *_data, char *source)
+{
+	copydir_data *data = (copydir_data *)_data;
+
+	data->dst[data->dst_len] = 0;
+	strcpy(data->dst + data->dst_len, source + data->src_len);
+
+	if (gitfo_isdir(source) == GIT_SUCCESS) {
+		if (gitfo_mkdir(data->dst, 0755) < 0)
+			return GIT_EOSERR;
+		return gitfo_dirent(source, GIT_PATH_MAX, copy_filesystem_element_recurs, _data);
+	}
+
+	return copy_file(source, data->dst);
+}
+
+int copydir_recurs(const char *source_directory_path, const char *destination_directory_path)
+{
+	char source_buffer[GIT_PATH_MAX];
+	char dest_buffer[GIT_PATH_MAX];
+	copydir_data data;
+
+	/* Source has to exist, Destination hast to _not_ exist */
+	if (gitfo_isdir(source_directory_path) || !gitfo_isdir(destination_directory_path))
+		return GIT_ERROR;
+
+	if (gitfo_mkdir(destination_directory_path, 0755) < 0)
+		return GIT_EOSERR;
+
+	strcpy(source_buffer, source_directory_path);
+	data.src_len = strlen(source_buffer);
+	if (source_buffer[data.src_len - 1] != '/')
+		source_buffer[data.src_len++] = '/';
+	source_buffer[data.src_len] = 0;
+
+	strcpy(dest_buffer, destination_directory_path);
+	data.dst = dest_buffer;
+	data.dst_len = strlen(dest_buffer);
+	if (dest_buffer[data.dst_len - 1] != '/')
+		dest_buffer[data.dst_len++] = '/';
+	dest_buffer[data.dst_len] = 0;
+
+	return gitfo_dirent(source_buffer, sizeof(source_buffer), copy_filesystem_element_recurs, &data);
+}
+
+static int remove_filesystem_element_recurs(void *GIT_UNUSED(nil), char *path)
+{
+	GIT_UNUSED_ARG(nil)
+
+	if (gitfo_isdir(path) == GIT_SUCCESS) {
+		size_t root_size = strlen(path);
+
+		if (gitfo_dirent(path, GIT_PATH_MAX, remove_filesystem_element_recurs, NULL) < GIT_SUCCESS)
+			return GIT_EOSERR;
+
+		path[root_size] = 0;
+		return gitfo_rmdir(path);
+	}
+
+	return gitfo_unlink(path);
+}
+
+int rmdir_recurs(const char *directory_path)
+{
+	char buffer[GIT_PATH_MAX];
+	strcpy(buffer, directory_path);
+	return remove_filesystem_element_recurs(NULL, buffer);
+}
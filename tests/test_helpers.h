@@ -31,6 +31,7 @@
 
 #define ODB_FOLDER "../resources/testrepo.git/objects/"
 #define REPOSITORY_FOLDER "../resources/testrepo.git/"
+#define TEMP_ODB_FOLDER "test-objects-tmp/"
 
 typedef struct object_data {
     unsigned char *bytes;  /* (compressed) bytes stored in object store */
@@ -53,5 +54,9 @@ extern int cmp_objects(git_rawobj *o, object_data *d);
 
 extern int remove_loose_object(const char *odb_dir, git_object *object);
 
+extern int copy_file(const char *source, const char *dest);
+extern int copydir_recurs(const char *source_directory, const char *destination_directory);
+extern int rmdir_recurs(const char *directory_path);
+
 #endif
 /* INCLUDE_test_helpers_h__ */